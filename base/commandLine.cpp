@@ -128,6 +128,12 @@ static const char HELP_STRING[] =
 #ifdef ENABLE_GRIM
 	"  --dimuse-tempo=NUM       Set internal Digital iMuse tempo (10 - 100) per second\n"
 	"                           (default: 10)\n"
+	"  --benchmark=FILE         Run with a fixed time step and the offscreen software\n"
+	"                           renderer, and write the frame times to FILE and\n"
+	"                           the Lua opcode counts to FILE.opcodes\n"
+	"  --benchmark-frames=NUM   Quit the benchmark after NUM frames\n"
+	"  --build-lua-cache        Compile the source scripts of the game into the save\n"
+	"                           path, and quit\n"
 #endif
 ;
 #endif
@@ -536,6 +542,15 @@ Common::String parseCommandLine(Common::StringMap &settings, int argc, const cha
 #ifdef ENABLE_GRIM
 			DO_LONG_OPTION_INT("dimuse-tempo")
 			END_OPTION
+
+			DO_LONG_OPTION("benchmark")
+			END_OPTION
+
+			DO_LONG_OPTION_INT("benchmark-frames")
+			END_OPTION
+
+			DO_LONG_OPTION_BOOL("build-lua-cache")
+			END_OPTION
 #endif
 
 
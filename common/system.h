@@ -975,6 +975,13 @@ public:
 	*/
 	virtual uint32 getMillis(bool skipRecord = false) = 0;
 
+	/**
+	 * Get the number of milliseconds since the program was started, even
+	 * while the event recorder plays back a recording. Meant for measuring
+	 * performance: the value is never recorded nor played back.
+	 */
+	virtual uint32 getRealMillis() { return getMillis(true); }
+
 	/** Delay/sleep for the specified amount of milliseconds. */
 	virtual void delayMillis(uint msecs) = 0;
 
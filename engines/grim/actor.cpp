@@ -384,6 +384,7 @@ bool Actor::restoreState(SaveGame *savedState) {
 
 		shadow.shadowMaskSize = savedState->readLESint32();
 		delete[] shadow.shadowMask;
+		shadow.shadowMaskRect = Common::Rect();
 		if (shadow.shadowMaskSize > 0) {
 			shadow.shadowMask = new byte[shadow.shadowMaskSize];
 			savedState->read(shadow.shadowMask, shadow.shadowMaskSize);
@@ -536,6 +537,64 @@ void Actor::turnTo(const Math::Angle &pitchParam, const Math::Angle &yawParam, c
 		_turning = false;
 }
 
+// A* search state of one sector in Actor::walkTo(). The nodes are indexed
+// like the set's sectors.
+struct PathNode {
+	int parent;
+	Math::Vector3d pos;
+	float dist;
+	float cost;
+	// Bumped whenever a better path to the node is found, see PathHeapEntry.
+	int version;
+	bool open;
+	bool closed;
+};
+
+// Entry in the open set of Actor::walkTo(), a binary min-heap on the
+// estimated path cost. Entries aren't updated in place: when a node gets a
+// better path a new entry is pushed, and entries with an old version are
+// skipped when popped.
+struct PathHeapEntry {
+	float cost;
+	int node;
+	int version;
+};
+
+static void pushPathHeap(Common::Array<PathHeapEntry> &heap, const PathHeapEntry &entry) {
+	heap.push_back(entry);
+	uint i = heap.size() - 1;
+	while (i > 0) {
+		uint parent = (i - 1) / 2;
+		if (heap[parent].cost <= heap[i].cost)
+			break;
+		SWAP(heap[parent], heap[i]);
+		i = parent;
+	}
+}
+
+static PathHeapEntry popPathHeap(Common::Array<PathHeapEntry> &heap) {
+	PathHeapEntry top = heap[0];
+	heap[0] = heap.back();
+	heap.pop_back();
+
+	const uint size = heap.size();
+	uint i = 0;
+	for (;;) {
+		uint smallest = i;
+		uint left = 2 * i + 1;
+		uint right = left + 1;
+		if (left < size && heap[left].cost < heap[smallest].cost)
+			smallest = left;
+		if (right < size && heap[right].cost < heap[smallest].cost)
+			smallest = right;
+		if (smallest == i)
+			break;
+		SWAP(heap[i], heap[smallest]);
+		i = smallest;
+	}
+	return top;
+}
+
 void Actor::walkTo(const Math::Vector3d &p) {
 	if (p == _pos)
 		_walking = false;
@@ -550,127 +609,105 @@ void Actor::walkTo(const Math::Vector3d &p) {
 			Set *currSet = g_grim->getCurrSet();
 			currSet->findClosestSector(p, NULL, &_destPos);
 
-			Common::List<PathNode *> openList;
-			Common::List<PathNode *> closedList;
-
-			PathNode *start = new PathNode;
-			start->parent = NULL;
-			start->pos = _pos;
-			start->dist = 0.f;
-			start->cost = 0.f;
-			openList.push_back(start);
-			currSet->findClosestSector(_pos, &start->sect, NULL);
-
-			Common::List<Sector *> sectors;
-			for (int i = 0; i < currSet->getSectorCount(); ++i) {
-				Sector *s = currSet->getSectorBase(i);
-				int type = s->getType();
-				if ((type == Sector::WalkType || type == Sector::HotType || type == Sector::FunnelType) && s->isVisible()) {
-					sectors.push_back(s);
-				}
-			}
-
-			Sector *endSec = NULL;
+			Sector *startSec = NULL, *endSec = NULL;
+			currSet->findClosestSector(_pos, &startSec, NULL);
 			currSet->findClosestSector(_destPos, &endSec, NULL);
 
-			do {
-				PathNode *node = NULL;
-				float cost = -1.f;
-				for (Common::List<PathNode *>::iterator j = openList.begin(); j != openList.end(); ++j) {
-					PathNode *n = *j;
-					float c = n->dist + n->cost;
-					if (cost < 0.f || c < cost) {
-						cost = c;
-						node = n;
-					}
-				}
-				closedList.push_back(node);
-				openList.remove(node);
-				Sector *sector = node->sect;
-
-				if (sector == endSec) {
-					PathNode *n = closedList.back();
-					// Don't put the start position in the list, or else
-					// the first angle calculated in updateWalk() will be
-					// meaningless. The only node without parent is the start
-					// one.
-					while (n->parent) {
-						_path.push_back(n->pos);
-						n = n->parent;
-					}
-
-					pathFound = true;
-					break;
+			if (startSec == endSec) {
+				pathFound = true;
+			} else if (startSec) {
+				const bool useXZ = (g_grim->getGameType() == GType_MONKEY4);
+				const int startIdx = currSet->getSectorIndex(startSec);
+				const int endIdx = currSet->getSectorIndex(endSec);
+
+				Common::Array<PathNode> nodes;
+				nodes.resize(currSet->getSectorCount());
+				for (uint i = 0; i < nodes.size(); ++i) {
+					nodes[i].open = false;
+					nodes[i].closed = false;
 				}
 
-				for (Common::List<Sector *>::iterator i = sectors.begin(); i != sectors.end(); ++i) {
-					Sector *s = *i;
-					bool inClosed = false;
-					for (Common::List<PathNode *>::iterator j = closedList.begin(); j != closedList.end(); ++j) {
-						if ((*j)->sect == s) {
-							inClosed = true;
-							break;
-						}
-					}
-					if (inClosed)
+				PathNode &start = nodes[startIdx];
+				start.parent = -1;
+				start.pos = _pos;
+				start.dist = 0.f;
+				start.cost = 0.f;
+				start.version = 0;
+				start.open = true;
+
+				Common::Array<PathHeapEntry> openHeap;
+				PathHeapEntry entry;
+				entry.cost = 0.f;
+				entry.node = startIdx;
+				entry.version = 0;
+				pushPathHeap(openHeap, entry);
+
+				while (!openHeap.empty()) {
+					entry = popPathHeap(openHeap);
+					PathNode &node = nodes[entry.node];
+					if (node.closed || entry.version != node.version)
 						continue;
-
-					Common::List<Math::Line3d> bridges = sector->getBridgesTo(s);
-					if (bridges.empty())
-						continue; // The sectors are not adjacent.
-
-					Math::Vector3d closestPoint = s->getClosestPoint(_destPos);
-					Math::Vector3d best;
-					float bestDist = 1e6f;
-					Math::Line3d l(node->pos, closestPoint);
-					while (!bridges.empty()) {
-						Math::Line3d bridge = bridges.back();
-						Math::Vector3d pos;
-						const bool useXZ = (g_grim->getGameType() == GType_MONKEY4);
-						if (!bridge.intersectLine2d(l, &pos, useXZ)) {
-							pos = bridge.middle();
+					node.closed = true;
+
+					if (entry.node == endIdx) {
+						// Don't put the start position in the list, or else
+						// the first angle calculated in updateWalk() will be
+						// meaningless. The only node without parent is the start
+						// one.
+						const PathNode *n = &node;
+						while (n->parent >= 0) {
+							_path.push_back(n->pos);
+							n = &nodes[n->parent];
 						}
-						float dist = (pos - closestPoint).getMagnitude();
-						if (dist < bestDist) {
-							bestDist = dist;
-							best = pos;
-						}
-						bridges.pop_back();
-					}
-					best = handleCollisionTo(node->pos, best);
 
-					PathNode *n = NULL;
-					for (Common::List<PathNode *>::iterator j = openList.begin(); j != openList.end(); ++j) {
-						if ((*j)->sect == s) {
-							n = *j;
-							break;
-						}
+						pathFound = true;
+						break;
 					}
-					if (n) {
-						float newCost = node->cost + (best - node->pos).getMagnitude();
-						if (newCost < n->cost) {
-							n->cost = newCost;
-							n->parent = node;
-							n->pos = best;
-							n->dist = (n->pos - _destPos).getMagnitude();
+
+					const Common::Array<Set::SectorLink> &links = currSet->getSectorLinks(entry.node);
+					for (uint i = 0; i < links.size(); ++i) {
+						const Set::SectorLink &link = links[i];
+						PathNode &n = nodes[link.sector];
+						Sector *s = currSet->getSectorBase(link.sector);
+						if (n.closed || !s->isVisible())
+							continue;
+
+						Math::Vector3d closestPoint = s->getClosestPoint(_destPos);
+						Math::Vector3d best;
+						float bestDist = 1e6f;
+						Math::Line3d l(node.pos, closestPoint);
+						for (Common::List<Math::Line3d>::const_iterator j = link.bridges.reverse_begin(); j != link.bridges.end(); --j) {
+							Math::Line3d bridge = *j;
+							Math::Vector3d pos;
+							if (!bridge.intersectLine2d(l, &pos, useXZ)) {
+								pos = bridge.middle();
+							}
+							float dist = (pos - closestPoint).getMagnitude();
+							if (dist < bestDist) {
+								bestDist = dist;
+								best = pos;
+							}
 						}
-					} else {
-						n = new PathNode;
-						n->parent = node;
-						n->sect = s;
-						n->pos = best;
-						n->dist = (n->pos - _destPos).getMagnitude();
-						n->cost = node->cost + (n->pos - node->pos).getMagnitude();
-						openList.push_back(n);
+						best = handleCollisionTo(node.pos, best);
+
+						float newCost = node.cost + (best - node.pos).getMagnitude();
+						if (n.open && newCost >= n.cost)
+							continue;
+
+						n.parent = entry.node;
+						n.pos = best;
+						n.dist = (n.pos - _destPos).getMagnitude();
+						n.cost = newCost;
+						n.version = n.open ? n.version + 1 : 0;
+						n.open = true;
+
+						PathHeapEntry e;
+						e.cost = n.dist + n.cost;
+						e.node = link.sector;
+						e.version = n.version;
+						pushPathHeap(openHeap, e);
 					}
 				}
-			} while (!openList.empty());
-
-			for (Common::List<PathNode *>::iterator j = closedList.begin(); j != closedList.end(); ++j) {
-				delete *j;
-			}
-			for (Common::List<PathNode *>::iterator j = openList.begin(); j != openList.end(); ++j) {
-				delete *j;
 			}
 
 			if (!pathFound) {
@@ -1746,6 +1783,7 @@ void Actor::clearShadowPlanes() {
 		delete[] shadow->shadowMask;
 		shadow->shadowMaskSize = 0;
 		shadow->shadowMask = NULL;
+		shadow->shadowMaskRect = Common::Rect();
 		shadow->active = false;
 		shadow->dontNegate = false;
 	}
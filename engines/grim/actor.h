@@ -23,6 +23,8 @@
 #ifndef GRIM_ACTOR_H
 #define GRIM_ACTOR_H
 
+#include "common/rect.h"
+
 #include "engines/grim/pool.h"
 #include "engines/grim/object.h"
 #include "engines/grim/color.h"
@@ -58,6 +60,9 @@ struct Shadow {
 	SectorListType planeList;
 	byte *shadowMask;
 	int shadowMaskSize;
+	// The part of the screen shadowMask covers, in the software renderer.
+	// It is not saved, the mask is drawn again after loading.
+	Common::Rect shadowMaskRect;
 	bool active;
 	bool dontNegate;
 	void *userData;
@@ -661,13 +666,6 @@ private:
 	Math::Vector3d _lookAtVector;
 
 	// struct used for path finding
-	struct PathNode {
-		Sector *sect;
-		PathNode *parent;
-		Math::Vector3d pos;
-		float dist;
-		float cost;
-	};
 	Common::List<Math::Vector3d> _path;
 
 	CollisionMode _collisionMode;
@@ -20,9 +20,17 @@
  *
  */
 
+#include "graphics/tinygl/zbuffer.h"
+
 #include "engines/grim/debugger.h"
 #include "engines/grim/md5check.h"
 #include "engines/grim/grim.h"
+#include "engines/grim/lua.h"
+#include "engines/grim/profiler.h"
+#include "engines/grim/resource.h"
+#include "engines/grim/set.h"
+
+#include "engines/grim/lua/lua.h"
 
 namespace Grim {
 
@@ -32,6 +40,12 @@ Debugger::Debugger() :
 	DCmd_Register("check_gamedata", WRAP_METHOD(Debugger, cmd_checkFiles));
 	DCmd_Register("lua_do", WRAP_METHOD(Debugger, cmd_lua_do));
 	DCmd_Register("emi_jump", WRAP_METHOD(Debugger, cmd_emi_jump));
+	DCmd_Register("resource_cache", WRAP_METHOD(Debugger, cmd_resource_cache));
+	DCmd_Register("sector_queries", WRAP_METHOD(Debugger, cmd_sector_queries));
+	DCmd_Register("tinygl_bench", WRAP_METHOD(Debugger, cmd_tinygl_bench));
+	DCmd_Register("profile", WRAP_METHOD(Debugger, cmd_profile));
+	DCmd_Register("lua_cache", WRAP_METHOD(Debugger, cmd_lua_cache));
+	DCmd_Register("lua_opstats", WRAP_METHOD(Debugger, cmd_lua_opstats));
 }
 
 Debugger::~Debugger() {
@@ -76,4 +90,182 @@ bool Debugger::cmd_emi_jump(int argc, const char **argv) {
 	return true;
 }
 
+bool Debugger::cmd_lua_cache(int argc, const char **argv) {
+	int built = LuaBase::instance()->buildScriptCache();
+	DebugPrintf("Compiled %d scripts into the script cache.\n", built);
+	return true;
+}
+
+bool Debugger::cmd_lua_opstats(int argc, const char **argv) {
+	if (argc < 2) {
+		DebugPrintf("Usage: lua_opstats on|off|reset|show [count]|csv <file>\n");
+		DebugPrintf("Counts the opcodes run by the Lua interpreter, and the pairs of\n");
+		DebugPrintf("consecutive opcodes.\n");
+		return true;
+	}
+
+	Common::String cmd(argv[1]);
+	if (cmd == "on") {
+		lua_setopstats(true);
+	} else if (cmd == "off") {
+		lua_setopstats(false);
+	} else if (cmd == "reset") {
+		lua_resetopstats();
+	} else if (cmd == "csv") {
+		if (argc < 3) {
+			DebugPrintf("Usage: lua_opstats csv <file>\n");
+		} else if (LuaBase::writeOpcodeStats(argv[2])) {
+			DebugPrintf("Opcode statistics written to %s.\n", argv[2]);
+		} else {
+			DebugPrintf("Could not write %s.\n", argv[2]);
+		}
+		return true;
+	}
+
+	int32 numOps = lua_numopcodes();
+	int count = (cmd == "show" && argc > 2) ? atoi(argv[2]) : 10;
+	uint32 total = 0;
+	for (int32 op = 0; op < numOps; ++op)
+		total += lua_opcount(op);
+	DebugPrintf("Opcode statistics %s, %u opcodes run\n", lua_getopstats() ? "on" : "off", total);
+	if (!total)
+		return true;
+
+	// The most frequent opcodes, then the most frequent pairs
+	uint32 last = 0xffffffff;
+	for (int i = 0; i < count; ++i) {
+		int32 best = -1;
+		for (int32 op = 0; op < numOps; ++op) {
+			uint32 n = lua_opcount(op);
+			if (n && n < last && (best == -1 || n > lua_opcount(best)))
+				best = op;
+		}
+		if (best == -1)
+			break;
+		last = lua_opcount(best);
+		DebugPrintf("%-14s %10u %5.1f%%\n", lua_opname(best), last, last * 100.f / total);
+	}
+	last = 0xffffffff;
+	for (int i = 0; i < count; ++i) {
+		int32 bestOp = -1, bestNext = -1;
+		uint32 bestCount = 0;
+		for (int32 op = 0; op < numOps; ++op) {
+			for (int32 next = 0; next < numOps; ++next) {
+				uint32 n = lua_oppaircount(op, next);
+				if (n && n < last && n > bestCount) {
+					bestOp = op;
+					bestNext = next;
+					bestCount = n;
+				}
+			}
+		}
+		if (bestOp == -1)
+			break;
+		last = bestCount;
+		DebugPrintf("%-14s %-14s %10u %5.1f%%\n", lua_opname(bestOp), lua_opname(bestNext), bestCount, bestCount * 100.f / total);
+	}
+	return true;
+}
+
+bool Debugger::cmd_resource_cache(int argc, const char **argv) {
+	if (!g_resourceloader) {
+		DebugPrintf("No resource loader.\n");
+		return true;
+	}
+
+	DebugPrintf("Entries: %d, size: %d KB", g_resourceloader->getCacheEntryCount(), g_resourceloader->getCacheMemorySize() / 1024);
+	if (g_resourceloader->getCacheBudget())
+		DebugPrintf(" of %d KB\n", g_resourceloader->getCacheBudget() / 1024);
+	else
+		DebugPrintf(" (unlimited)\n");
+	DebugPrintf("Hits: %d, misses: %d, evictions: %d\n", g_resourceloader->getCacheHits(),
+	            g_resourceloader->getCacheMisses(), g_resourceloader->getCacheEvictions());
+	return true;
+}
+
+bool Debugger::cmd_sector_queries(int argc, const char **argv) {
+	Set *set = g_grim->getCurrSet();
+	if (argc < 2 || !set) {
+		DebugPrintf("Usage: sector_queries record|stop|clear|run [iterations]\n");
+		DebugPrintf("Records the sector lookups of the current set, and replays them\n");
+		DebugPrintf("against a scan of all the sectors.\n");
+		return true;
+	}
+
+	Common::String cmd(argv[1]);
+	if (cmd == "record") {
+		set->setRecordSectorQueries(true);
+	} else if (cmd == "stop") {
+		set->setRecordSectorQueries(false);
+	} else if (cmd == "clear") {
+		set->clearRecordedSectorQueries();
+	} else if (cmd == "run") {
+		int iterations = argc > 2 ? atoi(argv[2]) : 100;
+		uint32 indexedMs, scanMs;
+		bool match = set->benchmarkSectorQueries(iterations, indexedMs, scanMs);
+		DebugPrintf("%d queries x %d: indexed %d ms, scan %d ms\n", set->getRecordedSectorQueryCount(), iterations, indexedMs, scanMs);
+		if (!match)
+			DebugPrintf("Warning: the indexed and scanned results differ!\n");
+		return true;
+	}
+	DebugPrintf("%d queries recorded in set %s.\n", set->getRecordedSectorQueryCount(), set->getName().c_str());
+	return true;
+}
+
+bool Debugger::cmd_tinygl_bench(int argc, const char **argv) {
+	int triangles = argc > 1 ? atoi(argv[1]) : 20000;
+	Common::Array<TinyGL::ZBufferBenchmarkResult> results;
+	TinyGL::ZB_benchmarkRasterizer(triangles, results);
+
+	DebugPrintf("%d triangles, span kernels: %s\n", triangles, TinyGL::ZB_getSpanKernels(true)->name);
+	for (uint i = 0; i < results.size(); ++i) {
+		const TinyGL::ZBufferBenchmarkResult &r = results[i];
+		// Mpixels/s is pixels per millisecond / 1000.
+		float scalar = r.scalarMs ? r.pixels / (r.scalarMs * 1000.f) : 0.f;
+		float simd = r.simdMs ? r.pixels / (r.simdMs * 1000.f) : 0.f;
+		DebugPrintf("%-20s scalar %7.1f Mpixels/s, SIMD %7.1f Mpixels/s%s\n", r.name, scalar, simd,
+		            r.identical ? "" : " (output differs!)");
+	}
+	return true;
+}
+
+bool Debugger::cmd_profile(int argc, const char **argv) {
+	if (argc < 2) {
+		DebugPrintf("Usage: profile on|off|overlay|reset|show|csv <file>\n");
+		DebugPrintf("Times the stages of the main loop, over the last frames.\n");
+		return true;
+	}
+
+	Common::String cmd(argv[1]);
+	if (cmd == "on") {
+		g_profiler->setEnabled(true);
+	} else if (cmd == "off") {
+		g_profiler->setEnabled(false);
+		g_profiler->setOverlay(false);
+	} else if (cmd == "overlay") {
+		g_profiler->setEnabled(true);
+		g_profiler->setOverlay(!g_profiler->hasOverlay());
+	} else if (cmd == "reset") {
+		g_profiler->reset();
+	} else if (cmd == "csv") {
+		if (argc < 3) {
+			DebugPrintf("Usage: profile csv <file>\n");
+		} else if (g_profiler->writeCSV(argv[2])) {
+			DebugPrintf("%d frames written to %s.\n", g_profiler->getNumFrames(), argv[2]);
+		} else {
+			DebugPrintf("Could not write %s.\n", argv[2]);
+		}
+		return true;
+	}
+
+	DebugPrintf("Profiler %s, %d frames, times in ms\n", g_profiler->isEnabled() ? "on" : "off", g_profiler->getNumFrames());
+	DebugPrintf("%-12s %5s %6s %6s\n", "stage", "min", "avg", "p99");
+	for (int i = 0; i < FrameProfiler::kNumStages; ++i) {
+		FrameProfiler::Stage stage = (FrameProfiler::Stage)i;
+		FrameProfiler::Readout r = g_profiler->getReadout(stage);
+		DebugPrintf("%-12s %5d %6.1f %6d\n", FrameProfiler::getStageName(stage), r.min, r.avg, r.p99);
+	}
+	return true;
+}
+
 }
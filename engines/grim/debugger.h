@@ -35,6 +35,12 @@ public:
 	bool cmd_checkFiles(int argc, const char **argv);
 	bool cmd_lua_do(int argc, const char **argv);
 	bool cmd_emi_jump(int argc, const char **argv);
+	bool cmd_resource_cache(int argc, const char **argv);
+	bool cmd_sector_queries(int argc, const char **argv);
+	bool cmd_tinygl_bench(int argc, const char **argv);
+	bool cmd_profile(int argc, const char **argv);
+	bool cmd_lua_cache(int argc, const char **argv);
+	bool cmd_lua_opstats(int argc, const char **argv);
 };
 
 }
@@ -225,7 +225,7 @@ void EMIEngine::sortTextObjects() {
 
 bool EMIEngine::compareActor(const Actor *x, const Actor *y) {
 	if (x->getEffectiveSortOrder() == y->getEffectiveSortOrder()) {
-		return x->getId() < y->getId();
+		return x->getCreationOrder() < y->getCreationOrder();
 	}
 	return x->getEffectiveSortOrder() > y->getEffectiveSortOrder();
 }
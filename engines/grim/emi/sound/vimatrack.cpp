@@ -130,7 +130,8 @@ int32 VimaTrack::getDataFromRegion(SoundDesc *sound, int region, byte **buf, int
 	}
 
 	if (sound->mcmpData) {
-		size = sound->mcmpMgr->decompressSample(region_offset + offset, size, buf);
+		*buf = (byte *)malloc(size);
+		size = sound->mcmpMgr->decompressSample(region_offset + offset, size, *buf);
 	} else {
 		*buf = new byte[size];
 		sound->inStream->seek(region_offset + offset + sound->headerSize, SEEK_SET);
@@ -23,6 +23,8 @@
 #ifndef GRIM_GFX_BASE_H
 #define GRIM_GFX_BASE_H
 
+#include "common/str.h"
+
 #include "math/vector3d.h"
 #include "math/quat.h"
 
@@ -195,6 +197,11 @@ public:
 	virtual void destroyTextObject(TextObject *text) = 0;
 
 	virtual Bitmap *getScreenshot(int w, int h) = 0;
+	/**
+	 * Get the MD5 of the pixels of the current frame, or an empty string if
+	 * the renderer can't read them back.
+	 */
+	virtual Common::String getScreenChecksum() { return Common::String(); }
 	virtual void storeDisplay() = 0;
 	virtual void copyStoredToDisplay() = 0;
 
@@ -235,6 +242,13 @@ public:
 	 * @see releaseMovieFrame
 	 */
 	virtual void prepareMovieFrame(Graphics::Surface *frame) = 0;
+
+	/**
+	 * The pixel format prepareMovieFrame() takes without any conversion.
+	 * The movie player converts the frames to it while decoding ahead.
+	 * The default, an empty format, keeps the frames as decoded.
+	 */
+	virtual Graphics::PixelFormat getMovieFrameFormat() const { return Graphics::PixelFormat(); }
 	virtual void drawMovieFrame(int offsetX, int offsetY) = 0;
 
 	/**
@@ -257,6 +271,7 @@ public:
 	virtual Material *getSpecialtyTexture(int n) { return &_specialty[n]; }
 
 	virtual void createModel(Mesh *mesh) {}
+	virtual void destroyModel(Mesh *mesh) {}
 	virtual void createEMIModel(EMIModel *model) {}
 	virtual void updateEMIModel(const EMIModel *model) {}
 
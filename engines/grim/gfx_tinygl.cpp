@@ -20,7 +20,12 @@
  *
  */
 
+#include "common/array.h"
+#include "common/config-manager.h"
 #include "common/endian.h"
+#include "common/hashmap.h"
+#include "common/md5.h"
+#include "common/memstream.h"
 #include "common/system.h"
 
 #include "graphics/surface.h"
@@ -41,42 +46,53 @@
 
 namespace Grim {
 
+/**
+ * The faces of a mesh as indexed triangles, built once in createModel().
+ * A vertex is a distinct pair of position and texture coordinates, shared
+ * by all the faces using it so that it is transformed only once per draw.
+ */
+struct TinyGLMeshData {
+	Common::Array<float> _vertices;     // sets of 3
+	Common::Array<float> _normals;      // sets of 3
+	Common::Array<float> _texCoords;    // sets of 2
+	Common::Array<uint32> _indices;
+	// The triangles of face i are at _indices[_faceStart[i]] up to _faceStart[i + 1].
+	Common::Array<uint32> _faceStart;
+	float _bboxMin[3], _bboxMax[3];
+};
+
 /**
  * This class is used for blitting bitmaps with transparent pixels.
  * Instead of checking every pixel for transparency, it creates a list of 'lines'.
- * A line is, well, a line of non trasparent pixels, and itstores a pointer to the
- * first pixel, and the position of it, which can be used to memcpy the entire line
- * to the destination buffer.
+ * A line is, well, a line of non trasparent pixels, and it stores the offset of
+ * the first pixel and the position of it, which can be used to memcpy the entire
+ * line to the destination buffer.
+ * The lines are stored row after row, with the index of the first line of every
+ * row, so that a blit starts at its first visible row right away.
  */
 class BlitImage {
 public:
 	BlitImage() {
-		_lines = NULL;
-		_last = NULL;
 		_width = 0;
 		_height = 0;
 	}
-	~BlitImage() {
-		Line *temp = _lines;
-		while (temp != NULL) {
-			_lines = temp->next;
-			delete temp;
-			temp = _lines;
-		}
-	}
+
 	void create(const Graphics::PixelBuffer &buf, uint32 transparency, int x, int y, int width, int height) {
 		Graphics::PixelBuffer srcBuf = buf;
 		_width = width;
 		_height = height;
+		_lines.clear();
+		_rowStart.resize(height + 1);
 		// A line of pixels can not wrap more that one line of the image, since it would break
 		// blitting of bitmaps with a non-zero x position.
 		for (int l = 0; l < height; l++) {
 			int start = -1;
 
+			_rowStart[l] = _lines.size();
 			for (int r = 0; r < width; ++r) {
 				// We found a transparent pixel, so save a line from 'start' to the pixel before this.
 				if (srcBuf.getValueAt(r) == transparency && start >= 0) {
-					newLine(start, l, r - start, srcBuf.getRawBuffer(start));
+					newLine(start, r - start, l * width + start);
 
 					start = -1;
 				} else if (srcBuf.getValueAt(r) != transparency && start == -1) {
@@ -85,45 +101,36 @@ public:
 			}
 			// end of the bitmap line. if start is an actual pixel save the line.
 			if (start >= 0) {
-				newLine(start, l, width - start, srcBuf.getRawBuffer(start));
+				newLine(start, width - start, l * width + start);
 			}
 
 			srcBuf.shiftBy(width);
 		}
+		_rowStart[height] = _lines.size();
 	}
 
-	void newLine(int x, int y, int length, byte *pixels) {
+	void newLine(int x, int length, int offset) {
 		if (length < 1) {
 			return;
 		}
 
-		Line *line = new Line;
-
-		line->x = x;
-		line->y = y;
-		line->length = length;
-		line->pixels = pixels;
-		line->next = NULL;
-
-		if (_last) {
-			_last->next = line;
-		}
-		if (!_lines) {
-			_lines = line;
-		}
-		_last = line;
+		Line line;
+		line.x = x;
+		line.length = length;
+		line.offset = offset;
+		_lines.push_back(line);
 	}
 
 	struct Line {
 		int x;
-		int y;
 		int length;
-		byte *pixels;
-
-		Line *next;
+		// The index of the first pixel in the image.
+		int offset;
 	};
-	Line *_lines;
-	Line *_last;
+	Common::Array<Line> _lines;
+	// The index in _lines of the first line of every row, and the number of
+	// lines at the end.
+	Common::Array<uint> _rowStart;
 	int _width, _height;
 };
 
@@ -233,7 +240,8 @@ TGLint tgluProject(TGLfloat objx, TGLfloat objy, TGLfloat objz, const TGLfloat m
 
 GfxTinyGL::GfxTinyGL() :
 		_smushWidth(0), _smushHeight(0), _zb(NULL), _alpha(1.f),
-		_bufferId(0), _currentActor(NULL) {
+		_bufferId(0), _currentActor(NULL), _offscreen(false), _binning(false), _shadowMaskScratch(NULL),
+		_zBitmapValues(NULL) {
 	g_driver = this;
 	_storedDisplay = NULL;
 }
@@ -244,26 +252,39 @@ GfxTinyGL::~GfxTinyGL() {
 		TinyGL::glClose();
 		ZB_close(_zb);
 	}
+	delete[] _shadowMaskScratch;
+	delete[] _zBitmapValues;
 }
 
 byte *GfxTinyGL::setupScreen(int screenW, int screenH, bool fullscreen) {
-	Graphics::PixelBuffer buf = g_system->setupScreen(screenW, screenH, fullscreen, false);
-	byte *buffer = buf.getRawBuffer();
+	// The benchmark draws offscreen, without a window: ZB_open() allocates
+	// the frame buffer.
+	_offscreen = ConfMan.hasKey("benchmark");
+	// Binning draws the bands one after the other on this thread, and sets
+	// each triangle up again for every band it covers, so it stays off
+	// unless asked for.
+	_binning = ConfMan.getBool("tinygl_binning");
+	Graphics::PixelBuffer buf(Graphics::PixelFormat(2, 5, 6, 5, 0, 11, 5, 0, 0), NULL);
+	if (!_offscreen)
+		buf = g_system->setupScreen(screenW, screenH, fullscreen, false);
 
 	_screenWidth = screenW;
 	_screenHeight = screenH;
 	_scaleW = _screenWidth / (float)_gameWidth;
 	_scaleH = _screenHeight / (float)_gameHeight;
 
-	_isFullscreen = g_system->getFeatureState(OSystem::kFeatureFullscreenMode);
+	if (!_offscreen) {
+		_isFullscreen = g_system->getFeatureState(OSystem::kFeatureFullscreenMode);
 
-	g_system->showMouse(!fullscreen);
+		g_system->showMouse(!fullscreen);
 
-	g_system->setWindowCaption("ResidualVM: Software 3D Renderer");
+		g_system->setWindowCaption("ResidualVM: Software 3D Renderer");
+	}
 
 	_pixelFormat = buf.getFormat();
 	_zb = TinyGL::ZB_open(screenW, screenH, buf);
 	TinyGL::glInit(_zb);
+	byte *buffer = _zb->pbuf.getRawBuffer();
 
 	_screenSize = _gameWidth * _gameHeight * _pixelFormat.bytesPerPixel;
 	_storedDisplay.create(_pixelFormat, _gameWidth * _gameHeight, DisposeAfterUse::YES);
@@ -319,10 +340,19 @@ void GfxTinyGL::positionCamera(const Math::Vector3d &pos, const Math::Vector3d &
 void GfxTinyGL::clearScreen() {
 	_zb->pbuf.clear(_screenSize);
 	memset(_zb->zbuf, 0, _gameWidth * _gameHeight * sizeof(unsigned int));
+	TinyGL::ZB_invalidateDepthPyramid(_zb);
 }
 
 void GfxTinyGL::flipBuffer() {
-	g_system->updateScreen();
+	tglFlush();
+	if (!_offscreen)
+		g_system->updateScreen();
+}
+
+Common::String GfxTinyGL::getScreenChecksum() {
+	tglFlush();
+	Common::MemoryReadStream stream(_zb->pbuf.getRawBuffer(), _screenSize);
+	return Common::computeStreamMD5AsString(stream);
 }
 
 int GfxTinyGL::genBuffer() {
@@ -583,21 +613,31 @@ void GfxTinyGL::getBoundingBoxPos(const EMIModel *model, int *x1, int *y1, int *
 
 void GfxTinyGL::startActorDraw(const Actor *actor) {
 	_currentActor = actor;
+	// The shadow planes are only drawn when they change, a loaded or a
+	// new shadow may not have a mask of the right size yet.
+	if (_currentShadowArray) {
+		const Common::Rect &rect = _currentShadowArray->shadowMaskRect;
+		if (!_currentShadowArray->shadowMask || rect.width() * rect.height() != _currentShadowArray->shadowMaskSize)
+			drawShadowPlanes();
+	}
+	// The actor's ops are only run in finishActorDraw(), and with binning
+	// its triangles are drawn band by band, nothing else writes to the frame
+	// buffer in between.
+	tglSetDeferred(true);
+	TinyGL::ZB_setBinning(_zb, _binning);
+	// The background is drawn by now, the actors hidden behind it are skipped.
+	TinyGL::ZB_buildDepthPyramid(_zb);
 	tglEnable(TGL_TEXTURE_2D);
 	tglMatrixMode(TGL_PROJECTION);
 	tglPushMatrix();
 	tglMatrixMode(TGL_MODELVIEW);
 	tglPushMatrix();
 	if (_currentShadowArray) {
-		// TODO find out why shadowMask at device in woods is null
-		if (!_currentShadowArray->shadowMask) {
-			_currentShadowArray->shadowMask = new byte[_gameWidth * _gameHeight];
-			_currentShadowArray->shadowMaskSize = _gameWidth * _gameHeight;
-		}
-		assert(_currentShadowArray->shadowMask);
+		const Common::Rect &rect = _currentShadowArray->shadowMaskRect;
 		//tglSetShadowColor(255, 255, 255);
 		tglSetShadowColor(_shadowColorR, _shadowColorG, _shadowColorB);
 		tglSetShadowMaskBuf(_currentShadowArray->shadowMask);
+		tglSetShadowMaskRect(rect.left, rect.top, rect.width(), rect.height());
 		SectorListType::iterator i = _currentShadowArray->planeList.begin();
 		Sector *shadowSector = i->sector;
 		tglShadowProjection(_currentShadowArray->pos, shadowSector->getVertices()[0], shadowSector->getNormal(), _currentShadowArray->dontNegate);
@@ -654,6 +694,8 @@ void GfxTinyGL::startActorDraw(const Actor *actor) {
 }
 
 void GfxTinyGL::finishActorDraw() {
+	tglSetDeferred(false);
+	TinyGL::ZB_setBinning(_zb, false);
 	tglMatrixMode(TGL_MODELVIEW);
 	tglPopMatrix();
 	tglMatrixMode(TGL_PROJECTION);
@@ -691,14 +733,16 @@ void GfxTinyGL::finishActorDraw() {
 }
 
 void GfxTinyGL::drawShadowPlanes() {
-	tglEnable(TGL_SHADOW_MASK_MODE);
-	if (!_currentShadowArray->shadowMask) {
-		_currentShadowArray->shadowMask = new byte[_gameWidth * _gameHeight];
-		_currentShadowArray->shadowMaskSize = _gameWidth * _gameHeight;
+	if (!_shadowMaskScratch) {
+		_shadowMaskScratch = new byte[_gameWidth * _gameHeight];
+		memset(_shadowMaskScratch, 0, _gameWidth * _gameHeight);
 	}
-	memset(_currentShadowArray->shadowMask, 0, _gameWidth * _gameHeight);
 
-	tglSetShadowMaskBuf(_currentShadowArray->shadowMask);
+	tglEnable(TGL_SHADOW_MASK_MODE);
+	tglSetShadowMaskBuf(_shadowMaskScratch);
+	TinyGL::ZB_resetShadowMaskDirty(_zb);
+	tglSetDeferred(true);
+	TinyGL::ZB_setBinning(_zb, _binning);
 	_currentShadowArray->planeList.begin();
 	for (SectorListType::iterator i = _currentShadowArray->planeList.begin(); i != _currentShadowArray->planeList.end(); ++i) {
 		Sector *shadowSector = i->sector;
@@ -708,8 +752,29 @@ void GfxTinyGL::drawShadowPlanes() {
 		}
 		tglEnd();
 	}
+	tglSetDeferred(false);
+	TinyGL::ZB_setBinning(_zb, false);
 	tglSetShadowMaskBuf(NULL);
 	tglDisable(TGL_SHADOW_MASK_MODE);
+
+	// Move the written rectangle out of the scratch mask, clearing it for the
+	// next shadow.
+	Common::Rect rect;
+	if (_zb->shadow_mask_dirty_xmin <= _zb->shadow_mask_dirty_xmax)
+		rect = Common::Rect(_zb->shadow_mask_dirty_xmin, _zb->shadow_mask_dirty_ymin,
+		                    _zb->shadow_mask_dirty_xmax + 1, _zb->shadow_mask_dirty_ymax + 1);
+	int size = rect.width() * rect.height();
+	if (size != _currentShadowArray->shadowMaskSize || !_currentShadowArray->shadowMask) {
+		delete[] _currentShadowArray->shadowMask;
+		_currentShadowArray->shadowMask = new byte[MAX(size, 1)];
+		_currentShadowArray->shadowMaskSize = size;
+	}
+	_currentShadowArray->shadowMaskRect = rect;
+	for (int y = rect.top; y < rect.bottom; y++) {
+		byte *line = _shadowMaskScratch + y * _gameWidth + rect.left;
+		memcpy(_currentShadowArray->shadowMask + (y - rect.top) * rect.width(), line, rect.width());
+		memset(line, 0, rect.width());
+	}
 }
 
 void GfxTinyGL::setShadowMode() {
@@ -795,6 +860,61 @@ void GfxTinyGL::drawModelFace(const Mesh *mesh, const MeshFace *face) {
 	tglEnd();
 }
 
+void GfxTinyGL::drawMesh(const Mesh *mesh) {
+	const TinyGLMeshData *data = (const TinyGLMeshData *)mesh->_userData;
+	if (!data || data->_indices.empty()) {
+		GfxBase::drawMesh(mesh);
+		return;
+	}
+
+	// Meshes behind the background are skipped, but not in shadow mode, where
+	// the shadow mask is drawn without depth test.
+	if (!isShadowModeActive() && tglIsBoxOccluded(data->_bboxMin, data->_bboxMax))
+		return;
+
+	tglEnableClientState(TGL_VERTEX_ARRAY);
+	tglEnableClientState(TGL_NORMAL_ARRAY);
+	tglVertexPointer(3, TGL_FLOAT, 0, &data->_vertices[0]);
+	tglNormalPointer(TGL_FLOAT, 0, &data->_normals[0]);
+	tglTexCoordPointer(2, TGL_FLOAT, 0, &data->_texCoords[0]);
+
+	// Draw each run of faces that MeshFace::draw() would draw with the same
+	// state at once.
+	for (int i = 0; i < mesh->_numFaces;) {
+		const MeshFace *face = &mesh->_faces[i];
+		int first = i;
+		for (++i; i < mesh->_numFaces; ++i) {
+			const MeshFace *other = &mesh->_faces[i];
+			if (other->_material != face->_material || (other->_light == 0) != (face->_light == 0) ||
+			    (other->_texVertices == NULL) != (face->_texVertices == NULL))
+				break;
+		}
+
+		uint32 start = data->_faceStart[first];
+		uint32 count = data->_faceStart[i] - start;
+		if (count == 0)
+			continue;
+
+		bool unlit = face->_light == 0 && !isShadowModeActive();
+		if (unlit)
+			disableLights();
+
+		face->_material->select();
+		if (face->_texVertices)
+			tglEnableClientState(TGL_TEXTURE_COORD_ARRAY);
+		else
+			tglDisableClientState(TGL_TEXTURE_COORD_ARRAY);
+		tglDrawElements(TGL_TRIANGLES, count, TGL_UNSIGNED_INT, &data->_indices[start]);
+
+		if (unlit)
+			enableLights();
+	}
+
+	tglDisableClientState(TGL_TEXTURE_COORD_ARRAY);
+	tglDisableClientState(TGL_NORMAL_ARRAY);
+	tglDisableClientState(TGL_VERTEX_ARRAY);
+}
+
 void GfxTinyGL::drawSprite(const Sprite *sprite) {
 	// HACK: TinyGL doesn't support blending well, but atleast we can skip completely
 	// translucent sprites:
@@ -954,16 +1074,18 @@ void GfxTinyGL::createBitmap(BitmapData *bitmap) {
 		bitmap->convertToColorFormat(_pixelFormat);
 	}
 	if (bitmap->_format != 1) {
+		if (!_zBitmapValues) {
+			_zBitmapValues = new uint32[0x10000];
+			for (uint32 val = 0; val < 0x10000; val++)
+				_zBitmapValues[val] = val * 0x10000 / 100 / (0x10000 - val) << 14;
+			// fix the value if it is incorrectly set to the bitmap transparency color
+			_zBitmapValues[0xf81f] = _zBitmapValues[0];
+		}
 		for (int pic = 0; pic < bitmap->_numImages; pic++) {
 			uint32 *buf = new uint32[bitmap->_width * bitmap->_height];
 			uint16 *bufPtr = reinterpret_cast<uint16 *>(bitmap->getImageData(pic).getRawBuffer());
 			for (int i = 0; i < (bitmap->_width * bitmap->_height); i++) {
-				uint16 val = READ_LE_UINT16(bufPtr + i);
-				// fix the value if it is incorrectly set to the bitmap transparency color
-				if (val == 0xf81f) {
-					val = 0;
-				}
-				buf[i] = ((uint32) val) * 0x10000 / 100 / (0x10000 - val) << 14;
+				buf[i] = _zBitmapValues[READ_LE_UINT16(bufPtr + i)];
 			}
 			delete[] bufPtr;
 			bitmap->_data[pic] = Graphics::PixelBuffer(Graphics::PixelFormat(4, 8, 8, 8, 8, 0, 8, 16, 24), (byte *)buf);
@@ -978,7 +1100,7 @@ void GfxTinyGL::createBitmap(BitmapData *bitmap) {
 	}
 }
 
-void GfxTinyGL::blit(const Graphics::PixelFormat &format, BlitImage *image, byte *dst, byte *src, int x, int y, int width, int height, bool trans) {
+void GfxTinyGL::blit(const Graphics::PixelFormat &format, const BlitImage *image, byte *dst, byte *src, int x, int y, int width, int height, bool trans) {
 	int srcX, srcY;
 
 	if (x < 0) {
@@ -998,7 +1120,7 @@ void GfxTinyGL::blit(const Graphics::PixelFormat &format, BlitImage *image, byte
 	blit(format, image, dst, src, x, y, srcX, srcY, width, height, width, height, trans);
 }
 
-void GfxTinyGL::blit(const Graphics::PixelFormat &format, BlitImage *image, byte *dst, byte *src, int dstX, int dstY, int srcX, int srcY, int width, int height, int srcWidth, int srcHeight, bool trans) {
+void GfxTinyGL::blit(const Graphics::PixelFormat &format, const BlitImage *image, byte *dst, byte *src, int dstX, int dstY, int srcX, int srcY, int width, int height, int srcWidth, int srcHeight, bool trans) {
 	if (_dimLevel >= 1.0f) {
 		return;
 	} else if (_dimLevel > 0.0f) {
@@ -1020,6 +1142,8 @@ void GfxTinyGL::blit(const Graphics::PixelFormat &format, BlitImage *image, byte
 	else
 		clampHeight = height;
 
+	// The lines of the image are relative to its first pixel.
+	const byte *pixels = src;
 	dst += (dstX + (dstY * _gameWidth)) * format.bytesPerPixel;
 	src += (srcX + (srcY * srcWidth)) * format.bytesPerPixel;
 
@@ -1033,34 +1157,22 @@ void GfxTinyGL::blit(const Graphics::PixelFormat &format, BlitImage *image, byte
 			srcBuf.shiftBy(srcWidth);
 		}
 	} else {
-		if (image) {
-			BlitImage::Line *l = image->_lines;
-			int maxY = srcY + clampHeight;
-			int maxX = srcX + clampWidth;
-			while (l && l->y < srcY)
-				l = l->next;
-
-			while (l && l->y < maxY) {
-				if (l->x < maxX && l->x + l->length > srcX) {
-					int length = l->length;
-					int skipStart = l->x < srcX ? srcX - l->x : 0;
-					length -= skipStart;
-					int skipEnd   = l->x + l->length > maxX ? l->x + l->length - maxX : 0;
-					length -= skipEnd;
-					memcpy(dstBuf.getRawBuffer((l->y - srcY) * _gameWidth + MAX(l->x - srcX, 0)),
-						   l->pixels + skipStart * format.bytesPerPixel, length * format.bytesPerPixel);
-				}
-				l = l->next;
-			}
-		} else {
-			for (int l = 0; l < clampHeight; l++) {
-				for (int r = 0; r < clampWidth; ++r) {
-					if (srcBuf.getValueAt(r) != 0xf81f) {
-						dstBuf.setPixelAt(r, srcBuf);
-					}
-				}
-				dstBuf.shiftBy(_gameWidth);
-				srcBuf.shiftBy(srcWidth);
+		assert(image);
+		int maxY = MIN(srcY + clampHeight, image->_height);
+		int maxX = srcX + clampWidth;
+		int bpp = format.bytesPerPixel;
+		for (int row = MAX(srcY, 0); row < maxY; ++row) {
+			byte *dstRow = dstBuf.getRawBuffer((row - srcY) * _gameWidth);
+			const BlitImage::Line *l = image->_lines.begin() + image->_rowStart[row];
+			const BlitImage::Line *end = image->_lines.begin() + image->_rowStart[row + 1];
+			for (; l != end; ++l) {
+				if (l->x >= maxX)
+					break;
+				if (l->x + l->length <= srcX)
+					continue;
+				int skipStart = l->x < srcX ? srcX - l->x : 0;
+				int length = MIN(l->x + l->length, maxX) - l->x - skipStart;
+				memcpy(dstRow + MAX(l->x - srcX, 0) * bpp, pixels + (l->offset + skipStart) * bpp, length * bpp);
 			}
 		}
 	}
@@ -1114,9 +1226,11 @@ void GfxTinyGL::drawBitmap(const Bitmap *bitmap, int x, int y, uint32 layer) {
 	if (bitmap->getFormat() == 1)
 		blit(bitmap->getPixelFormat(num), &b[num], (byte *)_zb->pbuf.getRawBuffer(), (byte *)bitmap->getData(num).getRawBuffer(),
 			 x, y, bitmap->getWidth(), bitmap->getHeight(), true);
-	else
+	else {
 		blit(bitmap->getPixelFormat(num), NULL, (byte *)_zb->zbuf, (byte *)bitmap->getData(num).getRawBuffer(),
 			 x, y, bitmap->getWidth(), bitmap->getHeight(), false);
+		TinyGL::ZB_invalidateDepthPyramid(_zb);
+	}
 }
 
 void GfxTinyGL::destroyBitmap(BitmapData *bitmap) {
@@ -1136,6 +1250,7 @@ void GfxTinyGL::destroyFont(Font *font) {
 struct TextObjectData {
 	byte *data;
 	int width, height, x, y;
+	BlitImage image;
 };
 
 void GfxTinyGL::createTextObject(TextObject *text) {
@@ -1202,6 +1317,7 @@ void GfxTinyGL::createTextObject(TextObject *text) {
 		userData[j].width = width;
 		userData[j].height = height;
 		userData[j].data = buf.getRawBuffer();
+		userData[j].image.create(buf, 0xf81f, 0, 0, width, height);
 		userData[j].x = text->getLineX(j);
 		userData[j].y = text->getLineY(j);
 
@@ -1220,7 +1336,7 @@ void GfxTinyGL::drawTextObject(const TextObject *text) {
 	if (userData) {
 		int numLines = text->getNumLines();
 		for (int i = 0; i < numLines; ++i) {
-			blit(_pixelFormat, NULL, (byte *)_zb->pbuf.getRawBuffer(), userData[i].data, userData[i].x, userData[i].y, userData[i].width, userData[i].height, true);
+			blit(_pixelFormat, &userData[i].image, (byte *)_zb->pbuf.getRawBuffer(), userData[i].data, userData[i].x, userData[i].y, userData[i].width, userData[i].height, true);
 		}
 	}
 }
@@ -1280,7 +1396,13 @@ void GfxTinyGL::createMaterial(Texture *material, const char *data, const CMap *
 	tglTexParameteri(TGL_TEXTURE_2D, TGL_TEXTURE_WRAP_S, TGL_REPEAT);
 	tglTexParameteri(TGL_TEXTURE_2D, TGL_TEXTURE_WRAP_T, TGL_REPEAT);
 	tglTexParameteri(TGL_TEXTURE_2D, TGL_TEXTURE_MAG_FILTER, TGL_LINEAR);
-	tglTexParameteri(TGL_TEXTURE_2D, TGL_TEXTURE_MIN_FILTER, TGL_LINEAR);
+	// Mipmaps make far away surfaces read less texels. Their texels have
+	// averaged alphas though, which the alpha test would eat away, so the
+	// textures with transparent parts keep only the full size image.
+	if (format == TGL_BGR)
+		tglTexParameteri(TGL_TEXTURE_2D, TGL_TEXTURE_MIN_FILTER, TGL_LINEAR_MIPMAP_NEAREST);
+	else
+		tglTexParameteri(TGL_TEXTURE_2D, TGL_TEXTURE_MIN_FILTER, TGL_LINEAR);
 	tglTexImage2D(TGL_TEXTURE_2D, 0, 3, material->_width, material->_height, 0, format, TGL_UNSIGNED_BYTE, texdata);
 	delete[] texdata;
 }
@@ -1306,11 +1428,15 @@ void GfxTinyGL::destroyMaterial(Texture *material) {
 }
 
 void GfxTinyGL::prepareMovieFrame(Graphics::Surface *frame) {
-	_smushWidth = frame->w;
-	_smushHeight = frame->h;
+	if (frame->w != _smushWidth || frame->h != _smushHeight || !_smushBitmap.getRawBuffer()) {
+		_smushWidth = frame->w;
+		_smushHeight = frame->h;
+		_smushBitmap.create(_pixelFormat, frame->w * frame->h, DisposeAfterUse::YES);
+	}
 
+	// The movie player hands over frames in _pixelFormat already (see
+	// getMovieFrameFormat()), so this is a plain copy.
 	Graphics::PixelBuffer srcBuf(frame->format, (byte *)frame->getPixels());
-	_smushBitmap.create(_pixelFormat, frame->w * frame->h, DisposeAfterUse::YES);
 	_smushBitmap.copyBuffer(0, frame->w * frame->h, srcBuf);
 }
 
@@ -1530,6 +1656,65 @@ void GfxTinyGL::readPixels(int x, int y, int width, int height, uint8 *buffer) {
 	}
 }
 
+void GfxTinyGL::createModel(Mesh *mesh) {
+	TinyGLMeshData *data = new TinyGLMeshData();
+	Common::HashMap<uint32, uint32> vertexIds;
+	Common::Array<uint32> faceIds;
+	const uint32 numTexIds = mesh->_numTextureVerts + 1;
+
+	data->_faceStart.reserve(mesh->_numFaces + 1);
+	for (int i = 0; i < mesh->_numFaces; ++i) {
+		const MeshFace *face = &mesh->_faces[i];
+		data->_faceStart.push_back(data->_indices.size());
+
+		faceIds.resize(face->_numVertices);
+		for (int j = 0; j < face->_numVertices; ++j) {
+			int v = face->_vertices[j];
+			int t = face->_texVertices ? face->_texVertices[j] : -1;
+			uint32 key = v * numTexIds + (t + 1);
+
+			Common::HashMap<uint32, uint32>::const_iterator it = vertexIds.find(key);
+			if (it != vertexIds.end()) {
+				faceIds[j] = it->_value;
+				continue;
+			}
+
+			uint32 id = data->_vertices.size() / 3;
+			for (int k = 0; k < 3; ++k) {
+				data->_vertices.push_back(mesh->_vertices[3 * v + k]);
+				data->_normals.push_back(mesh->_vertNormals[3 * v + k]);
+			}
+			data->_texCoords.push_back(t >= 0 ? mesh->_textureVerts[2 * t] : 0.f);
+			data->_texCoords.push_back(t >= 0 ? mesh->_textureVerts[2 * t + 1] : 0.f);
+			vertexIds[key] = id;
+			faceIds[j] = id;
+		}
+
+		// The same triangles, in the same order, as TGL_POLYGON gives.
+		for (int j = face->_numVertices - 1; j >= 2; --j) {
+			data->_indices.push_back(faceIds[j]);
+			data->_indices.push_back(faceIds[0]);
+			data->_indices.push_back(faceIds[j - 1]);
+		}
+	}
+	data->_faceStart.push_back(data->_indices.size());
+
+	for (int k = 0; k < 3; ++k) {
+		data->_bboxMin[k] = data->_bboxMax[k] = data->_vertices.empty() ? 0.f : data->_vertices[k];
+		for (uint i = k; i < data->_vertices.size(); i += 3) {
+			data->_bboxMin[k] = MIN(data->_bboxMin[k], data->_vertices[i]);
+			data->_bboxMax[k] = MAX(data->_bboxMax[k], data->_vertices[i]);
+		}
+	}
+
+	mesh->_userData = data;
+}
+
+void GfxTinyGL::destroyModel(Mesh *mesh) {
+	delete (TinyGLMeshData *)mesh->_userData;
+	mesh->_userData = NULL;
+}
+
 void GfxTinyGL::createSpecialtyTextures() {
 	//make a buffer big enough to hold any of the textures
 	uint8 *buffer = new uint8[256 * 256 * 4];
@@ -76,6 +76,7 @@ public:
 
 	void drawEMIModelFace(const EMIModel *model, const EMIMeshFace *face);
 	void drawModelFace(const Mesh *mesh, const MeshFace *face);
+	void drawMesh(const Mesh *mesh);
 	void drawSprite(const Sprite *sprite);
 
 	void enableLights();
@@ -103,6 +104,7 @@ public:
 	void irisAroundRegion(int x1, int y1, int x2, int y2);
 
 	Bitmap *getScreenshot(int w, int h);
+	Common::String getScreenChecksum();
 	void storeDisplay();
 	void copyStoredToDisplay();
 
@@ -114,11 +116,15 @@ public:
 	void drawPolygon(const PrimitiveObject *primitive);
 
 	void prepareMovieFrame(Graphics::Surface *frame);
+	Graphics::PixelFormat getMovieFrameFormat() const { return _pixelFormat; }
 	void drawMovieFrame(int offsetX, int offsetY);
 	void releaseMovieFrame();
 
 	void createSpecialtyTextures();
 
+	void createModel(Mesh *mesh);
+	void destroyModel(Mesh *mesh);
+
 	int genBuffer();
 	void delBuffer(int buffer);
 	void selectBuffer(int buffer);
@@ -138,10 +144,17 @@ private:
 	Common::HashMap<int, TinyGL::Buffer *> _buffers;
 	uint _bufferId;
 	const Actor *_currentActor;
+	bool _offscreen;
+	bool _binning;
+	// The shadow planes are drawn to this screen sized mask, then only the
+	// rectangle they cover is kept in the Shadow. It is always left cleared.
+	byte *_shadowMaskScratch;
+	// The z buffer value of every 16 bit depth of the z bitmaps.
+	uint32 *_zBitmapValues;
 
 	void readPixels(int x, int y, int width, int height, uint8 *buffer);
-	void blit(const Graphics::PixelFormat &format, BlitImage *blit, byte *dst, byte *src, int x, int y, int width, int height, bool trans);
-	void blit(const Graphics::PixelFormat &format, BlitImage *blit, byte *dst, byte *src, int dstX, int dstY, int srcX, int srcY, int width, int height, int srcWidth, int srcHeight, bool trans);
+	void blit(const Graphics::PixelFormat &format, const BlitImage *blit, byte *dst, byte *src, int x, int y, int width, int height, bool trans);
+	void blit(const Graphics::PixelFormat &format, const BlitImage *blit, byte *dst, byte *src, int dstX, int dstY, int srcX, int srcY, int width, int height, int srcWidth, int srcHeight, bool trans);
 };
 
 } // end of namespace Grim
@@ -31,6 +31,7 @@
 #include "common/foreach.h"
 #include "common/fs.h"
 #include "common/config-manager.h"
+#include "common/savefile.h"
 
 #include "graphics/pixelbuffer.h"
 
@@ -58,6 +59,7 @@
 #include "engines/grim/bitmap.h"
 #include "engines/grim/font.h"
 #include "engines/grim/primitives.h"
+#include "engines/grim/profiler.h"
 #include "engines/grim/objectstate.h"
 #include "engines/grim/set.h"
 #include "engines/grim/sound.h"
@@ -79,6 +81,7 @@ GrimEngine::GrimEngine(OSystem *syst, uint32 gameFlags, GrimGameType gameType, C
 	g_grim = this;
 
 	_debugger = new Debugger();
+	g_profiler = new FrameProfiler();
 	_gameType = gameType;
 	_gameFlags = gameFlags;
 	_gamePlatform = platform;
@@ -100,6 +103,9 @@ GrimEngine::GrimEngine(OSystem *syst, uint32 gameFlags, GrimGameType gameType, C
 	ConfMan.registerDefault("fullscreen", false);
 	ConfMan.registerDefault("show_fps", false);
 	ConfMan.registerDefault("use_arb_shaders", true);
+	ConfMan.registerDefault("resource_cache_size", 32 * 1024);
+	ConfMan.registerDefault("imuse_decode_ahead", 500);
+	ConfMan.registerDefault("tinygl_binning", false);
 
 	_showFps = ConfMan.getBool("show_fps");
 
@@ -130,6 +136,10 @@ GrimEngine::GrimEngine(OSystem *syst, uint32 gameFlags, GrimGameType gameType, C
 	ConfMan.setInt("engine_speed", 1000 / _speedLimitMs);
 	_listFilesIter = NULL;
 	_savedState = NULL;
+	_benchmark = NULL;
+	_benchmarkFrames = 0;
+	_benchmarkFrame = 0;
+	_benchmarkTime = 0;
 	_fps[0] = 0;
 	_iris = new Iris();
 	_buildActiveActorsList = false;
@@ -193,6 +203,13 @@ GrimEngine::~GrimEngine() {
 	g_driver = NULL;
 	delete _iris;
 	delete _debugger;
+	if (_benchmark) {
+		_benchmark->finalize();
+		delete _benchmark;
+		LuaBase::writeOpcodeStats(ConfMan.get("benchmark") + ".opcodes");
+	}
+	delete g_profiler;
+	g_profiler = NULL;
 
 	ConfMan.flushToDisk();
 	DebugMan.clearAllDebugChannels();
@@ -219,6 +236,10 @@ void GrimEngine::createRenderer() {
 	_softRenderer = ConfMan.getBool("soft_renderer");
 #endif
 
+	// The benchmark must run the same everywhere, with no display.
+	if (ConfMan.hasKey("benchmark"))
+		_softRenderer = true;
+
 	if (!_softRenderer && !g_system->hasFeature(OSystem::kFeatureOpenGL)) {
 		warning("gfx backend doesn't support hardware rendering");
 		_softRenderer = true;
@@ -271,6 +292,15 @@ Common::Error GrimEngine::run() {
 	}
 
 	g_resourceloader = new ResourceLoader();
+
+	// --build-lua-cache compiles the source scripts for dofile(), then quits
+	if (ConfMan.hasKey("build_lua_cache") && ConfMan.getBool("build_lua_cache")) {
+		int built = createLua()->buildScriptCache();
+		Common::String msg = Common::String::format("Compiled %d scripts into the script cache\n", built);
+		g_system->logMessage(LogMessageType::kInfo, msg.c_str());
+		return Common::kNoError;
+	}
+
 	bool demo = getGameFlags() & ADGF_DEMO;
 	if (getGameType() == GType_GRIM)
 		g_movie = CreateSmushPlayer(demo);
@@ -450,6 +480,10 @@ void GrimEngine::luaUpdate() {
 
 	// Update timing information
 	unsigned newStart = g_system->getMillis();
+	// Still call getMillis(), so that the event recorder plays back the
+	// same sequence in benchmarks.
+	if (_benchmark)
+		newStart = _benchmarkTime;
 	if (newStart < _frameStart) {
 		_frameStart = newStart;
 		return;
@@ -461,20 +495,27 @@ void GrimEngine::luaUpdate() {
 		_frameTime = 0;
 	}
 
-	LuaBase::instance()->update(_frameTime, _movieTime);
+	{
+		ProfileScope scope(FrameProfiler::kStageLuaTasks);
+		LuaBase::instance()->update(_frameTime, _movieTime);
+	}
 
 	if (_currSet && (_mode == NormalMode || _mode == SmushMode)) {
 		// call updateTalk() before calling update(), since it may modify costumes state, and
 		// the costumes are updated in update().
-		for (Common::List<Actor *>::iterator i = _talkingActors.begin(); i != _talkingActors.end(); ++i) {
-			Actor *a = *i;
-			if (!a->updateTalk(_frameTime)) {
-				i = _talkingActors.reverse_erase(i);
+		{
+			ProfileScope scope(FrameProfiler::kStageTalkUpdate);
+			for (Common::List<Actor *>::iterator i = _talkingActors.begin(); i != _talkingActors.end(); ++i) {
+				Actor *a = *i;
+				if (!a->updateTalk(_frameTime)) {
+					i = _talkingActors.reverse_erase(i);
+				}
 			}
 		}
 
 		// Update the actors. Do it here so that we are sure to react asap to any change
 		// in the actors state caused by lua.
+		ProfileScope scope(FrameProfiler::kStageActorUpdate);
 		buildActiveActorsList();
 		foreach (Actor *a, _activeActors) {
 			// Note that the actor need not be visible to update chores, for example:
@@ -494,6 +535,11 @@ void GrimEngine::luaUpdate() {
 void GrimEngine::updateDisplayScene() {
 	_doFlip = true;
 
+	{
+		ProfileScope scope(FrameProfiler::kStageMovie);
+		g_movie->update();
+	}
+
 	if (_mode == SmushMode) {
 		if (g_movie->isPlaying()) {
 			_movieTime = g_movie->getMovieTime();
@@ -504,6 +550,7 @@ void GrimEngine::updateDisplayScene() {
 			int frame = g_movie->getFrame();
 			if (frame >= 0) {
 				if (frame != _prevSmushFrame) {
+					ProfileScope scope(FrameProfiler::kStageBitmaps);
 					_prevSmushFrame = g_movie->getFrame();
 					g_driver->drawMovieFrame(g_movie->getX(), g_movie->getY());
 					if (_showFps)
@@ -514,6 +561,7 @@ void GrimEngine::updateDisplayScene() {
 				g_driver->releaseMovieFrame();
 		}
 		// Draw Primitives
+		ProfileScope scope(FrameProfiler::kStagePrimitives);
 		foreach (PrimitiveObject *p, PrimitiveObject::getPool()) {
 			p->draw();
 		}
@@ -529,11 +577,18 @@ void GrimEngine::updateNormalMode() {
 	if (!_currSet)
 		return;
 
-	g_driver->clearScreen();
+	{
+		ProfileScope scope(FrameProfiler::kStageBackground);
+		g_driver->clearScreen();
+	}
 
 	drawNormalMode();
 
-	g_driver->drawBuffers();
+	{
+		ProfileScope scope(FrameProfiler::kStageBuffers);
+		g_driver->drawBuffers();
+	}
+	ProfileScope scope(FrameProfiler::kStagePrimitives);
 	drawPrimitives();
 }
 
@@ -547,43 +602,53 @@ void GrimEngine::drawNormalMode() {
 	_prevSmushFrame = 0;
 	_movieTime = 0;
 
-	_currSet->drawBackground();
-
-	// Draw underlying scene components
-	// Background objects are drawn underneath everything except the background
-	// There are a bunch of these, especially in the tube-switcher room
-	_currSet->drawBitmaps(ObjectState::OBJSTATE_BACKGROUND);
-
-	// State objects are drawn on top of other things, such as the flag
-	// on Manny's message tube
-	_currSet->drawBitmaps(ObjectState::OBJSTATE_STATE);
-
-	// Play SMUSH Animations
-	// This should occur on top of all underlying scene objects,
-	// a good example is the tube switcher room where some state objects
-	// need to render underneath the animation or you can't see what's going on
-	// This should not occur on top of everything though or Manny gets covered
-	// up when he's next to Glottis's service room
-	if (g_movie->isPlaying() && _movieSetup == _currSet->getCurrSetup()->_name) {
-		_movieTime = g_movie->getMovieTime();
-		if (g_movie->isUpdateNeeded()) {
-			g_driver->prepareMovieFrame(g_movie->getDstSurface());
-			g_movie->clearUpdateNeeded();
-		}
-		if (g_movie->getFrame() >= 0)
-			g_driver->drawMovieFrame(g_movie->getX(), g_movie->getY());
-		else
-			g_driver->releaseMovieFrame();
+	{
+		ProfileScope scope(FrameProfiler::kStageBackground);
+		_currSet->drawBackground();
 	}
 
-	// Underlay objects must be drawn on top of movies
-	// Otherwise the lighthouse door will always be open as the underlay for
-	// the closed door will be overdrawn by a movie used as background image.
-	_currSet->drawBitmaps(ObjectState::OBJSTATE_UNDERLAY);
+	{
+		ProfileScope scope(FrameProfiler::kStageBitmaps);
+
+		// Draw underlying scene components
+		// Background objects are drawn underneath everything except the background
+		// There are a bunch of these, especially in the tube-switcher room
+		_currSet->drawBitmaps(ObjectState::OBJSTATE_BACKGROUND);
+
+		// State objects are drawn on top of other things, such as the flag
+		// on Manny's message tube
+		_currSet->drawBitmaps(ObjectState::OBJSTATE_STATE);
+
+		// Play SMUSH Animations
+		// This should occur on top of all underlying scene objects,
+		// a good example is the tube switcher room where some state objects
+		// need to render underneath the animation or you can't see what's going on
+		// This should not occur on top of everything though or Manny gets covered
+		// up when he's next to Glottis's service room
+		if (g_movie->isPlaying() && _movieSetup == _currSet->getCurrSetup()->_name) {
+			_movieTime = g_movie->getMovieTime();
+			if (g_movie->isUpdateNeeded()) {
+				g_driver->prepareMovieFrame(g_movie->getDstSurface());
+				g_movie->clearUpdateNeeded();
+			}
+			if (g_movie->getFrame() >= 0)
+				g_driver->drawMovieFrame(g_movie->getX(), g_movie->getY());
+			else
+				g_driver->releaseMovieFrame();
+		}
+
+		// Underlay objects must be drawn on top of movies
+		// Otherwise the lighthouse door will always be open as the underlay for
+		// the closed door will be overdrawn by a movie used as background image.
+		_currSet->drawBitmaps(ObjectState::OBJSTATE_UNDERLAY);
+	}
 
 	// Draw Primitives
-	foreach (PrimitiveObject *p, PrimitiveObject::getPool()) {
-		p->draw();
+	{
+		ProfileScope scope(FrameProfiler::kStagePrimitives);
+		foreach (PrimitiveObject *p, PrimitiveObject::getPool()) {
+			p->draw();
+		}
 	}
 
 	_currSet->setupCamera();
@@ -596,10 +661,13 @@ void GrimEngine::drawNormalMode() {
 	}
 
 	// Draw actors
-	buildActiveActorsList();
-	foreach (Actor *a, _activeActors) {
-		if (a->isVisible())
-			a->draw();
+	{
+		ProfileScope scope(FrameProfiler::kStageActors);
+		buildActiveActorsList();
+		foreach (Actor *a, _activeActors) {
+			if (a->isVisible())
+				a->draw();
+		}
 	}
 
 	flagRefreshShadowMask(false);
@@ -607,6 +675,7 @@ void GrimEngine::drawNormalMode() {
 	// Draw overlying scene components
 	// The overlay objects should be drawn on top of everything else,
 	// including 3D objects such as Manny and the message tube
+	ProfileScope scope(FrameProfiler::kStageBitmaps);
 	_currSet->drawBitmaps(ObjectState::OBJSTATE_OVERLAY);
 }
 
@@ -618,9 +687,13 @@ void GrimEngine::doFlip() {
 
 	if (_showFps && _mode != DrawMode)
 		g_driver->drawEmergString(550, 25, _fps, Color(255, 255, 255));
+	if (g_profiler->hasOverlay() && _mode != DrawMode)
+		g_profiler->drawOverlay();
 
-	if (_flipEnable)
+	if (_flipEnable) {
+		ProfileScope scope(FrameProfiler::kStageFlip);
 		g_driver->flipBuffer();
+	}
 
 	if (_showFps && _mode != DrawMode) {
 		unsigned int currentTime = g_system->getMillis();
@@ -633,6 +706,33 @@ void GrimEngine::doFlip() {
 	}
 }
 
+void GrimEngine::startBenchmark() {
+	Common::String filename = ConfMan.get("benchmark");
+	_benchmark = g_system->getSavefileManager()->openForSaving(filename, false);
+	if (!_benchmark)
+		error("Could not open the benchmark file %s", filename.c_str());
+	_benchmarkFrames = ConfMan.hasKey("benchmark_frames") ? ConfMan.getInt("benchmark_frames") : 0;
+	_benchmarkFrame = 0;
+	_benchmarkTime = _frameStart;
+	g_profiler->setEnabled(true);
+	lua_resetopstats();
+	lua_setopstats(true);
+
+	Common::String line("frame,total");
+	for (int i = 0; i < FrameProfiler::kNumStages; ++i)
+		line += Common::String::format(",%s", FrameProfiler::getStageName((FrameProfiler::Stage)i));
+	_benchmark->writeString(line + ",checksum\n");
+}
+
+void GrimEngine::writeBenchmarkFrame(uint32 frameTime) {
+	Common::String line = Common::String::format("%d,%d", _benchmarkFrame, frameTime);
+	for (int i = 0; i < FrameProfiler::kNumStages; ++i)
+		line += Common::String::format(",%d", g_profiler->getLastFrameTime((FrameProfiler::Stage)i));
+	line += "," + g_driver->getScreenChecksum() + "\n";
+	_benchmark->writeString(line);
+	_benchmarkFrame++;
+}
+
 void GrimEngine::mainLoop() {
 	_movieTime = 0;
 	_frameTime = 0;
@@ -647,8 +747,13 @@ void GrimEngine::mainLoop() {
 	_changeFullscreenState = false;
 	_setupChanged = true;
 
+	if (ConfMan.hasKey("benchmark"))
+		startBenchmark();
+
 	for (;;) {
 		uint32 startTime = g_system->getMillis();
+		uint32 realStartTime = g_system->getRealMillis();
+		_benchmarkTime += _speedLimitMs;
 		if (_shortFrame) {
 			if (resetShortFrame) {
 				_shortFrame = false;
@@ -706,6 +811,7 @@ void GrimEngine::mainLoop() {
 		_debugger->onFrame();
 
 		// Process events
+		uint32 eventsStart = g_system->getRealMillis();
 		Common::Event event;
 		while (g_system->getEventManager()->pollEvent(event)) {
 			// Handle any buttons, keys and joystick operations
@@ -743,6 +849,8 @@ void GrimEngine::mainLoop() {
 				}
 			}
 		}
+		if (g_profiler->isEnabled())
+			g_profiler->addTime(FrameProfiler::kStageEvents, eventsStart);
 
 		if (_mode != PauseMode) {
 			// Draw the display scene before doing the luaUpdate.
@@ -762,6 +870,13 @@ void GrimEngine::mainLoop() {
 		if (_mode != PauseMode) {
 			doFlip();
 		}
+		g_profiler->endFrame();
+
+		if (_benchmark) {
+			writeBenchmarkFrame(g_system->getRealMillis() - realStartTime);
+			if (_benchmarkFrames && _benchmarkFrame >= _benchmarkFrames)
+				quitGame();
+		}
 
 		if (g_imuseState != -1) {
 			g_sound->setMusicState(g_imuseState);
@@ -776,7 +891,16 @@ void GrimEngine::mainLoop() {
 			continue;
 		if (diffTime < _speedLimitMs) {
 			uint32 delayTime = _speedLimitMs - diffTime;
-			g_system->delayMillis(delayTime);
+			// Spend the spare time of the frame reading ahead prefetched resources.
+			if (g_resourceloader->hasPendingPrefetch()) {
+				g_resourceloader->processPrefetchQueue(delayTime);
+				diffTime = g_system->getMillis() - startTime;
+				if (diffTime >= _speedLimitMs)
+					continue;
+				delayTime = _speedLimitMs - diffTime;
+			}
+			if (!_benchmark)
+				g_system->delayMillis(delayTime);
 		}
 	}
 }
@@ -1136,15 +1260,51 @@ void GrimEngine::setSet(Set *scene) {
 	Set *lastSet = _currSet;
 	_currSet = scene;
 	_currSet->setSoundParameters(20, 127);
+	if (lastSet)
+		noteSetChange(lastSet->getName(), _currSet->getName());
 	// should delete the old scene after setting the new one
 	if (lastSet && !lastSet->_locked) {
 		delete lastSet;
 	}
+	prefetchSetNeighbours(_currSet->getName());
 	_shortFrame = true;
 	_setupChanged = true;
 	invalidateActiveActorsList();
 }
 
+static void addSetNeighbour(Common::StringArray &neighbours, const Common::String &name) {
+	static const uint maxNeighbours = 4;
+
+	for (uint i = 0; i < neighbours.size(); ++i) {
+		if (neighbours[i].equalsIgnoreCase(name)) {
+			neighbours.remove_at(i);
+			break;
+		}
+	}
+	neighbours.insert_at(0, name);
+	if (neighbours.size() > maxNeighbours)
+		neighbours.resize(maxNeighbours);
+}
+
+void GrimEngine::noteSetChange(const Common::String &from, const Common::String &to) {
+	addSetNeighbour(_setNeighbours[from], to);
+	addSetNeighbour(_setNeighbours[to], from);
+}
+
+// The set files don't say which sets are next to each other, so learn it
+// from the set changes and read the known neighbours of the new set in the
+// idle time of the following frames.
+void GrimEngine::prefetchSetNeighbours(const Common::String &name) {
+	if (!_setNeighbours.contains(name))
+		return;
+
+	const Common::StringArray &neighbours = _setNeighbours[name];
+	for (uint i = 0; i < neighbours.size(); ++i) {
+		if (!findSet(neighbours[i]))
+			g_resourceloader->prefetchSet(neighbours[i]);
+	}
+}
+
 void GrimEngine::makeCurrentSetup(int num) {
 	int prevSetup = g_grim->getCurrSet()->getSetup();
 	if (prevSetup != num) {
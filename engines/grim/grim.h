@@ -34,6 +34,10 @@
 #include "engines/grim/textobject.h"
 #include "engines/grim/iris.h"
 
+namespace Common {
+class WriteStream;
+}
+
 namespace Grim {
 
 class Actor;
@@ -119,6 +123,8 @@ public:
 	void playIrisAnimation(Iris::Direction dir, int x, int y, int time);
 
 	void mainLoop();
+	void startBenchmark();
+	void writeBenchmarkFrame(uint32 frameTime);
 	unsigned getFrameStart() const { return _frameStart; }
 	unsigned getFrameTime() const { return _frameTime; }
 
@@ -206,6 +212,9 @@ protected:
 	virtual void updateDrawMode();
 	virtual void drawNormalMode();
 
+	void noteSetChange(const Common::String &from, const Common::String &to);
+	void prefetchSetNeighbours(const Common::String &name);
+
 	void savegameSave();
 	void saveGRIM();
 
@@ -220,6 +229,9 @@ protected:
 	SaveGame *_savedState;
 
 	Set *_currSet;
+	// The sets entered from or left to each set, most recent first, which
+	// are read ahead when the set becomes current again.
+	Common::HashMap<Common::String, Common::StringArray, Common::IgnoreCase_Hash, Common::IgnoreCase_EqualTo> _setNeighbours;
 	EngineMode _mode, _previousMode;
 	SpeechMode _speechMode;
 	int _textSpeed;
@@ -240,6 +252,13 @@ protected:
 	bool _showFps;
 	bool _softRenderer;
 
+	// The benchmark runs with a fixed time step, and writes the times and
+	// the checksum of every frame.
+	Common::WriteStream *_benchmark;
+	uint32 _benchmarkFrames;
+	uint32 _benchmarkFrame;
+	unsigned _benchmarkTime;
+
 	bool *_controlsEnabled;
 	bool *_controlsState;
 
@@ -20,11 +20,13 @@
  *
  */
 
+#include "common/config-manager.h"
 #include "common/textconsole.h"
 #include "common/timer.h"
 
 #include "engines/grim/savegame.h"
 #include "engines/grim/debug.h"
+#include "engines/grim/profiler.h"
 
 #include "engines/grim/imuse/imuse.h"
 #include "engines/grim/movie/codecs/vima.h"
@@ -48,10 +50,18 @@ void Imuse::timerHandler(void *refCon) {
 	imuse->callback();
 }
 
+// Decodes the sounds ahead of callback(), without holding _mutex, so that
+// the callback only copies decoded data and the other calls do not wait
+// for the disk or the VIMA decoder.
+void Imuse::decodeHandler(void *refCon) {
+	Imuse *imuse = (Imuse *)refCon;
+	imuse->_sound->decodeAhead();
+}
+
 Imuse::Imuse(int fps, bool demo) {
 	_demo = demo;
 	_pause = false;
-	_sound = new ImuseSndMgr(_demo);
+	_sound = new ImuseSndMgr(_demo, ConfMan.getInt("imuse_decode_ahead"));
 	assert(_sound);
 	_callbackFps = fps;
 	resetState();
@@ -70,9 +80,11 @@ Imuse::Imuse(int fps, bool demo) {
 		_seqMusicTable = grimSeqMusicTable;
 	}
 	g_system->getTimerManager()->installTimerProc(timerHandler, 1000000 / _callbackFps, this, "imuseCallback");
+	g_system->getTimerManager()->installTimerProc(decodeHandler, 1000000 / (2 * _callbackFps), this, "imuseDecode");
 }
 
 Imuse::~Imuse() {
+	g_system->getTimerManager()->removeTimerProc(decodeHandler);
 	g_system->getTimerManager()->removeTimerProc(timerHandler);
 	stopAllSounds();
 	for (int l = 0; l < MAX_IMUSE_TRACKS + MAX_IMUSE_FADETRACKS; l++) {
@@ -202,6 +214,7 @@ int32 Imuse::makeMixerFlags(int32 flags) {
 
 void Imuse::callback() {
 	Common::StackLock lock(_mutex);
+	ProfileScope scope(FrameProfiler::kStageIMuse);
 
 	for (int l = 0; l < MAX_IMUSE_TRACKS + MAX_IMUSE_FADETRACKS; l++) {
 		Track *track = _track[l];
@@ -57,6 +57,7 @@ private:
 
 	int32 makeMixerFlags(int32 flags);
 	static void timerHandler(void *refConf);
+	static void decodeHandler(void *refConf);
 	void callback();
 	void switchToNextRegion(Track *track);
 	int allocSlot(int priority);
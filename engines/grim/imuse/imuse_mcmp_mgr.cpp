@@ -88,7 +88,7 @@ bool McmpMgr::openSound(const char *filename, Common::SeekableReadStream *data,
 	return true;
 }
 
-int32 McmpMgr::decompressSample(int32 offset, int32 size, byte **comp_final) {
+int32 McmpMgr::decompressSample(int32 offset, int32 size, byte *comp_final) {
 	int32 i, final_size, output_size;
 	int skip, first_block, last_block;
 
@@ -105,8 +105,6 @@ int32 McmpMgr::decompressSample(int32 offset, int32 size, byte **comp_final) {
 	if ((last_block >= _numCompItems) && (_numCompItems > 0))
 		last_block = _numCompItems - 1;
 
-	int32 blocks_final_size = 0x2000 * (1 + last_block - first_block);
-	*comp_final = (byte *)malloc(blocks_final_size * sizeof(byte));
 	final_size = 0;
 
 	for (i = first_block; i <= last_block; i++) {
@@ -132,9 +130,7 @@ int32 McmpMgr::decompressSample(int32 offset, int32 size, byte **comp_final) {
 		if (output_size > size)
 			output_size = size;
 
-		assert(final_size + output_size <= blocks_final_size);
-
-		memcpy(*comp_final + final_size, _compOutput + skip, output_size);
+		memcpy(comp_final + final_size, _compOutput + skip, output_size);
 		final_size += output_size;
 
 		size -= output_size;
@@ -22,6 +22,7 @@
 
 #include "common/endian.h"
 #include "common/stream.h"
+#include "common/system.h"
 
 #include "engines/grim/resource.h"
 
@@ -30,8 +31,13 @@
 
 namespace Grim {
 
-ImuseSndMgr::ImuseSndMgr(bool demo) {
+// The most data decodeAhead() decodes per call, and at once for a sound
+static const int32 kDecodeAheadBudget = 8 * 0x2000;
+static const int32 kDecodeAheadChunk = 0x2000;
+
+ImuseSndMgr::ImuseSndMgr(bool demo, int decodeAheadMs) {
 	_demo = demo;
+	_decodeAheadMs = decodeAheadMs;
 	for (int l = 0; l < MAX_IMUSE_SOUNDS; l++) {
 		memset(&_sounds[l], 0, sizeof(SoundDesc));
 	}
@@ -209,12 +215,30 @@ ImuseSndMgr::SoundDesc *ImuseSndMgr::openSound(const char *soundName, int volGro
 		error("ImuseSndMgr::openSound() Unrecognized extension for sound file %s", soundName);
 	}
 
+	if (_decodeAheadMs > 0) {
+		// Room for the given time of 16 bit data, in whole blocks
+		int32 size = (int32)sound->freq * sound->channels * 2 * _decodeAheadMs / 1000;
+		size = (size + kDecodeAheadChunk - 1) & ~(kDecodeAheadChunk - 1);
+		byte *ring = (byte *)malloc(size);
+		Common::StackLock lock(_ringMutex);
+		sound->ring = ring;
+		sound->ringSize = size;
+		sound->ringRegion = -1;
+	}
+
 	return sound;
 }
 
 void ImuseSndMgr::closeSound(SoundDesc *sound) {
 	assert(checkForProperHandle(sound));
 
+	lockDecoder(sound);
+	{
+		Common::StackLock lock(_ringMutex);
+		free(sound->ring);
+		sound->ring = NULL;
+	}
+
 	if (sound->mcmpMgr) {
 		delete sound->mcmpMgr;
 		sound->mcmpMgr = NULL;
@@ -235,6 +259,7 @@ void ImuseSndMgr::closeSound(SoundDesc *sound) {
 		sound->inStream = NULL;
 	}
 
+	Common::StackLock lock(_ringMutex);
 	memset(sound, 0, sizeof(SoundDesc));
 }
 
@@ -338,6 +363,37 @@ int ImuseSndMgr::getJumpFade(SoundDesc *sound, int number) {
 	return sound->jump[number].fadeDelay;
 }
 
+/**
+ * Take the stream and the decoder of the sound for the caller, waiting for
+ * decodeAhead() to be done with them if it is working on another thread.
+ */
+void ImuseSndMgr::lockDecoder(SoundDesc *sound) {
+	for (;;) {
+		{
+			Common::StackLock lock(_ringMutex);
+			if (!sound->decoding) {
+				sound->decoding = true;
+				return;
+			}
+		}
+		g_system->delayMillis(1);
+	}
+}
+
+void ImuseSndMgr::unlockDecoder(SoundDesc *sound) {
+	Common::StackLock lock(_ringMutex);
+	sound->decoding = false;
+}
+
+int32 ImuseSndMgr::readData(SoundDesc *sound, int32 offset, int32 size, byte *buf) {
+	if (sound->mcmpData)
+		return sound->mcmpMgr->decompressSample(offset, size, buf);
+
+	sound->inStream->seek(offset + sound->headerSize, SEEK_SET);
+	sound->inStream->read(buf, size);
+	return size;
+}
+
 int32 ImuseSndMgr::getDataFromRegion(SoundDesc *sound, int region, byte **buf, int32 offset, int32 size) {
 	assert(checkForProperHandle(sound));
 	assert(buf && offset >= 0 && size >= 0);
@@ -353,15 +409,88 @@ int32 ImuseSndMgr::getDataFromRegion(SoundDesc *sound, int region, byte **buf, i
 		sound->endFlag = false;
 	}
 
-	if (sound->mcmpData) {
-		size = sound->mcmpMgr->decompressSample(region_offset + offset, size, buf);
-	} else {
-		*buf = (byte *)malloc(sizeof(byte) * size);
-		sound->inStream->seek(region_offset + offset + sound->headerSize, SEEK_SET);
-		sound->inStream->read(*buf, size);
+	*buf = (byte *)malloc(sizeof(byte) * size);
+
+	if (!sound->ring) {
+		return readData(sound, region_offset + offset, size, *buf);
+	}
+
+	// Take what the ring has from this position. The data between the read
+	// and the write positions is not touched by decodeAhead(), so it is
+	// copied without holding the lock.
+	int32 ready = 0, index = 0;
+	{
+		Common::StackLock lock(_ringMutex);
+		if (sound->ringRegion == region && sound->ringOffset == offset) {
+			ready = MIN(sound->ringWritten - sound->ringRead, size);
+			index = sound->ringRead % sound->ringSize;
+		}
+	}
+	int32 first = MIN(ready, sound->ringSize - index);
+	memcpy(*buf, sound->ring + index, first);
+	memcpy(*buf + first, sound->ring, ready - first);
+
+	if (ready == size) {
+		Common::StackLock lock(_ringMutex);
+		sound->ringRead += size;
+		sound->ringOffset += size;
+		return size;
+	}
+
+	// Decode the rest here, and start decoding ahead from the new position
+	lockDecoder(sound);
+	size = ready + readData(sound, region_offset + offset + ready, size - ready, *buf + ready);
+	{
+		Common::StackLock lock(_ringMutex);
+		sound->ringRegion = region;
+		sound->ringOffset = offset + size;
+		sound->ringRead = 0;
+		sound->ringWritten = 0;
+		sound->decoding = false;
 	}
 
 	return size;
 }
 
+void ImuseSndMgr::decodeAhead() {
+	int32 budget = kDecodeAheadBudget;
+	while (budget > 0) {
+		SoundDesc *sound = NULL;
+		int32 offset = 0, size = 0, index = 0;
+		{
+			Common::StackLock lock(_ringMutex);
+			// Pick the sound with the smallest part of its ring filled
+			for (int l = 0; l < MAX_IMUSE_SOUNDS; l++) {
+				SoundDesc *s = &_sounds[l];
+				if (!s->ring || s->decoding || s->ringRegion == -1)
+					continue;
+				int32 ready = s->ringWritten - s->ringRead;
+				int32 left = s->region[s->ringRegion].length - (s->ringOffset + ready);
+				if (ready == s->ringSize || left <= 0)
+					continue;
+				if (sound && (int64)ready * sound->ringSize >= (int64)(sound->ringWritten - sound->ringRead) * s->ringSize)
+					continue;
+				sound = s;
+				offset = s->region[s->ringRegion].offset + s->ringOffset + ready;
+				index = s->ringWritten % s->ringSize;
+				size = MIN(MIN(s->ringSize - ready, left), MIN(s->ringSize - index, kDecodeAheadChunk));
+			}
+			if (!sound)
+				return;
+			sound->decoding = true;
+		}
+
+		int32 result = readData(sound, offset, size, sound->ring + index);
+
+		Common::StackLock lock(_ringMutex);
+		sound->ringWritten += result;
+		sound->decoding = false;
+		budget -= size;
+		if (result < size) {
+			// The data ends before the region, stop decoding this one
+			sound->ringRegion = -1;
+		}
+	}
+}
+
 } // end of namespace Grim
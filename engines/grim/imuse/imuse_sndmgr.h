@@ -23,6 +23,8 @@
 #ifndef GRIM_IMUSE_SNDMGR_H
 #define GRIM_IMUSE_SNDMGR_H
 
+#include "common/mutex.h"
+
 #include "audio/mixer.h"
 #include "audio/audiostream.h"
 
@@ -77,21 +79,38 @@ public:
 		bool mcmpData;
 		uint32 headerSize;
 		Common::SeekableReadStream *inStream;
+
+		// Data decoded ahead of the reads, from ringOffset in ringRegion.
+		// ringRead and ringWritten count the bytes taken out of and put in
+		// the ring since ringOffset was set.
+		byte *ring;
+		int32 ringSize;
+		int32 ringRegion;
+		int32 ringOffset;
+		int32 ringRead;
+		int32 ringWritten;
+		bool decoding;      // the stream and decoder are in use
 	};
 
 private:
 
 	SoundDesc _sounds[MAX_IMUSE_SOUNDS];
 	bool _demo;
+	int _decodeAheadMs;
+	// Guards the ring positions and the decoding flags of the sounds
+	Common::Mutex _ringMutex;
 
 	bool checkForProperHandle(SoundDesc *soundDesc);
 	SoundDesc *allocSlot();
 	void parseSoundHeader(SoundDesc *sound, int &headerSize);
 	void countElements(SoundDesc *sound);
+	void lockDecoder(SoundDesc *sound);
+	void unlockDecoder(SoundDesc *sound);
+	int32 readData(SoundDesc *sound, int32 offset, int32 size, byte *buf);
 
 public:
 
-	ImuseSndMgr(bool demo);
+	ImuseSndMgr(bool demo, int decodeAheadMs = 0);
 	~ImuseSndMgr();
 
 	SoundDesc *openSound(const char *soundName, int volGroupId);
@@ -112,6 +131,12 @@ public:
 	int getJumpFade(SoundDesc *sound, int number);
 
 	int32 getDataFromRegion(SoundDesc *sound, int region, byte **buf, int32 offset, int32 size);
+	/**
+	 * Decode the open sounds ahead of getDataFromRegion(), up to the end of
+	 * the region being read. This does a bounded amount of work per call,
+	 * on the sounds with the least data ready first.
+	 */
+	void decodeAhead();
 };
 
 } // end of namespace Grim
@@ -20,14 +20,103 @@
  *
  */
 
+#include "common/bufferedstream.h"
 #include "common/file.h"
-#include "common/substream.h"
+#include "common/memstream.h"
+#include "common/mutex.h"
 
 #include "engines/grim/grim.h"
 #include "engines/grim/lab.h"
 
 namespace Grim {
 
+// Members up to this size are read into memory with a single read when
+// opened; anything bigger is streamed from the shared archive handle.
+static const uint32 kLabMemoryMemberLimit = 512 * 1024;
+
+// Size of the read buffer put in front of streamed members.
+static const uint32 kLabStreamBufferSize = 4096;
+
+/**
+ * The open archive file, shared by the Lab and every stream handed out
+ * for its members. Reads are positioned and serialized, since members may
+ * be read from the main thread and the sound timer thread at the same time.
+ */
+class LabHandle {
+public:
+	LabHandle(Common::File *file) : _file(file) {}
+	~LabHandle() { delete _file; }
+
+	uint32 read(uint32 offset, void *dataPtr, uint32 dataSize) {
+		Common::StackLock lock(_mutex);
+		if (!_file->seek(offset))
+			return 0;
+		return _file->read(dataPtr, dataSize);
+	}
+
+private:
+	Common::File *_file;
+	Common::Mutex _mutex;
+};
+
+/**
+ * A read stream over [begin, end) of a LabHandle. Keeps its own position,
+ * so any number of them can be used at once on the same handle.
+ */
+class LabStream : public Common::SeekableReadStream {
+public:
+	LabStream(const Common::SharedPtr<LabHandle> &handle, uint32 begin, uint32 end) :
+		_handle(handle), _begin(begin), _end(end), _pos(begin), _eos(false), _err(false) {}
+
+	bool eos() const { return _eos; }
+	bool err() const { return _err; }
+	void clearErr() { _eos = false; _err = false; }
+
+	uint32 read(void *dataPtr, uint32 dataSize) {
+		if (dataSize > _end - _pos) {
+			dataSize = _end - _pos;
+			_eos = true;
+		}
+
+		uint32 bytesRead = _handle->read(_pos, dataPtr, dataSize);
+		if (bytesRead != dataSize)
+			_err = true;
+		_pos += bytesRead;
+		return bytesRead;
+	}
+
+	int32 pos() const { return _pos - _begin; }
+	int32 size() const { return _end - _begin; }
+
+	bool seek(int32 offset, int whence = SEEK_SET) {
+		int32 newPos;
+		switch (whence) {
+		case SEEK_END:
+			newPos = size() + offset;
+			break;
+		case SEEK_CUR:
+			newPos = pos() + offset;
+			break;
+		case SEEK_SET:
+		default:
+			newPos = offset;
+			break;
+		}
+
+		if (newPos < 0 || newPos > size())
+			return false;
+
+		_pos = _begin + newPos;
+		_eos = false;
+		return true;
+	}
+
+private:
+	Common::SharedPtr<LabHandle> _handle;
+	uint32 _begin, _end, _pos;
+	bool _eos, _err;
+};
+
 LabEntry::LabEntry(const Common::String &name, uint32 offset, uint32 len, Lab *parent) :
 		_offset(offset), _len(len), _parent(parent), _name(name) {
 	_name.toLowercase();
@@ -40,22 +129,22 @@ Common::SeekableReadStream *LabEntry::createReadStream() const {
 bool Lab::open(const Common::String &filename) {
 	_labFileName = filename;
 
-	bool result = true;
-
 	Common::File *file = new Common::File();
 	if (!file->open(filename) || file->readUint32BE() != MKTAG('L','A','B','N')) {
-		result = false;
-	} else {
-		file->readUint32LE(); // version
-
-		if (g_grim->getGameType() == GType_GRIM)
-			parseGrimFileTable(file);
-		else
-			parseMonkey4FileTable(file);
+		delete file;
+		return false;
 	}
-	delete file;
 
-	return result;
+	file->readUint32LE(); // version
+
+	if (g_grim->getGameType() == GType_GRIM)
+		parseGrimFileTable(file);
+	else
+		parseMonkey4FileTable(file);
+
+	_handle = Common::SharedPtr<LabHandle>(new LabHandle(file));
+
+	return true;
 }
 
 void Lab::parseGrimFileTable(Common::File *file) {
@@ -158,16 +247,45 @@ const Common::ArchiveMemberPtr Lab::getMember(const Common::String &name) const
 }
 
 Common::SeekableReadStream *Lab::createReadStreamForMember(const Common::String &filename) const {
-	if (!hasFile(filename))
+	Common::String fname(filename);
+	fname.toLowercase();
+
+	LabMap::const_iterator it = _entries.find(fname);
+	if (it == _entries.end())
 		return 0;
 
-	Common::String fname(filename);
+	const LabEntry &entry = *it->_value;
+
+	if (entry._len <= kLabMemoryMemberLimit) {
+		uint32 len;
+		byte *data = readMember(fname, len);
+		if (!data)
+			return 0;
+		return new Common::MemoryReadStream(data, len, DisposeAfterUse::YES);
+	}
+
+	Common::SeekableReadStream *stream = new LabStream(_handle, entry._offset, entry._offset + entry._len);
+	return Common::wrapBufferedSeekableReadStream(stream, kLabStreamBufferSize, DisposeAfterUse::YES);
+}
+
+byte *Lab::readMember(const Common::String &name, uint32 &len) const {
+	Common::String fname(name);
 	fname.toLowercase();
-	LabEntryPtr i = _entries[fname];
 
-	Common::File *file = new Common::File();
-	file->open(_labFileName);
-	return new Common::SeekableSubReadStream(file, i->_offset, i->_offset + i->_len, DisposeAfterUse::YES);
+	LabMap::const_iterator it = _entries.find(fname);
+	if (it == _entries.end())
+		return 0;
+
+	const LabEntry &entry = *it->_value;
+	// Keep a valid pointer for empty members too.
+	byte *data = (byte *)malloc(entry._len ? entry._len : 1);
+	if (_handle->read(entry._offset, data, entry._len) != entry._len) {
+		warning("Lab::readMember(): short read of \"%s\" from \"%s\"", fname.c_str(), _labFileName.c_str());
+		free(data);
+		return 0;
+	}
+	len = entry._len;
+	return data;
 }
 
 } // end of namespace Grim
@@ -24,6 +24,7 @@
 #define GRIM_LAB_H
 
 #include "common/archive.h"
+#include "common/ptr.h"
 
 namespace Common {
 	class File;
@@ -32,6 +33,7 @@ namespace Common {
 namespace Grim {
 
 class Lab;
+class LabHandle;
 
 class LabEntry : public Common::ArchiveMember {
 	Lab *_parent;
@@ -44,6 +46,14 @@ public:
 	friend class Lab;
 };
 
+/**
+ * A LAB/M4B archive.
+ *
+ * The archive file is opened once and kept open for the lifetime of the
+ * Lab; all member streams share that single handle. Small members are
+ * read in one go into memory, larger ones (voices, music, movies) are
+ * streamed through positioned reads on the shared handle.
+ */
 class Lab : public Common::Archive {
 public:
 	bool open(const Common::String &filename);
@@ -54,11 +64,21 @@ public:
 	virtual const Common::ArchiveMemberPtr getMember(const Common::String &name) const;
 	virtual Common::SeekableReadStream *createReadStreamForMember(const Common::String &name) const;
 
+	/**
+	 * Read a whole member into a buffer allocated with malloc(), which the
+	 * caller owns and must free(). This lets the resource cache keep the
+	 * data without copying it out of a stream.
+	 *
+	 * @return the buffer, or NULL if there is no such member or the read failed.
+	 */
+	byte *readMember(const Common::String &name, uint32 &len) const;
+
 private:
 	void parseGrimFileTable(Common::File *_f);
 	void parseMonkey4FileTable(Common::File *_f);
 
 	Common::String _labFileName;
+	Common::SharedPtr<LabHandle> _handle;
 	typedef Common::SharedPtr<LabEntry> LabEntryPtr;
 	typedef Common::HashMap<Common::String, LabEntryPtr, Common::IgnoreCase_Hash, Common::IgnoreCase_EqualTo> LabMap;
 	LabMap _entries;
@@ -20,10 +20,15 @@
  *
  */
 
+#include "common/archive.h"
+#include "common/config-manager.h"
 #include "common/endian.h"
 #include "common/foreach.h"
 #include "common/system.h"
 #include "common/events.h"
+#include "common/md5.h"
+#include "common/memstream.h"
+#include "common/savefile.h"
 
 #include "math/matrix3.h"
 
@@ -44,6 +49,7 @@
 #include "engines/grim/primitives.h"
 
 #include "engines/grim/lua/lauxlib.h"
+#include "engines/grim/lua/lundump.h"
 #include "engines/grim/lua/luadebug.h"
 #include "engines/grim/lua/lualib.h"
 
@@ -107,9 +113,12 @@ void LuaObjects::pushObjects() const {
 LuaBase *LuaBase::s_instance = NULL;
 
 LuaBase::LuaBase() :
-		_translationMode(0), _frameTimeCollection(0) {
+		_translationMode(0) {
 	s_instance = this;
 
+	ConfMan.registerDefault("lua_script_cache", true);
+	_scriptCache = ConfMan.getBool("lua_script_cache");
+
 	lua_iolibopen();
 	lua_strlibopen();
 	lua_mathlibopen();
@@ -256,12 +265,6 @@ void LuaBase::boot() {
 }
 
 void LuaBase::update(int frameTime, int movieTime) {
-	_frameTimeCollection += frameTime;
-	if (_frameTimeCollection > 10000) {
-		_frameTimeCollection = 0;
-		lua_collectgarbage(0);
-	}
-
 	lua_beginblock();
 	setFrameTime(frameTime);
 	lua_endblock();
@@ -299,12 +302,155 @@ int LuaBase::dofile(const char *filename) {
 	int32 size = stream->size();
 	char *buffer = new char[size];
 	stream->read(buffer, size);
-	int result = lua_dobuffer(const_cast<char *>(buffer), size, const_cast<char *>(filename));
+	int result;
+	if (_scriptCache && size > 0 && buffer[0] != ID_CHUNK)
+		result = dofileCached(filename, buffer, size);
+	else
+		result = lua_dobuffer(const_cast<char *>(buffer), size, const_cast<char *>(filename));
 	delete stream;
 	delete[] buffer;
 	return result;
 }
 
+// The compiled scripts are saved as: tag, version, MD5 of the source, size, chunk.
+static const uint32 kScriptCacheTag = MKTAG('L', 'U', 'A', 'C');
+static const uint32 kScriptCacheVersion = 1;
+
+static Common::String getScriptCacheName(const char *filename) {
+	Common::String name = Common::String::format("%s-%s.luac", g_grim->getGameType() == GType_MONKEY4 ? "emi" : "grim", filename);
+	for (uint i = 0; i < name.size(); ++i) {
+		if (name[i] == '/' || name[i] == '\\')
+			name.setChar('_', i);
+	}
+	return name;
+}
+
+static byte *readScriptCache(const Common::String &cacheName, const uint8 digest[16], uint32 &size) {
+	Common::InSaveFile *in = g_system->getSavefileManager()->openForLoading(cacheName);
+	if (!in)
+		return NULL;
+
+	uint8 sourceDigest[16];
+	byte *chunk = NULL;
+	if (in->readUint32BE() == kScriptCacheTag && in->readUint32LE() == kScriptCacheVersion &&
+	    in->read(sourceDigest, 16) == 16 && memcmp(sourceDigest, digest, 16) == 0) {
+		size = in->readUint32LE();
+		if (size > 0 && size <= (uint32)(in->size() - in->pos())) {
+			chunk = new byte[size];
+			if (in->read(chunk, size) != size || chunk[0] != ID_CHUNK) {
+				delete[] chunk;
+				chunk = NULL;
+			}
+		}
+	}
+	delete in;
+	return chunk;
+}
+
+static void writeScriptCache(const Common::String &cacheName, const uint8 digest[16], Common::MemoryWriteStreamDynamic &chunk) {
+	Common::OutSaveFile *out = g_system->getSavefileManager()->openForSaving(cacheName, false);
+	if (!out)
+		return;
+	out->writeUint32BE(kScriptCacheTag);
+	out->writeUint32LE(kScriptCacheVersion);
+	out->write(digest, 16);
+	out->writeUint32LE(chunk.size());
+	out->write(chunk.getData(), chunk.size());
+	out->finalize();
+	if (out->err())
+		Debug::warning(Debug::Engine, "Cannot write the compiled script %s", cacheName.c_str());
+	delete out;
+}
+
+int LuaBase::dofileCached(const char *filename, const char *buffer, int32 size) {
+	uint8 digest[16];
+	Common::MemoryReadStream source((const byte *)buffer, size);
+	Common::computeStreamMD5(source, digest);
+
+	Common::String cacheName = getScriptCacheName(filename);
+	uint32 chunkSize;
+	byte *chunk = readScriptCache(cacheName, digest, chunkSize);
+	if (chunk) {
+		int result = lua_dobuffer((const char *)chunk, chunkSize, filename);
+		delete[] chunk;
+		return result;
+	}
+
+	Common::MemoryWriteStreamDynamic dump(DisposeAfterUse::YES);
+	bool dumped;
+	int result = lua_dobufferdump(buffer, size, filename, &dump, &dumped);
+	if (dumped)
+		writeScriptCache(cacheName, digest, dump);
+	return result;
+}
+
+bool LuaBase::writeOpcodeStats(const Common::String &filename) {
+	Common::OutSaveFile *file = g_system->getSavefileManager()->openForSaving(filename, false);
+	if (!file)
+		return false;
+
+	int32 numOps = lua_numopcodes();
+	file->writeString("opcode,count\n");
+	for (int32 op = 0; op < numOps; ++op)
+		file->writeString(Common::String::format("%s,%u\n", lua_opname(op), lua_opcount(op)));
+
+	file->writeString("\nopcode,next,count\n");
+	for (int32 op = 0; op < numOps; ++op) {
+		for (int32 next = 0; next < numOps; ++next) {
+			uint32 count = lua_oppaircount(op, next);
+			if (count)
+				file->writeString(Common::String::format("%s,%s,%u\n", lua_opname(op), lua_opname(next), count));
+		}
+	}
+
+	file->finalize();
+	bool ok = !file->err();
+	delete file;
+	return ok;
+}
+
+int LuaBase::buildScriptCache() {
+	Common::ArchiveMemberList files;
+	SearchMan.listMatchingMembers(files, "*.lua");
+
+	int built = 0;
+	for (Common::ArchiveMemberList::const_iterator x = files.begin(); x != files.end(); ++x) {
+		Common::String filename = (*x)->getName();
+		filename.toLowercase();
+		Common::SeekableReadStream *stream = g_resourceloader->openNewStreamFile(filename);
+		if (!stream)
+			continue;
+
+		int32 size = stream->size();
+		char *buffer = new char[size];
+		stream->read(buffer, size);
+		delete stream;
+		// Precompiled scripts are not parsed anyway
+		if (size > 0 && buffer[0] != ID_CHUNK) {
+			uint8 digest[16];
+			Common::MemoryReadStream source((const byte *)buffer, size);
+			Common::computeStreamMD5(source, digest);
+
+			Common::String cacheName = getScriptCacheName(filename.c_str());
+			uint32 chunkSize;
+			byte *chunk = readScriptCache(cacheName, digest, chunkSize);
+			if (chunk) {
+				delete[] chunk;
+			} else {
+				Common::MemoryWriteStreamDynamic dump(DisposeAfterUse::YES);
+				if (lua_dumpbuffer(buffer, size, filename.c_str(), &dump)) {
+					writeScriptCache(cacheName, digest, dump);
+					++built;
+				} else {
+					Debug::warning(Debug::Engine, "Cannot compile script %s", filename.c_str());
+				}
+			}
+		}
+		delete[] buffer;
+	}
+	return built;
+}
+
 bool LuaBase::callback(const char *name) {
 	LuaObjects o;
 	return callback(name, o);
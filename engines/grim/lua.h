@@ -109,6 +109,18 @@ public:
 	inline static LuaBase *instance() { return s_instance; }
 
 	int dofile(const char *filename);
+	/**
+	 * Compile the source scripts of the game data into the script cache,
+	 * where dofile() finds them. Scripts already cached are skipped.
+	 *
+	 * @return The number of scripts compiled.
+	 */
+	int buildScriptCache();
+	/**
+	 * Write the opcode statistics of the interpreter, turned on with
+	 * lua_setopstats(), to a CSV file in the save path.
+	 */
+	static bool writeOpcodeStats(const Common::String &filename);
 
 	virtual bool findCostume(lua_Object costumeObj, Actor *actor, Costume **costume);
 	virtual Common::String parseMsgText(const char *msg, char *msgId);
@@ -160,7 +172,14 @@ private:
 	// 1 - don't translate - message after '/msgId'
 	// 2 - return '/msgId/'
 	int _translationMode;
-	unsigned int _frameTimeCollection;
+
+	/**
+	 * Source scripts are parsed once and saved compiled in the save path,
+	 * keyed by the script name and the MD5 of its source. Disabled by the
+	 * "lua_script_cache" setting.
+	 */
+	int dofileCached(const char *filename, const char *buffer, int32 size);
+	bool _scriptCache;
 
 	int refSystemTable;
 	int refTypeOverride;
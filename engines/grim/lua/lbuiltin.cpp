@@ -81,30 +81,29 @@ static void foreachvar() {
 static void next() {
 	lua_Object o = luaL_tablearg(1);
 	lua_Object r = luaL_nonnullarg(2);
-	Node *n = luaH_next(luaA_Address(o), luaA_Address(r));
-	if (n) {
-		luaA_pushobject(&n->ref);
-		luaA_pushobject(&n->val);
+	Hash *t = avalue(luaA_Address(o));
+	TObject key, value;
+	if (luaH_next(t, luaH_pos(t, luaA_Address(r)), &key, &value) >= 0) {
+		luaA_pushobject(&key);
+		luaA_pushobject(&value);
 	}
 }
 
 static void foreach() {
 	TObject t = *luaA_Address(luaL_tablearg(1));
 	TObject f = *luaA_Address(luaL_functionarg(2));
-	int32 i;
-	for (i = 0; i < avalue(&t)->nhash; i++) {
-		Node *nd = &(avalue(&t)->node[i]);
-		if (ttype(ref(nd)) != LUA_T_NIL && ttype(val(nd)) != LUA_T_NIL) {
-			luaA_pushobject(&f);
-			luaA_pushobject(ref(nd));
-			luaA_pushobject(val(nd));
-			lua_state->state_counter1++;
-			luaD_call((lua_state->stack.top - lua_state->stack.stack) - 2, 1);
-			lua_state->state_counter1--;
-			if (ttype(lua_state->stack.top - 1) != LUA_T_NIL)
-				return;
-			lua_state->stack.top--;
-		}
+	TObject key, value;
+	int32 i = -1;
+	while ((i = luaH_next(avalue(&t), i, &key, &value)) >= 0) {
+		luaA_pushobject(&f);
+		luaA_pushobject(&key);
+		luaA_pushobject(&value);
+		lua_state->state_counter1++;
+		luaD_call((lua_state->stack.top - lua_state->stack.stack) - 2, 1);
+		lua_state->state_counter1--;
+		if (ttype(lua_state->stack.top - 1) != LUA_T_NIL)
+			return;
+		lua_state->stack.top--;
 	}
 }
 
@@ -379,24 +379,33 @@ int32 luaD_protectedrun(int32 nResults) {
 /*
 ** returns 0 = chunk loaded; 1 = error; 2 = no more chunks to load
 */
-static int32 protectedparser(ZIO *z, int32 bin) {
+static int32 protectedparse(ZIO *z, int32 bin, TProtoFunc **tf) {
 	int32 status;
-	TProtoFunc *tf;
 	jmp_buf myErrorJmp;
 	jmp_buf *oldErr = lua_state->errorJmp;
 	lua_state->errorJmp = &myErrorJmp;
 	if (setjmp(myErrorJmp) == 0) {
-		tf = bin ? luaU_undump1(z) : luaY_parser(z);
+		*tf = bin ? luaU_undump1(z) : luaY_parser(z);
 		status = 0;
 	} else {
-		tf = NULL;
+		*tf = NULL;
 		status = 1;
 	}
 	lua_state->errorJmp = oldErr;
 	if (status)
 		return 1;  // error code
-	if (tf == NULL)
+	if (*tf == NULL)
 		return 2;  // 'natural' end
+	return 0;
+}
+
+static int32 protectedparser(ZIO *z, int32 bin, Common::WriteStream *dump, bool *dumped) {
+	TProtoFunc *tf;
+	int32 status = protectedparse(z, bin, &tf);
+	if (status)
+		return status;
+	if (dump && !bin)
+		*dumped = luaU_dump(tf, dump);
 	luaD_adjusttop(lua_state->Cstack.base + 1);  // one slot for the pseudo-function
 	lua_state->stack.stack[lua_state->Cstack.base].ttype = LUA_T_PROTO;
 	lua_state->stack.stack[lua_state->Cstack.base].value.tf = tf;
@@ -404,11 +413,11 @@ static int32 protectedparser(ZIO *z, int32 bin) {
 	return 0;
 }
 
-static int32 do_main(ZIO *z, int32 bin) {
+static int32 do_main(ZIO *z, int32 bin, Common::WriteStream *dump, bool *dumped) {
 	int32 status;
 	do {
 		int32 old_blocks = (luaC_checkGC(), nblocks);
-		status = protectedparser(z, bin);
+		status = protectedparser(z, bin, dump, dumped);
 		if (status == 1)
 			return 1;  // error
 		else if (status == 2)
@@ -454,6 +463,10 @@ int32 lua_dostring(const char *str) {
 }
 
 int32 lua_dobuffer(const char *buff, int32 size, const char *name) {
+	return lua_dobufferdump(buff, size, name, NULL, NULL);
+}
+
+int32 lua_dobufferdump(const char *buff, int32 size, const char *name, Common::WriteStream *dump, bool *dumped) {
 	char newname[SIZE_PREF + 25];
 	ZIO z;
 	int32 status;
@@ -462,9 +475,22 @@ int32 lua_dobuffer(const char *buff, int32 size, const char *name) {
 		build_name(buff, newname);
 		name = newname;
 	}
+	if (dumped)
+		*dumped = false;
 	luaZ_mopen(&z, buff, size, name);
-	status = do_main(&z, buff[0] == ID_CHUNK);
+	status = do_main(&z, buff[0] == ID_CHUNK, dump, dumped);
 	return status;
 }
 
+bool lua_dumpbuffer(const char *buff, int32 size, const char *name, Common::WriteStream *dump) {
+	ZIO z;
+	TProtoFunc *tf;
+
+	luaZ_mopen(&z, buff, size, name);
+	luaC_checkGC();
+	if (buff[0] == ID_CHUNK || protectedparse(&z, 0, &tf) != 0)
+		return false;
+	return luaU_dump(tf, dump);
+}
+
 } // end of namespace Grim
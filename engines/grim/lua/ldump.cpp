@@ -0,0 +1,121 @@
+/*
+** save bytecodes to streams, in the format read by lundump.cpp
+** See Copyright Notice in lua.h
+*/
+
+#include "common/stream.h"
+
+#include "engines/grim/lua/lfunc.h"
+#include "engines/grim/lua/lundump.h"
+
+namespace Grim {
+
+// The inverse of conv_float in lundump.cpp
+static uint32 conv_float(float f) {
+	const byte *fdata = (const byte *)(&f);
+	uint32 l;
+	byte *data = (byte *)(&l);
+	data[0] = fdata[3];
+	data[1] = fdata[2];
+	data[2] = fdata[1];
+	data[3] = fdata[0];
+	return l;
+}
+
+static bool DumpWord(int32 w, Common::WriteStream *S) {
+	if (w < 0 || w > 0xffff)
+		return false;
+	S->writeUint16BE(w);
+	return true;
+}
+
+static bool DumpTString(TaggedString *s, Common::WriteStream *S) {
+	if (!s)
+		return DumpWord(0, S);
+	int32 size = strlen(s->str) + 1;
+	if (!DumpWord(size, S))
+		return false;
+	for (int32 i = 0; i < size; i++)
+		S->writeByte(s->str[i] ^ 0xff);
+	return true;
+}
+
+static bool DumpLocals(TProtoFunc *tf, Common::WriteStream *S) {
+	int32 n = 0;
+	if (tf->locvars) {
+		while (tf->locvars[n].line != -1)
+			n++;
+	}
+	if (!DumpWord(n, S))
+		return false;
+	for (int32 i = 0; i < n; i++) {
+		if (!DumpWord(tf->locvars[i].line, S) || !DumpTString(tf->locvars[i].varname, S))
+			return false;
+	}
+	return true;
+}
+
+static bool DumpConstants(TProtoFunc *tf, Common::WriteStream *S) {
+	if (!DumpWord(tf->nconsts, S))
+		return false;
+	for (int32 i = 0; i < tf->nconsts; i++) {
+		TObject *o = tf->consts + i;
+		switch (ttype(o)) {
+		case LUA_T_NUMBER:
+			S->writeByte(ID_NUM);
+			S->writeUint32BE(conv_float(nvalue(o)));
+			break;
+		case LUA_T_STRING:
+			S->writeByte(ID_STR);
+			if (!DumpTString(tsvalue(o), S))
+				return false;
+			break;
+		case LUA_T_PROTO:
+			S->writeByte(ID_FUN);
+			break;
+		default:
+			return false;  // the parser creates no other constant
+		}
+	}
+	return true;
+}
+
+static bool DumpFunction(TProtoFunc *tf, Common::WriteStream *S) {
+	if (!DumpWord(tf->lineDefined, S) || !DumpTString(tf->fileName, S))
+		return false;
+	int32 size = luaF_codesize(tf);
+	S->writeUint32BE(size);
+	S->write(tf->code, size);
+	if (!DumpConstants(tf, S) || !DumpLocals(tf, S))
+		return false;
+	for (int32 i = 0; i < tf->nconsts; i++) {
+		TObject *o = tf->consts + i;
+		if (ttype(o) == LUA_T_PROTO) {
+			S->writeByte(ID_FUNCTION);
+			DumpWord(i, S);
+			if (!DumpFunction(tfvalue(o), S))
+				return false;
+		}
+	}
+	S->writeByte(ID_END);
+	return true;
+}
+
+static void DumpHeader(Common::WriteStream *S) {
+	S->writeByte(ID_CHUNK);
+	S->write(SIGNATURE, strlen(SIGNATURE));
+	S->writeByte(VERSION);
+	S->writeByte(sizeof(float));
+	S->writeUint32BE(conv_float((float)TEST_FLOAT));
+}
+
+/*
+** save one chunk, which luaU_undump1 loads back
+** return false if it does not fit the format
+*/
+bool luaU_dump(TProtoFunc *Main, Common::WriteStream *S) {
+	DumpHeader(S);
+	return DumpFunction(Main, S) && !S->err();
+}
+
+} // end of namespace Grim
@@ -8,6 +8,7 @@
 
 #include "engines/grim/lua/lfunc.h"
 #include "engines/grim/lua/lmem.h"
+#include "engines/grim/lua/lopcodes.h"
 #include "engines/grim/lua/lstate.h"
 
 namespace Grim {
@@ -65,6 +66,36 @@ void luaF_freeclosure(Closure *l) {
 }
 
 
+static int32 opcodeSizeTable[] = {
+	1, 2, 1, 2, 1, 1, 1, 3, 2, 1, 1, 1, 1, 1, 1, 1, 1, 3, 2, 1,
+	1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 3,
+	1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 3, 2, 1, 1, 1, 1, 1, 1, 1, 1,
+	3, 2, 1, 1, 3, 2, 1, 1, 1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1,
+	1, 1, 1, 3, 1, 2, 3, 2, 4, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 1, 1,
+	3, 2, 2, 2, 2, 3, 2, 1, 1, 1, 2, 1, 2, 1, 1, 1, 3, 2, 1, 1,
+	1, 1, 1, 1, 1, 1, 3, 2, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 2,
+	1, 1, 1, 1, 1, 1, 1, 1, 3, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 3,
+	2, 1, 1, 1, 1, 1, 1, 1, 1, 3, 2, 1, 1, 3, 2, 1, 1, 1, 1, 1,
+	1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 3, 1, 2, 3, 2, 4, 2, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 3, 2, 3, 2, 3,
+	2, 3, 2, 3, 2, 3, 2, 1, 1, 3, 2, 2, 2, 2, 3, 2, 1, 1
+};
+
+/*
+** Size of the code of a function, up to and including its ENDCODE.
+*/
+int32 luaF_codesize(TProtoFunc *f) {
+	byte *codePtr = f->code + 2;
+	byte *tmpPtr = codePtr;
+	int32 opcodeId;
+	do {
+		opcodeId = *tmpPtr;
+		tmpPtr += opcodeSizeTable[opcodeId];
+	} while (opcodeId != ENDCODE);
+	return (tmpPtr - codePtr) + 2;
+}
+
 /*
 ** Look for n-th local variable at line "line" in function "func".
 ** Returns NULL if not found.
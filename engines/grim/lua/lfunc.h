@@ -15,6 +15,7 @@ TProtoFunc *luaF_newproto();
 Closure *luaF_newclosure(int32 nelems);
 void luaF_freeproto(TProtoFunc *l);
 void luaF_freeclosure(Closure *l);
+int32 luaF_codesize(TProtoFunc *f);
 
 char *luaF_getlocalname (TProtoFunc *func, int32 local_number, int32 line);
 
@@ -129,66 +129,84 @@ void luaC_strcallIM(TaggedString *l) {
 	}
 }
 
-static GCnode *listcollect(GCnode *l) {
-	GCnode *frees = NULL;
-	while (l) {
-		GCnode *next = l->next;
-		l->marked = 0;
-		while (next && !next->marked) {
-			l->next = next->next;
-			next->next = frees;
-			frees = next;
-			next = l->next;
-		}
-		l = next;
-	}
-	return frees;
+/*
+** =======================================================
+** Incremental collector
+** =======================================================
+** An object is white while it has not been reached, gray while it waits
+** on graystack for its children to be marked, and black after that. A
+** cycle marks the roots, then blackens a few gray objects at each step.
+** Stacks, globals, locked refs and tag methods are written without a
+** barrier, so once no gray object is left, the atomic step marks them
+** again before the lists are swept, also a few objects at a time.
+*/
+
+static TObject *graystack = NULL;
+static int32 graysize = 0;
+static int32 graytop = 0;
+
+static int32 sweepstrindex;
+static GCnode *sweeptable, *sweepproto, *sweepcl;  // lists detached by atomic()
+static GCnode *freetable, *freeproto, *freecl;
+static TaggedString *freestr;
+
+static void graypush(TObject *o) {
+	if (graytop >= graysize)
+		graysize = luaM_growvector(&graystack, graysize, TObject, memEM, MAX_INT);
+	graystack[graytop++] = *o;
+}
+
+void luaC_barrierback(Hash *h) {
+	TObject o;
+	ttype(&o) = LUA_T_ARRAY;
+	avalue(&o) = h;
+	h->head.marked = GC_GRAY;
+	graypush(&o);
 }
 
 static void strmark(TaggedString *s) {
 	if (!s->head.marked)
-		s->head.marked = 1;
+		s->head.marked = GC_BLACK;
 }
 
-static void protomark(TProtoFunc *f) {
-	if (!f->head.marked) {
-		LocVar *v = f->locvars;
-		int32 i;
-		f->head.marked = 1;
-		if (f->fileName)
-			strmark(f->fileName);
-		for (i = 0; i < f->nconsts; i++)
-			markobject(&f->consts[i]);
-		if (v) {
-			for (; v->line != -1; v++) {
-				if (v->varname)
-					strmark(v->varname);
-			}
+static int32 protomark(TProtoFunc *f) {
+	LocVar *v = f->locvars;
+	int32 i;
+	f->head.marked = GC_BLACK;
+	if (f->fileName)
+		strmark(f->fileName);
+	for (i = 0; i < f->nconsts; i++)
+		markobject(&f->consts[i]);
+	if (v) {
+		for (; v->line != -1; v++) {
+			if (v->varname)
+				strmark(v->varname);
 		}
 	}
+	return f->nconsts + 1;
 }
 
-static void closuremark(Closure *f) {
-	if (!f->head.marked) {
-		int32 i;
-		f->head.marked = 1;
-		for (i = f->nelems; i >= 0; i--)
-			markobject(&f->consts[i]);
-	}
+static int32 closuremark(Closure *f) {
+	int32 i;
+	f->head.marked = GC_BLACK;
+	for (i = f->nelems; i >= 0; i--)
+		markobject(&f->consts[i]);
+	return f->nelems + 1;
 }
 
-static void hashmark(Hash *h) {
-	if (!h->head.marked) {
-		int32 i;
-		h->head.marked = 1;
-		for (i = 0; i < nhash(h); i++) {
-			Node *n = node(h, i);
-			if (ttype(ref(n)) != LUA_T_NIL) {
-				markobject(&n->ref);
-				markobject(&n->val);
-			}
+static int32 hashmark(Hash *h) {
+	int32 i;
+	h->head.marked = GC_BLACK;
+	for (i = 0; i < narray(h); i++)
+		markobject(&h->array[i]);
+	for (i = 0; i < nhash(h); i++) {
+		Node *n = node(h, i);
+		if (ttype(ref(n)) != LUA_T_NIL) {
+			markobject(&n->ref);
+			markobject(&n->val);
 		}
 	}
+	return narray(h) + nhash(h) + 1;
 }
 
 static void globalmark() {
@@ -201,21 +219,31 @@ static void globalmark() {
 	}
 }
 
+static void graymark(GCnode *head, lua_Type t, Value v) {
+	if (head->marked == GC_WHITE) {
+		TObject o;
+		ttype(&o) = t;
+		o.value = v;
+		head->marked = GC_GRAY;
+		graypush(&o);
+	}
+}
+
 static int32 markobject(TObject *o) {
 	switch (ttype(o)) {
 	case LUA_T_STRING:
 		strmark(tsvalue(o));
 		break;
 	case LUA_T_ARRAY:
-		hashmark(avalue(o));
+		graymark(&avalue(o)->head, LUA_T_ARRAY, o->value);
 		break;
 	case LUA_T_CLOSURE:
 	case LUA_T_CLMARK:
-		closuremark(o->value.cl);
+		graymark(&o->value.cl->head, LUA_T_CLOSURE, o->value);
 		break;
 	case LUA_T_PROTO:
 	case LUA_T_PMARK:
-		protomark(o->value.tf);
+		graymark(&o->value.tf->head, LUA_T_PROTO, o->value);
 		break;
 	default:
 		break;  // numbers, cprotos, etc
@@ -230,34 +258,151 @@ static void markall() {
 	luaT_travtagmethods(markobject);  // mark fallbacks
 }
 
-int32 lua_collectgarbage(int32 limit) {
-	int32 recovered = nblocks;  // to subtract nblocks after gc
-	Hash *freetable;
-	TaggedString *freestr;
-	TProtoFunc *freefunc;
-	Closure *freeclos;
+/*
+** Blacken gray objects until 'work' nodes have been traversed.
+*/
+static int32 propagate(int32 work) {
+	while (graytop > 0 && work > 0) {
+		TObject *o = &graystack[--graytop];
+		switch (ttype(o)) {
+		case LUA_T_ARRAY:
+			work -= hashmark(avalue(o));
+			break;
+		case LUA_T_CLOSURE:
+			work -= closuremark(clvalue(o));
+			break;
+		default:  // LUA_T_PROTO
+			work -= protomark(tfvalue(o));
+			break;
+		}
+	}
+	return work;
+}
+
+static void atomic() {
 	markall();
+	propagate(MAX_INT);
 	invalidaterefs();
-	freestr = luaS_collector();
-	freetable = (Hash *)listcollect(&roottable);
-	freefunc = (TProtoFunc *)listcollect(&rootproto);
-	freeclos = (Closure *)listcollect(&rootcl);
-	GCthreshold *= 4;  // to avoid GC during GC
-	luaC_hashcallIM(freetable);  // GC tag methods for tables
+	luaS_collectglobals();
+	// New objects go on the lists while these are swept
+	sweeptable = roottable.next;
+	roottable.next = NULL;
+	sweepproto = rootproto.next;
+	rootproto.next = NULL;
+	sweepcl = rootcl.next;
+	rootcl.next = NULL;
+	sweepstrindex = 0;
+	GCphase = GCSsweepstring;
+}
+
+/*
+** Move the marked nodes of a detached list back to 'root', as white, and
+** the others to 'frees'.
+*/
+static int32 sweeplist(GCnode **l, GCnode *root, GCnode **frees, int32 work) {
+	while (*l && work > 0) {
+		GCnode *n = *l;
+		*l = n->next;
+		if (n->marked) {
+			n->marked = GC_WHITE;
+			n->next = root->next;
+			root->next = n;
+		} else {
+			n->next = *frees;
+			*frees = n;
+		}
+		work--;
+	}
+	return work;
+}
+
+static void finalize() {
+	GCphase = GCSfinalize;  // to avoid GC during GC
+	luaC_hashcallIM((Hash *)freetable);  // GC tag methods for tables
 	luaC_strcallIM(freestr);  // GC tag methods for userdata
 	luaD_gcIM(&luaO_nilobject);  // GC tag method for nil (signal end of GC)
-	luaH_free(freetable);
+	luaH_free((Hash *)freetable);
 	luaS_free(freestr);
-	luaF_freeproto(freefunc);
-	luaF_freeclosure(freeclos);
+	luaF_freeproto((TProtoFunc *)freeproto);
+	luaF_freeclosure((Closure *)freecl);
+	freetable = freeproto = freecl = NULL;
+	freestr = NULL;
+	GCphase = GCSpause;
+	GCthreshold = 2 * nblocks;
+}
+
+static void startcycle() {
+	markall();
+	GCphase = GCSpropagate;
+}
+
+void luaC_step(int32 work) {
+	while (work > 0 && GCphase != GCSpause) {
+		switch (GCphase) {
+		case GCSpropagate:
+			work = propagate(work);
+			if (graytop == 0)
+				atomic();
+			break;
+		case GCSsweepstring:
+			work -= luaS_collector(sweepstrindex++, &freestr);
+			if (sweepstrindex == NUM_HASHS)
+				GCphase = GCSsweep;
+			break;
+		case GCSsweep:
+			work = sweeplist(&sweeptable, &roottable, &freetable, work);
+			work = sweeplist(&sweepproto, &rootproto, &freeproto, work);
+			work = sweeplist(&sweepcl, &rootcl, &freecl, work);
+			if (!sweeptable && !sweepproto && !sweepcl) {
+				finalize();
+				return;
+			}
+			break;
+		default:
+			return;
+		}
+	}
+}
+
+void luaC_resetgc() {
+	luaM_free(graystack);
+	graystack = NULL;
+	graysize = 0;
+	graytop = 0;
+	sweeptable = sweepproto = sweepcl = NULL;
+	freetable = freeproto = freecl = NULL;
+	freestr = NULL;
+	GCphase = GCSpause;
+}
+
+void luaC_finishcycle() {
+	if (GCphase != GCSfinalize)
+		luaC_step(MAX_INT);
+}
+
+int32 lua_collectgarbage(int32 limit) {
+	int32 recovered = nblocks;  // to subtract nblocks after gc
+	if (GCphase == GCSfinalize)
+		return 0;  // called by a GC tag method
+	// A cycle past its atomic step keeps objects that died since
+	if (GCphase != GCSpause && GCphase != GCSpropagate)
+		luaC_step(MAX_INT);
+	if (GCphase == GCSpause)
+		startcycle();
+	luaC_step(MAX_INT);
 	recovered = recovered - nblocks;
 	GCthreshold = (limit == 0) ? 2 * nblocks : nblocks + limit;
 	return recovered;
 }
 
 void luaC_checkGC() {
-	if (nblocks >= GCthreshold)
-		lua_collectgarbage(0);
+	if (nblocks < GCthreshold || GCphase == GCSfinalize)
+		return;
+	if (GCphase == GCSpause)
+		startcycle();
+	luaC_step(GCSTEPSIZE);
+	if (GCphase != GCSpause)
+		GCthreshold = nblocks + GCSTEPBLOCKS;
 }
 
 } // end of namespace Grim
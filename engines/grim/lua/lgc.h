@@ -7,11 +7,28 @@
 #define GRIM_LGC_H
 
 
-#include "lobject.h"
+#include "engines/grim/lua/lstate.h"
 
 namespace Grim {
 
+// Values of GCnode::marked. Strings are never gray: a string marked
+// GC_GRAY or more is fixed, see luaS_newfixedstring and luaX_init.
+#define GC_WHITE 0
+#define GC_BLACK 1
+#define GC_GRAY  2
+
+#define GCSTEPSIZE   1024  // work done by luaC_checkGC during a cycle
+#define GCSTEPBLOCKS 32    // blocks allocated between two of those steps
+#define GCFRAMESTEP  4096  // work done by lua_runtasks every frame
+
+// A black table written to has to be traversed again
+#define luaC_tablebarrier(h)	{ if (GCphase == GCSpropagate && (h)->head.marked == GC_BLACK) luaC_barrierback(h); }
+
 void luaC_checkGC();
+void luaC_step(int32 work);
+void luaC_finishcycle();
+void luaC_resetgc();
+void luaC_barrierback(Hash *h);
 TObject* luaC_getref(int32 r);
 int32 luaC_ref(TObject *o, int32 lock);
 void luaC_hashcallIM(Hash *l);
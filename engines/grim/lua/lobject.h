@@ -137,6 +137,8 @@ typedef struct Hash {
 	int32 nhash;
 	int32 nuse;
 	int32 htag;
+	TObject *array;  // values of the integer keys 1..narray
+	int32 narray;
 } Hash;
 
 extern const char *luaO_typenames[];
@@ -311,6 +311,17 @@ void lua_Restore(SaveGame *savedState) {
 		tempHash->nuse = savedState->readLESint32();
 		tempHash->htag = savedState->readLESint32();
 		tempHash->node = hashnodecreate(tempHash->nhash);
+		tempHash->array = NULL;
+		tempHash->narray = 0;
+		// before version 10 the tables had no array part
+		if (savedState->saveMinorVersion() >= 10) {
+			tempHash->narray = savedState->readLESint32();
+			if (tempHash->narray > 0)
+				tempHash->array = luaM_newvector(tempHash->narray, TObject);
+			for (l = 0; l < tempHash->narray; l++) {
+				restoreObjectValue(&tempHash->array[l], savedState);
+			}
+		}
 		luaO_insertlist(prevHash, (GCnode *)tempHash);
 		prevHash = (GCnode *)tempHash;
 
@@ -404,6 +415,9 @@ void lua_Restore(SaveGame *savedState) {
 
 	tempHash = (Hash *)roottable.next;
 	while (tempHash) {
+		for (i = 0; i < tempHash->narray; i++) {
+			recreateObj(&tempHash->array[i]);
+		}
 		for (i = 0; i < tempHash->nuse; i++) {
 			recreateObj(&tempHash->node[i].ref);
 			recreateObj(&tempHash->node[i].val);
@@ -597,6 +611,8 @@ void lua_Restore(SaveGame *savedState) {
 			recreateObj(&state->taskFunc);
 	}
 
+	lua_schedrebuild();
+
 	for (; currentState; currentState--)
 		lua_state = lua_state->next;
 
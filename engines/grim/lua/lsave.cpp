@@ -10,6 +10,7 @@
 #include "engines/grim/lua/lauxlib.h"
 #include "engines/grim/lua/lmem.h"
 #include "engines/grim/lua/ldo.h"
+#include "engines/grim/lua/lfunc.h"
 #include "engines/grim/lua/ltm.h"
 #include "engines/grim/lua/ltable.h"
 #include "engines/grim/lua/lvm.h"
@@ -122,22 +123,6 @@ static void saveObjectValue(TObject *object, SaveGame *savedState) {
 	}
 }
 
-static int32 opcodeSizeTable[] = {
-	1, 2, 1, 2, 1, 1, 1, 3, 2, 1, 1, 1, 1, 1, 1, 1, 1, 3, 2, 1,
-	1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 3,
-	1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 3, 2, 1, 1, 1, 1, 1, 1, 1, 1,
-	3, 2, 1, 1, 3, 2, 1, 1, 1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1,
-	1, 1, 1, 3, 1, 2, 3, 2, 4, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-	1, 1, 1, 1, 1, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 1, 1,
-	3, 2, 2, 2, 2, 3, 2, 1, 1, 1, 2, 1, 2, 1, 1, 1, 3, 2, 1, 1,
-	1, 1, 1, 1, 1, 1, 3, 2, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 2,
-	1, 1, 1, 1, 1, 1, 1, 1, 3, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 3,
-	2, 1, 1, 1, 1, 1, 1, 1, 1, 3, 2, 1, 1, 3, 2, 1, 1, 1, 1, 1,
-	1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1, 3, 1, 2, 3, 2, 4, 2, 1,
-	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 3, 2, 3, 2, 3,
-	2, 3, 2, 3, 2, 3, 2, 1, 1, 3, 2, 2, 2, 2, 3, 2, 1, 1
-};
-
 void lua_Save(SaveGame *savedState) {
 	savedState->beginSection('LUAS');
 
@@ -255,6 +240,10 @@ void lua_Save(SaveGame *savedState) {
 		}
 		savedState->writeLESint32(countUsedHash);
 		savedState->writeLESint32(tempHash->htag);
+		savedState->writeLESint32(tempHash->narray);
+		for (i = 0; i < tempHash->narray; i++) {
+			saveObjectValue(&tempHash->array[i], savedState);
+		}
 		for (i = 0; i < tempHash->nhash; i++) {
 			Node *newNode = &tempHash->node[i];
 			if (newNode->ref.ttype != LUA_T_NIL && newNode->val.ttype != LUA_T_NIL) {
@@ -288,14 +277,7 @@ void lua_Save(SaveGame *savedState) {
 			savedState->writeLESint32(tempProtoFunc->locvars[i].line);
 		}
 
-		byte *codePtr = tempProtoFunc->code + 2;
-		byte *tmpPtr = codePtr;
-		int32 opcodeId;
-		do {
-			opcodeId = *tmpPtr;
-			tmpPtr += opcodeSizeTable[opcodeId];
-		} while (opcodeId != ENDCODE);
-		int32 codeSize = (tmpPtr - codePtr) + 2;
+		int32 codeSize = luaF_codesize(tempProtoFunc);
 		savedState->writeLESint32(codeSize);
 		savedState->write(tempProtoFunc->code, codeSize);
 		tempProtoFunc = (TProtoFunc *)tempProtoFunc->head.next;
@@ -406,7 +388,7 @@ void lua_Save(SaveGame *savedState) {
 			savedState->writeLESint32(state->Cblocks[i].num);
 		}
 
-		savedState->writeLEUint32(state->sleepFor);
+		savedState->writeLEUint32(lua_schedsleepleft(state));
 		savedState->writeLEUint32(state->id);
 		saveObjectValue(&state->taskFunc, savedState);
 
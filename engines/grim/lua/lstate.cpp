@@ -42,6 +42,7 @@ struct ref *refArray;
 int32 refSize;
 int32 GCthreshold;
 int32 nblocks;
+GCPhase GCphase;
 int32 Mbuffsize;
 int32 Mbuffnext;
 char *Mbuffbase;
@@ -91,6 +92,10 @@ void lua_stateinit(LState *state) {
 	state->some_task = NULL;
 	state->taskFunc.ttype = LUA_T_NIL;
 	state->sleepFor = 0;
+	state->wakeTime = 0;
+	state->order = 0;
+	state->queue = TQ_NONE;
+	state->queueIndex = 0;
 
 	state->stack.stack = luaM_newvector(STACK_UNIT, TObject);
 	state->stack.top = state->stack.stack;
@@ -98,6 +103,7 @@ void lua_stateinit(LState *state) {
 }
 
 void lua_statedeinit(LState *state) {
+	lua_schedremove(state);
 	if (state->prev)
 		state->prev->next = state->next;
 	if (state->next)
@@ -132,6 +138,8 @@ void lua_resetglobals() {
 	refSize = 0;
 	GCthreshold = GARBAGE_BLOCK;
 	nblocks = 0;
+	luaC_resetgc();
+	lua_schedreset();
 
 	luaD_init();
 	luaS_init();
@@ -211,6 +219,8 @@ void lua_open() {
 }
 
 void lua_close() {
+	luaC_finishcycle();
+	luaC_resetgc();
 	TaggedString *alludata = luaS_collectudata();
 	GCthreshold = MAX_INT;  // to avoid GC during GC
 	luaC_hashcallIM((Hash *)roottable.next);  // GC t.methods for tables
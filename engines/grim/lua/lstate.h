@@ -53,6 +53,8 @@ typedef struct {
 
 enum Status { LOCK, HOLD, FREE, COLLECTED };
 
+enum GCPhase { GCSpause, GCSpropagate, GCSsweepstring, GCSsweep, GCSfinalize };
+
 struct ref {
 	TObject o;
 	enum Status status;
@@ -76,6 +78,7 @@ extern struct ref *refArray;
 extern int32 refSize;
 extern int32 GCthreshold;
 extern int32 nblocks;
+extern GCPhase GCphase;
 extern int32 Mbuffsize;
 extern int32 Mbuffnext;
 extern char *Mbuffbase;
@@ -106,6 +109,10 @@ struct LState {
 	struct C_Lua_Stack Cblocks[MAX_C_BLOCKS];
 	int numCblocks; // number of nested Cblocks
 	int sleepFor;
+	uint32 wakeTime; // scheduler time at which a sleeping state is runnable again
+	uint32 order; // rank of the state in the list, runnable states run in that order
+	int32 queue; // scheduler queue holding the state, see ltask.cpp
+	int32 queueIndex; // position of the state in that queue
 };
 
 extern LState *lua_state, *lua_rootState;
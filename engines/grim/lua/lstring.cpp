@@ -8,6 +8,7 @@
 
 #include "common/util.h"
 
+#include "engines/grim/lua/lgc.h"
 #include "engines/grim/lua/lmem.h"
 #include "engines/grim/lua/lobject.h"
 #include "engines/grim/lua/lstate.h"
@@ -106,8 +107,11 @@ static TaggedString *insert(const char *buff, int32 tag, stringtable *tb) {
 			j = i;
 		else if ((ts->constindex >= 0) ? // is a string?
 				(tag == LUA_T_STRING && (strcmp(buff, ts->str) == 0)) :
-				((tag == ts->globalval.ttype || tag == LUA_ANYTAG) && buff == (const char *)ts->globalval.value.ts))
+				((tag == ts->globalval.ttype || tag == LUA_ANYTAG) && buff == (const char *)ts->globalval.value.ts)) {
+			if (GCphase == GCSsweepstring && !ts->head.marked)
+				ts->head.marked = GC_BLACK;  // may be dead, but not swept yet
 			return ts;
+		}
 		if (++i == size)
 			i = 0;
 	}
@@ -117,6 +121,8 @@ static TaggedString *insert(const char *buff, int32 tag, stringtable *tb) {
 	else
 		tb->nuse++;
 	ts = tb->hash[i] = newone(buff, tag, h);
+	if (GCphase == GCSsweepstring)
+		ts->head.marked = GC_BLACK;  // this table may not be swept yet
 	return ts;
 }
 
@@ -159,33 +165,38 @@ void luaS_free(TaggedString *l) {
 static void remove_from_list(GCnode *l) {
 	while (l) {
 		GCnode *next = l->next;
-		while (next && !next->marked)
-			next = l->next = next->next;
+		while (next && !next->marked) {
+			l->next = next->next;
+			next->next = next;  // signal it is in no list
+			next = l->next;
+		}
 		l = next;
 	}
 }
 
-TaggedString *luaS_collector() {
-	TaggedString *frees = NULL;
-	int32 i;
+void luaS_collectglobals() {
 	remove_from_list(&rootglobal);
-	for (i = 0; i < NUM_HASHS; i++) {
-		stringtable *tb = &string_root[i];
-		int32 j;
-		for (j = 0; j < tb->size; j++) {
-			TaggedString *t = tb->hash[j];
-			if (!t)
-				continue;
-			if (t->head.marked == 1)
-				t->head.marked = 0;
-			else if (!t->head.marked) {
-				t->head.next = (GCnode *)frees;
-				frees = t;
-				tb->hash[j] = &EMPTY;
-			}
+}
+
+/*
+** Sweep the string table 'i', and return the work done.
+*/
+int32 luaS_collector(int32 i, TaggedString **frees) {
+	stringtable *tb = &string_root[i];
+	int32 j;
+	for (j = 0; j < tb->size; j++) {
+		TaggedString *t = tb->hash[j];
+		if (!t)
+			continue;
+		if (t->head.marked == GC_BLACK)
+			t->head.marked = GC_WHITE;
+		else if (!t->head.marked) {
+			t->head.next = (GCnode *)*frees;
+			*frees = t;
+			tb->hash[j] = &EMPTY;
 		}
 	}
-	return frees;
+	return tb->size + 1;
 }
 
 TaggedString *luaS_collectudata() {
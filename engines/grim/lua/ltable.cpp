@@ -1,5 +1,5 @@
 /*
-** Lua tables (hash)
+** Lua tables (array and hash)
 ** See Copyright Notice in lua.h
 */
 
@@ -7,6 +7,7 @@
 #define FORBIDDEN_SYMBOL_EXCEPTION_longjmp
 
 #include "engines/grim/lua/lauxlib.h"
+#include "engines/grim/lua/lgc.h"
 #include "engines/grim/lua/lmem.h"
 #include "engines/grim/lua/lobject.h"
 #include "engines/grim/lua/lstate.h"
@@ -16,9 +17,12 @@
 namespace Grim {
 
 #define gcsize(n)		(1 + (n / 16))
+#define tablegcsize(t)	gcsize(nhash(t) + narray(t))
 #define nuse(t)			((t)->nuse)
 #define nodevector(t)	((t)->node)
 #define REHASH_LIMIT	0.70    // avoid more than this % full
+#define MAXABITS		24      // the array part holds at most 2^MAXABITS keys
+#define MINASIZE		4
 #define TagDefault		LUA_T_ARRAY;
 
 #ifdef SCUMM_64BITS
@@ -130,6 +134,22 @@ int32 present(Hash *t, TObject *key) {
 
 #endif
 
+/*
+** Returns the index of the key in the array part, when it is an integer
+** in 1..2^MAXABITS, or 0.
+*/
+static int32 arrayindex(TObject *key) {
+	if (ttype(key) == LUA_T_NUMBER) {
+		float n = nvalue(key);
+		if (n >= 1 && n <= (float)(1 << MAXABITS)) {
+			int32 k = (int32)n;
+			if ((float)k == n)
+				return k;
+		}
+	}
+	return 0;
+}
+
 /*
 ** Alloc a vector node
 */
@@ -145,6 +165,7 @@ Node *hashnodecreate(int32 nhash) {
 ** Delete a hash
 */
 static void hashdelete(Hash *t) {
+	luaM_free(t->array);
 	luaM_free(nodevector(t));
 	luaM_free(t);
 }
@@ -152,7 +173,7 @@ static void hashdelete(Hash *t) {
 void luaH_free(Hash *frees) {
 	while (frees) {
 		Hash *next = (Hash *)frees->head.next;
-		nblocks -= gcsize(frees->nhash);
+		nblocks -= tablegcsize(frees);
 		hashdelete(frees);
 		frees = next;
 	}
@@ -164,6 +185,8 @@ Hash *luaH_new(int32 nhash) {
 	nodevector(t) = hashnodecreate(nhash);
 	nhash(t) = nhash;
 	nuse(t) = 0;
+	t->array = NULL;
+	narray(t) = 0;
 	t->htag = TagDefault;
 	luaO_insertlist(&roottable, (GCnode *)t);
 	nblocks += gcsize(nhash);
@@ -171,42 +194,155 @@ Hash *luaH_new(int32 nhash) {
 }
 
 /*
-** Rehash:
-** Check if table has deleted slots. It it has, it does not need to
-** grow, since rehash will reuse them.
+** Set the sizes of both parts, and move the entries to their new place.
 */
-static int emptyslots(Hash *t) {
-	int i;
-
-	for (i = nhash(t) - 1; i >= 0; i--) {
-		Node *n = node(t, i);
-		if (ttype(ref(n)) != LUA_T_NIL && ttype(val(n)) == LUA_T_NIL)
-			return 1;
-	}
-	return 0;
-}
-
-static void rehash(Hash *t) {
+static void resize(Hash *t, int32 nasize, int32 nhsize) {
+	int32 oldgcsize = tablegcsize(t);
+	int32 naold = narray(t);
 	int32 nold = nhash(t);
 	Node *vold = nodevector(t);
 	int32 i;
-	if (!emptyslots(t))
-		nhash(t) = luaO_redimension(nhash(t));
-	nodevector(t) = hashnodecreate(nhash(t));
+	if (nasize > naold) {
+		t->array = luaM_reallocvector(t->array, nasize, TObject);
+		for (i = naold; i < nasize; i++)
+			ttype(&t->array[i]) = LUA_T_NIL;
+	}
+	narray(t) = nasize;
+	nodevector(t) = hashnodecreate(nhsize);
+	nhash(t) = nhsize;
+	nuse(t) = 0;
+	// the array entries which do not fit anymore go to the hash part
+	for (i = nasize; i < naold; i++) {
+		if (ttype(&t->array[i]) != LUA_T_NIL) {
+			TObject key;
+			ttype(&key) = LUA_T_NUMBER;
+			nvalue(&key) = (float)(i + 1);
+			Node *n = node(t, present(t, &key));
+			*ref(n) = key;
+			*val(n) = t->array[i];
+			nuse(t)++;
+		}
+	}
+	if (nasize < naold) {
+		if (nasize)
+			t->array = luaM_reallocvector(t->array, nasize, TObject);
+		else {
+			luaM_free(t->array);
+			t->array = NULL;
+		}
+	}
 	for (i = 0; i < nold; i++) {
 		Node *n = vold + i;
-		if (ttype(ref(n)) != LUA_T_NIL && ttype(val(n)) != LUA_T_NIL)
-			*node(t, present(t, ref(n))) = *n;  // copy old node to luaM_new hash
+		if (ttype(ref(n)) != LUA_T_NIL && ttype(val(n)) != LUA_T_NIL) {
+			int32 k = arrayindex(ref(n));
+			if (k && k <= nasize)
+				t->array[k - 1] = *val(n);
+			else {
+				*node(t, present(t, ref(n))) = *n;  // copy old node to luaM_new hash
+				nuse(t)++;
+			}
+		}
 	}
-	nblocks += gcsize(t->nhash) - gcsize(nold);
+	nblocks += tablegcsize(t) - oldgcsize;
 	luaM_free(vold);
 }
 
+static void countkey(TObject *key, int32 *nums, int32 *nint) {
+	int32 k = arrayindex(key);
+	if (k) {
+		int32 lg = 0;
+		while ((1 << lg) < k)
+			lg++;
+		nums[lg]++;
+		(*nint)++;
+	}
+}
+
+/*
+** Rehash:
+** The array part gets the largest size n, a power of 2, such that more
+** than half of the slots 1..n are in use, counting the key to insert.
+** The other keys go to the hash part, and the deleted ones are dropped.
+*/
+static void rehash(Hash *t, TObject *r) {
+	int32 nums[MAXABITS + 1];
+	int32 nint = 0;
+	int32 total = 1;
+	int32 i;
+	for (i = 0; i <= MAXABITS; i++)
+		nums[i] = 0;
+	countkey(r, nums, &nint);
+	for (i = 0; i < narray(t); i++) {
+		if (ttype(&t->array[i]) != LUA_T_NIL) {
+			TObject key;
+			ttype(&key) = LUA_T_NUMBER;
+			nvalue(&key) = (float)(i + 1);
+			countkey(&key, nums, &nint);
+			total++;
+		}
+	}
+	for (i = 0; i < nhash(t); i++) {
+		Node *n = node(t, i);
+		if (ttype(ref(n)) != LUA_T_NIL && ttype(val(n)) != LUA_T_NIL) {
+			countkey(ref(n), nums, &nint);
+			total++;
+		}
+	}
+	int32 nasize = 0;
+	int32 nainuse = 0;
+	int32 a = 0;
+	for (i = 0; i <= MAXABITS && (1 << i) / 2 < nint; i++) {
+		a += nums[i];
+		if (a > (1 << i) / 2) {
+			nasize = 1 << i;
+			nainuse = a;
+		}
+	}
+	resize(t, nasize, luaO_redimension((int32)((float)(total - nainuse) / REHASH_LIMIT)));
+}
+
+/*
+** Grow the array part to hold at least the keys 1..size. The live keys of
+** the new range move from the hash part; the nodes they leave behind are
+** dropped by the next rehash.
+*/
+void luaH_resizearray(Hash *t, int32 size) {
+	int32 naold = narray(t);
+	int32 i;
+	if (size <= naold)
+		return;
+	if (size > (1 << MAXABITS))
+		lua_error("table overflow");
+	luaC_tablebarrier(t);
+	if (nuse(t) == 0) {
+		// a table built as a list does not need the hash part it was sized for
+		resize(t, size, luaO_redimension(0));
+		return;
+	}
+	t->array = luaM_reallocvector(t->array, size, TObject);
+	narray(t) = size;
+	nblocks += gcsize(nhash(t) + size) - gcsize(nhash(t) + naold);
+	for (i = naold; i < size; i++) {
+		TObject key;
+		ttype(&key) = LUA_T_NUMBER;
+		nvalue(&key) = (float)(i + 1);
+		Node *n = node(t, present(t, &key));
+		if (ttype(ref(n)) != LUA_T_NIL) {
+			t->array[i] = *val(n);
+			ttype(val(n)) = LUA_T_NIL;
+		} else
+			ttype(&t->array[i]) = LUA_T_NIL;
+	}
+}
+
 /*
 ** If the hash node is present, return its pointer, otherwise return
-** null.
+** null. The keys in the range of the array part always have a slot.
 */
 TObject *luaH_get(Hash *t, TObject *r) {
+	int32 k = arrayindex(r);
+	if (k && k <= narray(t))
+		return &t->array[k - 1];
 	int32 h = present(t, r);
 	if (ttype(ref(node(t, h))) != LUA_T_NIL)
 		return val(node(t, h));
@@ -216,46 +352,72 @@ TObject *luaH_get(Hash *t, TObject *r) {
 
 /*
 ** If the hash node is present, return its pointer, otherwise create a luaM_new
-** node for the given reference and also return its pointer.
+** node for the given reference and also return its pointer. The key right
+** after the array part grows it, so that the lists filled in order never
+** go through the hash part.
 */
 TObject *luaH_set(Hash *t, TObject *r) {
+	luaC_tablebarrier(t);
+	int32 k = arrayindex(r);
+	if (k && k <= narray(t))
+		return &t->array[k - 1];
+	if (k && k == narray(t) + 1 && k <= (1 << MAXABITS)) {
+		int32 size = narray(t) ? 2 * narray(t) : MINASIZE;
+		luaH_resizearray(t, (size < (1 << MAXABITS)) ? size : (1 << MAXABITS));
+		return &t->array[k - 1];
+	}
 	Node *n = node(t, present(t, r));
 	if (ttype(ref(n)) == LUA_T_NIL) {
-		nuse(t)++;
-		if ((float)nuse(t) > (float)nhash(t) * REHASH_LIMIT) {
-			rehash(t);
-			n = node(t, present(t, r));
+		if ((float)(nuse(t) + 1) > (float)nhash(t) * REHASH_LIMIT) {
+			rehash(t, r);
+			return luaH_set(t, r);
 		}
+		nuse(t)++;
 		*ref(n) = *r;
 		ttype(val(n)) = LUA_T_NIL;
 	}
 	return (val(n));
 }
 
-static Node *hashnext(Hash *t, int32 i) {
-	Node *n;
-	int32 tsize = nhash(t);
-	if (i >= tsize)
-		return NULL;
-	n = node(t, i);
-	while (ttype(ref(n)) == LUA_T_NIL || ttype(val(n)) == LUA_T_NIL) {
-		if (++i >= tsize)
-			return NULL;
-		n = node(t, i);
-	}
-	return node(t, i);
+/*
+** The entries are numbered from 0, first the array part, then the hash
+** part. Returns the number of the given key, or -1 for nil, to start the
+** traversal with luaH_next.
+*/
+int32 luaH_pos(Hash *t, TObject *r) {
+	if (ttype(r) == LUA_T_NIL)
+		return -1;
+	int32 k = arrayindex(r);
+	if (k && k <= narray(t))
+		return k - 1;
+	int32 i = present(t, r);
+	Node *n = node(t, i);
+	luaL_arg_check(ttype(ref(n)) != LUA_T_NIL && ttype(val(n)) != LUA_T_NIL, 2, "key not found");
+	return narray(t) + i;
 }
 
-Node *luaH_next(TObject *o, TObject *r) {
-	Hash *t = avalue(o);
-	if (ttype(r) == LUA_T_NIL)
-		return hashnext(t, 0);
-	else {
-		int32 i = present(t, r);
-		Node *n = node(t, i);
-		luaL_arg_check(ttype(ref(n)) != LUA_T_NIL && ttype(val(n)) != LUA_T_NIL, 2, "key not found");
-		return hashnext(t, i + 1);
+/*
+** Find the first entry after the number i, copy its key and its value
+** and return its number, or -1 when there is none.
+*/
+int32 luaH_next(Hash *t, int32 i, TObject *key, TObject *value) {
+	for (i++; i < narray(t); i++) {
+		if (ttype(&t->array[i]) != LUA_T_NIL) {
+			ttype(key) = LUA_T_NUMBER;
+			nvalue(key) = (float)(i + 1);
+			*value = t->array[i];
+			return i;
+		}
+	}
+	for (; i < narray(t) + nhash(t); i++) {
+		Node *n = node(t, i - narray(t));
+		if (ttype(ref(n)) != LUA_T_NIL && ttype(val(n)) != LUA_T_NIL) {
+			*key = *ref(n);
+			*value = *val(n);
+			return i;
+		}
 	}
+	return -1;
 }
 
 } // end of namespace Grim
@@ -1,5 +1,5 @@
 /*
-** Lua tables (hash)
+** Lua tables (array and hash)
 ** See Copyright Notice in lua.h
 */
 
@@ -14,12 +14,15 @@ namespace Grim {
 #define ref(n)		(&(n)->ref)
 #define val(n)		(&(n)->val)
 #define nhash(t)	((t)->nhash)
+#define narray(t)	((t)->narray)
 
 Hash *luaH_new(int32 nhash);
 void luaH_free(Hash *frees);
 TObject *luaH_get(Hash *t, TObject *r);
 TObject *luaH_set(Hash *t, TObject *r);
-Node *luaH_next(TObject *o, TObject *r);
+void luaH_resizearray(Hash *t, int32 size);
+int32 luaH_pos(Hash *t, TObject *r);
+int32 luaH_next(Hash *t, int32 i, TObject *key, TObject *value);
 Node *hashnodecreate(int32 nhash);
 int32 present(Hash *t, TObject *key);
 
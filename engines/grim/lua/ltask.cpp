@@ -10,6 +10,7 @@
 #include "engines/grim/lua/lauxlib.h"
 #include "engines/grim/lua/lmem.h"
 #include "engines/grim/lua/ldo.h"
+#include "engines/grim/lua/lgc.h"
 #include "engines/grim/lua/lvm.h"
 #include "engines/grim/grim.h"
 
@@ -59,6 +60,7 @@ void start_script() {
 	if (state->next)
 		state->next->prev = state;
 	lua_state->next = state;
+	lua_schedinsert(state);
 
 	state->taskFunc.ttype = type;
 	state->taskFunc.value = Address(paramObj)->value;
@@ -276,6 +278,7 @@ void unpause_script() {
 	for (state = lua_rootState->next; state != NULL; state = state->next) {
 		if (state->id == task) {
 			state->paused = false;
+			lua_schedunpause(state);
 			return;
 		}
 	}
@@ -297,6 +300,7 @@ void unpause_scripts() {
 			} else {
 				t->all_paused = 0;
 			}
+			lua_schedunpause(t);
 		}
 	}
 }
@@ -318,79 +322,281 @@ void sleep_for() {
 	}
 }
 
+/*
+** Scheduler. Every state is kept in the list in the order in which the
+** tasks run, and the 'order' rank of a state mirrors its position in
+** it. The queues hold the states which may run at some point: the ready
+** and repass queues are heaps on the rank, so a pass still runs the states
+** in list order, and the sleep queue is a heap on the wake time. A frame
+** only touches the states which actually run or wake up; the sleeping
+** and paused ones are not visited.
+*/
+
+#define ORDER_GAP (1 << 16)
+
+struct TaskQueue {
+	LState **items;
+	int32 size;
+	int32 count;
+};
+
+static TaskQueue taskQueues[TQ_COUNT];
+static uint32 taskClock = 0;  // sum of the frame times, in ms
+static bool taskPass = false;  // true while runtasks is running the states
+static uint32 taskPassOrder = 0;  // rank of the state the pass is at
+
+static bool queueBefore(int32 id, LState *a, LState *b) {
+	if (id == TQ_SLEEP)
+		return (int32)(a->wakeTime - b->wakeTime) < 0;
+	return a->order < b->order;
+}
+
+static void queueSet(TaskQueue *q, int32 i, LState *state) {
+	q->items[i] = state;
+	state->queueIndex = i;
+}
+
+static void queueSiftUp(int32 id, int32 i) {
+	TaskQueue *q = &taskQueues[id];
+	LState *state = q->items[i];
+	while (i > 0) {
+		int32 parent = (i - 1) / 2;
+		if (!queueBefore(id, state, q->items[parent]))
+			break;
+		queueSet(q, i, q->items[parent]);
+		i = parent;
+	}
+	queueSet(q, i, state);
+}
+
+static void queueSiftDown(int32 id, int32 i) {
+	TaskQueue *q = &taskQueues[id];
+	LState *state = q->items[i];
+	for (;;) {
+		int32 child = 2 * i + 1;
+		if (child >= q->count)
+			break;
+		if (child + 1 < q->count && queueBefore(id, q->items[child + 1], q->items[child]))
+			child++;
+		if (!queueBefore(id, q->items[child], state))
+			break;
+		queueSet(q, i, q->items[child]);
+		i = child;
+	}
+	queueSet(q, i, state);
+}
+
+static void queuePush(int32 id, LState *state) {
+	TaskQueue *q = &taskQueues[id];
+	if (q->count >= q->size)
+		q->size = luaM_growvector(&q->items, q->size, LState *, memEM, MAX_INT);
+	state->queue = id;
+	queueSet(q, q->count++, state);
+	queueSiftUp(id, state->queueIndex);
+}
+
+static LState *queuePop(int32 id) {
+	LState *state = taskQueues[id].items[0];
+	lua_schedremove(state);
+	return state;
+}
+
+// Move all the states of a queue to the empty queue 'to', both have the same ordering
+static void queueMoveAll(int32 from, int32 to) {
+	TaskQueue tmp = taskQueues[to];
+	taskQueues[to] = taskQueues[from];
+	taskQueues[from] = tmp;
+	for (int32 i = 0; i < taskQueues[to].count; i++)
+		taskQueues[to].items[i]->queue = to;
+}
+
+static void renumberStates() {
+	int32 count = 0;
+	for (LState *state = lua_rootState; state != NULL; state = state->next)
+		count++;
+	uint32 gap = 0xffffffff / (uint32)(count + 1);
+	if (gap > ORDER_GAP)
+		gap = ORDER_GAP;
+	uint32 order = 0;
+	for (LState *state = lua_rootState; state != NULL; state = state->next) {
+		state->order = order;
+		order += gap;
+	}
+	// The ranks keep their relative order, so the heaps stay valid
+	if (taskPass)
+		taskPassOrder = lua_state->order;
+}
+
+// Queue a runnable state to run in this frame if it can still do so, or else in the next one
+static void scheduleState(LState *state) {
+	if (!taskPass || state->updated)
+		queuePush(TQ_FRAME, state);
+	else if (state->order > taskPassOrder)
+		queuePush(TQ_READY, state);
+	else
+		queuePush(TQ_REPASS, state);
+}
+
+static void sleepState(LState *state) {
+	state->wakeTime = taskClock + state->sleepFor;
+	state->sleepFor = 0;
+	queuePush(TQ_SLEEP, state);
+}
+
+void lua_schedreset() {
+	for (int32 i = 0; i < TQ_COUNT; i++) {
+		luaM_free(taskQueues[i].items);
+		taskQueues[i].items = NULL;
+		taskQueues[i].size = 0;
+		taskQueues[i].count = 0;
+	}
+	taskClock = 0;
+	taskPass = false;
+	taskPassOrder = 0;
+}
+
+// Rank a state just linked in the list and schedule it
+void lua_schedinsert(LState *state) {
+	uint32 prevOrder = state->prev->order;
+	if (state->next) {
+		if (state->next->order - prevOrder < 2)
+			renumberStates();
+		else
+			state->order = prevOrder + (state->next->order - prevOrder) / 2;
+	} else {
+		if (prevOrder > 0xffffffff - ORDER_GAP)
+			renumberStates();
+		else
+			state->order = prevOrder + ORDER_GAP;
+	}
+	scheduleState(state);
+}
+
+void lua_schedremove(LState *state) {
+	if (state->queue == TQ_NONE)
+		return;
+
+	TaskQueue *q = &taskQueues[state->queue];
+	int32 id = state->queue;
+	int32 i = state->queueIndex;
+	state->queue = TQ_NONE;
+	LState *last = q->items[--q->count];
+	if (last != state) {
+		queueSet(q, i, last);
+		queueSiftDown(id, i);
+		queueSiftUp(id, last->queueIndex);
+	}
+}
+
+// Schedule again a parked state whose pause has been lifted
+void lua_schedunpause(LState *state) {
+	if (state->queue == TQ_NONE && state != lua_state && !state->paused && !state->all_paused)
+		scheduleState(state);
+}
+
+// Rank and schedule the states read from a savegame
+void lua_schedrebuild() {
+	renumberStates();
+	for (LState *state = lua_rootState->next; state != NULL; state = state->next) {
+		if (state->sleepFor > 0)
+			sleepState(state);
+		else
+			queuePush(TQ_FRAME, state);
+	}
+}
+
+// Time a state still has to sleep, as stored in the savegames
+int32 lua_schedsleepleft(LState *state) {
+	if (state->queue == TQ_SLEEP)
+		return (int32)(state->wakeTime - taskClock);
+	return state->sleepFor;
+}
+
 void lua_runtasks() {
-	if (!lua_state || !lua_state->next) {
+	if (!lua_state) {
 		return;
 	}
 
-	// Mark all the states to be updated
-	LState *state = lua_state->next;
-	do {
-		if (state->sleepFor > 0) {
-			state->sleepFor -= g_grim->getFrameTime();
-		} else {
-			state->updated = false;
-		}
-		state = state->next;
-	} while	(state);
+	// Advance the collection started by luaC_checkGC, if any
+	if (GCphase != GCSpause) {
+		luaC_step(GCFRAMESTEP);
+	}
+
+	// A sleeping state runs in the first frame which begins after its wake time
+	uint32 now = taskClock;
+	taskClock += g_grim->getFrameTime();
+
+	if (!lua_state->next) {
+		return;
+	}
+
+	// The states which ran in the last frame run again, along with the ones waking up
+	queueMoveAll(TQ_FRAME, TQ_READY);
+	TaskQueue *sleeping = &taskQueues[TQ_SLEEP];
+	while (sleeping->count > 0 && (int32)(sleeping->items[0]->wakeTime - now) <= 0)
+		queuePush(TQ_READY, queuePop(TQ_SLEEP));
 
 	// And run them
 	runtasks(lua_state);
 }
 
 void runtasks(LState *const rootState) {
-	lua_state = lua_state->next;
-	while (lua_state) {
-		LState *nextState = NULL;
+	taskPass = true;
+	taskPassOrder = 0;
+	for (;;) {
+		if (taskQueues[TQ_READY].count == 0) {
+			// States made runnable behind the current position: run a new pass.
+			if (taskQueues[TQ_REPASS].count == 0)
+				break;
+			queueMoveAll(TQ_REPASS, TQ_READY);
+			taskPassOrder = 0;
+		}
+
+		lua_state = queuePop(TQ_READY);
+		taskPassOrder = lua_state->order;
+		lua_state->updated = false;
+		// A paused state is parked, lua_schedunpause will queue it again
+		if (lua_state->all_paused || lua_state->paused)
+			continue;
+
 		bool stillRunning;
-		if (!lua_state->all_paused && !lua_state->updated && !lua_state->paused) {
-			jmp_buf	errorJmp;
-			lua_state->errorJmp = &errorJmp;
-			if (setjmp(errorJmp)) {
-				lua_Task *t, *m;
-				for (t = lua_state->task; t != NULL;) {
-					m = t->next;
-					luaM_free(t);
-					t = m;
-				}
-				stillRunning = false;
-				lua_state->task = NULL;
-			} else {
-				if (lua_state->task) {
-					stillRunning = luaD_call(lua_state->task->some_base, lua_state->task->some_results);
-				} else {
-					StkId base = lua_state->Cstack.base;
-					luaD_openstack((lua_state->stack.top - lua_state->stack.stack) - base);
-					set_normalized(lua_state->stack.stack + lua_state->Cstack.base, &lua_state->taskFunc);
-					stillRunning = luaD_call(base + 1, 255);
-				}
+		jmp_buf	errorJmp;
+		lua_state->errorJmp = &errorJmp;
+		if (setjmp(errorJmp)) {
+			lua_Task *t, *m;
+			for (t = lua_state->task; t != NULL;) {
+				m = t->next;
+				luaM_free(t);
+				t = m;
 			}
-			nextState = lua_state->next;
-			// The state returned. Delete it
-			if (!stillRunning) {
-				lua_statedeinit(lua_state);
-				luaM_free(lua_state);
+			stillRunning = false;
+			lua_state->task = NULL;
+		} else {
+			if (lua_state->task) {
+				stillRunning = luaD_call(lua_state->task->some_base, lua_state->task->some_results);
 			} else {
-				lua_state->updated = true;
+				StkId base = lua_state->Cstack.base;
+				luaD_openstack((lua_state->stack.top - lua_state->stack.stack) - base);
+				set_normalized(lua_state->stack.stack + lua_state->Cstack.base, &lua_state->taskFunc);
+				stillRunning = luaD_call(base + 1, 255);
 			}
+		}
+		// The state returned. Delete it
+		if (!stillRunning) {
+			lua_statedeinit(lua_state);
+			luaM_free(lua_state);
 		} else {
-			nextState = lua_state->next;
+			lua_state->updated = true;
+			if (lua_state->sleepFor > 0)
+				sleepState(lua_state);
+			else
+				queuePush(TQ_FRAME, lua_state);
 		}
-		lua_state = nextState;
 	}
 
 	// Restore the value of lua_state to the main script
 	lua_state = rootState;
-	// Check for states that may have been created in this run.
-	LState *state = lua_state->next;
-	while (state) {
-		if (!state->all_paused && !state->paused && !state->updated) {
-			// New state! Run a new pass.
-			runtasks(rootState);
-			return;
-		}
-		state = state->next;
-	}
+	taskPass = false;
 }
 
 } // end of namespace Grim
@@ -36,6 +36,27 @@ void find_script();
 void break_here();
 void sleep_for();
 
+/* Scheduler queues. A state is in at most one of them: sleeping states wait
+ * for their wake time, ready states run in the current pass, repass states
+ * were made runnable behind the current position and run in the next pass,
+ * and the states which already ran wait in the frame queue. Paused states
+ * are in no queue until they get unpaused. */
+enum {
+	TQ_NONE,
+	TQ_SLEEP,
+	TQ_READY,
+	TQ_REPASS,
+	TQ_FRAME,
+	TQ_COUNT
+};
+
+void lua_schedreset();
+void lua_schedinsert(LState *state);
+void lua_schedremove(LState *state);
+void lua_schedunpause(LState *state);
+void lua_schedrebuild();
+int32 lua_schedsleepleft(LState *state);
+
 void runtasks(LState *const rootState);
 
 } // end of namespace Grim
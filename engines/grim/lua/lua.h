@@ -80,6 +80,10 @@ void lua_settag(int32 tag); // In: object
 void lua_error(const char *s);
 int32 lua_dostring(const char *string); // Out: returns
 int32 lua_dobuffer(const char *buff, int32 size, const char *name);
+// Also save a source chunk to 'dump' with luaU_dump. Out: 'dumped'
+int32 lua_dobufferdump(const char *buff, int32 size, const char *name, Common::WriteStream *dump, bool *dumped);
+// Save a source chunk to 'dump' without running it
+bool lua_dumpbuffer(const char *buff, int32 size, const char *name, Common::WriteStream *dump);
 int32 lua_callfunction(lua_Object f);
 // In: parameters; Out: returns */
 
@@ -134,6 +138,15 @@ int32 lua_collectgarbage(int32 limit);
 void lua_runtasks();
 void current_script();
 
+// Count the opcodes run by the interpreter, and the pairs of consecutive ones
+void lua_setopstats(bool enable);
+bool lua_getopstats();
+void lua_resetopstats();
+int32 lua_numopcodes();
+const char *lua_opname(int32 op);
+uint32 lua_opcount(int32 op);
+uint32 lua_oppaircount(int32 op, int32 next);
+
 /* some useful macros/derived functions */
 
 #define lua_call(name)		lua_callfunction(lua_getglobal(name))
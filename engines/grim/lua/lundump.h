@@ -9,6 +9,10 @@
 #include "engines/grim/lua/lobject.h"
 #include "engines/grim/lua/lzio.h"
 
+namespace Common {
+class WriteStream;
+}
+
 namespace Grim {
 
 #define ID_CHUNK		27              // ESC
@@ -24,6 +28,7 @@ namespace Grim {
 #define IsMain(f)			(f->lineDefined == 0)
 
 TProtoFunc* luaU_undump1(ZIO* Z);      // load one chunk
+bool luaU_dump(TProtoFunc *Main, Common::WriteStream *S);  // save one chunk
 
 } // end of namespace Grim
 
@@ -210,19 +210,20 @@ static void comparison(lua_Type ttype_less, lua_Type ttype_equal, lua_Type ttype
 	ttype(S->top - 1) = (result < 0) ? ttype_less : (result == 0) ? ttype_equal : ttype_great;
 }
 
+static int32 numcompare(TObject *l, TObject *r) {
+	return (nvalue(l) < nvalue(r)) ? -1 : (nvalue(l) == nvalue(r)) ? 0 : 1;
+}
+
 void luaV_pack(StkId firstel, int32 nvararg, TObject *tab) {
 	TObject *firstelem = lua_state->stack.stack + firstel;
 	int32 i;
 	if (nvararg < 0)
 		nvararg = 0;
-	avalue(tab) = luaH_new(nvararg + 1);  // +1 for field 'n'
+	avalue(tab) = luaH_new(1);  // for field 'n'
 	ttype(tab) = LUA_T_ARRAY;
-	for (i = 0; i < nvararg; i++) {
-		TObject index;
-		ttype(&index) = LUA_T_NUMBER;
-		nvalue(&index) = (float)i + 1;
-		*(luaH_set(avalue(tab), &index)) = *(firstelem + i);
-	}
+	luaH_resizearray(avalue(tab), nvararg);
+	for (i = 0; i < nvararg; i++)
+		avalue(tab)->array[i] = *(firstelem + i);
 	// store counter in field "n" */
 	{
 		TObject index, extra;
@@ -241,6 +242,136 @@ static void adjust_varargs(StkId first_extra_arg) {
 	*lua_state->stack.top++ = arg;
 }
 
+/*
+** Opcode statistics, to find out what the scripts spend their time on.
+** luaV_execute only counts when they are turned on as it is entered.
+*/
+static bool opStatsEnabled = false;
+static uint32 opCount[NUMOPCODES];
+static uint32 opPairCount[NUMOPCODES][NUMOPCODES];
+static int32 lastOp = ENDCODE;
+
+static const char *const opNames[NUMOPCODES] = {
+	"ENDCODE", "PUSHNIL", "PUSHNIL0", "PUSHNUMBER", "PUSHNUMBER0", "PUSHNUMBER1",
+	"PUSHNUMBER2", "PUSHNUMBERW", "PUSHCONSTANT", "PUSHCONSTANT0", "PUSHCONSTANT1", "PUSHCONSTANT2",
+	"PUSHCONSTANT3", "PUSHCONSTANT4", "PUSHCONSTANT5", "PUSHCONSTANT6", "PUSHCONSTANT7", "PUSHCONSTANTW",
+	"PUSHUPVALUE", "PUSHUPVALUE0", "PUSHUPVALUE1", "PUSHLOCAL", "PUSHLOCAL0", "PUSHLOCAL1",
+	"PUSHLOCAL2", "PUSHLOCAL3", "PUSHLOCAL4", "PUSHLOCAL5", "PUSHLOCAL6", "PUSHLOCAL7",
+	"GETGLOBAL", "GETGLOBAL0", "GETGLOBAL1", "GETGLOBAL2", "GETGLOBAL3", "GETGLOBAL4",
+	"GETGLOBAL5", "GETGLOBAL6", "GETGLOBAL7", "GETGLOBALW", "GETTABLE", "GETDOTTED",
+	"GETDOTTED0", "GETDOTTED1", "GETDOTTED2", "GETDOTTED3", "GETDOTTED4", "GETDOTTED5",
+	"GETDOTTED6", "GETDOTTED7", "GETDOTTEDW", "PUSHSELF", "PUSHSELF0", "PUSHSELF1",
+	"PUSHSELF2", "PUSHSELF3", "PUSHSELF4", "PUSHSELF5", "PUSHSELF6", "PUSHSELF7",
+	"PUSHSELFW", "CREATEARRAY", "CREATEARRAY0", "CREATEARRAY1", "CREATEARRAYW", "SETLOCAL",
+	"SETLOCAL0", "SETLOCAL1", "SETLOCAL2", "SETLOCAL3", "SETLOCAL4", "SETLOCAL5",
+	"SETLOCAL6", "SETLOCAL7", "SETGLOBAL", "SETGLOBAL0", "SETGLOBAL1", "SETGLOBAL2",
+	"SETGLOBAL3", "SETGLOBAL4", "SETGLOBAL5", "SETGLOBAL6", "SETGLOBAL7", "SETGLOBALW",
+	"SETTABLE0", "SETTABLE", "SETLIST", "SETLIST0", "SETLISTW", "SETMAP",
+	"SETMAP0", "EQOP", "NEQOP", "LTOP", "LEOP", "GTOP",
+	"GEOP", "ADDOP", "SUBOP", "MULTOP", "DIVOP", "POWOP",
+	"CONCOP", "MINUSOP", "NOTOP", "ONTJMP", "ONTJMPW", "ONFJMP",
+	"ONFJMPW", "JMP", "JMPW", "IFFJMP", "IFFJMPW", "IFTUPJMP",
+	"IFTUPJMPW", "IFFUPJMP", "IFFUPJMPW", "CLOSURE", "CLOSURE0", "CLOSURE1",
+	"CALLFUNC", "CALLFUNC0", "CALLFUNC1", "RETCODE", "SETLINE", "SETLINEW",
+	"POP", "POP0", "POP1"
+};
+
+static void countop(int32 op) {
+	opCount[op]++;
+	opPairCount[lastOp][op]++;
+	lastOp = op;
+}
+
+void lua_setopstats(bool enable) {
+	opStatsEnabled = enable;
+}
+
+bool lua_getopstats() {
+	return opStatsEnabled;
+}
+
+void lua_resetopstats() {
+	memset(opCount, 0, sizeof(opCount));
+	memset(opPairCount, 0, sizeof(opPairCount));
+	lastOp = ENDCODE;
+}
+
+int32 lua_numopcodes() {
+	return NUMOPCODES;
+}
+
+const char *lua_opname(int32 op) {
+	return opNames[op];
+}
+
+uint32 lua_opcount(int32 op) {
+	return opCount[op];
+}
+
+uint32 lua_oppaircount(int32 op, int32 next) {
+	return opPairCount[op][next];
+}
+
+/*
+** Fast paths for the table accesses without tag methods. They still raise
+** an error for a bad key, so the caller saves the top of the stack first.
+*/
+static int32 fastgettable(TObject *t) {
+	if (ttype(t) != LUA_T_ARRAY || ttype(luaT_getim(avalue(t)->htag, IM_GETTABLE)) != LUA_T_NIL)
+		return 0;
+	TObject *h = luaH_get(avalue(t), t + 1);
+	if (!h || ttype(h) == LUA_T_NIL)
+		return 0;
+	*t = *h;
+	return 1;
+}
+
+static int32 fastsettable(TObject *t, TObject *value) {
+	if (ttype(t) != LUA_T_ARRAY || ttype(luaT_getim(avalue(t)->htag, IM_SETTABLE)) != LUA_T_NIL)
+		return 0;
+	*luaH_set(avalue(t), t + 1) = *value;
+	return 1;
+}
+
+/*
+** The program counter and the top and base of the stack of the running
+** function live in locals. They are written back before anything that
+** uses lua_state->stack, or that may run the collector, which scans the
+** stacks: 'protect' stores the top, and reloads the top and the base,
+** since the stack may have been reallocated. The program counter only
+** goes back to the task when returning to luaD_call, for a call, a yield
+** or a return.
+*/
+#define savetop()	(S->top = top)
+#define loadstack()	(top = S->top, base = S->stack + task->base)
+#define protect(x)	do { savetop(); x; loadstack(); } while (0)
+
+/*
+** With GCC, every handler jumps straight to the next one through a table
+** of label addresses, instead of going back to a switch. Labels as values
+** are a GNU extension, so it needs a compiler that can silence -Wpedantic
+** around luaV_execute; the others use the switch.
+*/
+#if !defined(LUA_NO_THREADED_DISPATCH) && \
+	(defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8))))
+#define LUA_THREADED_DISPATCH
+#endif
+
+#ifdef LUA_THREADED_DISPATCH
+#define vmdispatch(o)	goto *dispatch[o];
+#define vmcase(op)		L_##op:
+#define vmbreak			{ aux = *pc++; goto *dispatch[aux]; }
+#else
+#define vmdispatch(o)	switch ((OpCode)(o))
+#define vmcase(op)		case op:
+#define vmbreak			break
+#endif
+
+#ifdef LUA_THREADED_DISPATCH
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
 StkId luaV_execute(lua_Task *task) {
 	if (!task->some_flag) {
 		luaD_checkstack((*task->pc++) + EXTRA_STACK);
@@ -254,431 +385,577 @@ StkId luaV_execute(lua_Task *task) {
 	}
 	lua_state->state_counter2++;
 
+#ifdef LUA_THREADED_DISPATCH
+	static const void *const opTable[NUMOPCODES] = {
+		&&L_ENDCODE, &&L_PUSHNIL, &&L_PUSHNIL0, &&L_PUSHNUMBER,
+		&&L_PUSHNUMBER0, &&L_PUSHNUMBER1, &&L_PUSHNUMBER2, &&L_PUSHNUMBERW,
+		&&L_PUSHCONSTANT, &&L_PUSHCONSTANT0, &&L_PUSHCONSTANT1, &&L_PUSHCONSTANT2,
+		&&L_PUSHCONSTANT3, &&L_PUSHCONSTANT4, &&L_PUSHCONSTANT5, &&L_PUSHCONSTANT6,
+		&&L_PUSHCONSTANT7, &&L_PUSHCONSTANTW, &&L_PUSHUPVALUE, &&L_PUSHUPVALUE0,
+		&&L_PUSHUPVALUE1, &&L_PUSHLOCAL, &&L_PUSHLOCAL0, &&L_PUSHLOCAL1,
+		&&L_PUSHLOCAL2, &&L_PUSHLOCAL3, &&L_PUSHLOCAL4, &&L_PUSHLOCAL5,
+		&&L_PUSHLOCAL6, &&L_PUSHLOCAL7, &&L_GETGLOBAL, &&L_GETGLOBAL0,
+		&&L_GETGLOBAL1, &&L_GETGLOBAL2, &&L_GETGLOBAL3, &&L_GETGLOBAL4,
+		&&L_GETGLOBAL5, &&L_GETGLOBAL6, &&L_GETGLOBAL7, &&L_GETGLOBALW,
+		&&L_GETTABLE, &&L_GETDOTTED, &&L_GETDOTTED0, &&L_GETDOTTED1,
+		&&L_GETDOTTED2, &&L_GETDOTTED3, &&L_GETDOTTED4, &&L_GETDOTTED5,
+		&&L_GETDOTTED6, &&L_GETDOTTED7, &&L_GETDOTTEDW, &&L_PUSHSELF,
+		&&L_PUSHSELF0, &&L_PUSHSELF1, &&L_PUSHSELF2, &&L_PUSHSELF3,
+		&&L_PUSHSELF4, &&L_PUSHSELF5, &&L_PUSHSELF6, &&L_PUSHSELF7,
+		&&L_PUSHSELFW, &&L_CREATEARRAY, &&L_CREATEARRAY0, &&L_CREATEARRAY1,
+		&&L_CREATEARRAYW, &&L_SETLOCAL, &&L_SETLOCAL0, &&L_SETLOCAL1,
+		&&L_SETLOCAL2, &&L_SETLOCAL3, &&L_SETLOCAL4, &&L_SETLOCAL5,
+		&&L_SETLOCAL6, &&L_SETLOCAL7, &&L_SETGLOBAL, &&L_SETGLOBAL0,
+		&&L_SETGLOBAL1, &&L_SETGLOBAL2, &&L_SETGLOBAL3, &&L_SETGLOBAL4,
+		&&L_SETGLOBAL5, &&L_SETGLOBAL6, &&L_SETGLOBAL7, &&L_SETGLOBALW,
+		&&L_SETTABLE0, &&L_SETTABLE, &&L_SETLIST, &&L_SETLIST0,
+		&&L_SETLISTW, &&L_SETMAP, &&L_SETMAP0, &&L_EQOP,
+		&&L_NEQOP, &&L_LTOP, &&L_LEOP, &&L_GTOP,
+		&&L_GEOP, &&L_ADDOP, &&L_SUBOP, &&L_MULTOP,
+		&&L_DIVOP, &&L_POWOP, &&L_CONCOP, &&L_MINUSOP,
+		&&L_NOTOP, &&L_ONTJMP, &&L_ONTJMPW, &&L_ONFJMP,
+		&&L_ONFJMPW, &&L_JMP, &&L_JMPW, &&L_IFFJMP,
+		&&L_IFFJMPW, &&L_IFTUPJMP, &&L_IFTUPJMPW, &&L_IFFUPJMP,
+		&&L_IFFUPJMPW, &&L_CLOSURE, &&L_CLOSURE0, &&L_CLOSURE1,
+		&&L_CALLFUNC, &&L_CALLFUNC0, &&L_CALLFUNC1, &&L_RETCODE,
+		&&L_SETLINE, &&L_SETLINEW, &&L_POP, &&L_POP0,
+		&&L_POP1
+	};
+#define STATS4	&&L_stats, &&L_stats, &&L_stats, &&L_stats
+#define STATS16	STATS4, STATS4, STATS4, STATS4
+	static const void *const statsTable[256] = {
+		STATS16, STATS16, STATS16, STATS16, STATS16, STATS16, STATS16, STATS16,
+		STATS16, STATS16, STATS16, STATS16, STATS16, STATS16, STATS16, STATS16
+	};
+#undef STATS16
+#undef STATS4
+	const void *const *dispatch = opStatsEnabled ? statsTable : opTable;
+#else
+	const bool stats = opStatsEnabled;
+#endif
+
+	Stack *S = task->S;
+	byte *pc = task->pc;
+	TObject *consts = task->consts;
+	TObject *top, *base;
+	int32 aux, cond;
+	loadstack();
+
 	while (1) {
-		switch ((OpCode)(task->aux = *task->pc++)) {
-		case PUSHNIL0:
-			ttype(task->S->top++) = LUA_T_NIL;
-			break;
-		case PUSHNIL:
-			task->aux = *task->pc++;
+		aux = *pc++;
+#ifndef LUA_THREADED_DISPATCH
+		if (stats)
+			countop(aux);
+#endif
+		vmdispatch(aux) {
+#ifdef LUA_THREADED_DISPATCH
+L_stats:
+		countop(aux);
+		goto *opTable[aux];
+#endif
+		vmcase(PUSHNIL0)
+			ttype(top++) = LUA_T_NIL;
+			vmbreak;
+		vmcase(PUSHNIL)
+			aux = *pc++;
 			do {
-				ttype(task->S->top++) = LUA_T_NIL;
-			} while (task->aux--);
-			break;
-		case PUSHNUMBER:
-			task->aux = *task->pc++;
+				ttype(top++) = LUA_T_NIL;
+			} while (aux--);
+			vmbreak;
+		vmcase(PUSHNUMBER)
+			aux = *pc++;
 			goto pushnumber;
-		case PUSHNUMBERW:
-			task->aux = next_word(task->pc);
+		vmcase(PUSHNUMBERW)
+			aux = next_word(pc);
 			goto pushnumber;
-		case PUSHNUMBER0:
-		case PUSHNUMBER1:
-		case PUSHNUMBER2:
-			task->aux -= PUSHNUMBER0;
+		vmcase(PUSHNUMBER0)
+		vmcase(PUSHNUMBER1)
+		vmcase(PUSHNUMBER2)
+			aux -= PUSHNUMBER0;
 pushnumber:
-			ttype(task->S->top) = LUA_T_NUMBER;
-			nvalue(task->S->top) = (float)task->aux;
-			task->S->top++;
-			break;
-		case PUSHLOCAL:
-			task->aux = *task->pc++;
+			ttype(top) = LUA_T_NUMBER;
+			nvalue(top) = (float)aux;
+			top++;
+			vmbreak;
+		vmcase(PUSHLOCAL)
+			aux = *pc++;
 			goto pushlocal;
-		case PUSHLOCAL0:
-		case PUSHLOCAL1:
-		case PUSHLOCAL2:
-		case PUSHLOCAL3:
-		case PUSHLOCAL4:
-		case PUSHLOCAL5:
-		case PUSHLOCAL6:
-		case PUSHLOCAL7:
-			task->aux -= PUSHLOCAL0;
+		vmcase(PUSHLOCAL0)
+		vmcase(PUSHLOCAL1)
+		vmcase(PUSHLOCAL2)
+		vmcase(PUSHLOCAL3)
+		vmcase(PUSHLOCAL4)
+		vmcase(PUSHLOCAL5)
+		vmcase(PUSHLOCAL6)
+		vmcase(PUSHLOCAL7)
+			aux -= PUSHLOCAL0;
 pushlocal:
-			*task->S->top++ = *((task->S->stack + task->base) + task->aux);
-			break;
-		case GETGLOBALW:
-			task->aux = next_word(task->pc);
+			*top++ = *(base + aux);
+			vmbreak;
+		vmcase(GETGLOBALW)
+			aux = next_word(pc);
 			goto getglobal;
-		case GETGLOBAL:
-			task->aux = *task->pc++;
+		vmcase(GETGLOBAL)
+			aux = *pc++;
 			goto getglobal;
-		case GETGLOBAL0:
-		case GETGLOBAL1:
-		case GETGLOBAL2:
-		case GETGLOBAL3:
-		case GETGLOBAL4:
-		case GETGLOBAL5:
-		case GETGLOBAL6:
-		case GETGLOBAL7:
-			task->aux -= GETGLOBAL0;
+		vmcase(GETGLOBAL0)
+		vmcase(GETGLOBAL1)
+		vmcase(GETGLOBAL2)
+		vmcase(GETGLOBAL3)
+		vmcase(GETGLOBAL4)
+		vmcase(GETGLOBAL5)
+		vmcase(GETGLOBAL6)
+		vmcase(GETGLOBAL7)
+			aux -= GETGLOBAL0;
 getglobal:
-			luaV_getglobal(tsvalue(&task->consts[task->aux]));
-			break;
-		case GETTABLE:
-			luaV_gettable();
-			break;
-		case GETDOTTEDW:
-			task->aux = next_word(task->pc); goto getdotted;
-		case GETDOTTED:
-			task->aux = *task->pc++;
+			{
+				TObject *value = &tsvalue(&consts[aux])->globalval;
+				if (ttype(luaT_getimbyObj(value, IM_GETGLOBAL)) == LUA_T_NIL)
+					*top++ = *value;
+				else
+					protect(luaV_getglobal(tsvalue(&consts[aux])));
+				vmbreak;
+			}
+		vmcase(GETTABLE)
+			savetop();
+			if (fastgettable(top - 2))
+				top--;
+			else
+				protect(luaV_gettable());
+			vmbreak;
+		vmcase(GETDOTTEDW)
+			aux = next_word(pc);
 			goto getdotted;
-		case GETDOTTED0:
-		case GETDOTTED1:
-		case GETDOTTED2:
-		case GETDOTTED3:
-		case GETDOTTED4:
-		case GETDOTTED5:
-		case GETDOTTED6:
-		case GETDOTTED7:
-			task->aux -= GETDOTTED0;
+		vmcase(GETDOTTED)
+			aux = *pc++;
+			goto getdotted;
+		vmcase(GETDOTTED0)
+		vmcase(GETDOTTED1)
+		vmcase(GETDOTTED2)
+		vmcase(GETDOTTED3)
+		vmcase(GETDOTTED4)
+		vmcase(GETDOTTED5)
+		vmcase(GETDOTTED6)
+		vmcase(GETDOTTED7)
+			aux -= GETDOTTED0;
 getdotted:
-			*task->S->top++ = task->consts[task->aux];
-			luaV_gettable();
-			break;
-		case PUSHSELFW:
-			task->aux = next_word(task->pc);
+			*top++ = consts[aux];
+			savetop();
+			if (fastgettable(top - 2))
+				top--;
+			else
+				protect(luaV_gettable());
+			vmbreak;
+		vmcase(PUSHSELFW)
+			aux = next_word(pc);
 			goto pushself;
-		case PUSHSELF:
-			task->aux = *task->pc++;
+		vmcase(PUSHSELF)
+			aux = *pc++;
 			goto pushself;
-		case PUSHSELF0:
-		case PUSHSELF1:
-		case PUSHSELF2:
-		case PUSHSELF3:
-		case PUSHSELF4:
-		case PUSHSELF5:
-		case PUSHSELF6:
-		case PUSHSELF7:
-			task->aux -= PUSHSELF0;
+		vmcase(PUSHSELF0)
+		vmcase(PUSHSELF1)
+		vmcase(PUSHSELF2)
+		vmcase(PUSHSELF3)
+		vmcase(PUSHSELF4)
+		vmcase(PUSHSELF5)
+		vmcase(PUSHSELF6)
+		vmcase(PUSHSELF7)
+			aux -= PUSHSELF0;
 pushself:
 			{
-				TObject receiver = *(task->S->top - 1);
-				*task->S->top++ = task->consts[task->aux];
-				luaV_gettable();
-				*task->S->top++ = receiver;
-				break;
+				TObject receiver = *(top - 1);
+				*top++ = consts[aux];
+				savetop();
+				if (fastgettable(top - 2))
+					top--;
+				else
+					protect(luaV_gettable());
+				*top++ = receiver;
+				vmbreak;
 			}
-		case PUSHCONSTANTW:
-			task->aux = next_word(task->pc);
+		vmcase(PUSHCONSTANTW)
+			aux = next_word(pc);
 			goto pushconstant;
-		case PUSHCONSTANT:
-			task->aux = *task->pc++; goto pushconstant;
-		case PUSHCONSTANT0:
-		case PUSHCONSTANT1:
-		case PUSHCONSTANT2:
-		case PUSHCONSTANT3:
-		case PUSHCONSTANT4:
-		case PUSHCONSTANT5:
-		case PUSHCONSTANT6:
-		case PUSHCONSTANT7:
-			task->aux -= PUSHCONSTANT0;
+		vmcase(PUSHCONSTANT)
+			aux = *pc++;
+			goto pushconstant;
+		vmcase(PUSHCONSTANT0)
+		vmcase(PUSHCONSTANT1)
+		vmcase(PUSHCONSTANT2)
+		vmcase(PUSHCONSTANT3)
+		vmcase(PUSHCONSTANT4)
+		vmcase(PUSHCONSTANT5)
+		vmcase(PUSHCONSTANT6)
+		vmcase(PUSHCONSTANT7)
+			aux -= PUSHCONSTANT0;
 pushconstant:
-			*task->S->top++ = task->consts[task->aux];
-			break;
-		case PUSHUPVALUE:
-			task->aux = *task->pc++;
+			*top++ = consts[aux];
+			vmbreak;
+		vmcase(PUSHUPVALUE)
+			aux = *pc++;
 			goto pushupvalue;
-		case PUSHUPVALUE0:
-		case PUSHUPVALUE1:
-			task->aux -= PUSHUPVALUE0;
+		vmcase(PUSHUPVALUE0)
+		vmcase(PUSHUPVALUE1)
+			aux -= PUSHUPVALUE0;
 pushupvalue:
-			*task->S->top++ = task->cl->consts[task->aux + 1];
-			break;
-		case SETLOCAL:
-			task->aux = *task->pc++;
+			*top++ = task->cl->consts[aux + 1];
+			vmbreak;
+		vmcase(SETLOCAL)
+			aux = *pc++;
 			goto setlocal;
-		case SETLOCAL0:
-		case SETLOCAL1:
-		case SETLOCAL2:
-		case SETLOCAL3:
-		case SETLOCAL4:
-		case SETLOCAL5:
-		case SETLOCAL6:
-		case SETLOCAL7:
-			task->aux -= SETLOCAL0;
+		vmcase(SETLOCAL0)
+		vmcase(SETLOCAL1)
+		vmcase(SETLOCAL2)
+		vmcase(SETLOCAL3)
+		vmcase(SETLOCAL4)
+		vmcase(SETLOCAL5)
+		vmcase(SETLOCAL6)
+		vmcase(SETLOCAL7)
+			aux -= SETLOCAL0;
 setlocal:
-			*((task->S->stack + task->base) + task->aux) = *(--task->S->top);
-			break;
-		case SETGLOBALW:
-			task->aux = next_word(task->pc);
+			*(base + aux) = *(--top);
+			vmbreak;
+		vmcase(SETGLOBALW)
+			aux = next_word(pc);
 			goto setglobal;
-		case SETGLOBAL:
-			task->aux = *task->pc++;
+		vmcase(SETGLOBAL)
+			aux = *pc++;
 			goto setglobal;
-		case SETGLOBAL0:
-		case SETGLOBAL1:
-		case SETGLOBAL2:
-		case SETGLOBAL3:
-		case SETGLOBAL4:
-		case SETGLOBAL5:
-		case SETGLOBAL6:
-		case SETGLOBAL7:
-			task->aux -= SETGLOBAL0;
+		vmcase(SETGLOBAL0)
+		vmcase(SETGLOBAL1)
+		vmcase(SETGLOBAL2)
+		vmcase(SETGLOBAL3)
+		vmcase(SETGLOBAL4)
+		vmcase(SETGLOBAL5)
+		vmcase(SETGLOBAL6)
+		vmcase(SETGLOBAL7)
+			aux -= SETGLOBAL0;
 setglobal:
-			luaV_setglobal(tsvalue(&task->consts[task->aux]));
-			break;
-		case SETTABLE0:
-			luaV_settable(task->S->top - 3, 1);
-			break;
-		case SETTABLE:
-			luaV_settable(task->S->top - 3 - (*task->pc++), 2);
-			break;
-		case SETLISTW:
-			task->aux = next_word(task->pc);
-			task->aux *= LFIELDS_PER_FLUSH;
+			{
+				TaggedString *ts = tsvalue(&consts[aux]);
+				if (ttype(luaT_getimbyObj(&ts->globalval, IM_SETGLOBAL)) == LUA_T_NIL)
+					luaS_rawsetglobal(ts, --top);
+				else
+					protect(luaV_setglobal(ts));
+				vmbreak;
+			}
+		vmcase(SETTABLE0)
+			savetop();
+			if (fastsettable(top - 3, top - 1))
+				top -= 3;
+			else
+				protect(luaV_settable(top - 3, 1));
+			vmbreak;
+		vmcase(SETTABLE)
+			{
+				TObject *t = top - 3 - (*pc++);
+				savetop();
+				if (fastsettable(t, top - 1))
+					top--;
+				else
+					protect(luaV_settable(t, 2));
+				vmbreak;
+			}
+		vmcase(SETLISTW)
+			aux = next_word(pc);
+			aux *= LFIELDS_PER_FLUSH;
 			goto setlist;
-		case SETLIST:
-			task->aux = *(task->pc++) * LFIELDS_PER_FLUSH;
+		vmcase(SETLIST)
+			aux = *(pc++) * LFIELDS_PER_FLUSH;
 			goto setlist;
-		case SETLIST0:
-			task->aux = 0;
+		vmcase(SETLIST0)
+			aux = 0;
 setlist:
 			{
-				int32 n = *(task->pc++);
-				TObject *arr = task->S->top - n - 1;
+				int32 n = *(pc++);
+				TObject *arr = top - n - 1;
+				TObject key;
+				ttype(&key) = LUA_T_NUMBER;
+				// Growing the table may raise an error.
+				savetop();
+				luaH_resizearray(avalue(arr), n + aux);
 				for (; n; n--) {
-					ttype(task->S->top) = LUA_T_NUMBER;
-					nvalue(task->S->top) = (float)(n + task->aux);
-					*(luaH_set(avalue(arr), task->S->top)) = *(task->S->top - 1);
-					task->S->top--;
+					nvalue(&key) = (float)(n + aux);
+					*(luaH_set(avalue(arr), &key)) = *(top - 1);
+					top--;
+				}
+				vmbreak;
 			}
-			break;
-		}
-		case SETMAP0:
-			task->aux = 0;
+		vmcase(SETMAP0)
+			aux = 0;
 			goto setmap;
-		case SETMAP:
-			task->aux = *task->pc++;
+		vmcase(SETMAP)
+			aux = *pc++;
 setmap:
 			{
-				TObject *arr = task->S->top - (2 * task->aux) - 3;
+				TObject *arr = top - (2 * aux) - 3;
+				// A nil key raises an error.
+				savetop();
 				do {
-					*(luaH_set(avalue(arr), task->S->top - 2)) = *(task->S->top - 1);
-					task->S->top -= 2;
-				} while (task->aux--);
-				break;
+					*(luaH_set(avalue(arr), top - 2)) = *(top - 1);
+					top -= 2;
+				} while (aux--);
+				vmbreak;
 			}
-		case POP:
-			task->aux = *task->pc++;
+		vmcase(POP)
+			aux = *pc++;
 			goto pop;
-		case POP0:
-		case POP1:
-			task->aux -= POP0;
+		vmcase(POP0)
+		vmcase(POP1)
+			aux -= POP0;
 pop:
-			task->S->top -= (task->aux + 1);
-			break;
-		case CREATEARRAYW:
-			task->aux = next_word(task->pc);
+			top -= (aux + 1);
+			vmbreak;
+		vmcase(CREATEARRAYW)
+			aux = next_word(pc);
 			goto createarray;
-		case CREATEARRAY0:
-		case CREATEARRAY1:
-			task->aux -= CREATEARRAY0;
+		vmcase(CREATEARRAY0)
+		vmcase(CREATEARRAY1)
+			aux -= CREATEARRAY0;
 			goto createarray;
-		case CREATEARRAY:
-			task->aux = *task->pc++;
+		vmcase(CREATEARRAY)
+			aux = *pc++;
 createarray:
-			luaC_checkGC();
-			avalue(task->S->top) = luaH_new(task->aux);
-			ttype(task->S->top) = LUA_T_ARRAY;
-			task->S->top++;
-			break;
-		case EQOP:
-		case NEQOP:
-			{
-				int32 res = luaO_equalObj(task->S->top - 2, task->S->top - 1);
-				task->S->top--;
-				if (task->aux == NEQOP)
-					res = !res;
-				ttype(task->S->top - 1) = res ? LUA_T_NUMBER : LUA_T_NIL;
-				nvalue(task->S->top - 1) = 1;
-				break;
+			protect(luaC_checkGC());
+			avalue(top) = luaH_new(aux);
+			ttype(top) = LUA_T_ARRAY;
+			top++;
+			vmbreak;
+		vmcase(EQOP)
+		vmcase(NEQOP)
+			cond = luaO_equalObj(top - 2, top - 1);
+			if (aux == NEQOP)
+				cond = !cond;
+			goto condresult;
+		vmcase(LTOP)
+			if (ttype(top - 2) != LUA_T_NUMBER || ttype(top - 1) != LUA_T_NUMBER) {
+				protect(comparison(LUA_T_NUMBER, LUA_T_NIL, LUA_T_NIL, IM_LT));
+				vmbreak;
+			}
+			cond = numcompare(top - 2, top - 1) < 0;
+			goto condresult;
+		vmcase(LEOP)
+			if (ttype(top - 2) != LUA_T_NUMBER || ttype(top - 1) != LUA_T_NUMBER) {
+				protect(comparison(LUA_T_NUMBER, LUA_T_NUMBER, LUA_T_NIL, IM_LE));
+				vmbreak;
 			}
-		case LTOP:
-			comparison(LUA_T_NUMBER, LUA_T_NIL, LUA_T_NIL, IM_LT);
-			break;
-		case LEOP:
-			comparison(LUA_T_NUMBER, LUA_T_NUMBER, LUA_T_NIL, IM_LE);
-			break;
-		case GTOP:
-			comparison(LUA_T_NIL, LUA_T_NIL, LUA_T_NUMBER, IM_GT);
-			break;
-		case GEOP:
-			comparison(LUA_T_NIL, LUA_T_NUMBER, LUA_T_NUMBER, IM_GE);
-			break;
-		case ADDOP:
+			cond = numcompare(top - 2, top - 1) <= 0;
+			goto condresult;
+		vmcase(GTOP)
+			if (ttype(top - 2) != LUA_T_NUMBER || ttype(top - 1) != LUA_T_NUMBER) {
+				protect(comparison(LUA_T_NIL, LUA_T_NIL, LUA_T_NUMBER, IM_GT));
+				vmbreak;
+			}
+			cond = numcompare(top - 2, top - 1) > 0;
+			goto condresult;
+		vmcase(GEOP)
+			if (ttype(top - 2) != LUA_T_NUMBER || ttype(top - 1) != LUA_T_NUMBER) {
+				protect(comparison(LUA_T_NIL, LUA_T_NUMBER, LUA_T_NUMBER, IM_GE));
+				vmbreak;
+			}
+			cond = numcompare(top - 2, top - 1) >= 0;
+condresult:
+			// A test is mostly followed by a jump on its result: then do the
+			// jump right away instead of pushing the result.
+			if (*pc == IFFJMP) {
+				top -= 2;
+				aux = *(pc + 1);
+				pc += 2;
+				if (!cond)
+					pc += aux;
+			} else if (*pc == IFFJMPW) {
+				top -= 2;
+				pc++;
+				aux = next_word(pc);
+				if (!cond)
+					pc += aux;
+			} else {
+				top--;
+				ttype(top - 1) = cond ? LUA_T_NUMBER : LUA_T_NIL;
+				nvalue(top - 1) = 1;
+			}
+			vmbreak;
+		vmcase(ADDOP)
 			{
-				TObject *l = task->S->top - 2;
-				TObject *r = task->S->top - 1;
+				TObject *l = top - 2;
+				TObject *r = top - 1;
 				if (tonumber(r) || tonumber(l))
-					call_arith(IM_ADD);
+					protect(call_arith(IM_ADD));
 				else {
 					nvalue(l) += nvalue(r);
-					--task->S->top;
+					--top;
 				}
-			break;
+				vmbreak;
 			}
-		case SUBOP:
+		vmcase(SUBOP)
 			{
-				TObject *l = task->S->top - 2;
-				TObject *r = task->S->top - 1;
+				TObject *l = top - 2;
+				TObject *r = top - 1;
 				if (tonumber(r) || tonumber(l))
-					call_arith(IM_SUB);
+					protect(call_arith(IM_SUB));
 				else {
 					nvalue(l) -= nvalue(r);
-					--task->S->top;
+					--top;
 				}
-				break;
+				vmbreak;
 			}
-		case MULTOP:
+		vmcase(MULTOP)
 			{
-				TObject *l = task->S->top - 2;
-				TObject *r = task->S->top - 1;
+				TObject *l = top - 2;
+				TObject *r = top - 1;
 				if (tonumber(r) || tonumber(l))
-					call_arith(IM_MUL);
+					protect(call_arith(IM_MUL));
 				else {
 					nvalue(l) *= nvalue(r);
-					--task->S->top;
+					--top;
 				}
-				break;
+				vmbreak;
 			}
-		case DIVOP:
+		vmcase(DIVOP)
 			{
-				TObject *l = task->S->top - 2;
-				TObject *r = task->S->top - 1;
+				TObject *l = top - 2;
+				TObject *r = top - 1;
 				if (tonumber(r) || tonumber(l))
-					call_arith(IM_DIV);
+					protect(call_arith(IM_DIV));
 				else {
 					nvalue(l) /= nvalue(r);
-					--task->S->top;
+					--top;
 				}
-				break;
+				vmbreak;
 			}
-		case POWOP:
-			call_arith(IM_POW);
-			break;
-		case CONCOP:
+		vmcase(POWOP)
+			protect(call_arith(IM_POW));
+			vmbreak;
+		vmcase(CONCOP)
 			{
-				TObject *l = task->S->top - 2;
-				TObject *r = task->S->top - 1;
+				TObject *l = top - 2;
+				TObject *r = top - 1;
 				if (tostring(l) || tostring(r))
-					call_binTM(IM_CONCAT, "unexpected type for concatenation");
+					protect(call_binTM(IM_CONCAT, "unexpected type for concatenation"));
 				else {
 					tsvalue(l) = strconc(svalue(l), svalue(r));
-					--task->S->top;
+					--top;
 				}
-				luaC_checkGC();
-				break;
+				protect(luaC_checkGC());
+				vmbreak;
 			}
-		case MINUSOP:
-			if (tonumber(task->S->top - 1)) {
-				ttype(task->S->top) = LUA_T_NIL;
-				task->S->top++;
-				call_arith(IM_UNM);
+		vmcase(MINUSOP)
+			if (tonumber(top - 1)) {
+				ttype(top) = LUA_T_NIL;
+				top++;
+				protect(call_arith(IM_UNM));
 			} else
-				nvalue(task->S->top - 1) = -nvalue(task->S->top - 1);
-			break;
-		case NOTOP:
-			ttype(task->S->top - 1) = (ttype(task->S->top - 1) == LUA_T_NIL) ? LUA_T_NUMBER : LUA_T_NIL;
-			nvalue(task->S->top - 1) = 1;
-			break;
-		case ONTJMPW:
-			task->aux = next_word(task->pc);
+				nvalue(top - 1) = -nvalue(top - 1);
+			vmbreak;
+		vmcase(NOTOP)
+			ttype(top - 1) = (ttype(top - 1) == LUA_T_NIL) ? LUA_T_NUMBER : LUA_T_NIL;
+			nvalue(top - 1) = 1;
+			vmbreak;
+		vmcase(ONTJMPW)
+			aux = next_word(pc);
 			goto ontjmp;
-		case ONTJMP:
-			task->aux = *task->pc++;
+		vmcase(ONTJMP)
+			aux = *pc++;
 ontjmp:
-			if (ttype(task->S->top - 1) != LUA_T_NIL)
-				task->pc += task->aux;
+			if (ttype(top - 1) != LUA_T_NIL)
+				pc += aux;
 			else
-				task->S->top--;
-			break;
-		case ONFJMPW:
-			task->aux = next_word(task->pc);
+				top--;
+			vmbreak;
+		vmcase(ONFJMPW)
+			aux = next_word(pc);
 			goto onfjmp;
-		case ONFJMP:
-			task->aux = *task->pc++;
+		vmcase(ONFJMP)
+			aux = *pc++;
 onfjmp:
-			if (ttype(task->S->top - 1) == LUA_T_NIL)
-				task->pc += task->aux;
+			if (ttype(top - 1) == LUA_T_NIL)
+				pc += aux;
 			else
-				task->S->top--;
-			break;
-		case JMPW:
-			task->aux = next_word(task->pc);
+				top--;
+			vmbreak;
+		vmcase(JMPW)
+			aux = next_word(pc);
 			goto jmp;
-		case JMP:
-			task->aux = *task->pc++;
+		vmcase(JMP)
+			aux = *pc++;
 jmp:
-			task->pc += task->aux;
-			break;
-		case IFFJMPW:
-			task->aux = next_word(task->pc);
+			pc += aux;
+			vmbreak;
+		vmcase(IFFJMPW)
+			aux = next_word(pc);
 			goto iffjmp;
-		case IFFJMP:
-			task->aux = *task->pc++;
+		vmcase(IFFJMP)
+			aux = *pc++;
 iffjmp:
-			if (ttype(--task->S->top) == LUA_T_NIL)
-				task->pc += task->aux;
-			break;
-		case IFTUPJMPW:
-			task->aux = next_word(task->pc);
+			if (ttype(--top) == LUA_T_NIL)
+				pc += aux;
+			vmbreak;
+		vmcase(IFTUPJMPW)
+			aux = next_word(pc);
 			goto iftupjmp;
-		case IFTUPJMP:
-			task->aux = *task->pc++;
+		vmcase(IFTUPJMP)
+			aux = *pc++;
 iftupjmp:
-			if (ttype(--task->S->top) != LUA_T_NIL)
-				task->pc -= task->aux;
-			break;
-		case IFFUPJMPW:
-			task->aux = next_word(task->pc);
+			if (ttype(--top) != LUA_T_NIL)
+				pc -= aux;
+			vmbreak;
+		vmcase(IFFUPJMPW)
+			aux = next_word(pc);
 			goto iffupjmp;
-		case IFFUPJMP:
-			task->aux = *task->pc++;
+		vmcase(IFFUPJMP)
+			aux = *pc++;
 iffupjmp:
-			if (ttype(--task->S->top) == LUA_T_NIL)
-				task->pc -= task->aux;
-			break;
-		case CLOSURE:
-			task->aux = *task->pc++;
+			if (ttype(--top) == LUA_T_NIL)
+				pc -= aux;
+			vmbreak;
+		vmcase(CLOSURE)
+			aux = *pc++;
 			goto closure;
-		case CLOSURE0:
-		case CLOSURE1:
-			task->aux -= CLOSURE0;
+		vmcase(CLOSURE0)
+		vmcase(CLOSURE1)
+			aux -= CLOSURE0;
 closure:
-			luaV_closure(task->aux);
-			luaC_checkGC();
-			break;
-	  case CALLFUNC:
-			task->aux = *task->pc++;
+			protect(luaV_closure(aux); luaC_checkGC());
+			vmbreak;
+		vmcase(CALLFUNC)
+			aux = *pc++;
 			goto callfunc;
-	  case CALLFUNC0:
-	  case CALLFUNC1:
-			task->aux -= CALLFUNC0;
+		vmcase(CALLFUNC0)
+		vmcase(CALLFUNC1)
+			aux -= CALLFUNC0;
 callfunc:
-			lua_state->state_counter2--;
-			return -((task->S->top - task->S->stack) - (*task->pc++));
-		case ENDCODE:
-			task->S->top = task->S->stack + task->base;
+			{
+				StkId func = (top - S->stack) - (*pc++);
+				savetop();
+				task->pc = pc;
+				task->aux = aux;  // number of results, for luaD_call
+				lua_state->state_counter2--;
+				return -func;
+			}
+		vmcase(ENDCODE)
+			top = base;
 			// goes through
-		case RETCODE:
+		vmcase(RETCODE)
+			savetop();
+			task->pc = pc;
 			lua_state->state_counter2--;
-			return (task->base + ((task->aux == 123) ? *task->pc : 0));
-		case SETLINEW:
-			task->aux = next_word(task->pc);
+			return (task->base + ((aux == RETCODE) ? *pc : 0));
+		vmcase(SETLINEW)
+			aux = next_word(pc);
 			goto setline;
-		case SETLINE:
-			task->aux = *task->pc++;
+		vmcase(SETLINE)
+			aux = *pc++;
 setline:
-			if ((task->S->stack + task->base - 1)->ttype != LUA_T_LINE) {
+			if ((base - 1)->ttype != LUA_T_LINE) {
 				// open space for LINE value */
-				luaD_openstack((task->S->top - task->S->stack) - task->base);
-				task->base++;
-				(task->S->stack + task->base - 1)->ttype = LUA_T_LINE;
+				protect(luaD_openstack((top - S->stack) - task->base); task->base++);
+				(base - 1)->ttype = LUA_T_LINE;
 			}
-			(task->S->stack + task->base - 1)->value.i = task->aux;
+			(base - 1)->value.i = aux;
 			if (lua_linehook)
-				luaD_lineHook(task->aux);
-			break;
-#ifdef LUA_DEBUG
+				protect(luaD_lineHook(aux));
+			vmbreak;
+#if defined(LUA_DEBUG) && !defined(LUA_THREADED_DISPATCH)
 		default:
 			LUA_INTERNALERROR("internal error - opcode doesn't match");
 #endif
@@ -686,4 +963,8 @@ setline:
 	}
 }
 
+#ifdef LUA_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+
 } // end of namespace Grim
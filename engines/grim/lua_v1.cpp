@@ -798,6 +798,7 @@ struct luaL_reg grimMainOpcodes[] = {
 	{ "MakeCurrentSet", LUA_OPCODE(Lua_V1, MakeCurrentSet) },
 	{ "LockSet", LUA_OPCODE(Lua_V1, LockSet) },
 	{ "UnLockSet", LUA_OPCODE(Lua_V1, UnLockSet) },
+	{ "PrefetchSet", LUA_OPCODE(Lua_V1, PrefetchSet) },
 	{ "MakeCurrentSetup", LUA_OPCODE(Lua_V1, MakeCurrentSetup) },
 	{ "GetCurrentSetup", LUA_OPCODE(Lua_V1, GetCurrentSetup) },
 	{ "NextSetup", LUA_OPCODE(Lua_V1, NextSetup) },
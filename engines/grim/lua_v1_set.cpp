@@ -27,6 +27,7 @@
 #include "engines/grim/actor.h"
 #include "engines/grim/grim.h"
 #include "engines/grim/set.h"
+#include "engines/grim/resource.h"
 
 #include "engines/grim/lua/lauxlib.h"
 
@@ -233,6 +234,18 @@ void Lua_V1::UnLockSet() {
 	g_grim->setSetLock(name, false);
 }
 
+// ResidualVM-specific: read a set's files ahead of MakeCurrentSet, using
+// the idle time of the following frames.
+void Lua_V1::PrefetchSet() {
+	lua_Object nameObj = lua_getparam(1);
+	if (!lua_isstring(nameObj))
+		return;
+
+	const char *name = lua_getstring(nameObj);
+	if (!g_grim->findSet(name))
+		g_resourceloader->prefetchSet(name);
+}
+
 void Lua_V1::MakeCurrentSet() {
 	lua_Object nameObj = lua_getparam(1);
 	if (!lua_isstring(nameObj)) {
@@ -34,7 +34,7 @@
 
 namespace Grim {
 
-Common::List<MaterialData *> *MaterialData::_materials = NULL;
+ResourceRegistry<MaterialData> *MaterialData::_materials = NULL;
 
 MaterialData::MaterialData(const Common::String &filename, Common::SeekableReadStream *data, CMap *cmap) :
 		_fname(filename), _cmap(cmap), _refCount(1), _textures(NULL) {
@@ -180,23 +180,24 @@ MaterialData::~MaterialData() {
 
 MaterialData *MaterialData::getMaterialData(const Common::String &filename, Common::SeekableReadStream *data, CMap *cmap) {
 	if (!_materials) {
-		_materials = new Common::List<MaterialData *>();
+		_materials = new ResourceRegistry<MaterialData>();
 	}
 
-	for (Common::List<MaterialData *>::iterator i = _materials->begin(); i != _materials->end(); ++i) {
-		MaterialData *m = *i;
-		if (m->_fname == filename && g_grim->getGameType() == GType_MONKEY4) {
-			++m->_refCount;
-			return m;
-		}
-		if (m->_fname == filename && m->_cmap->getFilename() == cmap->getFilename()) {
-			++m->_refCount;
-			return m;
-		}
+	// EMI materials don't depend on a colormap.
+	Common::String key;
+	if (g_grim->getGameType() == GType_MONKEY4)
+		key = makeResourceKey(filename);
+	else
+		key = makeResourceKey(filename, cmap);
+
+	MaterialData *m = _materials->find(key);
+	if (m) {
+		++m->_refCount;
+		return m;
 	}
 
-	MaterialData *m = new MaterialData(filename, data, cmap);
-	_materials->push_back(m);
+	m = new MaterialData(filename, data, cmap);
+	_materials->add(key, m);
 	return m;
 }
 
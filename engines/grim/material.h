@@ -28,6 +28,7 @@
 namespace Grim {
 
 class CMap;
+template<class T> class ResourceRegistry;
 
 class Texture {
 public:
@@ -46,7 +47,7 @@ public:
 	~MaterialData();
 
 	static MaterialData *getMaterialData(const Common::String &filename, Common::SeekableReadStream *data, CMap *cmap);
-	static Common::List<MaterialData *> *_materials;
+	static ResourceRegistry<MaterialData> *_materials;
 
 	Common::String _fname;
 	const ObjectPtr<CMap> _cmap;
@@ -228,6 +228,8 @@ void Model::reload(CMap *cmap) {
 	for (int i = 0; i < _numGeosets; i++)
 		_geosets[i].changeMaterials(_materials);
 	_cmap = cmap;
+	// getModel() must find this model under its new colormap, not the old one.
+	g_resourceloader->recacheModel(this);
 }
 
 void Model::loadMaterial(int index, CMap *cmap) {
@@ -370,6 +372,8 @@ Mesh::Mesh() :
 
 
 Mesh::~Mesh() {
+	if (g_driver)
+		g_driver->destroyModel(this);
 	delete[] _vertices;
 	delete[] _verticesI;
 	delete[] _vertNormals;
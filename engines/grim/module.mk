@@ -53,6 +53,7 @@ MODULE_OBJS := \
 	lua/lbuffer.o \
 	lua/lbuiltin.o \
 	lua/ldo.o \
+	lua/ldump.o \
 	lua/lfunc.o \
 	lua/lgc.o \
 	lua/liolib.o \
@@ -116,6 +117,7 @@ MODULE_OBJS := \
 	model.o \
 	objectstate.o \
 	primitives.o \
+	profiler.o \
 	patchr.o \
 	registry.o \
 	resource.o \
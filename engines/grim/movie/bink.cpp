@@ -52,16 +52,14 @@ bool BinkPlayer::bikCheck(Common::SeekableReadStream *stream, uint32 pos) {
 	return (tag & 0xFFFFFF00) == MKTAG('B', 'I', 'K', 0);
 }
 
-void BinkPlayer::handleFrame() {
-	MoviePlayer::handleFrame();
-
+void BinkPlayer::handleShownFrame(int32 frame) {
 	if (!_showSubtitles || _subtitleIndex == _subtitles.end())
 		return;
 
 	unsigned int startFrame, endFrame, curFrame;
 	startFrame = _subtitleIndex->_startFrame;
 	endFrame = _subtitleIndex->_endFrame;
-	curFrame = _videoDecoder->getCurFrame();
+	curFrame = frame;
 	if (startFrame <= curFrame && curFrame <= endFrame) {
 		if (!_subtitleIndex->active) {
 			TextObject *textObject = new TextObject();
@@ -49,7 +49,7 @@ private:
 	bool loadFile(const Common::String &filename);
 	bool _demo;
 	bool bikCheck(Common::SeekableReadStream *stream, uint32 pos);
-	virtual void handleFrame();
+	virtual void handleShownFrame(int32 frame);
 };
 
 } // end of namespace Grim
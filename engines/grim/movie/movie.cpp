@@ -20,6 +20,7 @@
  *
  */
 
+#include "graphics/conversion.h"
 #include "graphics/surface.h"
 
 #include "common/system.h"
@@ -28,12 +29,40 @@
 #include "engines/grim/movie/movie.h"
 #include "engines/grim/grim.h"
 #include "engines/grim/debug.h"
+#include "engines/grim/gfx_base.h"
 #include "engines/grim/savegame.h"
 
 namespace Grim {
 
 MoviePlayer *g_movie;
 
+// Copies a decoded frame into a queue slot, converting it to the renderer's
+// movie format on the way if it has one. The slot keeps its buffer from
+// frame to frame as long as the size and the format do not change.
+static void convertFrame(Graphics::Surface &dst, const Graphics::Surface &src, const Graphics::PixelFormat &format) {
+	Graphics::PixelFormat dstFormat = format;
+	if (dstFormat.bytesPerPixel < 2 || src.format.bytesPerPixel < 2)
+		dstFormat = src.format;
+
+	if (dst.w != src.w || dst.h != src.h || dst.format != dstFormat || !dst.getPixels())
+		dst.create(src.w, src.h, dstFormat);
+
+	if (dstFormat != src.format) {
+		if (Graphics::crossBlit((byte *)dst.getPixels(), (const byte *)src.getPixels(), dst.pitch, src.pitch,
+		                        src.w, src.h, dstFormat, src.format))
+			return;
+		dst.create(src.w, src.h, src.format);
+	}
+
+	const byte *srcRow = (const byte *)src.getPixels();
+	byte *dstRow = (byte *)dst.getPixels();
+	for (int y = 0; y < src.h; ++y) {
+		memcpy(dstRow, srcRow, src.w * src.format.bytesPerPixel);
+		srcRow += src.pitch;
+		dstRow += dst.pitch;
+	}
+}
+
 MoviePlayer::MoviePlayer() {
 	_channels = -1;
 	_freq = 22050;
@@ -48,7 +77,13 @@ MoviePlayer::MoviePlayer() {
 	_y = 0;
 	_videoDecoder = NULL;
 	_internalSurface = NULL;
+	_internalTime = 0;
 	_externalSurface = new Graphics::Surface();
+	_queueHead = 0;
+	_queueCount = 0;
+	_queueEpoch = 0;
+	_lastDueTime = 0;
+	_decoding = false;
 	_timerStarted = false;
 }
 
@@ -63,63 +98,174 @@ MoviePlayer::~MoviePlayer() {
 	delete _externalSurface;
 }
 
-void MoviePlayer::pause(bool p) {
+void MoviePlayer::claimDecoder() {
+	while (!tryClaimDecoder())
+		g_system->delayMillis(1);
+}
+
+bool MoviePlayer::tryClaimDecoder() {
 	Common::StackLock lock(_frameMutex);
+	if (_decoding)
+		return false;
+	_decoding = true;
+	return true;
+}
+
+void MoviePlayer::releaseDecoder() {
+	Common::StackLock lock(_frameMutex);
+	_decoding = false;
+}
+
+void MoviePlayer::pause(bool p) {
+	claimDecoder();
 	_videoPause = p;
 	_videoDecoder->pauseVideo(p);
+	releaseDecoder();
 }
 
 void MoviePlayer::stop() {
-	Common::StackLock lock(_frameMutex);
+	claimDecoder();
 	deinit();
+	releaseDecoder();
 	g_grim->setMode(GrimEngine::NormalMode);
 }
 
+void MoviePlayer::update() {
+	if (!tryClaimDecoder())
+		return;
+
+	if (!_videoFinished) {
+		presentFrame();
+		decodeFrames(2);
+		// Catch up at once if the frame we just decoded is already due.
+		presentFrame();
+		checkFinished();
+	}
+
+	releaseDecoder();
+}
+
 void MoviePlayer::timerCallback(void *instance) {
 	MoviePlayer *movie = static_cast<MoviePlayer *>(instance);
-	Common::StackLock lock(movie->_frameMutex);
-	if (movie->prepareFrame())
-		movie->postHandleFrame();
+	if (!movie->tryClaimDecoder())
+		return;
+
+	// The main loop decodes ahead of time, so a due frame here means that it
+	// is behind. Make room by dropping the oldest queued frame rather than
+	// letting the decoder, and with it the audio, fall behind too.
+	if (!movie->_videoFinished && !movie->_videoPause && !movie->_videoDecoder->endOfVideo() &&
+	    movie->_videoDecoder->getTimeToNextFrame() == 0) {
+		if (movie->_queueCount == _frameQueueSize) {
+			movie->_queueHead = (movie->_queueHead + 1) % _frameQueueSize;
+			movie->_queueCount--;
+		}
+		movie->decodeFrames(1);
+	}
+	if (!movie->_videoFinished)
+		movie->checkFinished();
+
+	movie->releaseDecoder();
 }
 
 bool MoviePlayer::prepareFrame() {
-	if (!_videoLooping && _videoDecoder->endOfVideo()) {
-		_videoFinished = true;
+	if (_videoPause || _videoFinished) {
+		return false;
 	}
 
-	if (_videoPause) {
+	if (!_videoLooping && _videoDecoder->endOfVideo()) {
 		return false;
 	}
 
+	handleFrame();
 	if (_videoFinished) {
-		if (g_grim->getMode() == GrimEngine::SmushMode) {
-			g_grim->setMode(GrimEngine::NormalMode);
-		}
-		_videoPause = true;
 		return false;
 	}
 
-	if (_videoDecoder->getTimeToNextFrame() > 0)
-		return false;
-
-	handleFrame();
+	_internalTime = _videoDecoder->getTime() + _videoDecoder->getTimeToNextFrame();
 	_internalSurface = _videoDecoder->decodeNextFrame();
-	if (_frame != _videoDecoder->getCurFrame()) {
-		_updateNeeded = true;
+
+	return _internalSurface != NULL;
+}
+
+void MoviePlayer::decodeFrames(int count) {
+	for (; count > 0 && _queueCount < _frameQueueSize; --count) {
+		if (!prepareFrame())
+			return;
+		int x = _x, y = _y;
+		postHandleFrame(x, y);
+
+		QueuedFrame &queued = _frameQueue[(_queueHead + _queueCount) % _frameQueueSize];
+		convertFrame(queued.surface, *_internalSurface, _frameFormat);
+
+		// The clock goes back when a looping movie rewinds; the frames queued
+		// before that are due at once.
+		if (_internalTime < _lastDueTime)
+			_queueEpoch++;
+		_lastDueTime = _internalTime;
+
+		queued.frame = _videoDecoder->getCurFrame();
+		queued.dueTime = _internalTime;
+		queued.epoch = _queueEpoch;
+		queued.x = x;
+		queued.y = y;
+		_queueCount++;
 	}
+}
 
-	_movieTime = _videoDecoder->getTime();
-	_frame = _videoDecoder->getCurFrame();
+void MoviePlayer::presentFrame() {
+	uint32 now = _videoDecoder->getTime();
+	int due = 0;
+	while (due < _queueCount) {
+		const QueuedFrame &queued = _frameQueue[(_queueHead + due) % _frameQueueSize];
+		if (queued.epoch == _queueEpoch && queued.dueTime > now)
+			break;
+		due++;
+	}
+	if (due == 0)
+		return;
 
-	return true;
+	// Skip to the newest due frame, and swap it in so that the surface the
+	// renderer was given becomes the free slot for the next decode.
+	_queueHead = (_queueHead + due - 1) % _frameQueueSize;
+	_queueCount -= due - 1;
+
+	QueuedFrame &queued = _frameQueue[_queueHead];
+	Graphics::Surface shown = *_externalSurface;
+	*_externalSurface = queued.surface;
+	queued.surface = shown;
+
+	if (_frame != queued.frame) {
+		_updateNeeded = true;
+	}
+	_frame = queued.frame;
+	_movieTime = queued.dueTime;
+	_x = queued.x;
+	_y = queued.y;
+	handleShownFrame(_frame);
+
+	_queueHead = (_queueHead + 1) % _frameQueueSize;
+	_queueCount--;
 }
 
-Graphics::Surface *MoviePlayer::getDstSurface() {
-	Common::StackLock lock(_frameMutex);
-	if (_updateNeeded && _internalSurface) {
-		_externalSurface->copyFrom(*_internalSurface);
+void MoviePlayer::checkFinished() {
+	if (_videoLooping || _queueCount > 0 || !_videoDecoder->endOfVideo()) {
+		return;
 	}
 
+	_videoFinished = true;
+	if (g_grim->getMode() == GrimEngine::SmushMode) {
+		g_grim->setMode(GrimEngine::NormalMode);
+	}
+	_videoPause = true;
+}
+
+void MoviePlayer::clearFrameQueue() {
+	_queueHead = 0;
+	_queueCount = 0;
+	_lastDueTime = 0;
+}
+
+Graphics::Surface *MoviePlayer::getDstSurface() {
 	return _externalSurface;
 }
 
@@ -129,6 +275,9 @@ void MoviePlayer::init() {
 		_timerStarted = true;
 	}
 
+	_frameFormat = g_driver->getMovieFrameFormat();
+	clearFrameQueue();
+
 	_frame = -1;
 	_movieTime = 0;
 	_updateNeeded = false;
@@ -143,6 +292,10 @@ void MoviePlayer::deinit() {
 
 	_internalSurface = NULL;
 
+	clearFrameQueue();
+	for (int i = 0; i < _frameQueueSize; i++)
+		_frameQueue[i].surface.free();
+
 	if (_externalSurface)
 		_externalSurface->free();
 
@@ -151,7 +304,7 @@ void MoviePlayer::deinit() {
 }
 
 bool MoviePlayer::play(const Common::String &filename, bool looping, int x, int y, bool start, bool showSubtitles) {
-	Common::StackLock lock(_frameMutex);
+	claimDecoder();
 	deinit();
 	_x = x;
 	_y = y;
@@ -159,8 +312,10 @@ bool MoviePlayer::play(const Common::String &filename, bool looping, int x, int
 	_videoLooping = looping;
 	_showSubtitles = showSubtitles;
 
-	if (!loadFile(_fname))
+	if (!loadFile(_fname)) {
+		releaseDecoder();
 		return false;
+	}
 
 	Debug::debug(Debug::Movie, "Playing video '%s'.\n", filename.c_str());
 
@@ -171,9 +326,11 @@ bool MoviePlayer::play(const Common::String &filename, bool looping, int x, int
 		_videoDecoder->start();
 
 		// Get the first frame immediately
-		timerCallback(this);
+		decodeFrames(1);
+		presentFrame();
 	}
 
+	releaseDecoder();
 	return true;
 }
 
@@ -182,7 +339,7 @@ bool MoviePlayer::loadFile(const Common::String &filename) {
 }
 
 void MoviePlayer::saveState(SaveGame *state) {
-	Common::StackLock lock(_frameMutex);
+	claimDecoder();
 	state->beginSection('SMUS');
 
 	state->writeString(_fname);
@@ -198,10 +355,10 @@ void MoviePlayer::saveState(SaveGame *state) {
 	save(state);
 
 	state->endSection();
+	releaseDecoder();
 }
 
 void MoviePlayer::restoreState(SaveGame *state) {
-	Common::StackLock lock(_frameMutex);
 	state->beginSection('SMUS');
 
 	_fname = state->readString();
@@ -217,10 +374,13 @@ void MoviePlayer::restoreState(SaveGame *state) {
 	if (!videoFinished && !_fname.empty()) {
 		play(_fname.c_str(), videoLooping, x, y, false);
 	}
+
+	claimDecoder();
 	_frame = frame;
 	_movieTime = movieTime;
 
 	restore(state);
+	releaseDecoder();
 
 	state->endSection();
 }
@@ -248,6 +408,7 @@ public:
 	bool loadFile(const Common::String &filename) override { return true; }
 	void stop() {}
 	void pause(bool p) {}
+	void update() {}
 	void saveState(SaveGame *state) {}
 	void restoreState(SaveGame *state) {}
 private:
@@ -26,6 +26,8 @@
 #include "common/mutex.h"
 #include "common/system.h"
 
+#include "graphics/surface.h"
+
 #include "video/video_decoder.h"
 
 namespace Grim {
@@ -34,11 +36,33 @@ class SaveGame;
 
 class MoviePlayer {
 protected:
+	/**
+	 * A decoded frame waiting in the queue, already converted to the
+	 * pixel format the renderer wants for its movie frames.
+	 */
+	struct QueuedFrame {
+		Graphics::Surface surface;
+		int32 frame;
+		uint32 dueTime;
+		uint32 epoch;
+		int x, y;
+	};
+
+	static const int _frameQueueSize = 4;
+
 	Common::String _fname;
 	Common::Mutex _frameMutex;
 	Video::VideoDecoder *_videoDecoder;     //< Initialize this to your needed subclass of VideoDecoder in the constructor
 	const Graphics::Surface *_internalSurface;
+	uint32 _internalTime;
 	Graphics::Surface *_externalSurface;
+	Graphics::PixelFormat _frameFormat;
+	QueuedFrame _frameQueue[_frameQueueSize];
+	int _queueHead;
+	int _queueCount;
+	uint32 _queueEpoch;
+	uint32 _lastDueTime;
+	bool _decoding;
 	int32 _frame;
 	bool _updateNeeded;
 	bool _showSubtitles;
@@ -70,6 +94,14 @@ public:
 	virtual bool play(const Common::String &filename, bool looping, int x, int y, bool start = true, bool showSubtitles = false);
 	virtual void stop();
 	virtual void pause(bool p);
+
+	/**
+	 * Presents the newest queued frame whose time has come on the video
+	 * clock, and decodes ahead to refill the queue. Called once per
+	 * frame by the main loop; it returns at once if the timer fallback
+	 * is decoding.
+	 */
+	virtual void update();
 	virtual bool isPlaying() { return !_videoFinished; }
 	virtual bool isUpdateNeeded() { return _updateNeeded; }
 	virtual Graphics::Surface *getDstSurface();
@@ -87,16 +119,43 @@ public:
 	void restoreState(SaveGame *state);
 
 protected:
+	/**
+	 * Keeps the decoder going when the main loop falls behind, so that the
+	 * movie audio, which is demuxed along with the frames, does not starve.
+	 */
 	static void timerCallback(void *ptr);
+
 	/**
-	 * Handles basic stuff per frame, like copying the latest frame to
-	 * _externalBuffer, and updating the frame-counters.
+	 * Decodes the next frame into _internalSurface, and sets _internalTime
+	 * to the time it is due at. Called with the decoder claimed.
 	 *
-	 * @return false if a frame wasnt drawn to _externalBuffer, true otherwise.
+	 * @return false if no frame was decoded, true otherwise.
 	 * @see handleFrame
 	 */
 	virtual bool prepareFrame();
 
+	/**
+	 * Claims the decoder and the frame queue for the calling thread,
+	 * waiting for the timer fallback to be done with them.
+	 */
+	void claimDecoder();
+	bool tryClaimDecoder();
+	void releaseDecoder();
+
+	/**
+	 * Decodes up to count frames into the free slots of the queue.
+	 * Called with the decoder claimed.
+	 */
+	void decodeFrames(int count);
+
+	/**
+	 * Swaps the newest due frame of the queue into _externalSurface,
+	 * dropping the older ones. Called with the decoder claimed.
+	 */
+	void presentFrame();
+	void checkFinished();
+	void clearFrameQueue();
+
 	/**
 	 * Frame-handling function.
 	 *
@@ -114,12 +173,29 @@ protected:
 	 *
 	 * Perform any codec-specific per-frame operations after prepareFrame has been
 	 * run, this function is called whenever prepareFrame returns true.
+	 * The frame may be shown later, so the draw position goes to the queued
+	 * frame through x and y, and not to _x and _y.
 	 *
+	 * @param x             the x-coordinate to draw the decoded frame at
+	 * @param y             the y-coordinate to draw the decoded frame at
 	 * @see prepareFrame
 	 * @see clearUpdateNeeded
 	 * @see isUpdateNeeded
 	 */
-	virtual void postHandleFrame() {};
+	virtual void postHandleFrame(int &x, int &y) {};
+
+	/**
+	 * Frame-handling function.
+	 *
+	 * Perform any codec-specific operations tied to what is on screen, like
+	 * the subtitles. Unlike handleFrame, which runs when a frame is decoded
+	 * ahead, this is called on the main thread when presentFrame shows the
+	 * frame.
+	 *
+	 * @param frame         the number of the frame now shown
+	 * @see presentFrame
+	 */
+	virtual void handleShownFrame(int32 frame) {};
 
 	/**
 	 * Initialization of buffers
@@ -71,10 +71,10 @@ void SmushPlayer::handleFrame() {
 	}
 }
 
-void SmushPlayer::postHandleFrame() {
+void SmushPlayer::postHandleFrame(int &x, int &y) {
 	if (_demo) {
-		_x = _smushDecoder->getX();
-		_y = _smushDecoder->getY();
+		x = _smushDecoder->getX();
+		y = _smushDecoder->getY();
 	}
 }
 
@@ -82,7 +82,7 @@ void SmushPlayer::restore(SaveGame *state) {
 	if (isPlaying()) {
 		_smushDecoder->seek((uint32)_movieTime);
 		_smushDecoder->start();
-		timerCallback(this);
+		decodeFrames(1);
 	}
 }
 
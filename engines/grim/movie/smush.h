@@ -38,7 +38,7 @@ public:
 private:
 	bool loadFile(const Common::String &filename);
 	void handleFrame();
-	void postHandleFrame();
+	void postHandleFrame(int &x, int &y);
 	void init();
 	bool _demo;
 	SmushDecoder *_smushDecoder;
@@ -23,8 +23,9 @@
 #ifndef GRIM_POOL_H
 #define GRIM_POOL_H
 
+#include "common/array.h"
 #include "common/hashmap.h"
-#include "common/list.h"
+#include "common/textconsole.h"
 
 #include "engines/grim/savegame.h"
 
@@ -42,36 +43,57 @@ public:
 template<class T>
 class PoolObject : public PoolObjectBase {
 public:
+	/**
+	 * @short Generational slot map of the objects of a class
+	 * The id of an object is made of the index of its slot and of the generation of that
+	 * slot, which is bumped every time the slot is freed, so that a lookup is a simple
+	 * array access and a stale id never finds the object which reused its slot.
+	 * The objects are also kept in a dense array, in creation order, which is what the
+	 * iterators walk. Removing an object leaves a hole in it, so that removing objects
+	 * while iterating is safe; the holes are squeezed out when objects are added.
+	 */
 	class Pool {
 	public:
-		template<class it, class Type>
+		template<class ArrayType, class Type>
 		class Iterator {
 		public:
-			Iterator(const Iterator &i) : _i(i._i) { }
-			Iterator(const it &i) : _i(i) { }
+			Iterator(const Iterator &i) : _objects(i._objects), _index(i._index) { }
+			Iterator(ArrayType *objects, int32 index) : _objects(objects), _index(index) { skipForward(); }
 
-			int32 getId() const { return _i->_key; }
-			Type &getValue() const { return _i->_value; }
+			int32 getId() const { return getValue()->getId(); }
+			Type &getValue() const { return (*_objects)[_index]; }
 
-			Type &operator*() const { return _i->_value; }
+			Type &operator*() const { return (*_objects)[_index]; }
 
-			Iterator &operator=(const Iterator &i) { _i = i._i; return *this; }
+			Iterator &operator=(const Iterator &i) { _objects = i._objects; _index = i._index; return *this; }
 
-			bool operator==(const Iterator i) const { return _i == i._i; }
-			bool operator!=(const Iterator i) const { return _i != i._i; }
+			// Any two iterators past the last object are equal, even if the array shrunk
+			bool operator==(const Iterator i) const { return _index == i._index || (atEnd() && i.atEnd()); }
+			bool operator!=(const Iterator i) const { return !(*this == i); }
 
-			Iterator &operator++() { ++_i; return *this; }
-			Iterator operator++(int) { Iterator iter = *this; ++_i; return iter; }
+			Iterator &operator++() { ++_index; skipForward(); return *this; }
+			Iterator operator++(int) { Iterator iter = *this; ++*this; return iter; }
 
-			Iterator &operator--() { --_i; return *this; }
-			Iterator operator--(int) { Iterator iter = *this; --_i; return iter; }
+			Iterator &operator--() { --_index; skipBackward(); return *this; }
+			Iterator operator--(int) { Iterator iter = *this; --*this; return iter; }
 
 		private:
-			it _i;
+			bool atEnd() const { return _index >= (int32)_objects->size(); }
+			void skipForward() {
+				while (!atEnd() && !(*_objects)[_index])
+					++_index;
+			}
+			void skipBackward() {
+				while (_index > 0 && !(*_objects)[_index])
+					--_index;
+			}
+
+			ArrayType *_objects;
+			int32 _index;
 		};
 
-		typedef Iterator<typename Common::HashMap<int32, T *>::iterator, T *> iterator;
-		typedef Iterator<typename Common::HashMap<int32, T *>::const_iterator, T *const> const_iterator;
+		typedef Iterator<Common::Array<T *>, T *> iterator;
+		typedef Iterator<const Common::Array<T *>, T *const> const_iterator;
 
 		Pool();
 		~Pool();
@@ -90,8 +112,37 @@ public:
 		void restoreObjects(SaveGame *save);
 
 	private:
+		enum {
+			kIndexBits = 16,
+			kIndexMask = (1 << kIndexBits) - 1,
+			kGenerationMask = 0x7fff,
+			kMinHolesToCompact = 16
+		};
+
+		struct Slot {
+			T *_obj;
+			int32 _index;  // position of _obj in _objects, or next free slot
+			int32 _generation;
+		};
+
+		static int32 makeId(int32 slot, int32 generation) { return (generation << kIndexBits) | slot; }
+
+		void clear();
+		int32 allocSlot();
+		void freeSlot(int32 slot);
+		void rebuildFreeList();
+		void placeRestoredObject(T *obj);
+		void compact();
+
 		bool _restoring;
-		Common::HashMap<int32, T*> _map;
+		uint32 _nextCreationOrder;
+		Common::Array<T *> _objects;
+		Common::Array<Slot> _slots;  // slot 0 is never used, so no object has the id 0
+		int32 _freeHead;
+		int32 _freeTail;
+		int32 _holes;
+		// Objects restored with an id whose slot was already taken, e.g. from an old savegame
+		Common::HashMap<int32, T *> _strays;
 	};
 
 	/**
@@ -99,15 +150,16 @@ public:
 	 * This class wraps a C pointer to T, subclass of PoolObject, which gets reset to NULL as soon as
 	 * the object is deleted, e.g by Pool::restoreObjects().
 	 * Its operator overloads allows the Ptr class to be used as if it was a raw C pointer.
+	 * The pointers to an object are chained in an intrusive list, so copying a Ptr does not allocate.
 	 */
 	class Ptr {
 	public:
-		Ptr() : _obj(NULL) { }
-		Ptr(T *obj) : _obj(obj) {
+		Ptr() : _obj(NULL), _prev(NULL), _next(NULL) { }
+		Ptr(T *obj) : _obj(obj), _prev(NULL), _next(NULL) {
 			if (_obj)
 				_obj->addPointer(this);
 		}
-		Ptr(const Ptr &ptr) : _obj(ptr._obj) {
+		Ptr(const Ptr &ptr) : _obj(ptr._obj), _prev(NULL), _next(NULL) {
 			if (_obj)
 				_obj->addPointer(this);
 		}
@@ -129,9 +181,11 @@ public:
 		inline operator T*() const { return _obj; }
 
 	private:
-		inline void reset() { _obj = NULL; }
+		inline void reset() { _obj = NULL; _prev = NULL; _next = NULL; }
 
 		T *_obj;
+		Ptr *_prev;
+		Ptr *_next;
 
 		friend class PoolObject;
 	};
@@ -141,6 +195,13 @@ public:
 	int getId() const;
 	virtual int32 getTag() const { return T::getStaticTag(); }
 
+	/**
+	 * Increases with every object of the class created, so it orders the objects like
+	 * their ids used to before the ids reused freed slots. Restoring a savegame keeps
+	 * the order of the objects, but not the values.
+	 */
+	uint32 getCreationOrder() const { return _creationOrder; }
+
 	static Pool &getPool();
 
 protected:
@@ -151,14 +212,14 @@ protected:
 
 private:
 	void setId(int id);
-	void addPointer(Ptr *pointer) { _pointers.push_back(pointer); }
-	void removePointer(Ptr *pointer) { _pointers.remove(pointer); }
+	void addPointer(Ptr *pointer);
+	void removePointer(Ptr *pointer);
 
 	int _id;
-	static int s_id;
+	uint32 _creationOrder;
 	static Pool *s_pool;
 
-	Common::List<Ptr *> _pointers;
+	Ptr *_pointers;
 
 	friend class Pool;
 	friend class Ptr;
@@ -174,16 +235,12 @@ bool operator!=(T *obj, const typename PoolObject<T>::Ptr &ptr) {
 	return obj != ptr._obj;
 }
 
-template <class T>
-int PoolObject<T>::s_id = 0;
-
 template <class T>
 typename PoolObject<T>::Pool *PoolObject<T>::s_pool = NULL;
 
 template <class T>
-PoolObject<T>::PoolObject() {
-	++s_id;
-	_id = s_id;
+PoolObject<T>::PoolObject() :
+	_id(0), _creationOrder(0), _pointers(NULL) {
 
 	if (!s_pool) {
 		s_pool = new Pool();
@@ -195,17 +252,16 @@ template <class T>
 PoolObject<T>::~PoolObject() {
 	s_pool->removeObject(_id);
 
-	for (typename Common::List<Ptr *>::iterator i = _pointers.begin(); i != _pointers.end(); ++i) {
-		(*i)->reset();
+	for (Ptr *p = _pointers; p != NULL;) {
+		Ptr *next = p->_next;
+		p->reset();
+		p = next;
 	}
 }
 
 template <class T>
 void PoolObject<T>::setId(int id) {
 	_id = id;
-	if (id > s_id) {
-		s_id = id;
-	}
 }
 
 template <class T>
@@ -213,6 +269,27 @@ int PoolObject<T>::getId() const {
 	return _id;
 }
 
+template <class T>
+void PoolObject<T>::addPointer(Ptr *pointer) {
+	pointer->_prev = NULL;
+	pointer->_next = _pointers;
+	if (_pointers)
+		_pointers->_prev = pointer;
+	_pointers = pointer;
+}
+
+template <class T>
+void PoolObject<T>::removePointer(Ptr *pointer) {
+	if (pointer->_prev)
+		pointer->_prev->_next = pointer->_next;
+	else
+		_pointers = pointer->_next;
+	if (pointer->_next)
+		pointer->_next->_prev = pointer->_prev;
+	pointer->_prev = NULL;
+	pointer->_next = NULL;
+}
+
 template <class T>
 typename PoolObject<T>::Pool &PoolObject<T>::getPool() {
 	if (!s_pool) {
@@ -227,7 +304,8 @@ typename PoolObject<T>::Pool &PoolObject<T>::getPool() {
 
 template <class T>
 PoolObject<T>::Pool::Pool() :
-	_restoring(false) {
+	_restoring(false), _nextCreationOrder(0) {
+	clear();
 }
 
 template <class T>
@@ -235,51 +313,192 @@ PoolObject<T>::Pool::~Pool() {
 	PoolObject<T>::s_pool = NULL;
 }
 
+template <class T>
+void PoolObject<T>::Pool::clear() {
+	_objects.clear();
+	_slots.clear();
+	Slot reserved = { NULL, -1, 0 };
+	_slots.push_back(reserved);
+	_freeHead = _freeTail = -1;
+	_holes = 0;
+	_strays.clear();
+}
+
+template <class T>
+int32 PoolObject<T>::Pool::allocSlot() {
+	if (_freeHead != -1) {
+		int32 slot = _freeHead;
+		_freeHead = _slots[slot]._index;
+		if (_freeHead == -1)
+			_freeTail = -1;
+		return slot;
+	}
+
+	if ((int32)_slots.size() > kIndexMask)
+		error("Too many objects of type %s", tag2str(T::getStaticTag()));
+	Slot slot = { NULL, -1, 0 };
+	_slots.push_back(slot);
+	return _slots.size() - 1;
+}
+
+// Freed slots are reused in FIFO order, which delays the reuse of their ids as much as possible
+template <class T>
+void PoolObject<T>::Pool::freeSlot(int32 slot) {
+	Slot &s = _slots[slot];
+	s._obj = NULL;
+	s._index = -1;
+	s._generation = (s._generation + 1) & kGenerationMask;
+	if (_freeTail != -1)
+		_slots[_freeTail]._index = slot;
+	else
+		_freeHead = slot;
+	_freeTail = slot;
+}
+
+template <class T>
+void PoolObject<T>::Pool::rebuildFreeList() {
+	_freeHead = _freeTail = -1;
+	for (int32 slot = 1; slot < (int32)_slots.size(); ++slot) {
+		if (_slots[slot]._obj)
+			continue;
+		_slots[slot]._index = -1;
+		if (_freeTail != -1)
+			_slots[_freeTail]._index = slot;
+		else
+			_freeHead = slot;
+		_freeTail = slot;
+	}
+}
+
+template <class T>
+void PoolObject<T>::Pool::compact() {
+	uint32 j = 0;
+	for (uint32 i = 0; i < _objects.size(); ++i) {
+		T *obj = _objects[i];
+		if (!obj)
+			continue;
+		int32 slot = obj->_id & kIndexMask;
+		if (_slots[slot]._obj == obj)
+			_slots[slot]._index = j;
+		_objects[j++] = obj;
+	}
+	_objects.resize(j);
+	_holes = 0;
+}
+
 template <class T>
 void PoolObject<T>::Pool::addObject(T *obj) {
-	if (!_restoring) {
-		_map.setVal(obj->_id, obj);
+	if (_restoring) {
+		return;
 	}
+
+	// This moves the objects, so it must not happen while iterating on the pool
+	if (_holes >= kMinHolesToCompact && _holes * 2 > (int32)_objects.size())
+		compact();
+
+	int32 slot = allocSlot();
+	Slot &s = _slots[slot];
+	while (!_strays.empty() && _strays.contains(makeId(slot, s._generation)))
+		s._generation = (s._generation + 1) & kGenerationMask;
+	s._obj = obj;
+	s._index = _objects.size();
+	obj->_id = makeId(slot, s._generation);
+	obj->_creationOrder = _nextCreationOrder++;
+	_objects.push_back(obj);
+}
+
+template <class T>
+void PoolObject<T>::Pool::placeRestoredObject(T *obj) {
+	// The objects are saved in creation order, so they are restored in it too
+	obj->_creationOrder = _nextCreationOrder++;
+
+	int32 id = obj->_id;
+	int32 slot = id & kIndexMask;
+	int32 generation = id >> kIndexBits;
+	if (id <= 0 || slot == 0 || generation > kGenerationMask || (slot < (int32)_slots.size() && _slots[slot]._obj)) {
+		_strays[id] = obj;
+		_objects.push_back(obj);
+		return;
+	}
+
+	while ((int32)_slots.size() <= slot) {
+		Slot free = { NULL, -1, 0 };
+		_slots.push_back(free);
+	}
+	Slot &s = _slots[slot];
+	s._obj = obj;
+	s._index = _objects.size();
+	s._generation = generation;
+	_objects.push_back(obj);
 }
 
 template <class T>
 void PoolObject<T>::Pool::removeObject(int32 id) {
-	_map.erase(id);
+	int32 slot = id & kIndexMask;
+	if (slot < (int32)_slots.size() && _slots[slot]._obj && _slots[slot]._obj->_id == id) {
+		_objects[_slots[slot]._index] = NULL;
+		freeSlot(slot);
+	} else {
+		T *obj = _strays.getVal(id, NULL);
+		if (!obj)
+			return;
+		_strays.erase(id);
+		for (uint32 i = 0; i < _objects.size(); ++i) {
+			if (_objects[i] == obj) {
+				_objects[i] = NULL;
+				break;
+			}
+		}
+	}
+	++_holes;
+
+	while (!_objects.empty() && !_objects.back()) {
+		_objects.pop_back();
+		--_holes;
+	}
 }
 
 template <class T>
 T *PoolObject<T>::Pool::getObject(int32 id) {
-	return _map.getVal(id, NULL);
+	int32 slot = id & kIndexMask;
+	if (slot < (int32)_slots.size()) {
+		T *obj = _slots[slot]._obj;
+		if (obj && obj->_id == id)
+			return obj;
+	}
+	if (_strays.empty())
+		return NULL;
+	return _strays.getVal(id, NULL);
 }
 
 template <class T>
 typename PoolObject<T>::Pool::iterator PoolObject<T>::Pool::begin() {
-	return iterator(_map.begin());
+	return iterator(&_objects, 0);
 }
 
 template <class T>
 typename PoolObject<T>::Pool::const_iterator PoolObject<T>::Pool::begin() const {
-	return const_iterator(_map.begin());
+	return const_iterator(&_objects, 0);
 }
 
 template <class T>
 typename PoolObject<T>::Pool::iterator PoolObject<T>::Pool::end() {
-	return iterator(_map.end());
+	return iterator(&_objects, _objects.size());
 }
 
 template <class T>
 typename PoolObject<T>::Pool::const_iterator PoolObject<T>::Pool::end() const {
-	return const_iterator(_map.end());
+	return const_iterator(&_objects, _objects.size());
 }
 
 template <class T>
 int PoolObject<T>::Pool::getSize() const {
-	return _map.size();
+	return _objects.size() - _holes;
 }
 
 template <class T>
 void PoolObject<T>::Pool::deleteObjects() {
-	while (!_map.empty()) {
+	while (!_objects.empty()) {
 		delete *begin();
 	}
 	delete this;
@@ -291,7 +510,7 @@ void PoolObject<T>::Pool::saveObjects(SaveGame *state) {
 
 	T::saveStaticState(state);
 
-	state->writeLEUint32(_map.size());
+	state->writeLEUint32(getSize());
 	for (iterator i = begin(); i != end(); ++i) {
 		T *a = *i;
 		state->writeLESint32(i.getId());
@@ -310,22 +529,26 @@ void PoolObject<T>::Pool::restoreObjects(SaveGame *state) {
 
 	int32 size = state->readLEUint32();
 	_restoring = true;
-	Common::HashMap<int32, T *> tempMap;
+	Common::HashMap<int32, T *> oldObjects;
+	for (iterator i = begin(); i != end(); ++i) {
+		oldObjects[i.getId()] = *i;
+	}
+	clear();
 	for (int32 i = 0; i < size; ++i) {
 		int32 id = state->readLESint32();
-		T *t = _map.getVal(id);
-		_map.erase(id);
+		T *t = oldObjects.getVal(id, NULL);
+		oldObjects.erase(id);
 		if (!t) {
 			t = new T();
 			t->setId(id);
 		}
-		tempMap[id] = t;
+		placeRestoredObject(t);
 		t->restoreState(state);
 	}
-	for (iterator i = begin(); i != end(); ++i) {
-		delete *i;
+	rebuildFreeList();
+	for (typename Common::HashMap<int32, T *>::iterator i = oldObjects.begin(); i != oldObjects.end(); ++i) {
+		delete i->_value;
 	}
-	_map = tempMap;
 	_restoring = false;
 
 	state->endSection();
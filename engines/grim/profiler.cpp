@@ -0,0 +1,174 @@
+/* ResidualVM - A 3D game interpreter
+ *
+ * ResidualVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "common/algorithm.h"
+#include "common/savefile.h"
+#include "common/system.h"
+
+#include "engines/grim/profiler.h"
+#include "engines/grim/gfx_base.h"
+#include "engines/grim/color.h"
+
+namespace Grim {
+
+FrameProfiler *g_profiler = NULL;
+
+static const char *const stageNames[] = {
+	"events",
+	"lua_tasks",
+	"actor_update",
+	"talk_update",
+	"background",
+	"bitmaps",
+	"actors",
+	"buffers",
+	"primitives",
+	"flip",
+	"movie",
+	"imuse"
+};
+
+FrameProfiler::FrameProfiler() :
+		_enabled(false), _overlay(false), _imuseTotal(0) {
+	reset();
+}
+
+void FrameProfiler::setEnabled(bool enabled) {
+	if (enabled && !_enabled)
+		reset();
+	_enabled = enabled;
+}
+
+void FrameProfiler::addTime(Stage stage, uint32 start) {
+	uint32 time = g_system->getRealMillis() - start;
+	if (stage == kStageIMuse)
+		_imuseTotal += time;
+	else
+		_current[stage] += time;
+}
+
+void FrameProfiler::endFrame() {
+	if (!_enabled)
+		return;
+
+	uint32 imuseTotal = _imuseTotal;
+	_current[kStageIMuse] = imuseTotal - _imuseTotalAtFrameStart;
+	_imuseTotalAtFrameStart = imuseTotal;
+
+	memcpy(_frames[_frameCount % kNumFrames], _current, sizeof(_current));
+	memset(_current, 0, sizeof(_current));
+	_frameCount++;
+}
+
+void FrameProfiler::reset() {
+	memset(_current, 0, sizeof(_current));
+	_frameCount = 0;
+	_imuseTotalAtFrameStart = _imuseTotal;
+}
+
+uint FrameProfiler::getNumFrames() const {
+	return MIN<uint32>(_frameCount, kNumFrames);
+}
+
+FrameProfiler::Readout FrameProfiler::getReadout(Stage stage) const {
+	Readout readout;
+	readout.min = 0;
+	readout.avg = 0.f;
+	readout.p99 = 0;
+
+	uint numFrames = getNumFrames();
+	if (numFrames == 0)
+		return readout;
+
+	uint32 times[kNumFrames];
+	uint32 total = 0;
+	for (uint i = 0; i < numFrames; ++i) {
+		times[i] = _frames[i][stage];
+		total += times[i];
+	}
+	Common::sort(times, times + numFrames);
+
+	readout.min = times[0];
+	readout.avg = total / (float)numFrames;
+	readout.p99 = times[(numFrames * 99 + 99) / 100 - 1];
+	return readout;
+}
+
+uint32 FrameProfiler::getLastFrameTime(Stage stage) const {
+	if (_frameCount == 0)
+		return 0;
+	return _frames[(_frameCount - 1) % kNumFrames][stage];
+}
+
+const char *FrameProfiler::getStageName(Stage stage) {
+	return stageNames[stage];
+}
+
+void FrameProfiler::drawOverlay() const {
+	Color color(255, 255, 255);
+	g_driver->drawEmergString(10, 25, "stage          min    avg    p99", color);
+	for (int i = 0; i < kNumStages; ++i) {
+		Readout r = getReadout((Stage)i);
+		Common::String line = Common::String::format("%-12s %5d %6.1f %6d", stageNames[i], r.min, r.avg, r.p99);
+		g_driver->drawEmergString(10, 25 + (i + 1) * 14, line.c_str(), color);
+	}
+}
+
+bool FrameProfiler::writeCSV(const Common::String &filename) const {
+	Common::OutSaveFile *file = g_system->getSavefileManager()->openForSaving(filename, false);
+	if (!file)
+		return false;
+
+	Common::String line("frame");
+	for (int i = 0; i < kNumStages; ++i)
+		line += Common::String::format(",%s", stageNames[i]);
+	file->writeString(line + "\n");
+
+	// The oldest frame first.
+	uint numFrames = getNumFrames();
+	uint32 first = _frameCount - numFrames;
+	for (uint32 frame = first; frame < _frameCount; ++frame) {
+		line = Common::String::format("%d", frame);
+		for (int i = 0; i < kNumStages; ++i)
+			line += Common::String::format(",%d", _frames[frame % kNumFrames][i]);
+		file->writeString(line + "\n");
+	}
+
+	file->finalize();
+	bool ok = !file->err();
+	delete file;
+	return ok;
+}
+
+ProfileScope::ProfileScope(FrameProfiler::Stage stage) :
+		_stage(stage), _start(0) {
+	_active = g_profiler && g_profiler->isEnabled();
+	if (_active)
+		_start = g_system->getRealMillis();
+}
+
+ProfileScope::~ProfileScope() {
+	if (_active)
+		g_profiler->addTime(_stage, _start);
+}
+
+} // end of namespace Grim
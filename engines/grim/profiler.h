@@ -0,0 +1,125 @@
+/* ResidualVM - A 3D game interpreter
+ *
+ * ResidualVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef GRIM_PROFILER_H
+#define GRIM_PROFILER_H
+
+#include "common/str.h"
+
+namespace Grim {
+
+/**
+ * Times the stages of the main loop, frame after frame.
+ *
+ * The time spent in each stage during a frame is summed up, and stored at the
+ * end of the frame in a ring of the last kNumFrames frames, from which the
+ * readouts are computed. The iMuse callback runs on the timer thread: it only
+ * adds to its own running total, which the main thread reads at the end of
+ * the frame, so no lock is needed.
+ *
+ * The times are in milliseconds, the resolution of OSystem::getRealMillis().
+ */
+class FrameProfiler {
+public:
+	enum Stage {
+		kStageEvents,
+		kStageLuaTasks,
+		kStageActorUpdate,
+		kStageTalkUpdate,
+		kStageBackground,
+		kStageBitmaps,
+		kStageActors,
+		kStageBuffers,
+		kStagePrimitives,
+		kStageFlip,
+		kStageMovie,
+		kStageIMuse,
+		kNumStages
+	};
+
+	struct Readout {
+		uint32 min;
+		float avg;
+		uint32 p99;
+	};
+
+	FrameProfiler();
+
+	void setEnabled(bool enabled);
+	bool isEnabled() const { return _enabled; }
+	void setOverlay(bool overlay) { _overlay = overlay; }
+	bool hasOverlay() const { return _enabled && _overlay; }
+
+	/** Add the time from start, a getRealMillis() value, to the stage. */
+	void addTime(Stage stage, uint32 start);
+	/** Store the times of the frame in the ring, and start a new one. */
+	void endFrame();
+	/** Forget all the frames stored so far. */
+	void reset();
+
+	/** The number of frames the readouts are computed on. */
+	uint getNumFrames() const;
+	Readout getReadout(Stage stage) const;
+	/** The time spent in the stage in the last frame stored. */
+	uint32 getLastFrameTime(Stage stage) const;
+	static const char *getStageName(Stage stage);
+
+	/** Draw the readouts on the screen, with GfxBase::drawEmergString(). */
+	void drawOverlay() const;
+	/** Write the times of the stored frames to a file in the save path. */
+	bool writeCSV(const Common::String &filename) const;
+
+private:
+	static const uint kNumFrames = 512;
+
+	bool _enabled;
+	bool _overlay;
+	uint32 _current[kNumStages];
+	uint32 _frames[kNumFrames][kNumStages];
+	// The number of frames stored since the last reset, the next one goes to
+	// _frames[_frameCount % kNumFrames].
+	uint32 _frameCount;
+	// Only written by the timer thread.
+	volatile uint32 _imuseTotal;
+	uint32 _imuseTotalAtFrameStart;
+};
+
+extern FrameProfiler *g_profiler;
+
+/**
+ * Add the time spent in the scope to a stage of the profiler, if it is
+ * enabled.
+ */
+class ProfileScope {
+public:
+	ProfileScope(FrameProfiler::Stage stage);
+	~ProfileScope();
+
+private:
+	FrameProfiler::Stage _stage;
+	uint32 _start;
+	bool _active;
+};
+
+} // end of namespace Grim
+
+#endif
@@ -42,6 +42,7 @@
 #include "engines/grim/emi/modelemi.h"
 #include "engines/grim/emi/skeleton.h"
 #include "engines/grim/patchr.h"
+#include "engines/grim/textsplit.h"
 #include "engines/grim/md5check.h"
 #include "engines/grim/update/update.h"
 
@@ -50,6 +51,7 @@
 #include "common/memstream.h"
 #include "common/file.h"
 #include "common/config-manager.h"
+#include "common/system.h"
 
 namespace Grim {
 
@@ -70,9 +72,29 @@ public:
 	}
 };
 
+/**
+ * A read stream over a cached resource. It holds a reference to the data,
+ * so it stays valid even if the entry is evicted while the stream is in use.
+ */
+class CachedResourceStream : public Common::MemoryReadStream {
+public:
+	CachedResourceStream(const Common::SharedPtr<byte> &data, uint32 len) :
+		Common::MemoryReadStream(data.get(), len), _data(data) {}
+
+private:
+	Common::SharedPtr<byte> _data;
+};
+
+// The cached data is allocated with malloc(), like the buffers Lab::readMember() hands over.
+struct ResourceDataDeleter {
+	void operator()(byte *ptr) { free(ptr); }
+};
+
 ResourceLoader::ResourceLoader() {
-	_cacheDirty = false;
+	_cacheHead = _cacheTail = NULL;
 	_cacheMemorySize = 0;
+	_cacheBudget = MAX(ConfMan.getInt("resource_cache_size"), 0) * 1024;
+	_cacheHits = _cacheMisses = _cacheEvictions = 0;
 
 	Lab *l;
 	Common::ArchiveMemberList files, updFiles;
@@ -196,63 +218,90 @@ ResourceLoader::ResourceLoader() {
 			continue;
 
 		l = new Lab();
-		if (l->open(filename))
+		if (l->open(filename)) {
 			SearchMan.add(filename, l, priority--, true);
-		else
+			_labs.push_back(l);
+		} else
 			delete l;
 	}
 
 	files.clear();
 }
 
-template<typename T>
-void clearList(Common::List<T> &list) {
-	while (!list.empty()) {
-		T p = list.front();
-		list.erase(list.begin());
-		delete p;
-	}
+Common::String makeResourceKey(const Common::String &filename, const CMap *cmap) {
+	if (!cmap)
+		return filename;
+	// '|' never appears in resource filenames.
+	return filename + "|" + cmap->getFilename();
 }
 
 ResourceLoader::~ResourceLoader() {
-	for (Common::Array<ResourceCache>::iterator i = _cache.begin(); i != _cache.end(); ++i) {
-		ResourceCache &r = *i;
-		delete[] r.fname;
-		delete[] r.resPtr;
-	}
-	clearList(_models);
-	clearList(_colormaps);
-	clearList(_keyframeAnims);
-	clearList(_lipsyncs);
+	for (CacheMap::iterator i = _cache.begin(); i != _cache.end(); ++i)
+		delete i->_value;
+	_models.deleteAll();
+	_colormaps.deleteAll();
+	_keyframeAnims.deleteAll();
+	_lipsyncs.deleteAll();
 	MD5Check::clear();
 }
 
-static int sortCallback(const void *entry1, const void *entry2) {
-	return scumm_stricmp(((const ResourceLoader::ResourceCache *)entry1)->fname, ((const ResourceLoader::ResourceCache *)entry2)->fname);
-}
-
 Common::SeekableReadStream *ResourceLoader::getFileFromCache(const Common::String &filename) const {
-	ResourceLoader::ResourceCache *entry = getEntryFromCache(filename);
-	if (!entry)
+	CacheMap::const_iterator i = _cache.find(filename);
+	if (i == _cache.end()) {
+		++_cacheMisses;
 		return NULL;
+	}
 
-	return new Common::MemoryReadStream(entry->resPtr, entry->len);
+	ResourceCache *entry = i->_value;
+	++_cacheHits;
+	entry->prefetched = false;
+	if (entry != _cacheHead) {
+		unlinkCacheEntry(entry);
+		linkCacheEntry(entry);
+	}
 
+	return new CachedResourceStream(entry->resPtr, entry->len);
 }
 
-ResourceLoader::ResourceCache *ResourceLoader::getEntryFromCache(const Common::String &filename) const {
-	if (_cache.empty())
+Common::SeekableReadStream *ResourceLoader::takePrefetchedFile(const Common::String &filename) const {
+	CacheMap::const_iterator i = _cache.find(filename);
+	if (i == _cache.end() || !i->_value->prefetched)
 		return NULL;
 
-	if (_cacheDirty) {
-		qsort(_cache.begin(), _cache.size(), sizeof(ResourceCache), sortCallback);
-		_cacheDirty = false;
-	}
+	// Files opened without caching are only read once, so drop the entry.
+	ResourceCache *entry = i->_value;
+	Common::SeekableReadStream *s = new CachedResourceStream(entry->resPtr, entry->len);
+	removeFromCache(entry);
+	return s;
+}
 
-	ResourceCache key;
-	key.fname = const_cast<char *>(filename.c_str());
+void ResourceLoader::linkCacheEntry(ResourceCache *entry) const {
+	entry->prev = NULL;
+	entry->next = _cacheHead;
+	if (_cacheHead)
+		_cacheHead->prev = entry;
+	else
+		_cacheTail = entry;
+	_cacheHead = entry;
+}
 
-	return (ResourceLoader::ResourceCache *)bsearch(&key, _cache.begin(), _cache.size(), sizeof(ResourceCache), sortCallback);
+void ResourceLoader::unlinkCacheEntry(ResourceCache *entry) const {
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		_cacheHead = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		_cacheTail = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+
+void ResourceLoader::removeFromCache(ResourceCache *entry) const {
+	unlinkCacheEntry(entry);
+	_cache.erase(entry->fname);
+	_cacheMemorySize -= entry->len;
+	delete entry;
 }
 
 Common::SeekableReadStream *ResourceLoader::loadFile(const Common::String &filename) const {
@@ -266,6 +315,36 @@ Common::SeekableReadStream *ResourceLoader::loadFile(const Common::String &filen
 	return rs;
 }
 
+// Reads a whole file into a buffer for the cache. A file that comes from one
+// of our LAB archives, and has no patch, is read straight into the buffer
+// the cache keeps, instead of being copied out of a member stream.
+Common::SharedPtr<byte> ResourceLoader::loadFileData(const Common::String &filename, uint32 &len) const {
+	Common::ArchiveMemberPtr member = SearchMan.getMember(filename);
+	if (!member)
+		return Common::SharedPtr<byte>();
+
+	if (!SearchMan.hasFile(filename + ".patchr")) {
+		for (uint i = 0; i < _labs.size(); ++i) {
+			if (_labs[i]->getMember(filename).get() != member.get())
+				continue;
+			byte *data = _labs[i]->readMember(filename, len);
+			if (!data)
+				return Common::SharedPtr<byte>();
+			return Common::SharedPtr<byte>(data, ResourceDataDeleter());
+		}
+	}
+
+	Common::SeekableReadStream *s = loadFile(filename);
+	if (!s)
+		return Common::SharedPtr<byte>();
+
+	len = s->size();
+	byte *data = (byte *)malloc(len ? len : 1);
+	s->read(data, len);
+	delete s;
+	return Common::SharedPtr<byte>(data, ResourceDataDeleter());
+}
+
 Common::SeekableReadStream *ResourceLoader::openNewStreamFile(Common::String fname, bool cache) const {
 	Common::SeekableReadStream *s;
 	fname.toLowercase();
@@ -273,33 +352,117 @@ Common::SeekableReadStream *ResourceLoader::openNewStreamFile(Common::String fna
 	if (cache) {
 		s = getFileFromCache(fname);
 		if (!s) {
-			s = loadFile(fname);
-			if (!s)
+			uint32 size;
+			Common::SharedPtr<byte> buf = loadFileData(fname, size);
+			if (!buf)
 				return NULL;
 
-			uint32 size = s->size();
-			byte *buf = new byte[size];
-			s->read(buf, size);
 			putIntoCache(fname, buf, size);
-			delete s;
-			s = new Common::MemoryReadStream(buf, size);
+			s = new CachedResourceStream(buf, size);
 		}
 	} else {
-		s = loadFile(fname);
+		s = takePrefetchedFile(fname);
+		if (!s)
+			s = loadFile(fname);
 	}
 	// This will only have an effect if the stream is actually compressed.
 	return Common::wrapCompressedReadStream(s);
 }
 
-void ResourceLoader::putIntoCache(const Common::String &fname, byte *res, uint32 len) const {
-	ResourceCache entry;
-	entry.resPtr = res;
-	entry.len = len;
-	entry.fname = new char[fname.size() + 1];
-	strcpy(entry.fname, fname.c_str());
+void ResourceLoader::putIntoCache(const Common::String &fname, const Common::SharedPtr<byte> &res, uint32 len, bool prefetched) const {
+	CacheMap::iterator i = _cache.find(fname);
+	if (i != _cache.end())
+		removeFromCache(i->_value);
+
+	ResourceCache *entry = new ResourceCache;
+	entry->fname = fname;
+	entry->resPtr = res;
+	entry->len = len;
+	entry->prefetched = prefetched;
+	linkCacheEntry(entry);
+	_cache[fname] = entry;
 	_cacheMemorySize += len;
-	_cache.push_back(entry);
-	_cacheDirty = true;
+
+	if (_cacheBudget == 0)
+		return;
+
+	// Evict from the cold end, but never the entry we just added.
+	while (_cacheMemorySize > _cacheBudget && _cacheTail != entry) {
+		removeFromCache(_cacheTail);
+		++_cacheEvictions;
+	}
+}
+
+void ResourceLoader::prefetch(const Common::String &fname) {
+	queuePrefetch(fname, false);
+}
+
+void ResourceLoader::prefetchSet(const Common::String &setName) {
+	Common::String filename(setName);
+	// EMI-scripts refer to their .setb files as .set
+	if (g_grim->getGameType() == GType_MONKEY4)
+		filename += "b";
+	queuePrefetch(filename, true);
+}
+
+void ResourceLoader::queuePrefetch(const Common::String &fname, bool isSet) {
+	PrefetchRequest r;
+	r.fname = fname;
+	r.fname.toLowercase();
+	r.isSet = isSet;
+	if (!_cache.contains(r.fname))
+		_prefetchQueue.push(r);
+}
+
+void ResourceLoader::queueSetReferences(const Common::String &fname, const byte *data, uint32 len) {
+	if (len < 7 || memcmp(data, "section", 7) != 0)
+		return;
+
+	// Text sets name their colormaps, backgrounds and object art one per
+	// line; see Set::loadText() and Set::Setup::load().
+	Common::MemoryReadStream stream(data, len);
+	TextSplitter ts(fname, &stream);
+	for (; !ts.isEof(); ts.nextLine()) {
+		char key[32], name1[256], name2[256], name3[256];
+		int n = sscanf(ts.getCurrentLine(), " %31s %255s %255s %255s", key, name1, name2, name3);
+		if (n < 2)
+			continue;
+
+		if (strcmp(key, "colormap") == 0) {
+			if (!_colormaps.find(makeResourceKey(name1)))
+				queuePrefetch(name1, false);
+		} else if (strcmp(key, "background") == 0) {
+			queuePrefetch(name1, false);
+		} else if (strcmp(key, "zbuffer") == 0) {
+			if (strcmp(name1, "<none>.lbm") != 0)
+				queuePrefetch(name1, false);
+		} else if (strcmp(key, "object_art") == 0) {
+			if (n >= 3)
+				queuePrefetch(name2, false);
+			if (n >= 4)
+				queuePrefetch(name3, false);
+		}
+	}
+}
+
+void ResourceLoader::processPrefetchQueue(uint32 msecs) {
+	uint32 start = g_system->getMillis();
+	while (!_prefetchQueue.empty() && g_system->getMillis() - start < msecs) {
+		PrefetchRequest r = _prefetchQueue.pop();
+		if (_cache.contains(r.fname))
+			continue;
+
+		uint32 size;
+		Common::SharedPtr<byte> buf = loadFileData(r.fname, size);
+		if (!buf) {
+			Debug::debug(Debug::Engine, "Could not prefetch %s", r.fname.c_str());
+			continue;
+		}
+
+		putIntoCache(r.fname, buf, size, true);
+		if (r.isSet)
+			queueSetReferences(r.fname, buf.get(), size);
+	}
 }
 
 CMap *ResourceLoader::loadColormap(const Common::String &filename) {
@@ -309,7 +472,7 @@ CMap *ResourceLoader::loadColormap(const Common::String &filename) {
 	}
 
 	CMap *result = new CMap(filename, stream);
-	_colormaps.push_back(result);
+	_colormaps.add(makeResourceKey(filename), result);
 	delete stream;
 
 	return result;
@@ -373,7 +536,7 @@ KeyframeAnim *ResourceLoader::loadKeyframe(const Common::String &filename) {
 		error("Could not find keyframe file %s", filename.c_str());
 
 	KeyframeAnim *result = new KeyframeAnim(filename, stream);
-	_keyframeAnims.push_back(result);
+	_keyframeAnims.add(makeResourceKey(filename), result);
 	delete stream;
 
 	return result;
@@ -391,7 +554,7 @@ LipSync *ResourceLoader::loadLipSync(const Common::String &filename) {
 
 	// Some lipsync files have no data
 	if (result->isValid())
-		_lipsyncs.push_back(result);
+		_lipsyncs.add(makeResourceKey(filename), result);
 	else {
 		delete result;
 		result = NULL;
@@ -434,7 +597,7 @@ Model *ResourceLoader::loadModel(const Common::String &filename, CMap *c, Model
 		error("Could not find model %s", filename.c_str());
 
 	Model *result = new Model(filename, stream, c, parent);
-	_models.push_back(result);
+	_models.add(makeResourceKey(filename, c), result);
 	delete stream;
 
 	return result;
@@ -509,29 +672,20 @@ AnimationEmi *ResourceLoader::loadAnimationEmi(const Common::String &filename) {
 }
 
 void ResourceLoader::uncache(const char *filename) const {
-	Common::String fname = filename;
-	fname.toLowercase();
-
-	if (_cacheDirty) {
-		qsort(_cache.begin(), _cache.size(), sizeof(ResourceCache), sortCallback);
-		_cacheDirty = false;
-	}
-
-	for (unsigned int i = 0; i < _cache.size(); i++) {
-		if (fname.compareTo(_cache[i].fname) == 0) {
-			delete[] _cache[i].fname;
-			_cacheMemorySize -= _cache[i].len;
-			delete[] _cache[i].resPtr;
-			_cache.remove_at(i);
-			_cacheDirty = true;
-		}
-	}
+	CacheMap::iterator i = _cache.find(filename);
+	if (i != _cache.end())
+		removeFromCache(i->_value);
 }
 
 void ResourceLoader::uncacheModel(Model *m) {
 	_models.remove(m);
 }
 
+void ResourceLoader::recacheModel(Model *m) {
+	_models.remove(m);
+	_models.add(makeResourceKey(m->getFilename(), m->getCMap()), m);
+}
+
 void ResourceLoader::uncacheColormap(CMap *c) {
 	_colormaps.remove(c);
 }
@@ -545,53 +699,33 @@ void ResourceLoader::uncacheLipSync(LipSync *s) {
 }
 
 ModelPtr ResourceLoader::getModel(const Common::String &fname, CMap *c) {
-	Common::String filename = fname;
-	filename.toLowercase();
-	for (Common::List<Model *>::const_iterator i = _models.begin(); i != _models.end(); ++i) {
-		Model *m = *i;
-		if (filename == m->getFilename() && *m->getCMap() == *c) {
-			return m;
-		}
-	}
+	Model *m = _models.find(makeResourceKey(fname, c));
+	if (m)
+		return m;
 
 	return loadModel(fname, c);
 }
 
 CMapPtr ResourceLoader::getColormap(const Common::String &fname) {
-	Common::String filename = fname;
-	filename.toLowercase();
-	for (Common::List<CMap *>::const_iterator i = _colormaps.begin(); i != _colormaps.end(); ++i) {
-		CMap *c = *i;
-		if (filename.equals(c->_fname)) {
-			return c;
-		}
-	}
+	CMap *c = _colormaps.find(makeResourceKey(fname));
+	if (c)
+		return c;
 
 	return loadColormap(fname);
 }
 
 KeyframeAnimPtr ResourceLoader::getKeyframe(const Common::String &fname) {
-	Common::String filename = fname;
-	filename.toLowercase();
-	for (Common::List<KeyframeAnim *>::const_iterator i = _keyframeAnims.begin(); i != _keyframeAnims.end(); ++i) {
-		KeyframeAnim *k = *i;
-		if (filename == k->getFilename()) {
-			return k;
-		}
-	}
+	KeyframeAnim *k = _keyframeAnims.find(makeResourceKey(fname));
+	if (k)
+		return k;
 
 	return loadKeyframe(fname);
 }
 
 LipSyncPtr ResourceLoader::getLipSync(const Common::String &fname) {
-	Common::String filename = fname;
-	filename.toLowercase();
-	for (Common::List<LipSync *>::const_iterator i = _lipsyncs.begin(); i != _lipsyncs.end(); ++i) {
-		LipSync *l = *i;
-		if (filename == l->getFilename()) {
-			return l;
-		}
-	}
+	LipSync *l = _lipsyncs.find(makeResourceKey(fname));
+	if (l)
+		return l;
 
 	return loadLipSync(fname);
 }
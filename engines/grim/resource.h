@@ -25,6 +25,10 @@
 
 #include "common/archive.h"
 #include "common/array.h"
+#include "common/hashmap.h"
+#include "common/hash-str.h"
+#include "common/ptr.h"
+#include "common/queue.h"
 
 #include "engines/grim/object.h"
 
@@ -53,6 +57,75 @@ typedef ObjectPtr<KeyframeAnim> KeyframeAnimPtr;
 typedef ObjectPtr<Font> FontPtr;
 typedef ObjectPtr<LipSync> LipSyncPtr;
 
+/**
+ * Build a ResourceRegistry key from a resource filename and, for resources
+ * whose contents depend on it, the colormap it was loaded with.
+ */
+Common::String makeResourceKey(const Common::String &filename, const CMap *cmap = NULL);
+
+/**
+ * Index of loaded resources by key (see makeResourceKey()). Keys are
+ * compared case-insensitively. Several live resources may share a key;
+ * find() returns the oldest one.
+ */
+template<class T>
+class ResourceRegistry {
+public:
+	T *find(const Common::String &key) const {
+		typename EntryMap::const_iterator i = _entries.find(key);
+		if (i == _entries.end())
+			return NULL;
+		return i->_value.front();
+	}
+
+	void add(const Common::String &key, T *resource) {
+		_entries[key].push_back(resource);
+		_keys[resource] = key;
+	}
+
+	void remove(T *resource) {
+		typename KeyMap::iterator k = _keys.find(resource);
+		if (k == _keys.end())
+			return;
+
+		typename EntryMap::iterator i = _entries.find(k->_value);
+		Common::Array<T *> &list = i->_value;
+		for (uint j = 0; j < list.size(); ++j) {
+			if (list[j] == resource) {
+				list.remove_at(j);
+				break;
+			}
+		}
+		if (list.empty())
+			_entries.erase(i);
+		_keys.erase(k);
+	}
+
+	bool empty() const { return _keys.empty(); }
+	uint size() const { return _keys.size(); }
+
+	/** Delete every registered resource. */
+	void deleteAll() {
+		Common::Array<T *> resources;
+		for (typename KeyMap::iterator i = _keys.begin(); i != _keys.end(); ++i)
+			resources.push_back(i->_key);
+		_keys.clear();
+		_entries.clear();
+		for (uint i = 0; i < resources.size(); ++i)
+			delete resources[i];
+	}
+
+private:
+	struct PtrHash {
+		uint operator()(const T *p) const { return (uint)((size_t)p >> 3); }
+	};
+
+	typedef Common::HashMap<Common::String, Common::Array<T *>, Common::IgnoreCase_Hash, Common::IgnoreCase_EqualTo> EntryMap;
+	typedef Common::HashMap<T *, Common::String, PtrHash> KeyMap;
+	EntryMap _entries;
+	KeyMap _keys;
+};
+
 class ResourceLoader {
 public:
 	ResourceLoader();
@@ -76,34 +149,89 @@ public:
 	KeyframeAnimPtr getKeyframe(const Common::String &fname);
 	LipSyncPtr getLipSync(const Common::String &fname);
 	void uncacheModel(Model *m);
+	/** Index the model again under the colormap it now uses. */
+	void recacheModel(Model *m);
 	void uncacheColormap(CMap *c);
 	void uncacheKeyframe(KeyframeAnim *kf);
 	void uncacheLipSync(LipSync *l);
 
+	static Common::String fixFilename(const Common::String &filename, bool append = true);
+
+	/**
+	 * The file cache holds the raw data of resources opened with
+	 * openNewStreamFile(fname, true). Once its size grows past the budget
+	 * (the "resource_cache_size" setting, in KB, 0 meaning unlimited) the
+	 * least recently used entries are dropped.
+	 */
+	uint32 getCacheMemorySize() const { return _cacheMemorySize; }
+	uint32 getCacheBudget() const { return _cacheBudget; }
+	uint32 getCacheEntryCount() const { return _cache.size(); }
+	uint32 getCacheHits() const { return _cacheHits; }
+	uint32 getCacheMisses() const { return _cacheMisses; }
+	uint32 getCacheEvictions() const { return _cacheEvictions; }
+
+	/**
+	 * Queue a file to be read into the file cache before it is needed.
+	 * The first openNewStreamFile() of the file is then served from memory.
+	 */
+	void prefetch(const Common::String &fname);
+	/**
+	 * Queue a set file, and the colormaps and bitmaps it refers to, for
+	 * prefetching.
+	 */
+	void prefetchSet(const Common::String &setName);
+	/**
+	 * Read queued files until the queue is empty or about msecs have passed.
+	 * The main loop calls this with the spare time of each frame.
+	 */
+	void processPrefetchQueue(uint32 msecs);
+	bool hasPendingPrefetch() const { return !_prefetchQueue.empty(); }
+
+private:
 	struct ResourceCache {
-		char *fname;
-		byte *resPtr;
+		Common::String fname;
+		Common::SharedPtr<byte> resPtr;
 		uint32 len;
+		// Prefetched and not opened yet.
+		bool prefetched;
+		// Recency list, most recently used first.
+		ResourceCache *prev, *next;
 	};
+	typedef Common::HashMap<Common::String, ResourceCache *, Common::IgnoreCase_Hash, Common::IgnoreCase_EqualTo> CacheMap;
 
-	static Common::String fixFilename(const Common::String &filename, bool append = true);
-
-private:
 	Common::SeekableReadStream *loadFile(const Common::String &filename) const;
+	Common::SharedPtr<byte> loadFileData(const Common::String &filename, uint32 &len) const;
 	Common::SeekableReadStream *getFileFromCache(const Common::String &filename) const;
-	ResourceLoader::ResourceCache *getEntryFromCache(const Common::String &filename) const;
-	void putIntoCache(const Common::String &fname, byte *res, uint32 len) const;
+	Common::SeekableReadStream *takePrefetchedFile(const Common::String &filename) const;
+	void putIntoCache(const Common::String &fname, const Common::SharedPtr<byte> &res, uint32 len, bool prefetched = false) const;
 	void uncache(const char *fname) const;
+	void removeFromCache(ResourceCache *entry) const;
+	void linkCacheEntry(ResourceCache *entry) const;
+	void unlinkCacheEntry(ResourceCache *entry) const;
+
+	mutable CacheMap _cache;
+	mutable ResourceCache *_cacheHead, *_cacheTail;
+	mutable uint32 _cacheMemorySize;
+	uint32 _cacheBudget;
+	mutable uint32 _cacheHits, _cacheMisses, _cacheEvictions;
+
+	struct PrefetchRequest {
+		Common::String fname;
+		bool isSet;
+	};
+	void queuePrefetch(const Common::String &fname, bool isSet);
+	void queueSetReferences(const Common::String &fname, const byte *data, uint32 len);
+
+	Common::Queue<PrefetchRequest> _prefetchQueue;
 
-	mutable Common::Array<ResourceCache> _cache;
-	mutable bool _cacheDirty;
-	mutable int32 _cacheMemorySize;
+	// The archives opened by the constructor; SearchMan owns them.
+	Common::Array<Lab *> _labs;
 
 	Common::List<EMIModel *> _emiModels;
-	Common::List<Model *> _models;
-	Common::List<CMap *> _colormaps;
-	Common::List<KeyframeAnim *> _keyframeAnims;
-	Common::List<LipSync *> _lipsyncs;
+	ResourceRegistry<Model> _models;
+	ResourceRegistry<CMap> _colormaps;
+	ResourceRegistry<KeyframeAnim> _keyframeAnims;
+	ResourceRegistry<LipSync> _lipsyncs;
 };
 
 extern ResourceLoader *g_resourceloader;
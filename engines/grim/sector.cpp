@@ -411,6 +411,20 @@ Common::List<Math::Line3d> Sector::getBridgesTo(Sector *sector) const {
 	return bridges;
 }
 
+void Sector::getWalkPlaneBounds(Math::Vector2d &min, Math::Vector2d &max) const {
+	// The vertical axis is Y in EMI and Z in Grim.
+	const int axis = (g_grim->getGameType() == GType_MONKEY4) ? 2 : 1;
+	min = max = Math::Vector2d(_vertices[0].x(), _vertices[0].getValue(axis));
+	for (int i = 1; i < _numVertices; i++) {
+		float x = _vertices[i].x();
+		float y = _vertices[i].getValue(axis);
+		min.setX(MIN(min.getX(), x));
+		min.setY(MIN(min.getY(), y));
+		max.setX(MAX(max.getX(), x));
+		max.setY(MAX(max.getY(), y));
+	}
+}
+
 Math::Vector3d Sector::getProjectionToPlane(const Math::Vector3d &point) const {
 	if (_normal.getMagnitude() == 0)
 		error("Sector normal is (0,0,0)");
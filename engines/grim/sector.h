@@ -26,6 +26,7 @@
 #include "common/str.h"
 #include "common/list.h"
 
+#include "math/vector2d.h"
 #include "math/vector3d.h"
 #include "math/line3d.h"
 
@@ -75,6 +76,9 @@ public:
 
 	Math::Vector3d getClosestPoint(const Math::Vector3d &point) const;
 
+	// Bounding rectangle of the sector on the walk plane (XY for Grim, XZ for EMI).
+	void getWalkPlaneBounds(Math::Vector2d &min, Math::Vector2d &max) const;
+
 	// Interface to trace a ray to its exit from the polygon
 	struct ExitInfo {
 		Math::Vector3d exitPoint;
@@ -89,6 +93,7 @@ public:
 	int getNumVertices() { return _numVertices; }
 	Math::Vector3d *getVertices() const { return _vertices; }
 	Math::Vector3d getNormal() const { return _normal; }
+	float getHeight() const { return _height; }
 
 	Sector &operator=(const Sector &other);
 	bool operator==(const Sector &other) const;
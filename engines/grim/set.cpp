@@ -21,6 +21,7 @@
  */
 
 #include "common/foreach.h"
+#include "common/system.h"
 
 #include "engines/grim/debug.h"
 #include "engines/grim/set.h"
@@ -37,7 +38,8 @@
 namespace Grim {
 
 Set::Set(const Common::String &sceneName, Common::SeekableReadStream *data) :
-		_locked(false), _name(sceneName), _enableLights(false) {
+		_locked(false), _name(sceneName), _enableLights(false), _sectorGraphValid(false),
+		_sectorGridValid(false), _queryStamp(0), _recordSectorQueries(false) {
 
 	char header[7];
 	data->read(header, 7);
@@ -54,7 +56,8 @@ Set::Set() :
 		_cmaps(NULL), _locked(false), _enableLights(false), _numSetups(0),
 		_numLights(0), _numSectors(0), _numObjectStates(0), _minVolume(0),
 		_maxVolume(0), _numCmaps(0), _currSetup(NULL), _setups(NULL),
-		_lights(NULL), _sectors(NULL) {
+		_lights(NULL), _sectors(NULL), _sectorGraphValid(false), _sectorGridValid(false),
+		_queryStamp(0), _recordSectorQueries(false) {
 
 }
 
@@ -279,6 +282,8 @@ bool Set::restoreState(SaveGame *savedState) {
 	} else {
 		_sectors = NULL;
 	}
+	_sectorGraphValid = false;
+	_sectorGridValid = false;
 
 	_numLights = savedState->readLESint32();
 	_lights = new Light[_numLights];
@@ -575,6 +580,7 @@ public:
 		float d1 = (l1->_pos - _pos).getSquareMagnitude();
 		float d2 = (l2->_pos - _pos).getSquareMagnitude();
 		if (d1 == d2) {
+			// _id is the index of the light in the set, not a pool id.
 			return l1->_id < l2->_id;
 		}
 
@@ -652,7 +658,243 @@ void Set::drawBitmaps(ObjectState::Position stage) {
 	}
 }
 
+static Math::Vector2d toWalkPlane(const Math::Vector3d &v) {
+	// The vertical axis is Y in EMI and Z in Grim.
+	if (g_grim->getGameType() == GType_MONKEY4)
+		return Math::Vector2d(v.x(), v.z());
+	return Math::Vector2d(v.x(), v.y());
+}
+
+// Distance on the walk plane from p to the rectangle [min, max].
+static float distanceToBounds(const Math::Vector2d &p, const Math::Vector2d &min, const Math::Vector2d &max) {
+	float dx = MAX(MAX(min.getX() - p.getX(), p.getX() - max.getX()), 0.f);
+	float dy = MAX(MAX(min.getY() - p.getY(), p.getY() - max.getY()), 0.f);
+	return sqrt(dx * dx + dy * dy);
+}
+
+void Set::buildSectorGrid() {
+	const int numSectors = MAX(_numSectors, 0);
+	_sectorBoundsMin.resize(numSectors);
+	_sectorBoundsMax.resize(numSectors);
+	_sectorQueryStamp.resize(numSectors);
+	_unboundedSectors.clear();
+	_gridSectors.clear();
+
+	// Rectangles a point must be in to be inside each sector. isPointInSector()
+	// projects the point along the sector's normal, so on a sloped sector the
+	// point may be off the polygon's bounds by up to height * sin(slope).
+	// Sectors where that isn't bounded are kept apart and always tested.
+	Common::Array<Math::Vector2d> cellMin, cellMax;
+	cellMin.resize(numSectors);
+	cellMax.resize(numSectors);
+	bool haveBounds = false;
+	Math::Vector2d gridMin, gridMax;
+	for (int i = 0; i < numSectors; i++) {
+		Sector *sector = _sectors[i];
+		sector->getWalkPlaneBounds(_sectorBoundsMin[i], _sectorBoundsMax[i]);
+		_sectorQueryStamp[i] = 0;
+
+		Math::Vector3d normal = sector->getNormal();
+		float normalLength = normal.getMagnitude();
+		float sinSlope = 1.f;
+		if (normalLength > 0.f) {
+			Math::Vector2d horizontal = toWalkPlane(normal);
+			sinSlope = horizontal.getMagnitude() / normalLength;
+		}
+
+		float margin;
+		if (normalLength == 0.f || (sector->getHeight() >= 9000.f && sinSlope > 1e-6f)) {
+			_unboundedSectors.push_back(i);
+			margin = 0.01f;
+		} else if (sector->getHeight() >= 9000.f) {
+			margin = 0.01f;
+		} else {
+			margin = (sector->getHeight() + 0.01f) * sinSlope + 0.01f;
+		}
+
+		cellMin[i] = _sectorBoundsMin[i] - Math::Vector2d(margin, margin);
+		cellMax[i] = _sectorBoundsMax[i] + Math::Vector2d(margin, margin);
+		if (!haveBounds) {
+			gridMin = cellMin[i];
+			gridMax = cellMax[i];
+			haveBounds = true;
+		} else {
+			gridMin.setX(MIN(gridMin.getX(), cellMin[i].getX()));
+			gridMin.setY(MIN(gridMin.getY(), cellMin[i].getY()));
+			gridMax.setX(MAX(gridMax.getX(), cellMax[i].getX()));
+			gridMax.setY(MAX(gridMax.getY(), cellMax[i].getY()));
+		}
+	}
+
+	// About one sector per cell.
+	int side = 1;
+	while (side * side < numSectors && side < 32)
+		++side;
+	_gridWidth = _gridHeight = side;
+	_gridOrigin = gridMin;
+	_gridCellWidth = MAX((gridMax.getX() - gridMin.getX()) / _gridWidth, 0.01f);
+	_gridCellHeight = MAX((gridMax.getY() - gridMin.getY()) / _gridHeight, 0.01f);
+
+	const int numCells = _gridWidth * _gridHeight;
+	Common::Array<uint> cellCount;
+	cellCount.resize(numCells);
+	for (int c = 0; c < numCells; c++)
+		cellCount[c] = 0;
+
+	// Two passes: count the sectors of each cell, then fill them in, so
+	// every cell lists its sectors in index order.
+	for (int pass = 0; pass < 2; pass++) {
+		if (pass == 1) {
+			_gridCellStart.resize(numCells + 1);
+			_gridCellStart[0] = 0;
+			for (int c = 0; c < numCells; c++)
+				_gridCellStart[c + 1] = _gridCellStart[c] + cellCount[c];
+			_gridSectors.resize(_gridCellStart[numCells]);
+			for (int c = 0; c < numCells; c++)
+				cellCount[c] = _gridCellStart[c];
+		}
+
+		for (int i = 0; i < numSectors; i++) {
+			int x0 = CLIP<int>((int)((cellMin[i].getX() - _gridOrigin.getX()) / _gridCellWidth), 0, _gridWidth - 1);
+			int x1 = CLIP<int>((int)((cellMax[i].getX() - _gridOrigin.getX()) / _gridCellWidth), 0, _gridWidth - 1);
+			int y0 = CLIP<int>((int)((cellMin[i].getY() - _gridOrigin.getY()) / _gridCellHeight), 0, _gridHeight - 1);
+			int y1 = CLIP<int>((int)((cellMax[i].getY() - _gridOrigin.getY()) / _gridCellHeight), 0, _gridHeight - 1);
+			for (int y = y0; y <= y1; y++) {
+				for (int x = x0; x <= x1; x++) {
+					int c = y * _gridWidth + x;
+					if (pass == 0)
+						cellCount[c]++;
+					else
+						_gridSectors[cellCount[c]++] = i;
+				}
+			}
+		}
+	}
+
+	_sectorGridValid = true;
+}
+
 Sector *Set::findPointSector(const Math::Vector3d &p, Sector::SectorType type) {
+	if (_recordSectorQueries)
+		_recordedSectorQueries.push_back(p);
+	if (_numSectors <= 0)
+		return NULL;
+	if (!_sectorGridValid)
+		buildSectorGrid();
+
+	// Like a scan of all the sectors, return the first match by index.
+	int result = _numSectors;
+	for (uint i = 0; i < _unboundedSectors.size() && _unboundedSectors[i] < result; i++) {
+		Sector *sector = _sectors[_unboundedSectors[i]];
+		if ((sector->getType() & type) && sector->isVisible() && sector->isPointInSector(p))
+			result = _unboundedSectors[i];
+	}
+
+	Math::Vector2d pos = toWalkPlane(p);
+	float fx = (pos.getX() - _gridOrigin.getX()) / _gridCellWidth;
+	float fy = (pos.getY() - _gridOrigin.getY()) / _gridCellHeight;
+	if (fx >= 0.f && fy >= 0.f && fx < _gridWidth && fy < _gridHeight) {
+		int c = (int)fy * _gridWidth + (int)fx;
+		for (uint i = _gridCellStart[c]; i < _gridCellStart[c + 1] && _gridSectors[i] < result; i++) {
+			Sector *sector = _sectors[_gridSectors[i]];
+			if ((sector->getType() & type) && sector->isVisible() && sector->isPointInSector(p)) {
+				result = _gridSectors[i];
+				break;
+			}
+		}
+	}
+
+	return result < _numSectors ? _sectors[result] : NULL;
+}
+
+void Set::findClosestSector(const Math::Vector3d &p, Sector **sect, Math::Vector3d *closestPoint) {
+	if (_recordSectorQueries)
+		_recordedSectorQueries.push_back(p);
+
+	int resultIdx = -1;
+	Math::Vector3d resultPt = p;
+	float minDist = 0.0;
+
+	if (_numSectors > 0) {
+		if (!_sectorGridValid)
+			buildSectorGrid();
+		if (++_queryStamp == 0) {
+			for (int i = 0; i < _numSectors; i++)
+				_sectorQueryStamp[i] = 0;
+			_queryStamp = 1;
+		}
+
+		// Ties go to the lowest index, as with a scan of all the sectors.
+		for (uint i = 0; i < _unboundedSectors.size(); i++) {
+			int idx = _unboundedSectors[i];
+			Sector *sector = _sectors[idx];
+			_sectorQueryStamp[idx] = _queryStamp;
+			if ((sector->getType() & Sector::WalkType) == 0 || !sector->isVisible())
+				continue;
+			Math::Vector3d closestPt = sector->getClosestPoint(p);
+			float thisDist = (closestPt - p).getMagnitude();
+			if (resultIdx < 0 || thisDist < minDist) {
+				resultIdx = idx;
+				resultPt = closestPt;
+				minDist = thisDist;
+			}
+		}
+
+		// Visit the cells in growing rings around the point's cell, until
+		// the ring is farther than the best sector found. The closest point
+		// of a sector is always within its bounds, so the distance to them
+		// is a lower bound of the sector's distance.
+		Math::Vector2d pos = toWalkPlane(p);
+		int cx = CLIP<int>((int)floor((pos.getX() - _gridOrigin.getX()) / _gridCellWidth), 0, _gridWidth - 1);
+		int cy = CLIP<int>((int)floor((pos.getY() - _gridOrigin.getY()) / _gridCellHeight), 0, _gridHeight - 1);
+		const float minCell = MIN(_gridCellWidth, _gridCellHeight);
+		const int maxRing = MAX(MAX(cx, _gridWidth - 1 - cx), MAX(cy, _gridHeight - 1 - cy));
+		for (int ring = 0; ring <= maxRing; ring++) {
+			if (resultIdx >= 0 && (ring - 1) * minCell - 0.01f > minDist)
+				break;
+
+			for (int y = cy - ring; y <= cy + ring; y++) {
+				if (y < 0 || y >= _gridHeight)
+					continue;
+				// Only the border of the ring.
+				int step = (y == cy - ring || y == cy + ring) ? 1 : MAX(2 * ring, 1);
+				for (int x = cx - ring; x <= cx + ring; x += step) {
+					if (x < 0 || x >= _gridWidth)
+						continue;
+					int c = y * _gridWidth + x;
+					for (uint i = _gridCellStart[c]; i < _gridCellStart[c + 1]; i++) {
+						int idx = _gridSectors[i];
+						if (_sectorQueryStamp[idx] == _queryStamp)
+							continue;
+						_sectorQueryStamp[idx] = _queryStamp;
+
+						Sector *sector = _sectors[idx];
+						if ((sector->getType() & Sector::WalkType) == 0 || !sector->isVisible())
+							continue;
+						if (resultIdx >= 0 && distanceToBounds(pos, _sectorBoundsMin[idx], _sectorBoundsMax[idx]) - 0.01f > minDist)
+							continue;
+
+						Math::Vector3d closestPt = sector->getClosestPoint(p);
+						float thisDist = (closestPt - p).getMagnitude();
+						if (resultIdx < 0 || thisDist < minDist || (thisDist == minDist && idx < resultIdx)) {
+							resultIdx = idx;
+							resultPt = closestPt;
+							minDist = thisDist;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	if (sect)
+		*sect = resultIdx >= 0 ? _sectors[resultIdx] : NULL;
+
+	if (closestPoint)
+		*closestPoint = resultPt;
+}
+
+Sector *Set::findPointSectorScan(const Math::Vector3d &p, Sector::SectorType type) {
 	for (int i = 0; i < _numSectors; i++) {
 		Sector *sector = _sectors[i];
 		if (sector && (sector->getType() & type) && sector->isVisible() && sector->isPointInSector(p))
@@ -661,7 +903,7 @@ Sector *Set::findPointSector(const Math::Vector3d &p, Sector::SectorType type) {
 	return NULL;
 }
 
-void Set::findClosestSector(const Math::Vector3d &p, Sector **sect, Math::Vector3d *closestPoint) {
+void Set::findClosestSectorScan(const Math::Vector3d &p, Sector **sect, Math::Vector3d *closestPoint) {
 	Sector *resultSect = NULL;
 	Math::Vector3d resultPt = p;
 	float minDist = 0.0;
@@ -686,11 +928,51 @@ void Set::findClosestSector(const Math::Vector3d &p, Sector **sect, Math::Vector
 		*closestPoint = resultPt;
 }
 
+bool Set::benchmarkSectorQueries(int iterations, uint32 &indexedMs, uint32 &scanMs) {
+	bool record = _recordSectorQueries;
+	_recordSectorQueries = false;
+
+	// Check that both ways agree first.
+	bool match = true;
+	for (uint i = 0; i < _recordedSectorQueries.size(); i++) {
+		const Math::Vector3d &p = _recordedSectorQueries[i];
+		Sector *s1, *s2;
+		Math::Vector3d p1, p2;
+		findClosestSector(p, &s1, &p1);
+		findClosestSectorScan(p, &s2, &p2);
+		if (s1 != s2 || !(p1 == p2) || findPointSector(p, Sector::WalkType) != findPointSectorScan(p, Sector::WalkType))
+			match = false;
+	}
+
+	uint32 start = g_system->getMillis();
+	for (int n = 0; n < iterations; n++) {
+		for (uint i = 0; i < _recordedSectorQueries.size(); i++) {
+			findPointSector(_recordedSectorQueries[i], Sector::WalkType);
+			findClosestSector(_recordedSectorQueries[i], NULL, NULL);
+		}
+	}
+	indexedMs = g_system->getMillis() - start;
+
+	start = g_system->getMillis();
+	for (int n = 0; n < iterations; n++) {
+		for (uint i = 0; i < _recordedSectorQueries.size(); i++) {
+			findPointSectorScan(_recordedSectorQueries[i], Sector::WalkType);
+			findClosestSectorScan(_recordedSectorQueries[i], NULL, NULL);
+		}
+	}
+	scanMs = g_system->getMillis() - start;
+
+	_recordSectorQueries = record;
+	return match;
+}
+
 void Set::shrinkBoxes(float radius) {
 	for (int i = 0; i < _numSectors; i++) {
 		Sector *sector = _sectors[i];
 		sector->shrink(radius);
 	}
+	_sectorGraphValid = false;
+	_sectorGridValid = false;
 }
 
 void Set::unshrinkBoxes() {
@@ -698,6 +980,65 @@ void Set::unshrinkBoxes() {
 		Sector *sector = _sectors[i];
 		sector->unshrink();
 	}
+	_sectorGraphValid = false;
+	_sectorGridValid = false;
+}
+
+int Set::getSectorIndex(const Sector *sector) const {
+	for (int i = 0; i < _numSectors; i++) {
+		if (_sectors[i] == sector)
+			return i;
+	}
+	return -1;
+}
+
+const Common::Array<Set::SectorLink> &Set::getSectorLinks(int sector) {
+	if (!_sectorGraphValid)
+		buildSectorGraph();
+	return _sectorLinks[sector];
+}
+
+static bool isPathSector(const Sector *s) {
+	int type = s->getType();
+	return type == Sector::WalkType || type == Sector::HotType || type == Sector::FunnelType;
+}
+
+void Set::buildSectorGraph() {
+	const int numSectors = MAX(_numSectors, 0);
+	_sectorLinks.clear();
+	_sectorLinks.resize(numSectors);
+
+	Common::Array<Math::Vector2d> boundsMin, boundsMax;
+	boundsMin.resize(numSectors);
+	boundsMax.resize(numSectors);
+	for (int i = 0; i < numSectors; i++) {
+		if (isPathSector(_sectors[i]))
+			_sectors[i]->getWalkPlaneBounds(boundsMin[i], boundsMax[i]);
+	}
+
+	// Sectors whose bounds don't touch can't share an edge, so only the
+	// remaining pairs need the full bridge computation.
+	const float epsilon = 0.01f;
+	for (int i = 0; i < numSectors; i++) {
+		if (!isPathSector(_sectors[i]))
+			continue;
+		for (int j = 0; j < numSectors; j++) {
+			if (i == j || !isPathSector(_sectors[j]))
+				continue;
+			if (boundsMin[j].getX() > boundsMax[i].getX() + epsilon || boundsMax[j].getX() < boundsMin[i].getX() - epsilon ||
+				boundsMin[j].getY() > boundsMax[i].getY() + epsilon || boundsMax[j].getY() < boundsMin[i].getY() - epsilon)
+				continue;
+
+			SectorLink link;
+			link.bridges = _sectors[i]->getBridgesTo(_sectors[j]);
+			if (link.bridges.empty())
+				continue;
+			link.sector = j;
+			_sectorLinks[i].push_back(link);
+		}
+	}
+
+	_sectorGraphValid = true;
 }
 
 void Set::setLightIntensity(const char *light, float intensity) {
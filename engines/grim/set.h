@@ -99,6 +99,34 @@ public:
 	void shrinkBoxes(float radius);
 	void unshrinkBoxes();
 
+	/**
+	 * A walkable connection from one sector into another: the parts of the
+	 * first sector's edges that lie inside the second one, as returned by
+	 * Sector::getBridgesTo().
+	 */
+	struct SectorLink {
+		int sector;
+		Common::List<Math::Line3d> bridges;
+	};
+
+	/**
+	 * Returns the links from the given sector (an index as in
+	 * getSectorBase()) to the walk, hot and funnel sectors adjacent to it.
+	 * The links don't depend on sector visibility, callers must check it.
+	 */
+	const Common::Array<SectorLink> &getSectorLinks(int sector);
+	int getSectorIndex(const Sector *sector) const;
+
+	/**
+	 * Record the points passed to findPointSector() and findClosestSector(),
+	 * and replay them against a plain scan of the sectors; used by the
+	 * "sector_queries" debugger command.
+	 */
+	void setRecordSectorQueries(bool record) { _recordSectorQueries = record; }
+	uint getRecordedSectorQueryCount() const { return _recordedSectorQueries.size(); }
+	void clearRecordedSectorQueries() { _recordedSectorQueries.clear(); }
+	bool benchmarkSectorQueries(int iterations, uint32 &indexedMs, uint32 &scanMs);
+
 	void addObjectState(const ObjectState::Ptr &s);
 	void deleteObjectState(const ObjectState::Ptr &s) {
 		_states.remove(s);
@@ -144,6 +172,36 @@ private:
 	Setup *_setups;
 
 	Setup *_currSetup;
+
+	void buildSectorGraph();
+	// Built on demand, and rebuilt when the sectors' shapes change.
+	Common::Array<Common::Array<SectorLink> > _sectorLinks;
+	bool _sectorGraphValid;
+
+	Sector *findPointSectorScan(const Math::Vector3d &p, Sector::SectorType type);
+	void findClosestSectorScan(const Math::Vector3d &p, Sector **sect, Math::Vector3d *closestPt);
+	void buildSectorGrid();
+
+	// Uniform grid over the sectors' bounds on the walk plane, for the
+	// find*Sector() queries. Built on demand, like the sector graph, and
+	// independent of sector visibility. The sectors of cell c are
+	// _gridSectors[_gridCellStart[c] .. _gridCellStart[c + 1]), by index.
+	bool _sectorGridValid;
+	Math::Vector2d _gridOrigin;
+	float _gridCellWidth, _gridCellHeight;
+	int _gridWidth, _gridHeight;
+	Common::Array<uint> _gridCellStart;
+	Common::Array<int> _gridSectors;
+	// Sectors that a point can be in from anywhere on the walk plane, which
+	// are tested by every query.
+	Common::Array<int> _unboundedSectors;
+	Common::Array<Math::Vector2d> _sectorBoundsMin, _sectorBoundsMax;
+	Common::Array<uint> _sectorQueryStamp;
+	uint _queryStamp;
+
+	bool _recordSectorQueries;
+	Common::Array<Math::Vector3d> _recordedSectorQueries;
+
 	typedef Common::List<ObjectState::Ptr> StateList;
 	StateList _states;
 
@@ -42,9 +42,13 @@ MODULE_OBJS := \
 	tinygl/specbuf.o \
 	tinygl/texture.o \
 	tinygl/vertex.o \
+	tinygl/zbenchmark.o \
+	tinygl/zbin.o \
 	tinygl/zbuffer.o \
+	tinygl/zcull.o \
 	tinygl/zline.o \
 	tinygl/zmath.o \
+	tinygl/zspan.o \
 	tinygl/ztriangle.o \
 	tinygl/ztriangle_shadow.o
 
@@ -591,7 +591,9 @@ void tglCallList(unsigned int list) {
 }
 
 void tglFlush() {
-	// nothing to do
+	TinyGL::GLContext *c = TinyGL::gl_get_context();
+	TinyGL::gl_flush_deferred(c);
+	TinyGL::ZB_flushBins(c->zb);
 }
 
 void tglHint(int target, int mode) {
@@ -611,13 +613,35 @@ void tglDebug(int mode) {
 	c->print_flag = mode;
 }
 
+void tglSetDeferred(int enable) {
+	TinyGL::GLContext *c = TinyGL::gl_get_context();
+	if (!enable)
+		TinyGL::gl_flush_deferred(c);
+	c->defer_flag = enable;
+}
+
 void tglSetShadowMaskBuf(unsigned char *buf) {
 	TinyGL::GLContext *c = TinyGL::gl_get_context();
+	TinyGL::gl_flush_deferred(c);
 	c->zb->shadow_mask_buf = buf;
+	c->zb->shadow_mask_x = 0;
+	c->zb->shadow_mask_y = 0;
+	c->zb->shadow_mask_width = c->zb->xsize;
+	c->zb->shadow_mask_height = c->zb->ysize;
+}
+
+void tglSetShadowMaskRect(int x, int y, int width, int height) {
+	TinyGL::GLContext *c = TinyGL::gl_get_context();
+	TinyGL::gl_flush_deferred(c);
+	c->zb->shadow_mask_x = x;
+	c->zb->shadow_mask_y = y;
+	c->zb->shadow_mask_width = width;
+	c->zb->shadow_mask_height = height;
 }
 
 void tglSetShadowColor(unsigned char r, unsigned char g, unsigned char b) {
 	TinyGL::GLContext *c = TinyGL::gl_get_context();
+	TinyGL::gl_flush_deferred(c);
 	c->zb->shadow_color_r = r << 8;
 	c->zb->shadow_color_g = g << 8;
 	c->zb->shadow_color_b = b << 8;
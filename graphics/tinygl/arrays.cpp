@@ -8,19 +8,21 @@
 
 namespace TinyGL {
 
-void glopArrayElement(GLContext *c, GLParam *param) {
+static void gl_array_attributes(GLContext *c, int idx) {
 	int i;
 	int states = c->client_states;
-	int idx = param[1].i;
 
 	if (states & COLOR_ARRAY) {
-		GLParam p[5];
+		GLParam p[8];
 		int size = c->color_array_size;
 		i = idx * (size + c->color_array_stride);
 		p[1].f = c->color_array[i];
 		p[2].f = c->color_array[i + 1];
 		p[3].f = c->color_array[i + 2];
 		p[4].f = size > 3 ? c->color_array[i + 3] : 1.0f;
+		p[5].ui = (unsigned int)(p[1].f * (ZB_POINT_RED_MAX - ZB_POINT_RED_MIN) + ZB_POINT_RED_MIN);
+		p[6].ui = (unsigned int)(p[2].f * (ZB_POINT_GREEN_MAX - ZB_POINT_GREEN_MIN) + ZB_POINT_GREEN_MIN);
+		p[7].ui = (unsigned int)(p[3].f * (ZB_POINT_BLUE_MAX - ZB_POINT_BLUE_MIN) + ZB_POINT_BLUE_MIN);
 		glopColor(c, p);
 	}
 	if (states & NORMAL_ARRAY) {
@@ -28,7 +30,7 @@ void glopArrayElement(GLContext *c, GLParam *param) {
 		c->current_normal.X = c->normal_array[i];
 		c->current_normal.Y = c->normal_array[i + 1];
 		c->current_normal.Z = c->normal_array[i + 2];
-		c->current_normal.Z = 0.0f;
+		c->current_normal.W = 0.0f;
 	}
 	if (states & TEXCOORD_ARRAY) {
 		int size = c->texcoord_array_size;
@@ -38,32 +40,154 @@ void glopArrayElement(GLContext *c, GLParam *param) {
 		c->current_tex_coord.Z = size > 2 ? c->texcoord_array[i + 2] : 0.0f;
 		c->current_tex_coord.W = size > 3 ? c->texcoord_array[i + 3] : 1.0f;
 	}
-	if (states & VERTEX_ARRAY) {
+}
+
+static void gl_array_coord(GLContext *c, int idx, V4 *coord) {
+	int size = c->vertex_array_size;
+	int i = idx * (size + c->vertex_array_stride);
+	coord->X = c->vertex_array[i];
+	coord->Y = c->vertex_array[i + 1];
+	coord->Z = size > 2 ? c->vertex_array[i + 2] : 0.0f;
+	coord->W = size > 3 ? c->vertex_array[i + 3] : 1.0f;
+}
+
+void glopArrayElement(GLContext *c, GLParam *param) {
+	int idx = param[1].i;
+
+	gl_array_attributes(c, idx);
+	if (c->client_states & VERTEX_ARRAY) {
 		GLParam p[5];
-		int size = c->vertex_array_size;
-		i = idx * (size + c->vertex_array_stride);
-		p[1].f = c->vertex_array[i];
-		p[2].f = c->vertex_array[i + 1];
-		p[3].f = size > 2 ? c->vertex_array[i + 2] : 0.0f;
-		p[4].f = size > 3 ? c->vertex_array[i + 3] : 1.0f;
+		V4 coord;
+		gl_array_coord(c, idx, &coord);
+		p[1].f = coord.X;
+		p[2].f = coord.Y;
+		p[3].f = coord.Z;
+		p[4].f = coord.W;
 		glopVertex(c, p);
 	}
 }
 
-void glArrayElement(TGLint i) {
-	GLParam p[2];
-	p[0].op = OP_ArrayElement;
-	p[1].i = i;
-	gl_add_op(p);
+static inline unsigned int gl_element(const void *indices, int type, int i) {
+	switch (type) {
+	case TGL_UNSIGNED_BYTE:
+		return ((const unsigned char *)indices)[i];
+	case TGL_UNSIGNED_SHORT:
+		return ((const unsigned short *)indices)[i];
+	default:
+		return ((const unsigned int *)indices)[i];
+	}
+}
+
+// Triangles are drawn from a cache of the vertices of the arrays, so that
+// a vertex shared by several triangles is transformed and lit only once.
+void glopDrawElements(GLContext *c, GLParam *p) {
+	int mode = p[1].i;
+	int count = p[2].i;
+	int type = p[3].i;
+	const void *indices = p[4].p;
+	unsigned int min_index, max_index;
+	int size;
+	GLParam q[2];
+
+	q[0].op = OP_Begin;
+	q[1].i = mode;
+
+	if (mode != TGL_TRIANGLES || !(c->client_states & VERTEX_ARRAY)) {
+		glopBegin(c, q);
+		for (int i = 0; i < count; i++) {
+			q[1].i = gl_element(indices, type, i);
+			glopArrayElement(c, q);
+		}
+		glopEnd(c, q);
+		return;
+	}
+
+	if (count < 3)
+		return;
+
+	min_index = max_index = gl_element(indices, type, 0);
+	for (int i = 1; i < count; i++) {
+		unsigned int idx = gl_element(indices, type, i);
+		if (idx < min_index)
+			min_index = idx;
+		if (idx > max_index)
+			max_index = idx;
+	}
+
+	size = max_index - min_index + 1;
+	if (size > c->element_max) {
+		gl_free(c->element_vertex);
+		gl_free(c->element_done);
+		c->element_vertex = (GLVertex *)gl_malloc(size * sizeof(GLVertex));
+		c->element_done = (unsigned char *)gl_malloc(size);
+		if (!c->element_vertex || !c->element_done)
+			error("unable to allocate GLVertex array.");
+		c->element_max = size;
+	}
+	memset(c->element_done, 0, size);
+
+	glopBegin(c, q);
+	for (int i = 0; i + 2 < count; i += 3) {
+		GLVertex *v[3];
+		for (int j = 0; j < 3; j++) {
+			unsigned int idx = gl_element(indices, type, i + j);
+			int k = idx - min_index;
+			v[j] = &c->element_vertex[k];
+			if (!c->element_done[k]) {
+				gl_array_attributes(c, idx);
+				gl_array_coord(c, idx, &v[j]->coord);
+				gl_compute_vertex(c, v[j]);
+				c->element_done[k] = 1;
+			}
+		}
+		gl_draw_triangle(c, v[0], v[1], v[2]);
+	}
+	glopEnd(c, q);
 }
 
 void glopEnableClientState(GLContext *c, GLParam *p) {
 	c->client_states |= p[1].i;
 }
 
-void glEnableClientState(TGLenum array) {
-	GLParam p[2];
-	p[0].op = OP_EnableClientState;
+void glopDisableClientState(GLContext *c, GLParam *p) {
+	c->client_states &= p[1].i;
+}
+
+void glopVertexPointer(GLContext *c, GLParam *p) {
+	c->vertex_array_size = p[1].i;
+	c->vertex_array_stride = p[2].i;
+	c->vertex_array = (float *)p[3].p;
+}
+
+void glopColorPointer(GLContext *c, GLParam *p) {
+	c->color_array_size = p[1].i;
+	c->color_array_stride = p[2].i;
+	c->color_array = (float *)p[3].p;
+}
+
+void glopNormalPointer(GLContext *c, GLParam *p) {
+	c->normal_array_stride = p[1].i;
+	c->normal_array = (float *)p[2].p;
+}
+
+void glopTexCoordPointer(GLContext *c, GLParam *p) {
+	c->texcoord_array_size = p[1].i;
+	c->texcoord_array_stride = p[2].i;
+	c->texcoord_array = (float *)p[3].p;
+}
+
+} // end of namespace TinyGL
+
+void tglArrayElement(TGLint i) {
+	TinyGL::GLParam p[2];
+	p[0].op = TinyGL::OP_ArrayElement;
+	p[1].i = i;
+	TinyGL::gl_add_op(p);
+}
+
+void tglEnableClientState(TGLenum array) {
+	TinyGL::GLParam p[2];
+	p[0].op = TinyGL::OP_EnableClientState;
 
 	switch (array) {
 	case TGL_VERTEX_ARRAY:
@@ -82,16 +206,12 @@ void glEnableClientState(TGLenum array) {
 		assert(0);
 		break;
 	}
-	gl_add_op(p);
+	TinyGL::gl_add_op(p);
 }
 
-void glopDisableClientState(GLContext *c, GLParam *p) {
-	c->client_states &= p[1].i;
-}
-
-void glDisableClientState(TGLenum array) {
-	GLParam p[2];
-	p[0].op = OP_DisableClientState;
+void tglDisableClientState(TGLenum array) {
+	TinyGL::GLParam p[2];
+	p[0].op = TinyGL::OP_DisableClientState;
 
 	switch (array) {
 	case TGL_VERTEX_ARRAY:
@@ -110,69 +230,55 @@ void glDisableClientState(TGLenum array) {
 		assert(0);
 		break;
 	}
-	gl_add_op(p);
+	TinyGL::gl_add_op(p);
 }
 
-void glopVertexPointer(GLContext *c, GLParam *p) {
-	c->vertex_array_size = p[1].i;
-	c->vertex_array_stride = p[2].i;
-	c->vertex_array = (float *)p[3].p;
-}
-
-void  glVertexPointer(TGLint size, TGLenum type, TGLsizei stride, const TGLvoid *pointer) {
-	GLParam p[4];
+void tglVertexPointer(TGLint size, TGLenum type, TGLsizei stride, const TGLvoid *pointer) {
+	TinyGL::GLParam p[5];
 	assert(type == TGL_FLOAT);
-	p[0].op = OP_VertexPointer;
+	p[0].op = TinyGL::OP_VertexPointer;
 	p[1].i = size;
 	p[2].i = stride;
 	p[3].p = const_cast<void *>(pointer);
-	gl_add_op(p);
+	TinyGL::gl_add_op(p);
 }
 
-void glopColorPointer(GLContext *c, GLParam *p) {
-	c->color_array_size = p[1].i;
-	c->color_array_stride = p[2].i;
-	c->color_array = (float *)p[3].p;
-}
-
-void  glColorPointer(TGLint size, TGLenum type, TGLsizei stride, const TGLvoid *pointer) {
-	GLParam p[4];
+void tglColorPointer(TGLint size, TGLenum type, TGLsizei stride, const TGLvoid *pointer) {
+	TinyGL::GLParam p[5];
 	assert(type == TGL_FLOAT);
-	p[0].op = OP_ColorPointer;
+	p[0].op = TinyGL::OP_ColorPointer;
 	p[1].i = size;
 	p[2].i = stride;
 	p[3].p = const_cast<void *>(pointer);
-	gl_add_op(p);
+	TinyGL::gl_add_op(p);
 }
 
-void glopNormalPointer(GLContext *c, GLParam *p) {
-	c->normal_array_stride = p[1].i;
-	c->normal_array = (float *)p[2].p;
-}
-
-void glNormalPointer(TGLenum type, TGLsizei stride, const TGLvoid *pointer) {
-	GLParam p[3];
+void tglNormalPointer(TGLenum type, TGLsizei stride, const TGLvoid *pointer) {
+	TinyGL::GLParam p[4];
 	assert(type == TGL_FLOAT);
-	p[0].op = OP_NormalPointer;
+	p[0].op = TinyGL::OP_NormalPointer;
 	p[1].i = stride;
 	p[2].p = const_cast<void *>(pointer);
-	gl_add_op(p);
-}
-
-void glopTexCoordPointer(GLContext *c, GLParam *p) {
-	c->texcoord_array_size = p[1].i;
-	c->texcoord_array_stride = p[2].i;
-	c->texcoord_array = (float *)p[3].p;
+	TinyGL::gl_add_op(p);
 }
 
-void glTexCoordPointer(TGLint size, TGLenum type, TGLsizei stride, const TGLvoid *pointer) {
-	GLParam p[4];
+void tglTexCoordPointer(TGLint size, TGLenum type, TGLsizei stride, const TGLvoid *pointer) {
+	TinyGL::GLParam p[5];
 	assert(type == TGL_FLOAT);
-	p[0].op = OP_TexCoordPointer;
+	p[0].op = TinyGL::OP_TexCoordPointer;
 	p[1].i = size;
 	p[2].i = stride;
 	p[3].p = const_cast<void *>(pointer);
-	gl_add_op(p);
+	TinyGL::gl_add_op(p);
 }
 
-} // end of namespace TinyGL
+void tglDrawElements(TGLenum mode, TGLsizei count, TGLenum type, const TGLvoid *indices) {
+	TinyGL::GLParam p[5];
+	assert(type == TGL_UNSIGNED_BYTE || type == TGL_UNSIGNED_SHORT || type == TGL_UNSIGNED_INT);
+	p[0].op = TinyGL::OP_DrawElements;
+	p[1].i = mode;
+	p[2].i = count;
+	p[3].i = type;
+	p[4].p = const_cast<void *>(indices);
+	TinyGL::gl_add_op(p);
+}
@@ -389,24 +389,25 @@ void gl_draw_triangle_fill(GLContext *c, GLVertex *p0, GLVertex *p1, GLVertex *p
 
 	if (c->color_mask == 0) {
 		// FIXME: Accept more than just 0 or 1.
-		ZB_fillTriangleDepthOnly(c->zb, &p0->zp, &p1->zp, &p2->zp);
+		ZB_drawTriangle(c->zb, ZB_fillTriangleDepthOnly, &p0->zp, &p1->zp, &p2->zp);
 	}
 	if (c->shadow_mode & 1) {
 		assert(c->zb->shadow_mask_buf);
-		ZB_fillTriangleFlatShadowMask(c->zb, &p0->zp, &p1->zp, &p2->zp);
+		ZB_drawTriangle(c->zb, ZB_fillTriangleFlatShadowMask, &p0->zp, &p1->zp, &p2->zp);
 	} else if (c->shadow_mode & 2) {
 		assert(c->zb->shadow_mask_buf);
-		ZB_fillTriangleFlatShadow(c->zb, &p0->zp, &p1->zp, &p2->zp);
+		ZB_drawTriangle(c->zb, ZB_fillTriangleFlatShadow, &p0->zp, &p1->zp, &p2->zp);
 	} else if (c->texture_2d_enabled) {
 #ifdef TINYGL_PROFILE
 		count_triangles_textured++;
 #endif
-		ZB_setTexture(c->zb, c->current_texture->images[0].pixmap);
-		ZB_fillTriangleMappingPerspective(c->zb, &p0->zp, &p1->zp, &p2->zp);
+		GLImage *im = gl_select_texture_level(c, &p0->zp, &p1->zp, &p2->zp);
+		ZB_setTexture(c->zb, im->pixmap, im->xsize_bits, im->ysize_bits);
+		ZB_drawTriangle(c->zb, ZB_fillTriangleMappingPerspective, &p0->zp, &p1->zp, &p2->zp);
 	} else if (c->current_shade_model == TGL_SMOOTH) {
-		ZB_fillTriangleSmooth(c->zb, &p0->zp, &p1->zp, &p2->zp);
+		ZB_drawTriangle(c->zb, ZB_fillTriangleSmooth, &p0->zp, &p1->zp, &p2->zp);
 	} else {
-		ZB_fillTriangleFlat(c->zb, &p0->zp, &p1->zp, &p2->zp);
+		ZB_drawTriangle(c->zb, ZB_fillTriangleFlat, &p0->zp, &p1->zp, &p2->zp);
 	}
 }
 
@@ -441,3 +442,48 @@ void gl_draw_triangle_point(GLContext *c, GLVertex *p0, GLVertex *p1, GLVertex *
 }
 
 } // end of namespace TinyGL
+
+TGLboolean tglIsBoxOccluded(const TGLfloat *bboxMin, const TGLfloat *bboxMax) {
+	TinyGL::GLContext *c = TinyGL::gl_get_context();
+	TinyGL::gl_flush_deferred(c);
+	if (!TinyGL::ZB_hasDepthPyramid(c->zb))
+		return TGL_FALSE;
+
+	TinyGL::M4 m;
+	TinyGL::gl_M4_Mul(&m, c->matrix_stack_ptr[1], c->matrix_stack_ptr[0]);
+
+	float xmin = 0, ymin = 0, xmax = 0, ymax = 0, zmax = 0;
+	for (int i = 0; i < 8; i++) {
+		TinyGL::V4 v, pc;
+		v.X = (i & 1) ? bboxMax[0] : bboxMin[0];
+		v.Y = (i & 2) ? bboxMax[1] : bboxMin[1];
+		v.Z = (i & 4) ? bboxMax[2] : bboxMin[2];
+		v.W = 1;
+		TinyGL::gl_M4_MulV4(&pc, &m, &v);
+		// A box crossing the near plane can cover anything.
+		if (pc.W <= 0 || pc.Z < -pc.W)
+			return TGL_FALSE;
+
+		float winv = 1.0f / pc.W;
+		float x = pc.X * winv * c->viewport.scale.X + c->viewport.trans.X;
+		float y = pc.Y * winv * c->viewport.scale.Y + c->viewport.trans.Y;
+		float z = pc.Z * winv * c->viewport.scale.Z + c->viewport.trans.Z;
+		if (i == 0) {
+			xmin = xmax = x;
+			ymin = ymax = y;
+			zmax = z;
+		} else {
+			xmin = MIN(xmin, x);
+			xmax = MAX(xmax, x);
+			ymin = MIN(ymin, y);
+			ymax = MAX(ymax, y);
+			zmax = MAX(zmax, z);
+		}
+	}
+
+	// Off the screen, leave it to the clipping.
+	if (xmax < 0 || ymax < 0 || xmin >= c->zb->xsize || ymin >= c->zb->ysize)
+		return TGL_FALSE;
+	return TinyGL::ZB_isOccluded(c->zb, (int)floor(xmin), (int)floor(ymin), (int)ceil(xmax), (int)ceil(ymax),
+	                             (int)MIN(zmax, (float)(1 << 30))) ? TGL_TRUE : TGL_FALSE;
+}
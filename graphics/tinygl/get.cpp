@@ -5,6 +5,7 @@
 
 void tglGetIntegerv(int pname, int *params) {
 	TinyGL::GLContext *c = TinyGL::gl_get_context();
+	TinyGL::gl_flush_deferred(c);
 
 	switch (pname) {
 	case TGL_VIEWPORT:
@@ -38,6 +39,7 @@ void tglGetFloatv(int pname, float *v) {
 	int i;
 	int mnr = 0; // just a trick to return the correct matrix
 	TinyGL::GLContext *c = TinyGL::gl_get_context();
+	TinyGL::gl_flush_deferred(c);
 	switch (pname) {
 	case TGL_TEXTURE_MATRIX:
 		mnr++;
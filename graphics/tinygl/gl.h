@@ -792,8 +792,17 @@ void tglGetFloatv(int pname, float *v);
 void tglFrontFace(int mode);
 void tglColorMask(TGLboolean r, TGLboolean g, TGLboolean b, TGLboolean a);
 
+// Record the ops instead of running them, until deferring is disabled or
+// tglFlush() is called.
+void tglSetDeferred(int enable);
 void tglSetShadowMaskBuf(unsigned char *buf);
+// Make the shadow mask buffer cover only the given rectangle of the screen,
+// instead of all of it. The pixels out of it are neither masked nor shadowed.
+void tglSetShadowMaskRect(int x, int y, int width, int height);
 void tglSetShadowColor(unsigned char r, unsigned char g, unsigned char b);
+// Tell whether the box, in object coordinates, is entirely hidden behind the
+// depth pyramid of the z buffer (see ZB_buildDepthPyramid()).
+TGLboolean tglIsBoxOccluded(const TGLfloat *bboxMin, const TGLfloat *bboxMax);
 
 // opengl 1.2 arrays
 void tglEnableClientState(TGLenum array);
@@ -803,6 +812,7 @@ void tglVertexPointer(TGLint size, TGLenum type, TGLsizei stride, const TGLvoid
 void tglColorPointer(TGLint size, TGLenum type, TGLsizei stride, const TGLvoid *pointer);
 void tglNormalPointer(TGLenum type, TGLsizei stride, const TGLvoid *pointer);
 void tglTexCoordPointer(TGLint size, TGLenum type, TGLsizei stride, const TGLvoid *pointer);
+void tglDrawElements(TGLenum mode, TGLsizei count, TGLenum type, const TGLvoid *indices);
 
 // opengl 1.2 polygon offset
 void tglPolygonOffset(TGLfloat factor, TGLfloat units);
@@ -190,6 +190,9 @@ void glClose() {
 		gl_free(c->matrix_stack[i]);
 	endSharedState(c);
 	gl_free(c->vertex);
+	gl_free(c->element_vertex);
+	gl_free(c->element_done);
+	gl_free_deferred(c);
 
 	gl_free(c);
 }
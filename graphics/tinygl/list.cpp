@@ -128,13 +128,116 @@ void gl_compile_op(GLContext *c, GLParam *p) {
 	c->current_op_buffer_index = index;
 }
 
+// Ops whose whole effect is replaced by the next op of the same kind, when
+// they are recorded one after the other.
+static bool gl_op_is_replaced(int op) {
+	switch (op) {
+	case OP_Color:
+	case OP_TexCoord:
+	case OP_EdgeFlag:
+	case OP_Normal:
+	case OP_MatrixMode:
+	case OP_ShadeModel:
+	case OP_CullFace:
+	case OP_FrontFace:
+	case OP_ColorMask:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Ops which read client memory, which may have changed by the time the
+// deferred ops are run.
+static bool gl_op_is_immediate(int op) {
+	switch (op) {
+	case OP_TexImage2D:
+	case OP_ArrayElement:
+	case OP_VertexPointer:
+	case OP_ColorPointer:
+	case OP_NormalPointer:
+	case OP_TexCoordPointer:
+	case OP_DrawElements:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool gl_same_op(GLParam *p1, GLParam *p2, int op_size) {
+	for (int i = 0; i < op_size; i++) {
+		if (p1[i].ui != p2[i].ui)
+			return false;
+	}
+	return true;
+}
+
+static void gl_defer_op(GLContext *c, GLParam *p) {
+	int op, op_size;
+	GLParamBuffer *ob;
+	GLParam *last;
+	int index;
+
+	op = p[0].op;
+	op_size = op_table_size[op];
+
+	if (gl_op_is_immediate(op)) {
+		gl_flush_deferred(c);
+		op_table_func[op](c, p);
+		return;
+	}
+
+	// coalesce redundant state changes
+	last = c->defer_last_op;
+	if (last && last[0].op == op) {
+		if (gl_op_is_replaced(op)) {
+			for (int i = 0; i < op_size; i++)
+				last[i] = p[i];
+			return;
+		}
+		if ((op == OP_EnableDisable || op == OP_BindTexture) && gl_same_op(last, p, op_size))
+			return;
+	}
+
+	if (!c->defer_first_buffer) {
+		c->defer_first_buffer = (GLParamBuffer *)gl_zalloc(sizeof(GLParamBuffer));
+		c->defer_buffer = c->defer_first_buffer;
+		c->defer_index = 0;
+	}
+	index = c->defer_index;
+	ob = c->defer_buffer;
+
+	// keep room for a NextBuffer or an EndList opcode
+	if ((index + op_size) > (OP_BUFFER_MAX_SIZE - 2)) {
+		if (!ob->next)
+			ob->next = (GLParamBuffer *)gl_zalloc(sizeof(GLParamBuffer));
+
+		ob->ops[index].op = OP_NextBuffer;
+		ob->ops[index + 1].p = (void *)ob->next;
+
+		ob = ob->next;
+		c->defer_buffer = ob;
+		index = 0;
+	}
+
+	c->defer_last_op = &ob->ops[index];
+	for (int i = 0; i < op_size; i++) {
+		ob->ops[index] = p[i];
+		index++;
+	}
+	c->defer_index = index;
+}
+
 void gl_add_op(GLParam *p) {
 	GLContext *c = gl_get_context();
 	int op;
 
 	op = p[0].op;
 	if (c->exec_flag) {
-		op_table_func[op](c, p);
+		if (c->defer_flag)
+			gl_defer_op(c, p);
+		else
+			op_table_func[op](c, p);
 	}
 	if (c->compile_flag) {
 		gl_compile_op(c, p);
@@ -144,6 +247,94 @@ void gl_add_op(GLParam *p) {
 	}
 }
 
+// Transform the vertices of the ops starting at p, up to the first op which
+// may change how they are transformed.
+static void gl_batch_vertices(GLContext *c, GLParam *p) {
+	GLVertexBatch *b = &c->vertex_batch;
+	V4 normal = c->current_normal;
+	int count = 0;
+
+	while (count < VERTEX_BATCH_SIZE) {
+		int op = p[0].op;
+		if (op == OP_NextBuffer) {
+			p = (GLParam *)p[1].p;
+			continue;
+		}
+		if (op == OP_Vertex) {
+			b->x[count] = p[1].f;
+			b->y[count] = p[2].f;
+			b->z[count] = p[3].f;
+			b->nx[count] = normal.X;
+			b->ny[count] = normal.Y;
+			b->nz[count] = normal.Z;
+			count++;
+		} else if (op == OP_Normal) {
+			normal.X = p[1].f;
+			normal.Y = p[2].f;
+			normal.Z = p[3].f;
+		} else if (op != OP_Begin && op != OP_End && op != OP_TexCoord &&
+				   op != OP_Color && op != OP_EdgeFlag) {
+			break;
+		}
+		p += op_table_size[op];
+	}
+
+	b->count = count;
+	b->next = 0;
+	gl_transform_vertex_batch(c, b);
+}
+
+static void gl_run_ops(GLContext *c, GLParam *p) {
+	int op;
+
+	while (1) {
+		op = p[0].op;
+		if (op == OP_EndList)
+			break;
+		if (op == OP_NextBuffer) {
+			p = (GLParam *)p[1].p;
+		} else {
+			if (op == OP_Vertex && c->vertex_batch.next == c->vertex_batch.count)
+				gl_batch_vertices(c, p);
+			op_table_func[op](c, p);
+			p += op_table_size[op];
+		}
+	}
+}
+
+void gl_flush_deferred(GLContext *c) {
+	int defer_flag;
+
+	if (!c->defer_first_buffer || (c->defer_buffer == c->defer_first_buffer && c->defer_index == 0))
+		return;
+
+	c->defer_buffer->ops[c->defer_index].op = OP_EndList;
+
+	defer_flag = c->defer_flag;
+	c->defer_flag = 0;
+	gl_run_ops(c, c->defer_first_buffer->ops);
+	c->defer_flag = defer_flag;
+
+	c->defer_buffer = c->defer_first_buffer;
+	c->defer_index = 0;
+	c->defer_last_op = NULL;
+}
+
+void gl_free_deferred(GLContext *c) {
+	GLParamBuffer *pb, *pb1;
+
+	pb = c->defer_first_buffer;
+	while (pb) {
+		pb1 = pb->next;
+		gl_free(pb);
+		pb = pb1;
+	}
+	c->defer_first_buffer = NULL;
+	c->defer_buffer = NULL;
+	c->defer_index = 0;
+	c->defer_last_op = NULL;
+}
+
 // this opcode is never called directly
 void glopEndList(GLContext *, GLParam *) {
 	assert(0);
@@ -156,25 +347,13 @@ void glopNextBuffer(GLContext *, GLParam *) {
 
 void glopCallList(GLContext *c, GLParam *p) {
 	GLList *l;
-	int list, op;
+	int list;
 
 	list = p[1].ui;
 	l = find_list(c, list);
 	if (!l)
 		error("list %d not defined", list);
-	p = l->first_op_buffer->ops;
-
-	while (1) {
-		op = p[0].op;
-		if (op == OP_EndList)
-			break;
-		if (op == OP_NextBuffer) {
-			p = (GLParam *)p[1].p;
-		} else {
-			op_table_func[op](c, p);
-			p += op_table_size[op];
-		}
-	}
+	gl_run_ops(c, l->first_op_buffer->ops);
 }
 
 void glNewList(unsigned int list, int mode) {
@@ -184,6 +363,9 @@ void glNewList(unsigned int list, int mode) {
 	assert(mode == TGL_COMPILE || mode == TGL_COMPILE_AND_EXECUTE);
 	assert(c->compile_flag == 0);
 
+	// deferred CallList ops may use the list
+	gl_flush_deferred(c);
+
 	l = find_list(c, list);
 	if (l)
 		delete_list(c, list);
@@ -7,6 +7,8 @@ int glRenderMode(int mode) {
 	GLContext *c = gl_get_context();
 	int result = 0;
 
+	gl_flush_deferred(c);
+
 	switch (c->render_mode) {
 	case TGL_RENDER:
 		break;
@@ -31,6 +31,8 @@ void free_texture(GLContext *c, int h) {
 	if (t->next)
 		t->next->prev = t->prev;
 
+	// binned triangles may still use the texture
+	ZB_flushBins(c->zb);
 	for (int i = 0; i < MAX_TEXTURE_LEVELS; i++) {
 		im = &t->images[i];
 		if (im->pixmap)
@@ -54,10 +56,130 @@ GLTexture *alloc_texture(GLContext *c, int h) {
 	*ht = t;
 
 	t->handle = h;
+	// Unlike in OpenGL, textures have no mipmaps unless they are asked for.
+	t->min_filter = TGL_LINEAR;
 
 	return t;
 }
 
+static bool gl_is_mipmap_filter(int filter) {
+	return filter == TGL_NEAREST_MIPMAP_NEAREST || filter == TGL_NEAREST_MIPMAP_LINEAR ||
+	       filter == TGL_LINEAR_MIPMAP_NEAREST || filter == TGL_LINEAR_MIPMAP_LINEAR;
+}
+
+// The log2 of the smallest power of two not below size, up to the largest
+// texture size.
+static int gl_size_bits(int size) {
+	int bits = 0;
+	while ((1 << bits) < size && bits < MAX_TEXTURE_SIZE_BITS)
+		bits++;
+	return bits;
+}
+
+// Store the texels, given line after line, in the tiles of the image.
+static void gl_store_image(GLContext *c, GLImage *im, const Graphics::PixelFormat &pf,
+						   const uint32 *pixels, int xsize_bits, int ysize_bits) {
+	const int tileSize = 1 << ZB_TEXTURE_TILE_BITS;
+	int xsize = 1 << xsize_bits;
+	int ysize = 1 << ysize_bits;
+	int size = MAX(xsize, tileSize) * MAX(ysize, tileSize) * sizeof(uint32);
+	byte *buffer = new byte[size];
+	memset(buffer, 0, size);
+
+	ZBufferTextureLayout layout;
+	ZB_setTextureLayout(&layout, xsize_bits, ysize_bits);
+	uint32 *tiles = (uint32 *)buffer;
+	for (int y = 0; y < ysize; y++) {
+		for (int x = 0; x < xsize; x++)
+			tiles[ZB_tiledTexelIndex(layout, x, y)] = pixels[y * xsize + x];
+	}
+
+	if (im->pixmap) {
+		// binned triangles may still use the image
+		ZB_flushBins(c->zb);
+		im->pixmap.free();
+	}
+	im->pixmap = Graphics::PixelBuffer(pf, buffer);
+	im->xsize = xsize;
+	im->ysize = ysize;
+	im->xsize_bits = xsize_bits;
+	im->ysize_bits = ysize_bits;
+}
+
+// Build the mipmaps down to one texel from the first image, each texel being
+// the average of four of the level above.
+static void gl_build_mipmaps(GLContext *c, GLTexture *t) {
+	GLImage *im = &t->images[0];
+	int xsize_bits = im->xsize_bits;
+	int ysize_bits = im->ysize_bits;
+
+	ZBufferTextureLayout layout;
+	ZB_setTextureLayout(&layout, xsize_bits, ysize_bits);
+	const uint32 *tiles = (const uint32 *)im->pixmap.getRawBuffer();
+	uint32 *src = new uint32[im->xsize * im->ysize];
+	for (int y = 0; y < im->ysize; y++) {
+		for (int x = 0; x < im->xsize; x++)
+			src[y * im->xsize + x] = tiles[ZB_tiledTexelIndex(layout, x, y)];
+	}
+
+	int level = 1;
+	for (; level < MAX_TEXTURE_LEVELS && (xsize_bits > 0 || ysize_bits > 0); level++) {
+		int xsize = 1 << xsize_bits;
+		int ysize = 1 << ysize_bits;
+		xsize_bits = MAX(xsize_bits - 1, 0);
+		ysize_bits = MAX(ysize_bits - 1, 0);
+		int dxsize = 1 << xsize_bits;
+		int dysize = 1 << ysize_bits;
+
+		uint32 *dst = new uint32[dxsize * dysize];
+		for (int y = 0; y < dysize; y++) {
+			const uint32 *line0 = src + MIN(2 * y, ysize - 1) * xsize;
+			const uint32 *line1 = src + MIN(2 * y + 1, ysize - 1) * xsize;
+			for (int x = 0; x < dxsize; x++) {
+				int x0 = MIN(2 * x, xsize - 1);
+				int x1 = MIN(2 * x + 1, xsize - 1);
+				uint32 texel = 0;
+				for (int shift = 0; shift < 32; shift += 8) {
+					uint32 sum = ((line0[x0] >> shift) & 0xFF) + ((line0[x1] >> shift) & 0xFF) +
+								 ((line1[x0] >> shift) & 0xFF) + ((line1[x1] >> shift) & 0xFF);
+					texel |= ((sum + 2) / 4) << shift;
+				}
+				dst[y * dxsize + x] = texel;
+			}
+		}
+		gl_store_image(c, &t->images[level], im->pixmap.getFormat(), dst, xsize_bits, ysize_bits);
+
+		delete[] src;
+		src = dst;
+	}
+	delete[] src;
+
+	t->num_levels = level;
+}
+
+GLImage *gl_select_texture_level(GLContext *c, ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2) {
+	GLTexture *t = c->current_texture;
+	int level = 0;
+
+	if (t->num_levels > 1) {
+		// Pick the level whose texels are the closest to the pixels of the
+		// triangle in size, from the area it covers on the screen and in the
+		// first level. The s, t coordinates go from 0 to 1 << 22 over the
+		// texture.
+		GLImage *im = &t->images[0];
+		float area = fabs((float)(p1->x - p0->x) * (p2->y - p0->y) - (float)(p2->x - p0->x) * (p1->y - p0->y));
+		float texels = fabs((float)(p1->s - p0->s) * (p2->t - p0->t) - (float)(p2->s - p0->s) * (p1->t - p0->t));
+		texels *= (float)im->xsize / (1 << 22) * (float)im->ysize / (1 << 22);
+		// Each level has a quarter of the texels of the one above.
+		while (level + 1 < t->num_levels && texels > 4.0f * area) {
+			texels *= 0.25f;
+			level++;
+		}
+	}
+
+	return &t->images[level];
+}
+
 void glInitTextures(GLContext *c) {
 	// textures
 	c->texture_2d_enabled = 0;
@@ -88,7 +210,6 @@ void glopTexImage2D(GLContext *c, GLParam *p) {
 	int format = p[7].i;
 	int type = p[8].i;
 	byte *pixels = (byte *)p[9].p;
-	GLImage *im;
 	byte *pixels1;
 	bool do_free_after_rgb2rgba = false;
 
@@ -152,24 +273,33 @@ void glopTexImage2D(GLContext *c, GLParam *p) {
 		error("glTexImage2D: combination of parameters not handled");
 	}
 
-	pixels1 = new byte[256 * 256 * bytes];
-	if (width != 256 || height != 256) {
+	// The images keep their size if it is a power of two, or are resized up
+	// to the next one.
+	int xsize_bits = gl_size_bits(width);
+	int ysize_bits = gl_size_bits(height);
+	if ((1 << xsize_bits) != width || (1 << ysize_bits) != height) {
+		// gl_resizeImage() needs two pixels in each direction.
+		xsize_bits = MAX(xsize_bits, 1);
+		ysize_bits = MAX(ysize_bits, 1);
+		pixels1 = new byte[(1 << xsize_bits) * (1 << ysize_bits) * bytes];
 		// no interpolation is done here to respect the original image aliasing !
-		//gl_resizeImageNoInterpolate(pixels1, 256, 256, (unsigned char *)pixels, width, height);
+		//gl_resizeImageNoInterpolate(pixels1, xsize, ysize, (unsigned char *)pixels, width, height);
 		// used interpolation anyway, it look much better :) --- aquadran
-		gl_resizeImage(pixels1, 256, 256, pixels, width, height);
-		width = 256;
-		height = 256;
+		gl_resizeImage(pixels1, 1 << xsize_bits, 1 << ysize_bits, pixels, width, height);
 	} else {
-		memcpy(pixels1, pixels, 256 * 256 * bytes);
+		pixels1 = pixels;
 	}
 
-	im = &c->current_texture->images[level];
-	im->xsize = width;
-	im->ysize = height;
-	if (im->pixmap)
-		im->pixmap.free();
-	im->pixmap = Graphics::PixelBuffer(pf, pixels1);
+	GLTexture *t = c->current_texture;
+	gl_store_image(c, &t->images[level], pf, (const uint32 *)pixels1, xsize_bits, ysize_bits);
+	if (pixels1 != pixels)
+		delete[] pixels1;
+
+	if (level == 0) {
+		t->num_levels = 1;
+		if (gl_is_mipmap_filter(t->min_filter))
+			gl_build_mipmaps(c, t);
+	}
 
 	if (do_free_after_rgb2rgba) {
 		// pixels as been assigned to tmp.getRawBuffer() which was created with
@@ -197,7 +327,7 @@ error:
 }
 
 // TODO: not all tests are done
-void glopTexParameter(GLContext *, GLParam *p) {
+void glopTexParameter(GLContext *c, GLParam *p) {
 	int target = p[1].i;
 	int pname = p[2].i;
 	int param = p[3].i;
@@ -213,6 +343,17 @@ error:
 		if (param != TGL_REPEAT)
 			goto error;
 		break;
+	case TGL_TEXTURE_MIN_FILTER: {
+		GLTexture *t = c->current_texture;
+		t->min_filter = param;
+		if (!t->images[0].pixmap)
+			break;
+		if (!gl_is_mipmap_filter(param))
+			t->num_levels = 1;
+		else if (t->num_levels <= 1)
+			gl_build_mipmaps(c, t);
+		break;
+	}
 	default:
 		;
 	}
@@ -234,6 +375,9 @@ void tglGenTextures(int n, unsigned int *textures) {
 	int max;
 	TinyGL::GLTexture *t;
 
+	// deferred BindTexture ops may create textures
+	TinyGL::gl_flush_deferred(c);
+
 	max = 0;
 	for (int i = 0; i < TEXTURE_HASH_TABLE_SIZE; i++) {
 		t = c->shared_state.texture_hash_table[i];
@@ -252,6 +396,8 @@ void tglDeleteTextures(int n, const unsigned int *textures) {
 	TinyGL::GLContext *c = TinyGL::gl_get_context();
 	TinyGL::GLTexture *t;
 
+	TinyGL::gl_flush_deferred(c);
+
 	for (int i = 0; i < n; i++) {
 		t = TinyGL::find_texture(c, textures[i]);
 		if (t) {
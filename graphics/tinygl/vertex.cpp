@@ -188,8 +188,117 @@ static inline void gl_vertex_transform(GLContext *c, GLVertex *v) {
 	v->clip_code = gl_clipcode(v->pc.X, v->pc.Y, v->pc.Z, v->pc.W);
 }
 
+static inline void gl_vertex_attributes(GLContext *c, GLVertex *v) {
+	// color
+
+	if (c->lighting_enabled) {
+		gl_shade_vertex(c, v);
+	} else {
+		v->color = c->current_color;
+	}
+
+	// tex coords
+
+	if (c->texture_2d_enabled) {
+		if (c->apply_texture_matrix) {
+			gl_M4_MulV4(&v->tex_coord, c->matrix_stack_ptr[2], &c->current_tex_coord);
+		} else {
+			v->tex_coord = c->current_tex_coord;
+		}
+	}
+	// precompute the mapping to the viewport
+	if (v->clip_code == 0)
+		gl_transform_to_viewport(c, v);
+
+	// edge flag
+
+	v->edge_flag = c->current_edge_flag;
+}
+
+// Transform, light and map to the viewport a vertex set in v->coord.
+void gl_compute_vertex(GLContext *c, GLVertex *v) {
+	gl_vertex_transform(c, v);
+	gl_vertex_attributes(c, v);
+}
+
+// The same transformation as gl_vertex_transform(), for a whole batch.
+void gl_transform_vertex_batch(GLContext *c, GLVertexBatch *b) {
+	const int count = b->count;
+	const float *m;
+
+	if (c->lighting_enabled) {
+		m = &c->matrix_stack_ptr[0]->m[0][0];
+		for (int i = 0; i < count; i++) {
+			b->ecX[i] = (b->x[i] * m[0] + b->y[i] * m[1] + b->z[i] * m[2] + m[3]);
+			b->ecY[i] = (b->x[i] * m[4] + b->y[i] * m[5] + b->z[i] * m[6] + m[7]);
+			b->ecZ[i] = (b->x[i] * m[8] + b->y[i] * m[9] + b->z[i] * m[10] + m[11]);
+			b->ecW[i] = (b->x[i] * m[12] + b->y[i] * m[13] + b->z[i] * m[14] + m[15]);
+		}
+
+		m = &c->matrix_stack_ptr[1]->m[0][0];
+		for (int i = 0; i < count; i++) {
+			b->pcX[i] = (b->ecX[i] * m[0] + b->ecY[i] * m[1] + b->ecZ[i] * m[2] + b->ecW[i] * m[3]);
+			b->pcY[i] = (b->ecX[i] * m[4] + b->ecY[i] * m[5] + b->ecZ[i] * m[6] + b->ecW[i] * m[7]);
+			b->pcZ[i] = (b->ecX[i] * m[8] + b->ecY[i] * m[9] + b->ecZ[i] * m[10] + b->ecW[i] * m[11]);
+			b->pcW[i] = (b->ecX[i] * m[12] + b->ecY[i] * m[13] + b->ecZ[i] * m[14] + b->ecW[i] * m[15]);
+		}
+
+		m = &c->matrix_model_view_inv.m[0][0];
+		for (int i = 0; i < count; i++) {
+			b->normalX[i] = (b->nx[i] * m[0] + b->ny[i] * m[1] + b->nz[i] * m[2]);
+			b->normalY[i] = (b->nx[i] * m[4] + b->ny[i] * m[5] + b->nz[i] * m[6]);
+			b->normalZ[i] = (b->nx[i] * m[8] + b->ny[i] * m[9] + b->nz[i] * m[10]);
+		}
+
+		if (c->normalize_enabled) {
+			for (int i = 0; i < count; i++) {
+				V3 normal = gl_V3_New(b->normalX[i], b->normalY[i], b->normalZ[i]);
+				gl_V3_Norm(&normal);
+				b->normalX[i] = normal.X;
+				b->normalY[i] = normal.Y;
+				b->normalZ[i] = normal.Z;
+			}
+		}
+	} else {
+		m = &c->matrix_model_projection.m[0][0];
+		for (int i = 0; i < count; i++) {
+			b->pcX[i] = (b->x[i] * m[0] + b->y[i] * m[1] + b->z[i] * m[2] + m[3]);
+			b->pcY[i] = (b->x[i] * m[4] + b->y[i] * m[5] + b->z[i] * m[6] + m[7]);
+			b->pcZ[i] = (b->x[i] * m[8] + b->y[i] * m[9] + b->z[i] * m[10] + m[11]);
+		}
+		if (c->matrix_model_projection_no_w_transform) {
+			for (int i = 0; i < count; i++)
+				b->pcW[i] = m[15];
+		} else {
+			for (int i = 0; i < count; i++)
+				b->pcW[i] = (b->x[i] * m[12] + b->y[i] * m[13] + b->z[i] * m[14] + m[15]);
+		}
+	}
+
+	for (int i = 0; i < count; i++)
+		b->clip_code[i] = gl_clipcode(b->pcX[i], b->pcY[i], b->pcZ[i], b->pcW[i]);
+}
+
+static inline void gl_vertex_from_batch(GLContext *c, GLVertex *v, GLVertexBatch *b, int i) {
+	if (c->lighting_enabled) {
+		v->ec.X = b->ecX[i];
+		v->ec.Y = b->ecY[i];
+		v->ec.Z = b->ecZ[i];
+		v->ec.W = b->ecW[i];
+		v->normal.X = b->normalX[i];
+		v->normal.Y = b->normalY[i];
+		v->normal.Z = b->normalZ[i];
+	}
+	v->pc.X = b->pcX[i];
+	v->pc.Y = b->pcY[i];
+	v->pc.Z = b->pcZ[i];
+	v->pc.W = b->pcW[i];
+	v->clip_code = b->clip_code[i];
+}
+
 void glopVertex(GLContext *c, GLParam *p) {
 	GLVertex *v;
+	GLVertexBatch *b;
 	int n, cnt;
 
 	assert(c->in_begin != 0);
@@ -220,32 +329,16 @@ void glopVertex(GLContext *c, GLParam *p) {
 	v->coord.Z = p[3].f;
 	v->coord.W = p[4].f;
 
-	gl_vertex_transform(c, v);
-
-	// color
-
-	if (c->lighting_enabled) {
-		gl_shade_vertex(c, v);
+	// the deferred ops have their vertices transformed beforehand
+	b = &c->vertex_batch;
+	if (b->next < b->count) {
+		gl_vertex_from_batch(c, v, b, b->next);
+		b->next++;
 	} else {
-		v->color = c->current_color;
-	}
-
-	// tex coords
-
-	if (c->texture_2d_enabled) {
-		if (c->apply_texture_matrix) {
-			gl_M4_MulV4(&v->tex_coord, c->matrix_stack_ptr[2], &c->current_tex_coord);
-		} else {
-			v->tex_coord = c->current_tex_coord;
-		}
+		gl_vertex_transform(c, v);
 	}
-	// precompute the mapping to the viewport
-	if (v->clip_code == 0)
-		gl_transform_to_viewport(c, v);
 
-	// edge flag
-
-	v->edge_flag = c->current_edge_flag;
+	gl_vertex_attributes(c, v);
 
 	switch (c->begin_type) {
 	case TGL_POINTS:
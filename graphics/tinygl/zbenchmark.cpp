@@ -0,0 +1,134 @@
+// Rasterizer benchmark: draws the same random triangles with each
+// ZB_fillTriangle* function, with the scalar and the SIMD span kernels.
+
+#include "common/scummsys.h"
+#include "common/system.h"
+#include "common/util.h"
+
+#include "graphics/tinygl/zbuffer.h"
+
+namespace TinyGL {
+
+static const struct {
+	const char *name;
+	ZB_fillTriangleFunc fill;
+} fillFuncs[] = {
+	{ "DepthOnly", ZB_fillTriangleDepthOnly },
+	{ "Flat", ZB_fillTriangleFlat },
+	{ "FlatShadowMask", ZB_fillTriangleFlatShadowMask },
+	{ "FlatShadow", ZB_fillTriangleFlatShadow },
+	{ "Smooth", ZB_fillTriangleSmooth },
+	{ "Mapping", ZB_fillTriangleMapping },
+	{ "MappingPerspective", ZB_fillTriangleMappingPerspective }
+};
+
+// A fixed linear congruential generator, so that every run draws the same
+// triangles.
+static uint32 benchmarkRandom(uint32 &seed, uint32 range) {
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 8) % range);
+}
+
+static uint32 drawBenchmarkTriangles(ZBuffer *zb, ZB_fillTriangleFunc fill, const ZBufferPoint *points, int triangles) {
+	ZB_clear(zb, 1, 0, 1, 0, 0, 0);
+	if (zb->shadow_mask_buf)
+		memset(zb->shadow_mask_buf, 0, zb->xsize * zb->ysize);
+
+	uint32 start = g_system->getMillis();
+	for (int i = 0; i < triangles; ++i) {
+		ZBufferPoint p[3];
+		p[0] = points[i * 3];
+		p[1] = points[i * 3 + 1];
+		p[2] = points[i * 3 + 2];
+		fill(zb, &p[0], &p[1], &p[2]);
+	}
+	return g_system->getMillis() - start;
+}
+
+void ZB_benchmarkRasterizer(int triangles, Common::Array<ZBufferBenchmarkResult> &results) {
+	const int width = 640;
+	const int height = 480;
+	const int textureBits = 8;
+	const int textureSize = 1 << textureBits;
+	const Graphics::PixelFormat format(2, 5, 6, 5, 0, 11, 5, 0, 0);
+#if defined(SCUMM_BIG_ENDIAN)
+	const Graphics::PixelFormat textureFormat(4, 8, 8, 8, 8, 24, 16, 8, 0);
+#elif defined(SCUMM_LITTLE_ENDIAN)
+	const Graphics::PixelFormat textureFormat(4, 8, 8, 8, 8, 0, 8, 16, 24);
+#endif
+
+	results.clear();
+	if (triangles <= 0)
+		return;
+
+	// ZB_open() sets the global pixel size, the benchmark must not change
+	// the one of the game's buffer.
+	uint8 savedPSZB = PSZB;
+
+	uint32 seed = 1;
+	ZBufferPoint *points = new ZBufferPoint[triangles * 3];
+	uint32 pixels = 0;
+	for (int i = 0; i < triangles; ++i) {
+		int cx = benchmarkRandom(seed, width);
+		int cy = benchmarkRandom(seed, height);
+		for (int j = 0; j < 3; ++j) {
+			ZBufferPoint &p = points[i * 3 + j];
+			p.x = CLIP<int>(cx + (int)benchmarkRandom(seed, 96) - 48, 0, width - 1);
+			p.y = CLIP<int>(cy + (int)benchmarkRandom(seed, 96) - 48, 0, height - 1);
+			p.z = benchmarkRandom(seed, 1 << (ZB_Z_BITS + ZB_POINT_Z_FRAC_BITS));
+			p.s = ZB_POINT_S_MIN + benchmarkRandom(seed, ZB_POINT_S_MAX - ZB_POINT_S_MIN);
+			p.t = ZB_POINT_T_MIN + benchmarkRandom(seed, ZB_POINT_T_MAX - ZB_POINT_T_MIN);
+			p.r = ZB_POINT_RED_MIN + benchmarkRandom(seed, ZB_POINT_RED_MAX - ZB_POINT_RED_MIN);
+			p.g = ZB_POINT_GREEN_MIN + benchmarkRandom(seed, ZB_POINT_GREEN_MAX - ZB_POINT_GREEN_MIN);
+			p.b = ZB_POINT_BLUE_MIN + benchmarkRandom(seed, ZB_POINT_BLUE_MAX - ZB_POINT_BLUE_MIN);
+			p.sz = p.tz = 0.0f;
+		}
+		const ZBufferPoint *p = &points[i * 3];
+		pixels += ABS((p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y)) / 2;
+	}
+
+	// A texture with some transparent texels, to exercise the alpha test.
+	uint32 *texels = new uint32[textureSize * textureSize];
+	for (int i = 0; i < textureSize * textureSize; ++i) {
+		uint8 a = (benchmarkRandom(seed, 8) == 0) ? 0 : 0xFF;
+		texels[i] = textureFormat.ARGBToColor(a, benchmarkRandom(seed, 256), benchmarkRandom(seed, 256), benchmarkRandom(seed, 256));
+	}
+	Graphics::PixelBuffer texture(textureFormat, (byte *)texels);
+
+	ZBuffer *zb[2];
+	byte *frameBuffer[2];
+	for (int i = 0; i < 2; ++i) {
+		frameBuffer[i] = new byte[width * height * format.bytesPerPixel];
+		zb[i] = ZB_open(width, height, Graphics::PixelBuffer(format, frameBuffer[i]));
+		zb[i]->span_kernels = ZB_getSpanKernels(i == 1);
+		zb[i]->shadow_mask_buf = (unsigned char *)gl_zalloc(width * height);
+		zb[i]->shadow_color_r = 0x40 << 8;
+		zb[i]->shadow_color_g = 0x40 << 8;
+		zb[i]->shadow_color_b = 0x40 << 8;
+		ZB_setTexture(zb[i], texture, textureBits, textureBits);
+	}
+
+	for (uint i = 0; i < ARRAYSIZE(fillFuncs); ++i) {
+		ZBufferBenchmarkResult result;
+		result.name = fillFuncs[i].name;
+		result.pixels = pixels;
+		result.scalarMs = drawBenchmarkTriangles(zb[0], fillFuncs[i].fill, points, triangles);
+		result.simdMs = drawBenchmarkTriangles(zb[1], fillFuncs[i].fill, points, triangles);
+		result.identical = memcmp(zb[0]->zbuf, zb[1]->zbuf, width * height * sizeof(unsigned int)) == 0 &&
+		                   memcmp(frameBuffer[0], frameBuffer[1], width * height * format.bytesPerPixel) == 0 &&
+		                   memcmp(zb[0]->shadow_mask_buf, zb[1]->shadow_mask_buf, width * height) == 0;
+		results.push_back(result);
+	}
+
+	for (int i = 0; i < 2; ++i) {
+		gl_free(zb[i]->shadow_mask_buf);
+		ZB_close(zb[i]);
+		delete[] frameBuffer[i];
+	}
+	delete[] texels;
+	delete[] points;
+
+	PSZB = savedPSZB;
+}
+
+} // end of namespace TinyGL
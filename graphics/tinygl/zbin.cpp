@@ -0,0 +1,160 @@
+// Binned rasterization: triangles are sorted into horizontal bands of the
+// screen and drawn one band at a time.
+
+#include "common/array.h"
+
+#include "graphics/tinygl/zbuffer.h"
+
+namespace TinyGL {
+
+// A triangle, with the ZBuffer state its fill function reads.
+struct ZBufferBinnedTriangle {
+	ZB_fillTriangleFunc fill;
+	ZBufferPoint p[3];
+	Graphics::PixelBuffer texture;
+	ZBufferTextureLayout texture_layout;
+	unsigned char *shadow_mask_buf;
+	int shadow_mask_x, shadow_mask_y, shadow_mask_width, shadow_mask_height;
+	int shadow_color_r, shadow_color_g, shadow_color_b;
+};
+
+struct ZBufferBins {
+	bool enabled;
+	Common::Array<ZBufferBinnedTriangle> triangles;
+	// The triangles overlapping each band, as indices in submission order.
+	Common::Array<Common::Array<uint> > bands;
+};
+
+void ZB_setBinning(ZBuffer *zb, bool enable) {
+	if (!enable) {
+		ZB_flushBins(zb);
+		if (zb->bins)
+			zb->bins->enabled = false;
+		return;
+	}
+
+	if (!zb->bins)
+		zb->bins = new ZBufferBins();
+	zb->bins->enabled = true;
+}
+
+void ZB_drawTriangle(ZBuffer *zb, ZB_fillTriangleFunc fill, ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2) {
+	int xmin = MIN(p0->x, MIN(p1->x, p2->x));
+	int xmax = MAX(p0->x, MAX(p1->x, p2->x));
+	int ymin = MIN(p0->y, MIN(p1->y, p2->y));
+	int ymax = MAX(p0->y, MAX(p1->y, p2->y));
+
+	// The shadow mask fill is the only one without a depth test.
+	if (fill != ZB_fillTriangleFlatShadowMask &&
+	    ZB_isOccluded(zb, xmin, ymin, xmax, ymax, MAX(p0->z, MAX(p1->z, p2->z))))
+		return;
+	ZB_markDirty(zb, xmin, ymin, xmax, ymax);
+	if (fill == ZB_fillTriangleFlatShadowMask) {
+		zb->shadow_mask_dirty_xmin = MIN(zb->shadow_mask_dirty_xmin, MAX(xmin, zb->shadow_mask_x));
+		zb->shadow_mask_dirty_ymin = MIN(zb->shadow_mask_dirty_ymin, MAX(ymin, zb->shadow_mask_y));
+		zb->shadow_mask_dirty_xmax = MAX(zb->shadow_mask_dirty_xmax, MIN(xmax, zb->shadow_mask_x + zb->shadow_mask_width - 1));
+		zb->shadow_mask_dirty_ymax = MAX(zb->shadow_mask_dirty_ymax, MIN(ymax, zb->shadow_mask_y + zb->shadow_mask_height - 1));
+	}
+
+	ZBufferBins *bins = zb->bins;
+	if (!bins || !bins->enabled) {
+		fill(zb, p0, p1, p2);
+		return;
+	}
+
+	ymin = MAX(ymin, 0);
+	ymax = MIN(ymax, zb->ysize - 1);
+	if (ymin > ymax)
+		return;
+
+	uint index = bins->triangles.size();
+	bins->triangles.resize(index + 1);
+	ZBufferBinnedTriangle &t = bins->triangles[index];
+	t.fill = fill;
+	t.p[0] = *p0;
+	t.p[1] = *p1;
+	t.p[2] = *p2;
+	t.texture = zb->current_texture;
+	t.texture_layout = zb->texture_layout;
+	t.shadow_mask_buf = zb->shadow_mask_buf;
+	t.shadow_mask_x = zb->shadow_mask_x;
+	t.shadow_mask_y = zb->shadow_mask_y;
+	t.shadow_mask_width = zb->shadow_mask_width;
+	t.shadow_mask_height = zb->shadow_mask_height;
+	t.shadow_color_r = zb->shadow_color_r;
+	t.shadow_color_g = zb->shadow_color_g;
+	t.shadow_color_b = zb->shadow_color_b;
+
+	uint numBands = (zb->ysize + ZB_BAND_HEIGHT - 1) / ZB_BAND_HEIGHT;
+	if (bins->bands.size() != numBands)
+		bins->bands.resize(numBands);
+	for (int band = ymin / ZB_BAND_HEIGHT; band <= ymax / ZB_BAND_HEIGHT; ++band)
+		bins->bands[band].push_back(index);
+}
+
+void ZB_flushBins(ZBuffer *zb) {
+	ZBufferBins *bins = zb->bins;
+	if (!bins || bins->triangles.empty())
+		return;
+
+	Graphics::PixelBuffer texture = zb->current_texture;
+	ZBufferTextureLayout textureLayout = zb->texture_layout;
+	unsigned char *shadowMask = zb->shadow_mask_buf;
+	int shadowMaskX = zb->shadow_mask_x;
+	int shadowMaskY = zb->shadow_mask_y;
+	int shadowMaskWidth = zb->shadow_mask_width;
+	int shadowMaskHeight = zb->shadow_mask_height;
+	int shadowR = zb->shadow_color_r;
+	int shadowG = zb->shadow_color_g;
+	int shadowB = zb->shadow_color_b;
+
+	for (uint band = 0; band < bins->bands.size(); ++band) {
+		Common::Array<uint> &list = bins->bands[band];
+		if (list.empty())
+			continue;
+
+		zb->band_ymin = band * ZB_BAND_HEIGHT;
+		zb->band_ymax = MIN<int>(zb->band_ymin + ZB_BAND_HEIGHT, zb->ysize);
+		for (uint i = 0; i < list.size(); ++i) {
+			const ZBufferBinnedTriangle &t = bins->triangles[list[i]];
+			zb->current_texture = t.texture;
+			zb->texture_layout = t.texture_layout;
+			zb->shadow_mask_buf = t.shadow_mask_buf;
+			zb->shadow_mask_x = t.shadow_mask_x;
+			zb->shadow_mask_y = t.shadow_mask_y;
+			zb->shadow_mask_width = t.shadow_mask_width;
+			zb->shadow_mask_height = t.shadow_mask_height;
+			zb->shadow_color_r = t.shadow_color_r;
+			zb->shadow_color_g = t.shadow_color_g;
+			zb->shadow_color_b = t.shadow_color_b;
+
+			// The fill functions change the points.
+			ZBufferPoint p[3] = { t.p[0], t.p[1], t.p[2] };
+			t.fill(zb, &p[0], &p[1], &p[2]);
+		}
+		// Keep the storage for the next frame.
+		list.resize(0);
+	}
+	bins->triangles.resize(0);
+
+	zb->band_ymin = 0;
+	zb->band_ymax = zb->ysize;
+	zb->current_texture = texture;
+	zb->texture_layout = textureLayout;
+	zb->shadow_mask_buf = shadowMask;
+	zb->shadow_mask_x = shadowMaskX;
+	zb->shadow_mask_y = shadowMaskY;
+	zb->shadow_mask_width = shadowMaskWidth;
+	zb->shadow_mask_height = shadowMaskHeight;
+	zb->shadow_color_r = shadowR;
+	zb->shadow_color_g = shadowG;
+	zb->shadow_color_b = shadowB;
+}
+
+void ZB_closeBins(ZBuffer *zb) {
+	ZB_flushBins(zb);
+	delete zb->bins;
+	zb->bins = NULL;
+}
+
+} // end of namespace TinyGL
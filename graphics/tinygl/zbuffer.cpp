@@ -48,10 +48,22 @@ ZBuffer *ZB_open(int xsize, int ysize, const Graphics::PixelBuffer &frame_buffer
 	}
 
 	zb->current_texture = NULL;
+	ZB_setTextureLayout(&zb->texture_layout, 0, 0);
 	zb->shadow_mask_buf = NULL;
+	zb->shadow_mask_x = 0;
+	zb->shadow_mask_y = 0;
+	zb->shadow_mask_width = xsize;
+	zb->shadow_mask_height = ysize;
+	ZB_resetShadowMaskDirty(zb);
+	zb->span_kernels = ZB_getSpanKernels(true);
+	zb->band_ymin = 0;
+	zb->band_ymax = ysize;
+	zb->bins = NULL;
+	zb->depth_pyramid = NULL;
 
 	zb->buffer.pbuf = zb->pbuf.getRawBuffer();
 	zb->buffer.zbuf = zb->zbuf;
+	zb->selected_buffer = NULL;
 
 	return zb;
 error:
@@ -60,6 +72,9 @@ error:
 }
 
 void ZB_close(ZBuffer *zb) {
+	ZB_closeBins(zb);
+	ZB_closeDepthPyramid(zb);
+
 	if (zb->frame_buffer_allocated)
 		zb->pbuf.free();
 
@@ -70,12 +85,16 @@ void ZB_close(ZBuffer *zb) {
 void ZB_resize(ZBuffer *zb, void *frame_buffer, int xsize, int ysize) {
 	int size;
 
+	ZB_flushBins(zb);
+	ZB_invalidateDepthPyramid(zb);
+
 	// xsize must be a multiple of 4
 	xsize = xsize & ~3;
 
 	zb->xsize = xsize;
 	zb->ysize = ysize;
 	zb->linesize = (xsize * zb->pixelbytes + 3) & ~3;
+	zb->band_ymax = ysize;
 
 	size = zb->xsize * zb->ysize * sizeof(unsigned int);
 
@@ -111,6 +130,7 @@ static void ZB_copyBuffer(ZBuffer *zb, void *buf, int linesize) {
 }
 
 void ZB_copyFrameBuffer(ZBuffer *zb, void *buf, int linesize) {
+	ZB_flushBins(zb);
 	ZB_copyBuffer(zb, buf, linesize);
 }
 
@@ -162,9 +182,14 @@ void ZB_clear(ZBuffer *zb, int clear_z, int z, int clear_color, int r, int g, in
 	uint32 color;
 	byte *pp;
 
+	ZB_flushBins(zb);
 	if (clear_z) {
 		memset_l(zb->zbuf, z, zb->xsize * zb->ysize);
 	}
+	if (clear_z || clear_color)
+		ZB_markDirty(zb, 0, 0, zb->xsize - 1, zb->ysize - 1);
+	if (clear_z && !zb->selected_buffer)
+		ZB_invalidateDepthPyramid(zb);
 	if (clear_color) {
 		pp = zb->pbuf.getRawBuffer();
 		for (int y = 0; y < zb->ysize; y++) {
@@ -175,37 +200,66 @@ void ZB_clear(ZBuffer *zb, int clear_z, int z, int clear_color, int r, int g, in
 	}
 }
 
+static void resetDirtyRect(ZBuffer *zb, Buffer *buf) {
+	buf->dirty_xmin = zb->xsize;
+	buf->dirty_ymin = zb->ysize;
+	buf->dirty_xmax = -1;
+	buf->dirty_ymax = -1;
+}
+
 Buffer *ZB_genOffscreenBuffer(ZBuffer *zb) {
 	Buffer *buf = (Buffer *)gl_malloc(sizeof(Buffer));
-	buf->pbuf = (byte *)gl_malloc(zb->ysize * zb->linesize);
+	// The buffer starts clear, only its dirty rectangle is cleared after
+	// that.
+	buf->pbuf = (byte *)gl_zalloc(zb->ysize * zb->linesize);
 	int size = zb->xsize * zb->ysize * sizeof(unsigned int);
-	buf->zbuf = (unsigned int *)gl_malloc(size);
+	buf->zbuf = (unsigned int *)gl_zalloc(size);
+	buf->used = false;
+	resetDirtyRect(zb, buf);
 
 	return buf;
 }
 
 void ZB_delOffscreenBuffer(ZBuffer *zb, Buffer *buf) {
+	ZB_flushBins(zb);
+	if (zb->selected_buffer == buf)
+		zb->selected_buffer = NULL;
 	gl_free(buf->pbuf);
 	gl_free(buf->zbuf);
 	gl_free(buf);
 }
 
 void ZB_blitOffscreenBuffer(ZBuffer *zb, Buffer *buf) {
-	// TODO: could be faster, probably.
-	if (buf->used) {
-		for (int i = 0; i < zb->xsize * zb->ysize; ++i) {
-			unsigned int d1 = buf->zbuf[i];
-			unsigned int d2 = zb->zbuf[i];
-			if (d1 > d2) {
-				const int offset = i * PSZB;
-				memcpy(zb->pbuf.getRawBuffer() + offset, buf->pbuf + offset, PSZB);
-				memcpy(zb->zbuf + i, buf->zbuf + i, sizeof(int));
+	ZB_flushBins(zb);
+	if (!buf->used || buf->dirty_xmin > buf->dirty_xmax)
+		return;
+
+	// Outside of its dirty rectangle the buffer is clear, and none of its
+	// pixels can be above the ones of the screen.
+	const int xmin = buf->dirty_xmin;
+	const int count = buf->dirty_xmax - xmin + 1;
+	for (int y = buf->dirty_ymin; y <= buf->dirty_ymax; ++y) {
+		const int offset = y * zb->xsize + xmin;
+		unsigned int *pz = zb->zbuf + offset;
+		const unsigned int *srcz = buf->zbuf + offset;
+		byte *pp = zb->pbuf.getRawBuffer() + y * zb->linesize + xmin * PSZB;
+		const byte *srcp = buf->pbuf + y * zb->linesize + xmin * PSZB;
+		if (PSZB == 2) {
+			zb->span_kernels->blit16((uint16 *)pp, pz, (const uint16 *)srcp, srcz, count);
+		} else {
+			for (int i = 0; i < count; ++i) {
+				if (srcz[i] > pz[i]) {
+					memcpy(pp + i * PSZB, srcp + i * PSZB, PSZB);
+					pz[i] = srcz[i];
+				}
 			}
 		}
 	}
+	ZB_markDirty(zb, buf->dirty_xmin, buf->dirty_ymin, buf->dirty_xmax, buf->dirty_ymax);
 }
 
 void ZB_selectOffscreenBuffer(ZBuffer *zb, Buffer *buf) {
+	ZB_flushBins(zb);
 	if (buf) {
 		zb->pbuf = buf->pbuf;
 		zb->zbuf = buf->zbuf;
@@ -214,11 +268,20 @@ void ZB_selectOffscreenBuffer(ZBuffer *zb, Buffer *buf) {
 		zb->pbuf = zb->buffer.pbuf;
 		zb->zbuf = zb->buffer.zbuf;
 	}
+	zb->selected_buffer = buf;
 }
 
 void ZB_clearOffscreenBuffer(ZBuffer *zb, Buffer *buf) {
-	memset(buf->pbuf, 0, zb->ysize * zb->linesize);
-	memset(buf->zbuf, 0, zb->ysize * zb->xsize * sizeof(unsigned int));
+	ZB_flushBins(zb);
+	if (buf->dirty_xmin <= buf->dirty_xmax) {
+		const int xmin = buf->dirty_xmin;
+		const int count = buf->dirty_xmax - xmin + 1;
+		for (int y = buf->dirty_ymin; y <= buf->dirty_ymax; ++y) {
+			memset(buf->pbuf + y * zb->linesize + xmin * PSZB, 0, count * PSZB);
+			memset(buf->zbuf + y * zb->xsize + xmin, 0, count * sizeof(unsigned int));
+		}
+	}
+	resetDirtyRect(zb, buf);
 	buf->used = false;
 }
 
@@ -1,6 +1,8 @@
 #ifndef GRAPHICS_TINYGL_ZBUFFER_H_
 #define GRAPHICS_TINYGL_ZBUFFER_H_
 
+#include "common/array.h"
+
 #include "graphics/pixelbuffer.h"
 
 namespace TinyGL {
@@ -33,10 +35,45 @@ typedef byte PIXEL;
 
 extern uint8 PSZB;
 
+struct ZBufferSpanKernels;
+
+/**
+ * Textures are stored in tiles of 4x4 texels, the tiles of a row one after
+ * the other, so that the texels a triangle samples around a pixel are close
+ * in memory whatever direction the scanlines walk the texture in. Widths
+ * and heights are powers of two, and the tiles of textures narrower or
+ * lower than a tile are padded.
+ */
+#define ZB_TEXTURE_TILE_BITS 2
+
+struct ZBufferTextureLayout {
+	int sShift, tShift;        // from the s, t fixed point coordinates to texels
+	unsigned int xMask, yMask; // texture width and height minus one, to repeat it
+	int rowShift;              // log2 of the texels in a row of tiles
+};
+
+void ZB_setTextureLayout(ZBufferTextureLayout *layout, int widthBits, int heightBits);
+
+static inline unsigned int ZB_tiledTexelIndex(const ZBufferTextureLayout &layout, unsigned int x, unsigned int y) {
+	const unsigned int tileMask = (1 << ZB_TEXTURE_TILE_BITS) - 1;
+	return ((y >> ZB_TEXTURE_TILE_BITS) << layout.rowShift) |
+	       ((x >> ZB_TEXTURE_TILE_BITS) << (2 * ZB_TEXTURE_TILE_BITS)) |
+	       ((y & tileMask) << ZB_TEXTURE_TILE_BITS) | (x & tileMask);
+}
+
+static inline unsigned int ZB_texelIndex(const ZBufferTextureLayout &layout, unsigned int s, unsigned int t) {
+	return ZB_tiledTexelIndex(layout, (s >> layout.sShift) & layout.xMask, (t >> layout.tShift) & layout.yMask);
+}
+struct ZBufferBins;
+struct ZBufferDepthPyramid;
+
 struct Buffer {
 	byte *pbuf;
 	unsigned int *zbuf;
 	bool used;
+	// The pixels drawn since the buffer was cleared are all in this
+	// rectangle, which is empty if dirty_xmin > dirty_xmax.
+	int dirty_xmin, dirty_ymin, dirty_xmax, dirty_ymax;
 };
 
 struct ZBuffer {
@@ -47,9 +84,18 @@ struct ZBuffer {
 	int pixelbytes;
 
 	Buffer buffer;
+	// The offscreen buffer being drawn to, NULL for the screen.
+	Buffer *selected_buffer;
 
 	unsigned int *zbuf;
 	unsigned char *shadow_mask_buf;
+	// The rectangle of the screen the shadow mask covers, line after line.
+	int shadow_mask_x, shadow_mask_y;
+	int shadow_mask_width, shadow_mask_height;
+	// The pixels of the shadow mask written since ZB_resetShadowMaskDirty(),
+	// empty if shadow_mask_dirty_xmin > shadow_mask_dirty_xmax.
+	int shadow_mask_dirty_xmin, shadow_mask_dirty_ymin;
+	int shadow_mask_dirty_xmax, shadow_mask_dirty_ymax;
 	int shadow_color_r;
 	int shadow_color_g;
 	int shadow_color_b;
@@ -59,6 +105,15 @@ struct ZBuffer {
 	unsigned char *dctable;
 	int *ctable;
 	Graphics::PixelBuffer current_texture;
+	ZBufferTextureLayout texture_layout;
+
+	const ZBufferSpanKernels *span_kernels;
+
+	// The triangle rasterizer only draws the lines in [band_ymin, band_ymax).
+	int band_ymin, band_ymax;
+	ZBufferBins *bins;
+
+	ZBufferDepthPyramid *depth_pyramid;
 };
 
 struct ZBufferPoint {
@@ -82,6 +137,31 @@ void ZB_blitOffscreenBuffer(ZBuffer *zb, Buffer *buffer);
 void ZB_selectOffscreenBuffer(ZBuffer *zb, Buffer *buffer);
 void ZB_clearOffscreenBuffer(ZBuffer *zb, Buffer *buffer);
 
+/**
+ * Extend the dirty rectangle of the selected offscreen buffer, if any, to
+ * the pixels from xmin, ymin to xmax, ymax included.
+ */
+static inline void ZB_markDirty(ZBuffer *zb, int xmin, int ymin, int xmax, int ymax) {
+	Buffer *buf = zb->selected_buffer;
+	if (!buf)
+		return;
+	buf->dirty_xmin = MIN(buf->dirty_xmin, MAX(xmin, 0));
+	buf->dirty_ymin = MIN(buf->dirty_ymin, MAX(ymin, 0));
+	buf->dirty_xmax = MAX(buf->dirty_xmax, MIN(xmax, zb->xsize - 1));
+	buf->dirty_ymax = MAX(buf->dirty_ymax, MIN(ymax, zb->ysize - 1));
+}
+
+static inline void ZB_resetShadowMaskDirty(ZBuffer *zb) {
+	zb->shadow_mask_dirty_xmin = zb->xsize;
+	zb->shadow_mask_dirty_ymin = zb->ysize;
+	zb->shadow_mask_dirty_xmax = -1;
+	zb->shadow_mask_dirty_ymax = -1;
+}
+
+static inline unsigned char *ZB_shadowMaskAt(ZBuffer *zb, int x, int y) {
+	return zb->shadow_mask_buf + (y - zb->shadow_mask_y) * zb->shadow_mask_width + (x - zb->shadow_mask_x);
+}
+
 ZBuffer *ZB_open(int xsize, int ysize, const Graphics::PixelBuffer &buffer);
 void ZB_close(ZBuffer *zb);
 void ZB_resize(ZBuffer *zb, void *frame_buffer, int xsize, int ysize);
@@ -97,7 +177,8 @@ void ZB_line_z(ZBuffer *zb, ZBufferPoint *p1, ZBufferPoint *p2);
 
 // ztriangle.c */
 
-void ZB_setTexture(ZBuffer *zb, const Graphics::PixelBuffer &texture);
+// widthBits and heightBits are the log2 of the texture size, see ZBufferTextureLayout.
+void ZB_setTexture(ZBuffer *zb, const Graphics::PixelBuffer &texture, int widthBits, int heightBits);
 void ZB_fillTriangleDepthOnly(ZBuffer *zb, ZBufferPoint *p1,
 							  ZBufferPoint *p2, ZBufferPoint *p3);
 void ZB_fillTriangleFlat(ZBuffer *zb, ZBufferPoint *p1,
@@ -115,6 +196,104 @@ void ZB_fillTriangleMappingPerspective(ZBuffer *zb, ZBufferPoint *p0,
 typedef void (*ZB_fillTriangleFunc)(ZBuffer *, ZBufferPoint *,
 									ZBufferPoint *, ZBufferPoint *);
 
+// zspan.c
+
+/**
+ * The state of a scanline span, as the triangle rasterizer steps it from
+ * one pixel to the next. The span kernels advance z, s, t and rgb past the
+ * pixels they draw.
+ */
+struct ZBufferSpan {
+	unsigned int z, s, t;
+	int dzdx, dsdx, dtdx;
+	// Packed color, as in ZB_fillTriangleSmooth.
+	unsigned int rgb, drgbdx;
+
+	// Perspective mapping only.
+	const uint32 *texture;
+	ZBufferTextureLayout textureLayout;
+	Graphics::PixelFormat textureFormat;
+	Graphics::PixelFormat format;
+};
+
+/**
+ * The inner loops of ZB_fillTriangleDepthOnly, ZB_fillTriangleSmooth,
+ * ZB_fillTriangleMappingPerspective and ZB_blitOffscreenBuffer. smooth16,
+ * mapping16 and blit16 only handle 16 bit frame buffers, and mapping16 only 32 bit textures with 8 bits per
+ * component. Every set of kernels gives exactly the same output.
+ */
+struct ZBufferSpanKernels {
+	const char *name;
+	void (*depthOnly)(unsigned int *pz, ZBufferSpan *span, int count);
+	void (*smooth16)(uint16 *pp, unsigned int *pz, ZBufferSpan *span, int count);
+	void (*mapping16)(uint16 *pp, unsigned int *pz, ZBufferSpan *span, int count);
+	void (*blit16)(uint16 *pp, unsigned int *pz, const uint16 *srcp, const unsigned int *srcz, int count);
+};
+
+/**
+ * Return the SSE2 or NEON kernels if simd is true and the build targets
+ * either, the scalar ones otherwise.
+ */
+const ZBufferSpanKernels *ZB_getSpanKernels(bool simd);
+bool ZB_hasSIMDSpanKernels();
+
+// zbin.c
+
+#define ZB_BAND_HEIGHT 32
+
+/**
+ * Binned rasterization. While binning is enabled ZB_drawTriangle() does not
+ * draw the triangles, it sorts them into horizontal bands of ZB_BAND_HEIGHT
+ * lines. ZB_flushBins() then draws them one band at a time, in the order they
+ * were submitted, with the rasterizer clipped to the band. The bands share no
+ * pixel of the color, z and shadow mask buffers, so the output is the same as
+ * when drawing the triangles right away. The bands are drawn in turn, and a
+ * triangle is set up again for every band it covers, so this costs more than
+ * drawing right away; it is off unless enabled. The ZB_* functions which
+ * touch the buffers flush the bins first.
+ */
+void ZB_setBinning(ZBuffer *zb, bool enable);
+void ZB_drawTriangle(ZBuffer *zb, ZB_fillTriangleFunc fill, ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2);
+void ZB_flushBins(ZBuffer *zb);
+void ZB_closeBins(ZBuffer *zb);
+
+// zcull.c
+
+/**
+ * Build the depth pyramid of the screen z buffer, if it is not built yet.
+ * It only stays right as long as the z buffer values only go up, so it must
+ * be invalidated whenever the z buffer is cleared or written other than by
+ * the rasterizer, which ZB_clear() does. While it is valid, ZB_drawTriangle()
+ * skips the triangles drawn to the screen which are entirely behind it.
+ */
+void ZB_buildDepthPyramid(ZBuffer *zb);
+void ZB_invalidateDepthPyramid(ZBuffer *zb);
+bool ZB_hasDepthPyramid(ZBuffer *zb);
+/**
+ * Tell whether everything drawn in the given rectangle of the screen, from
+ * xmin, ymin to xmax, ymax included, with a z not above the given one
+ * would be hidden. It is false when there is no valid depth pyramid.
+ */
+bool ZB_isOccluded(ZBuffer *zb, int xmin, int ymin, int xmax, int ymax, int z);
+void ZB_closeDepthPyramid(ZBuffer *zb);
+
+// zbenchmark.c
+
+struct ZBufferBenchmarkResult {
+	const char *name;
+	uint32 pixels;
+	uint32 scalarMs, simdMs;
+	// Whether the scalar and SIMD kernels drew the same color and z buffers.
+	bool identical;
+};
+
+/**
+ * Draw the same random triangles with each ZB_fillTriangle* function, once
+ * with the scalar span kernels and once with the SIMD ones, into an
+ * offscreen 640x480 16 bit buffer.
+ */
+void ZB_benchmarkRasterizer(int triangles, Common::Array<ZBufferBenchmarkResult> &results);
+
 // memory.c
 void gl_free(void *p);
 void *gl_malloc(int size);
@@ -0,0 +1,130 @@
+// Occlusion culling: a pyramid of the farthest depth of each tile of the
+// screen z buffer, built once the background is drawn, tells which
+// triangles and meshes are entirely behind it.
+
+#include "common/array.h"
+
+#include "graphics/tinygl/zbuffer.h"
+
+namespace TinyGL {
+
+// The first level has a value for each tile of 8x8 pixels, and each next
+// level one for each 2x2 tiles of the previous one.
+#define ZB_CULL_TILE_BITS 3
+
+// The z of the pixels of a triangle can be a bit above the ones of its
+// points, because of rounding.
+#define ZB_CULL_Z_MARGIN (1 << ZB_POINT_Z_FRAC_BITS)
+
+struct ZBufferDepthPyramid {
+	bool valid;
+	Common::Array<Common::Array<unsigned int> > levels;
+	Common::Array<int> widths, heights;
+};
+
+void ZB_buildDepthPyramid(ZBuffer *zb) {
+	if (!zb->depth_pyramid)
+		zb->depth_pyramid = new ZBufferDepthPyramid();
+	ZBufferDepthPyramid *pyramid = zb->depth_pyramid;
+	if (pyramid->valid)
+		return;
+
+	// The pyramid is only used for the screen, whichever buffer is selected.
+	const unsigned int *zbuf = zb->buffer.zbuf;
+	int width = (zb->xsize + (1 << ZB_CULL_TILE_BITS) - 1) >> ZB_CULL_TILE_BITS;
+	int height = (zb->ysize + (1 << ZB_CULL_TILE_BITS) - 1) >> ZB_CULL_TILE_BITS;
+	pyramid->levels.resize(1);
+	pyramid->widths.resize(1);
+	pyramid->heights.resize(1);
+	pyramid->widths[0] = width;
+	pyramid->heights[0] = height;
+
+	Common::Array<unsigned int> &first = pyramid->levels[0];
+	first.resize(width * height);
+	for (int i = 0; i < width * height; ++i)
+		first[i] = 0xFFFFFFFF;
+	for (int y = 0; y < zb->ysize; ++y) {
+		unsigned int *tiles = &first[(y >> ZB_CULL_TILE_BITS) * width];
+		const unsigned int *pz = zbuf + y * zb->xsize;
+		for (int x = 0; x < zb->xsize; ++x) {
+			unsigned int &tile = tiles[x >> ZB_CULL_TILE_BITS];
+			tile = MIN(tile, pz[x]);
+		}
+	}
+
+	while (width > 1 || height > 1) {
+		int nextWidth = (width + 1) / 2;
+		int nextHeight = (height + 1) / 2;
+		pyramid->levels.resize(pyramid->levels.size() + 1);
+		pyramid->widths.push_back(nextWidth);
+		pyramid->heights.push_back(nextHeight);
+
+		const Common::Array<unsigned int> &level = pyramid->levels[pyramid->levels.size() - 2];
+		Common::Array<unsigned int> &next = pyramid->levels.back();
+		next.resize(nextWidth * nextHeight);
+		for (int y = 0; y < nextHeight; ++y) {
+			int y0 = 2 * y, y1 = MIN(2 * y + 1, height - 1);
+			for (int x = 0; x < nextWidth; ++x) {
+				int x0 = 2 * x, x1 = MIN(2 * x + 1, width - 1);
+				next[y * nextWidth + x] = MIN(MIN(level[y0 * width + x0], level[y0 * width + x1]),
+				                              MIN(level[y1 * width + x0], level[y1 * width + x1]));
+			}
+		}
+		width = nextWidth;
+		height = nextHeight;
+	}
+
+	pyramid->valid = true;
+}
+
+void ZB_invalidateDepthPyramid(ZBuffer *zb) {
+	if (zb->depth_pyramid)
+		zb->depth_pyramid->valid = false;
+}
+
+bool ZB_hasDepthPyramid(ZBuffer *zb) {
+	return zb->depth_pyramid && zb->depth_pyramid->valid && !zb->selected_buffer;
+}
+
+bool ZB_isOccluded(ZBuffer *zb, int xmin, int ymin, int xmax, int ymax, int z) {
+	if (!ZB_hasDepthPyramid(zb))
+		return false;
+
+	xmin = MAX(xmin, 0);
+	ymin = MAX(ymin, 0);
+	xmax = MIN(xmax, zb->xsize - 1);
+	ymax = MIN(ymax, zb->ysize - 1);
+	if (xmin > xmax || ymin > ymax)
+		return false;
+
+	// Go up the pyramid until the rectangle covers at most 4x4 values. The
+	// tiles are then larger than the rectangle, which only makes the test
+	// more conservative.
+	const ZBufferDepthPyramid *pyramid = zb->depth_pyramid;
+	uint level = 0;
+	int shift = ZB_CULL_TILE_BITS;
+	while (level + 1 < pyramid->levels.size() &&
+	       ((xmax >> shift) - (xmin >> shift) > 3 || (ymax >> shift) - (ymin >> shift) > 3)) {
+		level++;
+		shift++;
+	}
+
+	// A pixel is drawn if its z is not below the one in the z buffer.
+	const Common::Array<unsigned int> &tiles = pyramid->levels[level];
+	const int width = pyramid->widths[level];
+	const unsigned int zmax = (unsigned int)MAX(z, 0) + ZB_CULL_Z_MARGIN;
+	for (int y = ymin >> shift; y <= ymax >> shift; ++y) {
+		for (int x = xmin >> shift; x <= xmax >> shift; ++x) {
+			if (zmax >= tiles[y * width + x])
+				return false;
+		}
+	}
+	return true;
+}
+
+void ZB_closeDepthPyramid(ZBuffer *zb) {
+	delete zb->depth_pyramid;
+	zb->depth_pyramid = NULL;
+}
+
+} // end of namespace TinyGL
@@ -35,6 +35,7 @@ enum {
 #define MAX_TEXTURE_STACK_DEPTH     8
 #define MAX_NAME_STACK_DEPTH        64
 #define MAX_TEXTURE_LEVELS          11
+#define MAX_TEXTURE_SIZE_BITS       8
 #define T_MAX_LIGHTS                32
 
 #define VERTEX_HASH_SIZE 1031
@@ -109,6 +110,22 @@ struct GLList {
 	// TODO: extensions for an hash table or a better allocating scheme
 };
 
+#define VERTEX_BATCH_SIZE 64
+
+// Vertices of recorded ops, transformed together before their glopVertex()
+// runs. Each component has its own array so the loops can be vectorized.
+struct GLVertexBatch {
+	int count, next;
+	float x[VERTEX_BATCH_SIZE], y[VERTEX_BATCH_SIZE], z[VERTEX_BATCH_SIZE];
+	float nx[VERTEX_BATCH_SIZE], ny[VERTEX_BATCH_SIZE], nz[VERTEX_BATCH_SIZE];
+
+	// computed values
+	float ecX[VERTEX_BATCH_SIZE], ecY[VERTEX_BATCH_SIZE], ecZ[VERTEX_BATCH_SIZE], ecW[VERTEX_BATCH_SIZE];
+	float pcX[VERTEX_BATCH_SIZE], pcY[VERTEX_BATCH_SIZE], pcZ[VERTEX_BATCH_SIZE], pcW[VERTEX_BATCH_SIZE];
+	float normalX[VERTEX_BATCH_SIZE], normalY[VERTEX_BATCH_SIZE], normalZ[VERTEX_BATCH_SIZE];
+	int clip_code[VERTEX_BATCH_SIZE];
+};
+
 struct GLVertex {
 	int edge_flag;
 	V3 normal;
@@ -123,9 +140,11 @@ struct GLVertex {
 	ZBufferPoint zp;      // integer coordinates for the rasterization
 };
 
+// The texels are stored in tiles, see ZBufferTextureLayout.
 struct GLImage {
 	Graphics::PixelBuffer pixmap;
 	int xsize, ysize;
+	int xsize_bits, ysize_bits;
 };
 
 // textures
@@ -134,6 +153,10 @@ struct GLImage {
 
 struct GLTexture {
 	GLImage images[MAX_TEXTURE_LEVELS];
+	// The texels are never filtered, a *_MIPMAP_* minification filter only
+	// makes TinyGL build the mipmaps and pick one of them for each triangle.
+	int min_filter;
+	int num_levels;
 	int handle;
 	struct GLTexture *next, *prev;
 };
@@ -182,6 +205,13 @@ struct GLContext {
 	int current_op_buffer_index;
 	int exec_flag, compile_flag, print_flag;
 
+	// deferred ops, the buffers are kept from one flush to the next
+	int defer_flag;
+	GLParamBuffer *defer_first_buffer, *defer_buffer;
+	int defer_index;
+	GLParam *defer_last_op;
+	GLVertexBatch vertex_batch;
+
 	// matrix
 	int matrix_mode;
 	M4 *matrix_stack[3];
@@ -251,6 +281,10 @@ struct GLContext {
 	int texcoord_array_size;
 	int texcoord_array_stride;
 	int client_states;
+	// glDrawElements vertex cache
+	GLVertex *element_vertex;
+	unsigned char *element_done;
+	int element_max;
 
 	// opengl 1.1 polygon offset
 	float offset_factor;
@@ -279,6 +313,8 @@ struct GLContext {
 extern GLContext *gl_ctx;
 
 void gl_add_op(GLParam *p);
+void gl_flush_deferred(GLContext *c);
+void gl_free_deferred(GLContext *c);
 
 // clip.c
 void gl_transform_to_viewport(GLContext *c, GLVertex *v);
@@ -291,6 +327,10 @@ void gl_draw_triangle_line(GLContext *c, GLVertex *p0, GLVertex *p1, GLVertex *p
 void gl_draw_triangle_fill(GLContext *c, GLVertex *p0, GLVertex *p1, GLVertex *p2);
 void gl_draw_triangle_select(GLContext *c, GLVertex *p0, GLVertex *p1, GLVertex *p2);
 
+// vertex.c
+void gl_transform_vertex_batch(GLContext *c, GLVertexBatch *b);
+void gl_compute_vertex(GLContext *c, GLVertex *v);
+
 // matrix.c
 void gl_print_matrix(const float *m);
 
@@ -303,6 +343,7 @@ void glInitTextures(GLContext *c);
 void glEndTextures(GLContext *c);
 GLTexture *alloc_texture(GLContext *c, int h);
 void free_texture(GLContext *c, int h);
+GLImage *gl_select_texture_level(GLContext *c, ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2);
 
 // image_util.c
 void gl_resizeImage(unsigned char *dest, int xsize_dest, int ysize_dest,
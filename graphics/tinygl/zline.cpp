@@ -9,6 +9,8 @@ void ZB_plot(ZBuffer *zb, ZBufferPoint *p) {
 	unsigned int *pz;
 	PIXEL *pp;
 
+	ZB_flushBins(zb);
+	ZB_markDirty(zb, p->x, p->y, p->x, p->y);
 	pz = zb->zbuf + (p->y * zb->xsize + p->x);
 	pp = (PIXEL *)((char *) zb->pbuf.getRawBuffer() + zb->linesize * p->y + p->x * PSZB);
 	if (ZCMP((unsigned int)p->z, *pz)) {
@@ -42,6 +44,8 @@ static void ZB_line_interp(ZBuffer *zb, ZBufferPoint *p1, ZBufferPoint *p2) {
 void ZB_line_z(ZBuffer *zb, ZBufferPoint *p1, ZBufferPoint *p2) {
 	int color1, color2;
 
+	ZB_flushBins(zb);
+	ZB_markDirty(zb, MIN(p1->x, p2->x), MIN(p1->y, p2->y), MAX(p1->x, p2->x), MAX(p1->y, p2->y));
 	color1 = RGB_TO_PIXEL(p1->r, p1->g, p1->b);
 	color2 = RGB_TO_PIXEL(p2->r, p2->g, p2->b);
 
@@ -56,6 +60,8 @@ void ZB_line_z(ZBuffer *zb, ZBufferPoint *p1, ZBufferPoint *p2) {
 void ZB_line(ZBuffer *zb, ZBufferPoint *p1, ZBufferPoint *p2) {
 	int color1, color2;
 
+	ZB_flushBins(zb);
+	ZB_markDirty(zb, MIN(p1->x, p2->x), MIN(p1->y, p2->y), MAX(p1->x, p2->x), MAX(p1->y, p2->y));
 	color1 = RGB_TO_PIXEL(p1->r, p1->g, p1->b);
 	color2 = RGB_TO_PIXEL(p2->r, p2->g, p2->b);
 
@@ -0,0 +1,519 @@
+// Span kernels for the triangle rasterizer and the offscreen buffer blit.
+// The scalar ones are the inner loops of ztriangle.cpp and zbuffer.cpp as
+// they were; the SSE2 and NEON ones, used when
+// the compiler targets those instruction sets, draw 4 or 8 pixels at a time
+// and give the same output bit for bit.
+
+#include "common/scummsys.h"
+
+#include "graphics/tinygl/zbuffer.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define TINYGL_SPAN_SSE2
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TINYGL_SPAN_NEON
+#endif
+
+namespace TinyGL {
+
+// The color components of the packed rgb value are kept apart by guard
+// bits, which are cleared after each step.
+#define RGB_GUARD_MASK (~0x00200800)
+#define RGB_TO_565_MASK 0xF81F07E0
+
+static inline unsigned int stepRGB(unsigned int rgb, unsigned int drgbdx) {
+	return (rgb + drgbdx) & RGB_GUARD_MASK;
+}
+
+static inline unsigned int multiplyStep(int d, int n) {
+	return (unsigned int)d * n;
+}
+
+// Since the components wrap around on their own, stepping n pixels at once
+// is the same as stepping each component by n times its step.
+static inline unsigned int multiplyRGBStep(unsigned int drgbdx, int n) {
+	return (((drgbdx & 0xFFC00000) * n) & 0xFFC00000) |
+	       (((drgbdx & 0x001FF000) * n) & 0x001FF000) |
+	       (((drgbdx & 0x000007FF) * n) & 0x000007FF);
+}
+
+static inline uint16 texelToPixel16(uint32 texel, unsigned int rgb, const Graphics::PixelFormat &tf, const Graphics::PixelFormat &f) {
+	unsigned int tmp = rgb & RGB_TO_565_MASK;
+	unsigned int light = tmp | (tmp >> 16);
+	unsigned int l_r = (light & 0xF800) >> 8;
+	unsigned int l_g = (light & 0x07E0) >> 3;
+	unsigned int l_b = (light & 0x001F) << 3;
+	unsigned int c_r = (((texel >> tf.rShift) & 0xFF) * l_r) >> 8;
+	unsigned int c_g = (((texel >> tf.gShift) & 0xFF) * l_g) >> 8;
+	unsigned int c_b = (((texel >> tf.bShift) & 0xFF) * l_b) >> 8;
+	return f.RGBToColor(c_r, c_g, c_b);
+}
+
+// Scalar kernels
+
+static void depthOnlyScalar(unsigned int *pz, ZBufferSpan *span, int count) {
+	unsigned int z = span->z;
+	const int dzdx = span->dzdx;
+	for (int i = 0; i < count; ++i) {
+		if (z >= pz[i])
+			pz[i] = z;
+		z += dzdx;
+	}
+	span->z = z;
+}
+
+static void smooth16Scalar(uint16 *pp, unsigned int *pz, ZBufferSpan *span, int count) {
+	unsigned int z = span->z, rgb = span->rgb;
+	const int dzdx = span->dzdx;
+	const unsigned int drgbdx = span->drgbdx;
+	for (int i = 0; i < count; ++i) {
+		if (z >= pz[i]) {
+			unsigned int tmp = rgb & RGB_TO_565_MASK;
+			pp[i] = tmp | (tmp >> 16);
+			pz[i] = z;
+		}
+		z += dzdx;
+		rgb = stepRGB(rgb, drgbdx);
+	}
+	span->z = z;
+	span->rgb = rgb;
+}
+
+static void mapping16Scalar(uint16 *pp, unsigned int *pz, ZBufferSpan *span, int count) {
+	unsigned int z = span->z, s = span->s, t = span->t, rgb = span->rgb;
+	const int dzdx = span->dzdx, dsdx = span->dsdx, dtdx = span->dtdx;
+	const unsigned int drgbdx = span->drgbdx;
+	const Graphics::PixelFormat &tf = span->textureFormat;
+	for (int i = 0; i < count; ++i) {
+		if (z >= pz[i]) {
+			uint32 texel = span->texture[ZB_texelIndex(span->textureLayout, s, t)];
+			if (((texel >> tf.aShift) & 0xFF) == 0xFF) {
+				pp[i] = texelToPixel16(texel, rgb, tf, span->format);
+				pz[i] = z;
+			}
+		}
+		z += dzdx;
+		s += dsdx;
+		t += dtdx;
+		rgb = stepRGB(rgb, drgbdx);
+	}
+	span->z = z;
+	span->s = s;
+	span->t = t;
+	span->rgb = rgb;
+}
+
+static void blit16Scalar(uint16 *pp, unsigned int *pz, const uint16 *srcp, const unsigned int *srcz, int count) {
+	for (int i = 0; i < count; ++i) {
+		if (srcz[i] > pz[i]) {
+			pp[i] = srcp[i];
+			pz[i] = srcz[i];
+		}
+	}
+}
+
+static const ZBufferSpanKernels scalarKernels = {
+	"scalar",
+	depthOnlyScalar,
+	smooth16Scalar,
+	mapping16Scalar,
+	blit16Scalar
+};
+
+#if defined(TINYGL_SPAN_SSE2)
+
+static inline __m128i rampSSE2(unsigned int v, unsigned int d) {
+	return _mm_set_epi32((int)(v + 3 * d), (int)(v + 2 * d), (int)(v + d), (int)v);
+}
+
+static inline __m128i rampRGBSSE2(unsigned int rgb, unsigned int drgbdx) {
+	unsigned int rgb1 = stepRGB(rgb, drgbdx);
+	unsigned int rgb2 = stepRGB(rgb1, drgbdx);
+	unsigned int rgb3 = stepRGB(rgb2, drgbdx);
+	return _mm_set_epi32((int)rgb3, (int)rgb2, (int)rgb1, (int)rgb);
+}
+
+// Unsigned a >= b.
+static inline __m128i cmpGreaterEqualSSE2(__m128i a, __m128i b) {
+	const __m128i bias = _mm_set1_epi32((int)0x80000000);
+	__m128i lower = _mm_cmpgt_epi32(_mm_xor_si128(b, bias), _mm_xor_si128(a, bias));
+	return _mm_xor_si128(lower, _mm_set1_epi32(-1));
+}
+
+static inline __m128i selectSSE2(__m128i mask, __m128i a, __m128i b) {
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// Pack the low halves of the 32 bit lanes of a and b.
+static inline __m128i packLow16SSE2(__m128i a, __m128i b) {
+	a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+	b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+	return _mm_packs_epi32(a, b);
+}
+
+static inline __m128i rgbToPixelSSE2(__m128i rgb) {
+	__m128i tmp = _mm_and_si128(rgb, _mm_set1_epi32(RGB_TO_565_MASK));
+	return _mm_or_si128(tmp, _mm_srli_epi32(tmp, 16));
+}
+
+static void depthOnlySSE2(unsigned int *pz, ZBufferSpan *span, int count) {
+	if (count >= 4) {
+		__m128i z = rampSSE2(span->z, span->dzdx);
+		const __m128i dz = _mm_set1_epi32(multiplyStep(span->dzdx, 4));
+		for (; count >= 4; count -= 4, pz += 4) {
+			__m128i old = _mm_loadu_si128((const __m128i *)pz);
+			__m128i pass = cmpGreaterEqualSSE2(z, old);
+			_mm_storeu_si128((__m128i *)pz, selectSSE2(pass, z, old));
+			z = _mm_add_epi32(z, dz);
+		}
+		span->z = _mm_cvtsi128_si32(z);
+	}
+	depthOnlyScalar(pz, span, count);
+}
+
+static void smooth16SSE2(uint16 *pp, unsigned int *pz, ZBufferSpan *span, int count) {
+	if (count >= 8) {
+		__m128i z0 = rampSSE2(span->z, span->dzdx);
+		__m128i z1 = _mm_add_epi32(z0, _mm_set1_epi32(multiplyStep(span->dzdx, 4)));
+		const __m128i dz = _mm_set1_epi32(multiplyStep(span->dzdx, 8));
+		__m128i rgb0 = rampRGBSSE2(span->rgb, span->drgbdx);
+		__m128i rgb1 = rampRGBSSE2(stepRGB(span->rgb, multiplyRGBStep(span->drgbdx, 4)), span->drgbdx);
+		const __m128i drgb = _mm_set1_epi32(multiplyRGBStep(span->drgbdx, 8));
+		const __m128i guard = _mm_set1_epi32(RGB_GUARD_MASK);
+		for (; count >= 8; count -= 8, pz += 8, pp += 8) {
+			__m128i oldz0 = _mm_loadu_si128((const __m128i *)pz);
+			__m128i oldz1 = _mm_loadu_si128((const __m128i *)(pz + 4));
+			__m128i pass0 = cmpGreaterEqualSSE2(z0, oldz0);
+			__m128i pass1 = cmpGreaterEqualSSE2(z1, oldz1);
+			if (_mm_movemask_epi8(_mm_or_si128(pass0, pass1))) {
+				_mm_storeu_si128((__m128i *)pz, selectSSE2(pass0, z0, oldz0));
+				_mm_storeu_si128((__m128i *)(pz + 4), selectSSE2(pass1, z1, oldz1));
+				__m128i pixels = packLow16SSE2(rgbToPixelSSE2(rgb0), rgbToPixelSSE2(rgb1));
+				__m128i pass = _mm_packs_epi32(pass0, pass1);
+				__m128i old = _mm_loadu_si128((const __m128i *)pp);
+				_mm_storeu_si128((__m128i *)pp, selectSSE2(pass, pixels, old));
+			}
+			z0 = _mm_add_epi32(z0, dz);
+			z1 = _mm_add_epi32(z1, dz);
+			rgb0 = _mm_and_si128(_mm_add_epi32(rgb0, drgb), guard);
+			rgb1 = _mm_and_si128(_mm_add_epi32(rgb1, drgb), guard);
+		}
+		span->z = _mm_cvtsi128_si32(z0);
+		span->rgb = _mm_cvtsi128_si32(rgb0);
+	}
+	smooth16Scalar(pp, pz, span, count);
+}
+
+// Multiply the 8 bit texel components by the light ones and divide by 256.
+static inline __m128i modulateSSE2(__m128i c0, __m128i c1, __m128i l0, __m128i l1) {
+	__m128i c = _mm_packs_epi32(c0, c1);
+	__m128i l = _mm_packs_epi32(l0, l1);
+	return _mm_srli_epi16(_mm_mullo_epi16(c, l), 8);
+}
+
+static inline __m128i componentToPixelSSE2(__m128i c, int loss, int shift) {
+	return _mm_sll_epi16(_mm_srl_epi16(c, _mm_cvtsi32_si128(loss)), _mm_cvtsi32_si128(shift));
+}
+
+static void mapping16SSE2(uint16 *pp, unsigned int *pz, ZBufferSpan *span, int count) {
+	if (count >= 8) {
+		const Graphics::PixelFormat &tf = span->textureFormat;
+		const Graphics::PixelFormat &f = span->format;
+		const __m128i ff = _mm_set1_epi32(0xFF);
+		const __m128i aShift = _mm_cvtsi32_si128(tf.aShift);
+		const __m128i rShift = _mm_cvtsi32_si128(tf.rShift);
+		const __m128i gShift = _mm_cvtsi32_si128(tf.gShift);
+		const __m128i bShift = _mm_cvtsi32_si128(tf.bShift);
+		const __m128i alpha = _mm_set1_epi16((short)((0xFF >> f.aLoss) << f.aShift));
+
+		__m128i z0 = rampSSE2(span->z, span->dzdx);
+		__m128i z1 = _mm_add_epi32(z0, _mm_set1_epi32(multiplyStep(span->dzdx, 4)));
+		const __m128i dz = _mm_set1_epi32(multiplyStep(span->dzdx, 8));
+		unsigned int s = span->s, t = span->t, rgb = span->rgb;
+		const unsigned int drgb4 = multiplyRGBStep(span->drgbdx, 4);
+		const unsigned int drgb8 = multiplyRGBStep(span->drgbdx, 8);
+
+		for (; count >= 8; count -= 8, pz += 8, pp += 8) {
+			__m128i oldz0 = _mm_loadu_si128((const __m128i *)pz);
+			__m128i oldz1 = _mm_loadu_si128((const __m128i *)(pz + 4));
+			__m128i pass0 = cmpGreaterEqualSSE2(z0, oldz0);
+			__m128i pass1 = cmpGreaterEqualSSE2(z1, oldz1);
+			if (_mm_movemask_epi8(_mm_or_si128(pass0, pass1))) {
+				// There is no gather in SSE2, fetch the texels one by one.
+				uint32 texels[8];
+				unsigned int ss = s, tt = t;
+				for (int i = 0; i < 8; ++i) {
+					texels[i] = span->texture[ZB_texelIndex(span->textureLayout, ss, tt)];
+					ss += span->dsdx;
+					tt += span->dtdx;
+				}
+				__m128i tex0 = _mm_set_epi32(texels[3], texels[2], texels[1], texels[0]);
+				__m128i tex1 = _mm_set_epi32(texels[7], texels[6], texels[5], texels[4]);
+
+				pass0 = _mm_and_si128(pass0, _mm_cmpeq_epi32(_mm_and_si128(_mm_srl_epi32(tex0, aShift), ff), ff));
+				pass1 = _mm_and_si128(pass1, _mm_cmpeq_epi32(_mm_and_si128(_mm_srl_epi32(tex1, aShift), ff), ff));
+				if (_mm_movemask_epi8(_mm_or_si128(pass0, pass1))) {
+					__m128i light0 = rgbToPixelSSE2(rampRGBSSE2(rgb, span->drgbdx));
+					__m128i light1 = rgbToPixelSSE2(rampRGBSSE2(stepRGB(rgb, drgb4), span->drgbdx));
+					__m128i r = modulateSSE2(_mm_and_si128(_mm_srl_epi32(tex0, rShift), ff), _mm_and_si128(_mm_srl_epi32(tex1, rShift), ff),
+					                         _mm_srli_epi32(_mm_and_si128(light0, _mm_set1_epi32(0xF800)), 8),
+					                         _mm_srli_epi32(_mm_and_si128(light1, _mm_set1_epi32(0xF800)), 8));
+					__m128i g = modulateSSE2(_mm_and_si128(_mm_srl_epi32(tex0, gShift), ff), _mm_and_si128(_mm_srl_epi32(tex1, gShift), ff),
+					                         _mm_srli_epi32(_mm_and_si128(light0, _mm_set1_epi32(0x07E0)), 3),
+					                         _mm_srli_epi32(_mm_and_si128(light1, _mm_set1_epi32(0x07E0)), 3));
+					__m128i b = modulateSSE2(_mm_and_si128(_mm_srl_epi32(tex0, bShift), ff), _mm_and_si128(_mm_srl_epi32(tex1, bShift), ff),
+					                         _mm_slli_epi32(_mm_and_si128(light0, _mm_set1_epi32(0x001F)), 3),
+					                         _mm_slli_epi32(_mm_and_si128(light1, _mm_set1_epi32(0x001F)), 3));
+					__m128i pixels = _mm_or_si128(alpha, componentToPixelSSE2(r, f.rLoss, f.rShift));
+					pixels = _mm_or_si128(pixels, componentToPixelSSE2(g, f.gLoss, f.gShift));
+					pixels = _mm_or_si128(pixels, componentToPixelSSE2(b, f.bLoss, f.bShift));
+
+					_mm_storeu_si128((__m128i *)pz, selectSSE2(pass0, z0, oldz0));
+					_mm_storeu_si128((__m128i *)(pz + 4), selectSSE2(pass1, z1, oldz1));
+					__m128i pass = _mm_packs_epi32(pass0, pass1);
+					__m128i old = _mm_loadu_si128((const __m128i *)pp);
+					_mm_storeu_si128((__m128i *)pp, selectSSE2(pass, pixels, old));
+				}
+			}
+			z0 = _mm_add_epi32(z0, dz);
+			z1 = _mm_add_epi32(z1, dz);
+			s += multiplyStep(span->dsdx, 8);
+			t += multiplyStep(span->dtdx, 8);
+			rgb = stepRGB(rgb, drgb8);
+		}
+		span->z = _mm_cvtsi128_si32(z0);
+		span->s = s;
+		span->t = t;
+		span->rgb = rgb;
+	}
+	mapping16Scalar(pp, pz, span, count);
+}
+
+static void blit16SSE2(uint16 *pp, unsigned int *pz, const uint16 *srcp, const unsigned int *srcz, int count) {
+	for (; count >= 8; count -= 8, pp += 8, pz += 8, srcp += 8, srcz += 8) {
+		__m128i z0 = _mm_loadu_si128((const __m128i *)srcz);
+		__m128i z1 = _mm_loadu_si128((const __m128i *)(srcz + 4));
+		__m128i oldz0 = _mm_loadu_si128((const __m128i *)pz);
+		__m128i oldz1 = _mm_loadu_si128((const __m128i *)(pz + 4));
+		// Unsigned z > old z, the reverse of old z >= z.
+		__m128i pass0 = _mm_xor_si128(cmpGreaterEqualSSE2(oldz0, z0), _mm_set1_epi32(-1));
+		__m128i pass1 = _mm_xor_si128(cmpGreaterEqualSSE2(oldz1, z1), _mm_set1_epi32(-1));
+		if (_mm_movemask_epi8(_mm_or_si128(pass0, pass1))) {
+			_mm_storeu_si128((__m128i *)pz, selectSSE2(pass0, z0, oldz0));
+			_mm_storeu_si128((__m128i *)(pz + 4), selectSSE2(pass1, z1, oldz1));
+			__m128i pass = _mm_packs_epi32(pass0, pass1);
+			__m128i old = _mm_loadu_si128((const __m128i *)pp);
+			_mm_storeu_si128((__m128i *)pp, selectSSE2(pass, _mm_loadu_si128((const __m128i *)srcp), old));
+		}
+	}
+	blit16Scalar(pp, pz, srcp, srcz, count);
+}
+
+static const ZBufferSpanKernels simdKernels = {
+	"SSE2",
+	depthOnlySSE2,
+	smooth16SSE2,
+	mapping16SSE2,
+	blit16SSE2
+};
+
+#elif defined(TINYGL_SPAN_NEON)
+
+static inline uint32x4_t rampNEON(unsigned int v, unsigned int d) {
+	const uint32 lanes[4] = { v, v + d, v + 2 * d, v + 3 * d };
+	return vld1q_u32(lanes);
+}
+
+static inline uint32x4_t rampRGBNEON(unsigned int rgb, unsigned int drgbdx) {
+	uint32 lanes[4];
+	lanes[0] = rgb;
+	for (int i = 1; i < 4; ++i)
+		lanes[i] = stepRGB(lanes[i - 1], drgbdx);
+	return vld1q_u32(lanes);
+}
+
+static inline bool anySetNEON(uint32x4_t a, uint32x4_t b) {
+	uint32x4_t m = vorrq_u32(a, b);
+	uint32x2_t r = vorr_u32(vget_low_u32(m), vget_high_u32(m));
+	return (vget_lane_u32(r, 0) | vget_lane_u32(r, 1)) != 0;
+}
+
+static inline uint32x4_t rgbToPixelNEON(uint32x4_t rgb) {
+	uint32x4_t tmp = vandq_u32(rgb, vdupq_n_u32(RGB_TO_565_MASK));
+	return vorrq_u32(tmp, vshrq_n_u32(tmp, 16));
+}
+
+static inline uint16x8_t narrowNEON(uint32x4_t a, uint32x4_t b) {
+	return vcombine_u16(vmovn_u32(a), vmovn_u32(b));
+}
+
+static void depthOnlyNEON(unsigned int *pz, ZBufferSpan *span, int count) {
+	if (count >= 4) {
+		uint32x4_t z = rampNEON(span->z, span->dzdx);
+		const uint32x4_t dz = vdupq_n_u32(multiplyStep(span->dzdx, 4));
+		for (; count >= 4; count -= 4, pz += 4) {
+			uint32x4_t old = vld1q_u32(pz);
+			vst1q_u32(pz, vbslq_u32(vcgeq_u32(z, old), z, old));
+			z = vaddq_u32(z, dz);
+		}
+		span->z = vgetq_lane_u32(z, 0);
+	}
+	depthOnlyScalar(pz, span, count);
+}
+
+static void smooth16NEON(uint16 *pp, unsigned int *pz, ZBufferSpan *span, int count) {
+	if (count >= 8) {
+		uint32x4_t z0 = rampNEON(span->z, span->dzdx);
+		uint32x4_t z1 = vaddq_u32(z0, vdupq_n_u32(multiplyStep(span->dzdx, 4)));
+		const uint32x4_t dz = vdupq_n_u32(multiplyStep(span->dzdx, 8));
+		uint32x4_t rgb0 = rampRGBNEON(span->rgb, span->drgbdx);
+		uint32x4_t rgb1 = rampRGBNEON(stepRGB(span->rgb, multiplyRGBStep(span->drgbdx, 4)), span->drgbdx);
+		const uint32x4_t drgb = vdupq_n_u32(multiplyRGBStep(span->drgbdx, 8));
+		const uint32x4_t guard = vdupq_n_u32(RGB_GUARD_MASK);
+		for (; count >= 8; count -= 8, pz += 8, pp += 8) {
+			uint32x4_t oldz0 = vld1q_u32(pz);
+			uint32x4_t oldz1 = vld1q_u32(pz + 4);
+			uint32x4_t pass0 = vcgeq_u32(z0, oldz0);
+			uint32x4_t pass1 = vcgeq_u32(z1, oldz1);
+			if (anySetNEON(pass0, pass1)) {
+				vst1q_u32(pz, vbslq_u32(pass0, z0, oldz0));
+				vst1q_u32(pz + 4, vbslq_u32(pass1, z1, oldz1));
+				uint16x8_t pixels = narrowNEON(rgbToPixelNEON(rgb0), rgbToPixelNEON(rgb1));
+				vst1q_u16(pp, vbslq_u16(narrowNEON(pass0, pass1), pixels, vld1q_u16(pp)));
+			}
+			z0 = vaddq_u32(z0, dz);
+			z1 = vaddq_u32(z1, dz);
+			rgb0 = vandq_u32(vaddq_u32(rgb0, drgb), guard);
+			rgb1 = vandq_u32(vaddq_u32(rgb1, drgb), guard);
+		}
+		span->z = vgetq_lane_u32(z0, 0);
+		span->rgb = vgetq_lane_u32(rgb0, 0);
+	}
+	smooth16Scalar(pp, pz, span, count);
+}
+
+static inline uint16x8_t componentNEON(uint32x4_t tex0, uint32x4_t tex1, int shift) {
+	const int32x4_t right = vdupq_n_s32(-shift);
+	const uint32x4_t ff = vdupq_n_u32(0xFF);
+	return narrowNEON(vandq_u32(vshlq_u32(tex0, right), ff), vandq_u32(vshlq_u32(tex1, right), ff));
+}
+
+static inline uint16x8_t componentToPixelNEON(uint16x8_t c, int loss, int shift) {
+	return vshlq_u16(vshlq_u16(c, vdupq_n_s16(-loss)), vdupq_n_s16(shift));
+}
+
+static void mapping16NEON(uint16 *pp, unsigned int *pz, ZBufferSpan *span, int count) {
+	if (count >= 8) {
+		const Graphics::PixelFormat &tf = span->textureFormat;
+		const Graphics::PixelFormat &f = span->format;
+		const uint16x8_t alpha = vdupq_n_u16((0xFF >> f.aLoss) << f.aShift);
+		const uint32x4_t guard = vdupq_n_u32(RGB_GUARD_MASK);
+
+		uint32x4_t z0 = rampNEON(span->z, span->dzdx);
+		uint32x4_t z1 = vaddq_u32(z0, vdupq_n_u32(multiplyStep(span->dzdx, 4)));
+		const uint32x4_t dz = vdupq_n_u32(multiplyStep(span->dzdx, 8));
+		unsigned int s = span->s, t = span->t;
+		uint32x4_t rgb0 = rampRGBNEON(span->rgb, span->drgbdx);
+		uint32x4_t rgb1 = rampRGBNEON(stepRGB(span->rgb, multiplyRGBStep(span->drgbdx, 4)), span->drgbdx);
+		const uint32x4_t drgb = vdupq_n_u32(multiplyRGBStep(span->drgbdx, 8));
+
+		for (; count >= 8; count -= 8, pz += 8, pp += 8) {
+			uint32x4_t oldz0 = vld1q_u32(pz);
+			uint32x4_t oldz1 = vld1q_u32(pz + 4);
+			uint32x4_t pass0 = vcgeq_u32(z0, oldz0);
+			uint32x4_t pass1 = vcgeq_u32(z1, oldz1);
+			if (anySetNEON(pass0, pass1)) {
+				// There is no gather in NEON, fetch the texels one by one.
+				uint32 texels[8];
+				unsigned int ss = s, tt = t;
+				for (int i = 0; i < 8; ++i) {
+					texels[i] = span->texture[ZB_texelIndex(span->textureLayout, ss, tt)];
+					ss += span->dsdx;
+					tt += span->dtdx;
+				}
+				uint32x4_t tex0 = vld1q_u32(texels);
+				uint32x4_t tex1 = vld1q_u32(texels + 4);
+				const int32x4_t aRight = vdupq_n_s32(-tf.aShift);
+				const uint32x4_t ff = vdupq_n_u32(0xFF);
+				pass0 = vandq_u32(pass0, vceqq_u32(vandq_u32(vshlq_u32(tex0, aRight), ff), ff));
+				pass1 = vandq_u32(pass1, vceqq_u32(vandq_u32(vshlq_u32(tex1, aRight), ff), ff));
+				if (anySetNEON(pass0, pass1)) {
+					uint32x4_t light0 = rgbToPixelNEON(rgb0);
+					uint32x4_t light1 = rgbToPixelNEON(rgb1);
+					uint16x8_t light = narrowNEON(light0, light1);
+					uint16x8_t l_r = vshrq_n_u16(vandq_u16(light, vdupq_n_u16(0xF800)), 8);
+					uint16x8_t l_g = vshrq_n_u16(vandq_u16(light, vdupq_n_u16(0x07E0)), 3);
+					uint16x8_t l_b = vshlq_n_u16(vandq_u16(light, vdupq_n_u16(0x001F)), 3);
+					uint16x8_t r = vshrq_n_u16(vmulq_u16(componentNEON(tex0, tex1, tf.rShift), l_r), 8);
+					uint16x8_t g = vshrq_n_u16(vmulq_u16(componentNEON(tex0, tex1, tf.gShift), l_g), 8);
+					uint16x8_t b = vshrq_n_u16(vmulq_u16(componentNEON(tex0, tex1, tf.bShift), l_b), 8);
+					uint16x8_t pixels = vorrq_u16(alpha, componentToPixelNEON(r, f.rLoss, f.rShift));
+					pixels = vorrq_u16(pixels, componentToPixelNEON(g, f.gLoss, f.gShift));
+					pixels = vorrq_u16(pixels, componentToPixelNEON(b, f.bLoss, f.bShift));
+
+					vst1q_u32(pz, vbslq_u32(pass0, z0, oldz0));
+					vst1q_u32(pz + 4, vbslq_u32(pass1, z1, oldz1));
+					vst1q_u16(pp, vbslq_u16(narrowNEON(pass0, pass1), pixels, vld1q_u16(pp)));
+				}
+			}
+			z0 = vaddq_u32(z0, dz);
+			z1 = vaddq_u32(z1, dz);
+			s += multiplyStep(span->dsdx, 8);
+			t += multiplyStep(span->dtdx, 8);
+			rgb0 = vandq_u32(vaddq_u32(rgb0, drgb), guard);
+			rgb1 = vandq_u32(vaddq_u32(rgb1, drgb), guard);
+		}
+		span->z = vgetq_lane_u32(z0, 0);
+		span->s = s;
+		span->t = t;
+		span->rgb = vgetq_lane_u32(rgb0, 0);
+	}
+	mapping16Scalar(pp, pz, span, count);
+}
+
+static void blit16NEON(uint16 *pp, unsigned int *pz, const uint16 *srcp, const unsigned int *srcz, int count) {
+	for (; count >= 8; count -= 8, pp += 8, pz += 8, srcp += 8, srcz += 8) {
+		uint32x4_t z0 = vld1q_u32(srcz);
+		uint32x4_t z1 = vld1q_u32(srcz + 4);
+		uint32x4_t oldz0 = vld1q_u32(pz);
+		uint32x4_t oldz1 = vld1q_u32(pz + 4);
+		uint32x4_t pass0 = vcgtq_u32(z0, oldz0);
+		uint32x4_t pass1 = vcgtq_u32(z1, oldz1);
+		if (anySetNEON(pass0, pass1)) {
+			vst1q_u32(pz, vbslq_u32(pass0, z0, oldz0));
+			vst1q_u32(pz + 4, vbslq_u32(pass1, z1, oldz1));
+			vst1q_u16(pp, vbslq_u16(narrowNEON(pass0, pass1), vld1q_u16(srcp), vld1q_u16(pp)));
+		}
+	}
+	blit16Scalar(pp, pz, srcp, srcz, count);
+}
+
+static const ZBufferSpanKernels simdKernels = {
+	"NEON",
+	depthOnlyNEON,
+	smooth16NEON,
+	mapping16NEON,
+	blit16NEON
+};
+
+#endif
+
+bool ZB_hasSIMDSpanKernels() {
+#if defined(TINYGL_SPAN_SSE2) || defined(TINYGL_SPAN_NEON)
+	return true;
+#else
+	return false;
+#endif
+}
+
+const ZBufferSpanKernels *ZB_getSpanKernels(bool simd) {
+#if defined(TINYGL_SPAN_SSE2) || defined(TINYGL_SPAN_NEON)
+	if (simd)
+		return &simdKernels;
+#endif
+	return &scalarKernels;
+}
+
+} // end of namespace TinyGL
@@ -7,16 +7,20 @@ namespace TinyGL {
 #define ZCMP(z, zpix) ((z) >= (zpix))
 
 void ZB_fillTriangleDepthOnly(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2) {
+	ZBufferSpan span;
 
 #define INTERP_Z
 
-#define DRAW_INIT()
+#define DRAW_INIT() {							\
+	span.dzdx = dzdx;							\
+}
 
-#define PUT_PIXEL(_a) {						\
-	if (ZCMP(z, pz[_a])) {					\
-	pz[_a] = z;								\
-	}										\
-	z += dzdx;								\
+#define DRAW_LINE() {							\
+	int n = (x2 >> 16) - x1;					\
+	if (n >= 0) {								\
+		span.z = z1;							\
+		zb->span_kernels->depthOnly(pz1 + x1, &span, n + 1);	\
+	}											\
 }
 
 #include "graphics/tinygl/ztriangle.h"
@@ -48,6 +52,7 @@ void ZB_fillTriangleFlat(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBuffe
 
 void ZB_fillTriangleSmooth(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2) {
 	int _drgbdx;
+	ZBufferSpan span;
 
 #define INTERP_Z
 #define INTERP_RGB
@@ -58,6 +63,8 @@ void ZB_fillTriangleSmooth(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBuf
 	_drgbdx = (SAR_RND_TO_ZERO(drdx, 6) << 22) & 0xFFC00000;	\
 	_drgbdx |= SAR_RND_TO_ZERO(dgdx, 5) & 0x000007FF;			\
 	_drgbdx |= (SAR_RND_TO_ZERO(dbdx, 7) << 12) & 0x001FF000; 	\
+	span.dzdx = dzdx;											\
+	span.drgbdx = _drgbdx;										\
 }
 
 #define PUT_PIXEL(_a) {							\
@@ -84,43 +91,64 @@ void ZB_fillTriangleSmooth(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBuf
 	rgb |= (g1 >> 5) & 0x000007FF;					\
 	rgb |= (b1 << 5) & 0x001FF000;					\
 	drgbdx = _drgbdx;								\
-	while (n >= 3) {								\
-		PUT_PIXEL(0);								\
-		PUT_PIXEL(1);								\
-		PUT_PIXEL(2);								\
-		PUT_PIXEL(3);								\
-		pz += 4;									\
-		buf.shiftBy(4);								\
-		n -= 4;										\
-	}												\
-	while (n >= 0) {								\
-		PUT_PIXEL(0);								\
-		buf.shiftBy(1);								\
-		pz += 1;									\
-		n -= 1;										\
+	if (bpp == 2) {									\
+		if (n >= 0) {								\
+			span.z = z;								\
+			span.rgb = rgb;							\
+			zb->span_kernels->smooth16((uint16 *)buf.getRawBuffer(), pz, &span, n + 1);	\
+		}											\
+	} else {										\
+		while (n >= 3) {							\
+			PUT_PIXEL(0);							\
+			PUT_PIXEL(1);							\
+			PUT_PIXEL(2);							\
+			PUT_PIXEL(3);							\
+			pz += 4;								\
+			buf.shiftBy(4);							\
+			n -= 4;									\
+		}											\
+		while (n >= 0) {							\
+			PUT_PIXEL(0);							\
+			buf.shiftBy(1);							\
+			pz += 1;								\
+			n -= 1;									\
+		}											\
 	}												\
 }
 
 #include "graphics/tinygl/ztriangle.h"
 }
 
-void ZB_setTexture(ZBuffer *zb, const Graphics::PixelBuffer &texture) {
+void ZB_setTextureLayout(ZBufferTextureLayout *layout, int widthBits, int heightBits) {
+	// The s and t coordinates of the points go over the whole texture from
+	// 0 to 1 << 22.
+	layout->sShift = 22 - widthBits;
+	layout->tShift = 22 - heightBits;
+	layout->xMask = (1 << widthBits) - 1;
+	layout->yMask = (1 << heightBits) - 1;
+	layout->rowShift = MAX(widthBits, ZB_TEXTURE_TILE_BITS) + ZB_TEXTURE_TILE_BITS;
+}
+
+void ZB_setTexture(ZBuffer *zb, const Graphics::PixelBuffer &texture, int widthBits, int heightBits) {
 	zb->current_texture = texture;
+	ZB_setTextureLayout(&zb->texture_layout, widthBits, heightBits);
 }
 
 void ZB_fillTriangleMapping(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2) {
 	Graphics::PixelBuffer texture;
+	ZBufferTextureLayout layout;
 
 #define INTERP_Z
 #define INTERP_ST
 
 #define DRAW_INIT()	{				\
 	texture = zb->current_texture;	\
+	layout = zb->texture_layout;	\
 }
 
 #define PUT_PIXEL(_a) {						\
 	if (ZCMP(z, pz[_a])) {					\
-		pp[_a] = texture.getRawBuffer()[((t & 0x3FC00000) | s) >> 14];	\
+		pp[_a] = texture.getRawBuffer()[ZB_texelIndex(layout, s, t)];	\
 		pz[_a] = z;							\
 	}										\
 	z += dzdx;								\
@@ -133,15 +161,18 @@ void ZB_fillTriangleMapping(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBu
 
 void ZB_fillTriangleMappingPerspective(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2) {
 	Graphics::PixelBuffer texture;
+	ZBufferTextureLayout layout;
 	float fdzdx, fndzdx, ndszdx, ndtzdx;
 	int _drgbdx;
+	ZBufferSpan span;
+	bool spanKernel;
 
 #define NB_INTERP 8
 
 	ZBufferPoint *tp, *pr1 = 0, *pr2 = 0, *l1 = 0, *l2 = 0;
 	float fdx1, fdx2, fdy1, fdy2, fz0, d1, d2;
 	unsigned int *pz1;
-	int part, update_left, update_right;
+	int part, update_left, update_right, y;
 
 	int nb_lines, dx1, dy1, tmp, dx2, dy2;
 
@@ -241,8 +272,10 @@ void ZB_fillTriangleMappingPerspective(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoi
 
 	byte *pp1 = zb->pbuf.getRawBuffer() + zb->linesize * p0->y;
 	pz1 = zb->zbuf + p0->y * zb->xsize;
+	y = p0->y;
 
 	texture = zb->current_texture;
+	layout = zb->texture_layout;
 	fdzdx = (float)dzdx;
 	fndzdx = NB_INTERP * fdzdx;
 	ndszdx = NB_INTERP * dszdx;
@@ -251,6 +284,20 @@ void ZB_fillTriangleMappingPerspective(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoi
 	_drgbdx |= (dgdx / (1 << 5)) & 0x000007FF;
 	_drgbdx |= ((dbdx / (1 << 7)) << 12) & 0x001FF000;
 
+	// The span kernels handle 16 bit frame buffers and 8 bit per component
+	// textures with alpha.
+	const Graphics::PixelFormat &textureFormat = texture.getFormat();
+	spanKernel = PSZB == 2 && textureFormat.bytesPerPixel == 4 && textureFormat.aLoss == 0 &&
+	             textureFormat.rLoss == 0 && textureFormat.gLoss == 0 && textureFormat.bLoss == 0;
+	if (spanKernel) {
+		span.dzdx = dzdx;
+		span.drgbdx = _drgbdx;
+		span.texture = (const uint32 *)texture.getRawBuffer();
+		span.textureLayout = layout;
+		span.textureFormat = textureFormat;
+		span.format = zb->cmode;
+	}
+
 	for (part = 0; part < 2; part++) {
 		if (part == 0) {
 			if (fz0 > 0) {
@@ -341,7 +388,10 @@ void ZB_fillTriangleMappingPerspective(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoi
 
 		while (nb_lines > 0) {
 			nb_lines--;
-			{
+			// the lines past the band are not drawn
+			if (y >= zb->band_ymax)
+				return;
+			if (y >= zb->band_ymin) {
 				register unsigned int *pz;
 				register unsigned int s, t, z, rgb, drgbdx;
 				register int n, dsdx, dtdx;
@@ -373,31 +423,41 @@ void ZB_fillTriangleMappingPerspective(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoi
 						fz += fndzdx;
 						zinv = (float)(1.0 / fz);
 					}
-					for (int _a = 0; _a < 8; _a++) {
-						if (ZCMP(z, pz[_a])) {
-							unsigned ttt = (t & 0x003FC000) >> (9 - PSZSH);
-							unsigned sss = (s & 0x003FC000) >> (17 - PSZSH);
-							int pixel = ((ttt | sss) >> 1) ;
-
-							uint8 alpha, c_r, c_g, c_b;
-							texture.getARGBAt(pixel, alpha, c_r, c_g, c_b);
-							if (alpha == 0xFF) {
-								tmp = rgb & 0xF81F07E0;
-								unsigned int light = tmp | (tmp >> 16);
-								unsigned int l_r = (light & 0xF800) >> 8;
-								unsigned int l_g = (light & 0x07E0) >> 3;
-								unsigned int l_b = (light & 0x001F) << 3;
-								c_r = (c_r * l_r) / 256;
-								c_g = (c_g * l_g) / 256;
-								c_b = (c_b * l_b) / 256;
-								buf.setPixelAt(_a, c_r, c_g, c_b);
-								pz[_a] = z;
+					if (spanKernel) {
+						span.z = z;
+						span.s = s;
+						span.t = t;
+						span.dsdx = dsdx;
+						span.dtdx = dtdx;
+						span.rgb = rgb;
+						zb->span_kernels->mapping16((uint16 *)buf.getRawBuffer(), pz, &span, NB_INTERP);
+						z = span.z;
+						rgb = span.rgb;
+					} else {
+						for (int _a = 0; _a < 8; _a++) {
+							if (ZCMP(z, pz[_a])) {
+								int pixel = ZB_texelIndex(layout, s, t);
+
+								uint8 alpha, c_r, c_g, c_b;
+								texture.getARGBAt(pixel, alpha, c_r, c_g, c_b);
+								if (alpha == 0xFF) {
+									tmp = rgb & 0xF81F07E0;
+									unsigned int light = tmp | (tmp >> 16);
+									unsigned int l_r = (light & 0xF800) >> 8;
+									unsigned int l_g = (light & 0x07E0) >> 3;
+									unsigned int l_b = (light & 0x001F) << 3;
+									c_r = (c_r * l_r) / 256;
+									c_g = (c_g * l_g) / 256;
+									c_b = (c_b * l_b) / 256;
+									buf.setPixelAt(_a, c_r, c_g, c_b);
+									pz[_a] = z;
+								}
 							}
+							z += dzdx;
+							s += dsdx;
+							t += dtdx;
+							rgb = (rgb + drgbdx) & (~0x00200800);
 						}
-						z += dzdx;
-						s += dsdx;
-						t += dtdx;
-						rgb = (rgb + drgbdx) & (~0x00200800);
 					}
 
 					pz += NB_INTERP;
@@ -417,36 +477,46 @@ void ZB_fillTriangleMappingPerspective(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoi
 					dtdx = (int)((dtzdx - tt * fdzdx) * zinv);
 				}
 
-				while (n >= 0) {
-					{
-						if (ZCMP(z, pz[0])) {
-							unsigned ttt = (t & 0x003FC000) >> (9 - PSZSH);
-							unsigned sss = (s & 0x003FC000) >> (17 - PSZSH);
-							int pixel = ((ttt | sss) >> 1) ;
-
-							uint8 alpha, c_r, c_g, c_b;
-							texture.getARGBAt(pixel, alpha, c_r, c_g, c_b);
-							if (alpha == 0xFF) {
-								tmp = rgb & 0xF81F07E0;
-								unsigned int light = tmp | (tmp >> 16);
-								unsigned int l_r = (light & 0xF800) >> 8;
-								unsigned int l_g = (light & 0x07E0) >> 3;
-								unsigned int l_b = (light & 0x001F) << 3;
-								c_r = (c_r * l_r) / 256;
-								c_g = (c_g * l_g) / 256;
-								c_b = (c_b * l_b) / 256;
-								buf.setPixelAt(0, c_r, c_g, c_b);
-								pz[0] = z;
+				if (spanKernel) {
+					if (n >= 0) {
+						span.z = z;
+						span.s = s;
+						span.t = t;
+						span.dsdx = dsdx;
+						span.dtdx = dtdx;
+						span.rgb = rgb;
+						zb->span_kernels->mapping16((uint16 *)buf.getRawBuffer(), pz, &span, n + 1);
+					}
+				} else {
+					while (n >= 0) {
+						{
+							if (ZCMP(z, pz[0])) {
+								int pixel = ZB_texelIndex(layout, s, t);
+
+								uint8 alpha, c_r, c_g, c_b;
+								texture.getARGBAt(pixel, alpha, c_r, c_g, c_b);
+								if (alpha == 0xFF) {
+									tmp = rgb & 0xF81F07E0;
+									unsigned int light = tmp | (tmp >> 16);
+									unsigned int l_r = (light & 0xF800) >> 8;
+									unsigned int l_g = (light & 0x07E0) >> 3;
+									unsigned int l_b = (light & 0x001F) << 3;
+									c_r = (c_r * l_r) / 256;
+									c_g = (c_g * l_g) / 256;
+									c_b = (c_b * l_b) / 256;
+									buf.setPixelAt(0, c_r, c_g, c_b);
+									pz[0] = z;
+								}
 							}
+							z += dzdx;
+							s += dsdx;
+							t += dtdx;
+							rgb = (rgb + drgbdx) & (~0x00200800);
 						}
-						z += dzdx;
-						s += dsdx;
-						t += dtdx;
-						rgb = (rgb + drgbdx) & (~0x00200800);
+						pz += 1;
+						buf.shiftBy(1);
+						n -= 1;
 					}
-					pz += 1;
-					buf.shiftBy(1);
-					n -= 1;
 				}
 			}
 
@@ -483,6 +553,7 @@ void ZB_fillTriangleMappingPerspective(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoi
 			// screen coordinates
 			pp1 += zb->linesize;
 			pz1 += zb->xsize;
+			y++;
 		}
 	}
 }
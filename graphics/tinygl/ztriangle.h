@@ -6,7 +6,7 @@
 	float fdx1, fdx2, fdy1, fdy2, fz, d1, d2;
 	unsigned int *pz1;
 	PIXEL *pp1;
-	int part, update_left, update_right;
+	int part, update_left, update_right, y;
 
 	int nb_lines, dx1, dy1, tmp, dx2, dy2;
 
@@ -133,6 +133,7 @@
 
 	pp1 = (PIXEL *)((char *)zb->pbuf.getRawBuffer() + zb->linesize * p0->y);
 	pz1 = zb->zbuf + p0->y * zb->xsize;
+	y = p0->y;
 
 	DRAW_INIT();
 
@@ -239,9 +240,12 @@
 
 		while (nb_lines > 0) {
 			nb_lines--;
+			// the lines past the band are not drawn
+			if (y >= zb->band_ymax)
+				return;
 #ifndef DRAW_LINE
 			// generic draw line
-			{
+			if (y >= zb->band_ymin) {
 				register PIXEL *pp;
 				register int n;
 #ifdef INTERP_Z
@@ -298,7 +302,8 @@
 				}
 			}
 #else
-			DRAW_LINE();
+			if (y >= zb->band_ymin)
+				DRAW_LINE();
 #endif
 
 			// left edge
@@ -348,6 +353,7 @@
 			// screen coordinates
 			pp1 = (PIXEL *)((char *)pp1 + zb->linesize);
 			pz1 += zb->xsize;
+			y++;
 		}
 	}
 }
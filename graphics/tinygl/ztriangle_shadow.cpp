@@ -8,8 +8,7 @@ namespace TinyGL {
 void ZB_fillTriangleFlatShadowMask(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1, ZBufferPoint *p2) {
 	ZBufferPoint *t, *pr1 = 0, *pr2 = 0, *l1 = 0, *l2 = 0;
 	float fdx1, fdx2, fdy1, fdy2, fz;
-	unsigned char *pm1;
-	int part, update_left, update_right;
+	int part, update_left, update_right, y;
 
 	int nb_lines, dx1, dy1, tmp, dx2, dy2;
 
@@ -50,7 +49,7 @@ void ZB_fillTriangleFlatShadowMask(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *
 
 	// screen coordinates
 
-	pm1 = zb->shadow_mask_buf + zb->xsize * p0->y;
+	y = p0->y;
 
 	for (part = 0; part < 2; part++) {
 		if (part == 0) {
@@ -116,13 +115,18 @@ void ZB_fillTriangleFlatShadowMask(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *
 		// we draw all the scan line of the part
 		while (nb_lines > 0) {
 			nb_lines--;
+			// the lines past the band are not drawn
+			if (y >= zb->band_ymax)
+				return;
 			// generic draw line
-			{
+			// the mask only covers its rectangle of the screen
+			if (y >= zb->band_ymin && y >= zb->shadow_mask_y && y < zb->shadow_mask_y + zb->shadow_mask_height) {
 				register unsigned char *pm;
 				register int n;
+				int xs = MAX(x1, zb->shadow_mask_x);
 
-				n = (x2 >> 16) - x1;
-				pm = pm1 + x1;
+				n = MIN(x2 >> 16, zb->shadow_mask_x + zb->shadow_mask_width - 1) - xs;
+				pm = ZB_shadowMaskAt(zb, xs, y);
 				while (n >= 3) {
 					for (int a = 0; a <= 3; a++) {
 						pm[a] = 0xff;
@@ -150,7 +154,7 @@ void ZB_fillTriangleFlatShadowMask(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *
 			x2 += dx2dy2;
 
 			// screen coordinates
-			pm1 = pm1 + zb->xsize;
+			y++;
 		}
 	}
 }
@@ -159,10 +163,9 @@ void ZB_fillTriangleFlatShadow(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1,
 	int color;
 	ZBufferPoint *t, *pr1 = 0, *pr2 = 0, *l1 = 0, *l2 = 0;
 	float fdx1, fdx2, fdy1, fdy2, fz, d1, d2;
-	unsigned char *pm1;
 	unsigned int *pz1;
 	byte *pp1;
-	int part, update_left, update_right;
+	int part, update_left, update_right, y;
 
 	int nb_lines, dx1, dy1, tmp, dx2, dy2;
 
@@ -216,8 +219,8 @@ void ZB_fillTriangleFlatShadow(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1,
 	// screen coordinates
 
 	pp1 = zb->pbuf.getRawBuffer() + zb->linesize * p0->y;
-	pm1 = zb->shadow_mask_buf + p0->y * zb->xsize;
 	pz1 = zb->zbuf + p0->y * zb->xsize;
+	y = p0->y;
 
 	color = RGB_TO_PIXEL(zb->shadow_color_r, zb->shadow_color_g, zb->shadow_color_b);
 
@@ -291,24 +294,29 @@ void ZB_fillTriangleFlatShadow(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1,
 
 		while (nb_lines > 0) {
 			nb_lines--;
+			// the lines past the band are not drawn
+			if (y >= zb->band_ymax)
+				return;
 			// generic draw line
-			{
+			// the pixels out of the mask rectangle are never shadowed
+			if (y >= zb->band_ymin && y >= zb->shadow_mask_y && y < zb->shadow_mask_y + zb->shadow_mask_height) {
 				register unsigned char *pm;
 				register int n;
 				register unsigned int *pz;
 				register unsigned int z;
+				int xs = MAX(x1, zb->shadow_mask_x);
 
-				n = (x2 >> 16) - x1;
+				n = MIN(x2 >> 16, zb->shadow_mask_x + zb->shadow_mask_width - 1) - xs;
 
 				Graphics::PixelBuffer buf = zb->pbuf;
-				buf = pp1 + x1 * PSZB;
+				buf = pp1 + xs * PSZB;
 
-				pm = pm1 + x1;
-				pz = pz1 + x1;
-				z = z1;
+				pm = ZB_shadowMaskAt(zb, xs, y);
+				pz = pz1 + xs;
+				z = z1 + dzdx * (xs - x1);
 				while (n >= 3) {
 					for (int a = 0; a < 4; a++) {
-						if (ZCMP(z, pz[a]) && pm[0]) {
+						if (ZCMP(z, pz[a]) && pm[a]) {
 							buf.setPixelAt(a, color);
 							pz[a] = z;
 						}
@@ -324,6 +332,7 @@ void ZB_fillTriangleFlatShadow(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1,
 						buf.setPixelAt(0, color);
 						pz[0] = z;
 					}
+					z += dzdx;
 					pz += 1;
 					pm += 1;
 					buf.shiftBy(1);
@@ -348,7 +357,7 @@ void ZB_fillTriangleFlatShadow(ZBuffer *zb, ZBufferPoint *p0, ZBufferPoint *p1,
 			// screen coordinates
 			pp1 += zb->linesize;
 			pz1 += zb->xsize;
-			pm1 += zb->xsize;
+			y++;
 		}
 	}
 }